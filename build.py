@@ -121,8 +121,12 @@ def compile_basin(config: BuildConfig):
         next_command_index: int = 0
         failed: bool = False
 
+    # Compiles through basin.h with the compiler's objects (except main), run by tests/run_tests.py
+    API_TEST_SRC = f"{ROOT}/tests/api/api_test.c"
+    API_TEST_OBJ = f"{config.int_dir}/api_test.o"
+
     runtime = BuildRuntime()
-    for src, obj in zip(source_files, object_files):
+    for src, obj in zip(source_files + [ API_TEST_SRC ], object_files + [ API_TEST_OBJ ]):
         # IMPORTANT: DO NOT ADD -Wincompatible-pointer-types. It catches sizeof type mismatch when allocating objects. Explicitly cast to void* to ignore this error.
         CWARNS = ""
         CFLAGS = f"-c -g -fPIC -I{ROOT}/src -I{ROOT}/include -include {ROOT}/src/basin/pch.h"
@@ -189,6 +193,10 @@ def compile_basin(config: BuildConfig):
     
     # We use g++ because tracy is c++ and needs c++ runtime
     run(f"g++ {' '.join(object_files)} -o {PATH_EXE} {LDFLAGS}")
+
+    library_objects = [ obj for obj in object_files if os.path.basename(obj) != "main.o" ]
+    PATH_API_TEST = f"{config.int_dir}/basin_api_test" + (".exe" if platform.system() == "Windows" else "")
+    run(f"g++ {' '.join(library_objects)} {API_TEST_OBJ} -o {PATH_API_TEST} {LDFLAGS}")
     # run(f"g++ -shared -fPIC {LDFLAGS} {' '.join(object_files)} -o {PATH_DLL}")
     # run(f"ar rcs {PATH_LIB} {' '.join(object_files)}")
 
@@ -99,6 +99,10 @@ typedef struct {
 
 /*
     The input path in compile options will show up in error messages and __file__. Can be NULL.
+    Each input (input_text or input_file, and input_files) is compiled to its own object file.
+    With several inputs, output_file is a directory (the objects are put next to the
+    inputs if it's NULL) and objects are named after the inputs, 'src/main.bsn' -> 'main.o'.
+    Inputs that would be compiled to the same object file are an error, nothing is compiled.
 */
 typedef struct BasinCompileOptions {
     BasinTargetArch    target_arch;
@@ -113,6 +117,12 @@ typedef struct BasinCompileOptions {
     bool               skip_default_import_dirs;
     bool               skip_default_library_dirs;
     bool               silent;
+    bool               ordered_output; // print compiler output in the same order every run (output is delayed until compilation is done)
+    int                max_errors;     // stop compiling an input after this many errors, 0 stops at the first error
+    bool               stream_tokens;  // lex tokens as the parser needs them, token memory doesn't grow with the file size
+    bool               all_functions;  // executables generate every function, not only those reachable from main, and report their errors (always on for objects and libraries)
+    bool               dump_tokens;    // print the tokens of each file after lexing, not with stream_tokens
+    int                threads;        // threads of the temporary context when none is passed, 0 uses all CPU threads
     
     const char* const* import_dirs;
     int                import_dirs_len;
@@ -123,10 +133,14 @@ typedef struct BasinCompileOptions {
     const char*        input_text;
     u32                input_text_len;
     const char*        input_file;
+    const char* const* input_files;
+    int                input_files_len;
     const char*        output_file;
 
     const char**       run_output_argv; // args passed to program/comp time execution
     int                run_output_argc;
+
+    void*              _allocation; // internal, memory from basin_parse_argv, see basin_free_options
 } BasinCompileOptions;
 
 
@@ -148,6 +162,66 @@ typedef struct BasinCompileOptions {
 BASIN_API BasinResult basin_compile(const BasinCompileOptions* options);
 BASIN_API void basin_free_result(BasinResult* result);
 
+/*
+    A context keeps compiler threads and parsed imports alive between compilations.
+    Use it instead of basin_compile when compiling many times, imported files
+    are parsed once and threads are only started once.
+
+    A context compiles one thing at a time, don't use it from several threads at once.
+*/
+typedef struct BasinContext BasinContext;
+
+/*
+    @param thread_count Number of threads compiling code, 0 uses all CPU threads.
+    @return New context, destroy it with basin_destroy_context.
+*/
+BASIN_API BasinContext* basin_create_context(int thread_count);
+/*
+    Compile a file with a context. Same as basin_compile otherwise.
+*/
+BASIN_API BasinResult basin_compile_with_context(BasinContext* context, const BasinCompileOptions* options);
+BASIN_API void basin_destroy_context(BasinContext* context);
+
+/*
+    Compile several options in one go. The inputs of all options are compiled at the
+    same time by the same threads. Imports are parsed once for all options with the
+    same import directories.
+
+    @param context Context to compile with, NULL uses a temporary context.
+    @param options Array of compile options.
+    @param options_len Number of compile options.
+    @return Result of compilation. Contains error messages or SUCCESS status.
+*/
+BASIN_API BasinResult basin_compile_many(BasinContext* context, const BasinCompileOptions* options, int options_len);
+
+/*
+    Incremental compilation for programs that can't block until the compiler is done (editors, servers).
+    basin_begin_compile adds the work, basin_step_compile performs some of it and returns,
+    basin_end_compile finishes the rest and returns the result.
+
+        basin_begin_compile(context, &options, 1);
+        while (!basin_step_compile(context, 0, 2000)) {
+            // handle events
+        }
+        BasinResult result = basin_end_compile(context);
+
+    Options must stay alive until basin_end_compile. One compilation per context at a time.
+
+    @return Error if the options are invalid, nothing is compiled then and basin_end_compile shouldn't be called.
+*/
+BASIN_API BasinResult basin_begin_compile(BasinContext* context, const BasinCompileOptions* options, int options_len);
+/*
+    Performs at most max_tasks tasks or runs for at most max_microseconds, zero means no limit.
+    A task that started is finished before returning so the time can be exceeded by the time of one task.
+    @return True if the compilation is done.
+*/
+BASIN_API bool basin_step_compile(BasinContext* context, int max_tasks, int max_microseconds);
+/*
+    Finishes remaining work (blocks until done) and frees the compilation.
+    @return Result of compilation. Contains error messages or SUCCESS status.
+*/
+BASIN_API BasinResult basin_end_compile(BasinContext* context);
+
 
 
 //#########################################
@@ -182,6 +256,12 @@ BASIN_API BasinResult basin_parse_arguments(const char* arguments, BasinCompileO
 */
 BASIN_API BasinResult basin_parse_argv(int argc, const char** argv, BasinCompileOptions* out_options);
 
+/*
+    Frees memory in options filled by basin_parse_arguments or basin_parse_argv.
+    Call it even if parsing failed.
+*/
+BASIN_API void basin_free_options(BasinCompileOptions* options);
+
 
 
 #ifdef __cplusplus
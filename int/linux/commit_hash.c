@@ -0,0 +1,2 @@
+const char* BASIN_COMPILER_COMMIT = "74c03d4186";
+const char* BASIN_COMPILER_BUILD_DATE = "2026-10-18 03:28:44";
@@ -121,6 +121,12 @@ CodegenResult codegen_generate_function(Compilation* compilation, const IRFuncti
 
     x86_generate(&context);
 
+    // Instructions are scratch memory, the machine code is in machine_func.
+    // Compilations in a BasinContext run back to back so we don't want to keep it around.
+    mem__free(context.inst_sequence);
+    mem__free(context.instructions);
+    mem__free(context.operands);
+
     if (should_debug_print()) {
         dump_hex(context.machine_func->code, context.machine_func->code_len, 12);
     }
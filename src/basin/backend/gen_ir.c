@@ -25,15 +25,21 @@ typedef struct {
 
     ASTExpression_Block* current_block;
 
+    const FlatAST* flat;   // body of the function being generated
+
     TypeInfo* inferred_type;
 
     bool registers[256];
 
+    Array_Task machine_tasks; // added to the driver in one go when we are done
+    Array_Task reached_tasks; // IR of functions reached by calls (Compilation.lazy_ir), added with machine_tasks
+
     
     jmp_buf jump_state;
     SourceLocation bad_location;
     CLocation c_location;
     char error_message[512];
+    int errors; // reported with comp_report_error, a function with an error is skipped
     
     // Zones for tracy are cleaned up when long jumping.
     int zones_cap;
@@ -98,8 +104,9 @@ typedef enum GenFlags {
 } GenFlags;
 
 void walk(GenIRContext* context, ASTExpression* _expr);
+void generate_roots(GenIRContext* context);
 void generate_function(GenIRContext* context, ASTFunction* func);
-IRValue generate_expression(GenIRContext* context, ASTExpression* expr, GenFlags flags);
+IRValue generate_expression(GenIRContext* context, FlatIndex index, GenFlags flags);
 
 #define gen_error(LOC, FMT, ...) ( context->c_location.path = __FILE__, context->c_location.line = __LINE__, _gen_error(context, LOC, FMT __VA_OPT__(,)  __VA_ARGS__) )
 
@@ -115,7 +122,7 @@ void _gen_error(GenIRContext* context, SourceLocation loc, char* fmt, ...) {
 }
 
 
-Result generate_ir(Compilation* compilation, AST* ast, IRProgram* program) {
+Result generate_ir(Compilation* compilation, AST* ast, ASTFunction* function, IRProgram* program) {
     TracyCZone(zone, 1);
     // Find functions and generate them
     // We implement this recursively because it's easier to debug issues
@@ -137,25 +144,28 @@ Result generate_ir(Compilation* compilation, AST* ast, IRProgram* program) {
     context.ast = ast;
     context.builder.program = compilation->program;
 
-    int res = setjmp(context.jump_state);
-
-    if (res == 0) {
-
+    if (function) {
+        // Claimed by the caller that reached it
+        generate_function(&context, function);
+    } else if (compilation->lazy_ir) {
+        generate_roots(&context);
+    } else {
         walk(&context, (ASTExpression*)ast->global_block);
+    }
 
-    } else {
-        int line, column;
-        string code;
-        bool yes = compute_source_info(ast->stream, context.bad_location, &line, &column, &code);
-
-        char buffer[1024];
-        int len = 0;
-        len += snprintf(buffer + len, sizeof(buffer) - len, "\033[0;30m%s:%d\033[0m\n", context.c_location.path, context.c_location.line);
-        len += snprintf(buffer + len, sizeof(buffer) - len, "\033[31m%s:%d:%d:\033[0m %s\n%s", ast->stream->import->path.ptr, line, column, context.error_message, code.ptr);
+    // Functions reached before an error still need their IR, the compilation isn't cancelled until max_errors
+    driver_add_tasks(context.driver, context.reached_tasks.ptr, context.reached_tasks.len, -1);
+
+    if (context.errors > 0) {
+        // The errors are reported, the machine code would be thrown away
         result.kind = FAILURE;
-        result.message = string_clone_cptr(buffer);
+    } else {
+        driver_add_tasks(context.driver, context.machine_tasks.ptr, context.machine_tasks.len, -1);
     }
 
+    array_cleanup(&context.machine_tasks);
+    array_cleanup(&context.reached_tasks);
+
     TracyCZoneEnd(zone);
     return result;
 }
@@ -172,6 +182,9 @@ void walk(GenIRContext* context, ASTExpression* _expr) {
         case EXPR_BLOCK: {
             ASTExpression_Block* expr = (ASTExpression_Block*) _expr;
             for (int i=0;i<expr->functions.len;i++) {
+                // Another task failed, the remaining functions would be thrown away
+                if (context->compilation->cancelled)
+                    break;
                 ASTFunction* func = expr->functions.ptr[i];
                 generate_function(context, func);
             }
@@ -180,19 +193,57 @@ void walk(GenIRContext* context, ASTExpression* _expr) {
 }
 
 
+// Generates main, the other functions get their IR when a call reaches them.
+// Without a main (a file of functions to link with) every function of the file is a root.
+void generate_roots(GenIRContext* context) {
+    ASTExpression_Block* block = context->ast->global_block;
+    Atom main_name = interner_find(&context->driver->interner, "main", 4);
+
+    bool has_main = false;
+    for (int i=0;i<block->functions.len;i++) {
+        if (main_name && block->functions.ptr[i]->name == main_name) {
+            has_main = true;
+            break;
+        }
+    }
+
+    for (int i=0;i<block->functions.len;i++) {
+        if (context->compilation->cancelled)
+            break;
+        ASTFunction* func = block->functions.ptr[i];
+        if (has_main && func->name != main_name)
+            continue;
+        if (comp_reach_function(context->compilation, func))
+            generate_function(context, func);
+    }
+}
+
 void generate_function(GenIRContext* context, ASTFunction* func) {
+    // An error skips the rest of the function, the caller goes on with the next one
+    if (setjmp(context->jump_state)) {
+        cleanup_profile_zones(context);
+        Result error = source_error(context->ast->stream, context->bad_location, context->c_location.path, context->c_location.line, context->error_message);
+        comp_report_error(context->compilation, error.message.ptr);
+        string_cleanup(&error.message);
+        context->errors++;
+        memset(context->registers, 0, sizeof(context->registers));
+        context->current_block = NULL;
+        context->inferred_type = NULL;
+        return;
+    }
+
     PROFILE_START();
-    debug("Gen Func %s\n", func->name.ptr);
+    debug("Gen Func %s\n", interner_name(&context->driver->interner, func->name));
     
-    if(!func->body) {
-        debug(" skip no body %s\n", func->name.ptr);
+    if(!func->flat_body) {
+        debug(" skip no body %s\n", interner_name(&context->driver->interner, func->name));
         goto end;
     }
 
     IRFunction* ir_func;
     {
-        IRFunction empty_func = {};
-        ir_func = atomic_array_getptr(&context->compilation->program->functions, func->ir_function_id);
+        IRFunction_id id = comp_function_id(context->compilation, func);
+        ir_func = atomic_array_getptr(&context->compilation->program->functions, id);
 
         // @TODO Init_builder(func);
         context->builder.function = ir_func;
@@ -204,7 +255,8 @@ void generate_function(GenIRContext* context, ASTFunction* func) {
     // temporary variables, argument passed on stack.
     // maybe determine this after IR has been generated?
 
-    generate_expression(context, func->body, GEN_NONE);
+    context->flat = func->flat;
+    generate_expression(context, func->flat_body, GEN_NONE);
     
     // Check if we have RET at the end, only add if we don't.
 
@@ -226,22 +278,23 @@ void generate_function(GenIRContext* context, ASTFunction* func) {
     Task task = {};
     task.kind = TASK_GEN_MACHINE;
     task.compilation = context->compilation;
+    task.gen_machine.import = context->ast->stream->import;
     task.gen_machine.ir_function = ir_func;
-    driver_add_task(context->driver, &task);
+    array_push(&context->machine_tasks, &task);
 
 end:
     PROFILE_END();
 }
 
-IRValue generate_reference(GenIRContext* context, ASTExpression* _expression) {
+IRValue generate_reference(GenIRContext* context, FlatIndex index) {
     PROFILE_START();
     IRValue ir_value = {};
     IRBuilder* builder = &context->builder;
-    switch (_expression->kind) {
-        case EXPR_IDENTIFIER: {
-            ASTExpression_Identifier* iden = (ASTExpression_Identifier*)_expression;
+    const FlatNode* node = flat_node(context->flat, index);
+    switch (node->kind) {
+        case FLAT_IDENTIFIER: {
             FindResult result = {};
-            bool yes = find_identifier(cstr(iden->name), context->ast, context->current_block, &result);
+            bool yes = find_identifier(node->a, context->ast, context->current_block, &result);
             switch (result.kind) {
                 case FOUND_VARIABLE: {
                     ir_value.regnum = allocate_register(context);
@@ -268,24 +321,29 @@ IRValue generate_reference(GenIRContext* context, ASTExpression* _expression) {
 }
 
 
-IRValue generate_call(GenIRContext* context, ASTExpression_Call* expr_call) {
+IRValue generate_call(GenIRContext* context, FlatIndex index) {
+    const FlatAST* flat = context->flat;
+    const FlatNode* call = flat_node(flat, index);
+    u32 polyargs  = flat_extra(flat, call->b, 0);
+    u32 arguments = flat_extra(flat, call->b, 1);
     // @TODO Handle polymorphic arguments
-    ASSERT(expr_call->polymorphic_args.len == 0);
+    ASSERT(flat_list_len(flat, polyargs) == 0);
     // @TODO Handle calling function pointers
-    ASSERT(expr_call->expr->kind == EXPR_IDENTIFIER);
+    ASSERT(flat_node(flat, call->a)->kind == FLAT_IDENTIFIER);
     
-    ASTExpression_Identifier* expr_ident = (ASTExpression_Identifier*) expr_call->expr;
+    Atom name = flat_node(flat, call->a)->a;
+    SourceLocation name_location = flat_location(flat, call->a);
 
     // @TODO Implement find_function. special stuff for overloading etc. ?
     FindResult result = {};
-    bool res = find_identifier(cstr(expr_ident->name), context->ast, context->current_block, &result);
+    bool res = find_identifier(name, context->ast, context->current_block, &result);
     if (!res) {
-        gen_error(expr_ident->location, "Could not find '%s'", expr_ident->name.ptr);
+        gen_error(name_location, "Could not find '%s'", interner_name(&context->driver->interner, name));
     }
     
     if (result.kind != FOUND_FUNCTION) {
         // @TODO Print what kind we found (struct, global, etc)
-        gen_error(expr_ident->location, "Cannot call non-function '%s'", expr_ident->name.ptr);
+        gen_error(name_location, "Cannot call non-function '%s'", interner_name(&context->driver->interner, name));
     }
     
     ASTFunction* func = result.f_function;
@@ -299,21 +357,22 @@ IRValue generate_call(GenIRContext* context, ASTExpression_Call* expr_call) {
     ASSERT(arg_count <= ARRAY_LENGTH(ir_args));
     ASSERT(ret_count <= ARRAY_LENGTH(ir_ret_values));
 
-    for (int i=0;i<expr_call->arguments.len;i++) {
-        ASTExpression_Call_Argument* arg = &expr_call->arguments.ptr[i];
+    for (int i=0;i<flat_list_len(flat, arguments);i++) {
+        FlatIndex arg_index = flat_list_get(flat, arguments, i);
+        const FlatNode* arg = flat_node(flat, arg_index); // FLAT_NAMED
 
         int param_index = i;
-        if (arg->name.len) {
-            param_index = find_function_parameter(cstr(arg->name), func);
+        if (arg->a) {
+            param_index = find_function_parameter(arg->a, func);
             if (param_index == -1) {
-                gen_error(arg->location, "Function '%s' does not have parameter '%s', mispelled?", func->name.ptr, arg->name.ptr);
+                gen_error(flat_location(flat, arg_index), "Function '%s' does not have parameter '%s', mispelled?", interner_name(&context->driver->interner, func->name), interner_name(&context->driver->interner, arg->a));
             }
         }
 
         ASTFunction_Parameter* param = &func->parameters.ptr[param_index];
 
         // @TODO Infer type from param
-        IRValue arg_value = generate_expression(context, arg->expr, GEN_NONE);
+        IRValue arg_value = generate_expression(context, arg->b, GEN_NONE);
 
         ir_args[param_index] = arg_value.regnum;
     }
@@ -324,7 +383,16 @@ IRValue generate_call(GenIRContext* context, ASTExpression_Call* expr_call) {
         ir_ret_types[i] = IR_TYPE_S64;
     }
 
-    IRFunction_id id = func->ir_function_id;
+    IRFunction_id id = comp_function_id(context->compilation, func);
+
+    if (context->compilation->lazy_ir && comp_reach_function(context->compilation, func)) {
+        Task task = {};
+        task.kind = TASK_GEN_IR;
+        task.compilation = context->compilation;
+        task.gen_ir.import = driver_get_import(context->driver, func->location.import_id);
+        task.gen_ir.function = func;
+        array_push(&context->reached_tasks, &task);
+    }
     
     ir_call(&context->builder, id, func->parameters.len, func->return_values.len, ir_args, ir_ret_values, ir_ret_types);
 
@@ -350,13 +418,15 @@ IRValue generate_call(GenIRContext* context, ASTExpression_Call* expr_call) {
 }
 
 
-IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, GenFlags flags) {
+IRValue generate_expression(GenIRContext* context, FlatIndex index, GenFlags flags) {
     PROFILE_START();
     IRValue ir_value = {};
     IRBuilder* builder = &context->builder;
-    switch (_expression->kind) {
-        case EXPR_BLOCK: {
-            ASTExpression_Block* expression = (ASTExpression_Block*) _expression;
+    const FlatAST* flat = context->flat;
+    const FlatNode* node = flat_node(flat, index);
+    switch (node->kind) {
+        case FLAT_BLOCK: {
+            ASTExpression_Block* expression = flat_block(flat, node);
             ASTExpression_Block* prev_block = context->current_block;
             context->current_block = expression;
 
@@ -367,22 +437,21 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
             for (int i=0;i<expression->variables.len;i++) {
                 ASTVariable* var = expression->variables.ptr[i];
                 var->frame_offset = context->builder.function->frame_size;
-                if (string_equal_cstr(cstr(var->name), "text")) {
+                if (string_equal_cstr(interner_get(&context->driver->interner, var->name), "text")) {
                     context->builder.function->frame_size += 16; // @NOCHECKIN Increment by size of variable!!!
                 } else {
                     context->builder.function->frame_size += 8; // @NOCHECKIN Increment by size of variable!!!
                 }
-                printf("Install %s at %d\n", var->name.ptr, var->frame_offset);
+                log__dump("Install %s at %d\n", interner_name(&context->driver->interner, var->name), var->frame_offset);
             }
 
-            for (int i=0;i<expression->expressions.len;i++) {
-                generate_expression(context, expression->expressions.ptr[i], GEN_IGNORE_VALUE);
+            for (int i=0;i<flat_list_len(flat, node->b);i++) {
+                generate_expression(context, flat_list_get(flat, node->b, i), GEN_IGNORE_VALUE);
             }
             context->current_block = prev_block;
         } break;
-        case EXPR_LITERAL: {
-            ASTExpression_Literal* expression = (ASTExpression_Literal*) _expression;
-            switch (expression->literal_kind) {
+        case FLAT_LITERAL: {
+            switch (node->sub_kind) {
                 case EXPR_LITERAL_INTEGER: {
                     // @TODO Don't assume type
                     //   Get type from parent expression?
@@ -390,7 +459,7 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                         ASSERT(false);
                     } else {
                         int reg = allocate_register(context);
-                        ir_imm32(&context->builder, reg, expression->int_value, IR_TYPE_S64);
+                        ir_imm32(&context->builder, reg, flat_int(node), IR_TYPE_S64);
                         ir_value.regnum = reg;
                     }
                 } break;
@@ -401,7 +470,7 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                         ASSERT(false);
                     } else {
                         int reg = allocate_register(context);
-                        float v = expression->float_value;
+                        float v = flat_float(node);
                         ir_imm32(&context->builder, reg, *(i32*)&v, IR_TYPE_S64);
                         ir_value.regnum = reg;
                     }
@@ -425,13 +494,13 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                 default: ASSERT(false);
             }
         } break;
-        case EXPR_MEMBER: {
-            ASTExpression_Member* expr_member = (ASTExpression_Member*)_expression;
+        case FLAT_MEMBER: {
+            Atom member_name = node->b;
 
-            if (expr_member->expr->kind == EXPR_IDENTIFIER) {
-                ASTExpression_Identifier* expr_identifier = (ASTExpression_Identifier*)expr_member->expr;
+            if (flat_node(flat, node->a)->kind == FLAT_IDENTIFIER) {
+                Atom name = flat_node(flat, node->a)->a;
                 FindResult result = {};
-                bool yes = find_identifier(cstr(expr_identifier->name), context->ast, context->current_block, &result);
+                bool yes = find_identifier(name, context->ast, context->current_block, &result);
                 switch (result.kind) {
                     case FOUND_VARIABLE: {
                         ir_value.regnum = allocate_register(context);
@@ -440,9 +509,9 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
 
                         // @NOCHECKIN Don't hardcode field names
                         int field_offset;
-                        if (string_equal_cstr(cstr(expr_member->name), "ptr")) {
+                        if (string_equal_cstr(interner_get(&context->driver->interner, member_name), "ptr")) {
                             field_offset = 0;
-                        } else if (string_equal_cstr(cstr(expr_member->name), "len")) {
+                        } else if (string_equal_cstr(interner_get(&context->driver->interner, member_name), "len")) {
                             field_offset = 8;
                         } else ASSERT(false);
 
@@ -457,7 +526,7 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                     // case FOUND_ENUM:
                     // case FOUND_ENUM_MEMBER:
                     case FOUND_NONE: {
-                        gen_error(expr_identifier->location, "Could not find '%s'", expr_identifier->name.ptr);
+                        gen_error(flat_location(flat, node->a), "Could not find '%s'", interner_name(&context->driver->interner, name));
                     } break;
                     default: ASSERT(false);
                 }
@@ -465,17 +534,17 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                 ASSERT(false);
             }
         } break;
-        case EXPR_IDENTIFIER: {
-            ASTExpression_Identifier* expr_identifier = (ASTExpression_Identifier*)_expression;
+        case FLAT_IDENTIFIER: {
+            Atom name = node->a;
 
-            if (string_equal_cstr(cstr(expr_identifier->name), "null")) {
+            if (string_equal_cstr(interner_get(&context->driver->interner, name), "null")) {
                 ir_value.regnum = allocate_register(context);
                 ir_imm32(builder, ir_value.regnum, 0, IR_TYPE_S64);
                 break;
             }
 
             FindResult result = {};
-            bool yes= find_identifier(cstr(expr_identifier->name), context->ast, context->current_block, &result);
+            bool yes= find_identifier(name, context->ast, context->current_block, &result);
             switch (result.kind) {
                 case FOUND_VARIABLE:{
                     ir_value.regnum = allocate_register(context);
@@ -493,30 +562,28 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                 // case FOUND_ENUM:
                 // case FOUND_ENUM_MEMBER:
                 case FOUND_NONE: {
-                    gen_error(expr_identifier->location, "Could not find '%s'", expr_identifier->name.ptr);
+                    gen_error(flat_location(flat, index), "Could not find '%s'", interner_name(&context->driver->interner, name));
                 } break;
                 default: ASSERT(false);
             }
         } break;
-        case EXPR_RETURN: {
-            ASTExpression_Return* expr_return = (ASTExpression_Return*)_expression;
+        case FLAT_RETURN: {
+            int count = flat_list_len(flat, node->a);
 
             IROperand operands[10];
-            for (int i=0;i<expr_return->exprs.len;i++) {
-                IRValue value = generate_expression(context, expr_return->exprs.ptr[i], 0);
+            for (int i=0;i<count;i++) {
+                IRValue value = generate_expression(context, flat_list_get(flat, node->a, i), 0);
                 operands[i] = value.regnum;
             }
-            ir_ret(builder, expr_return->exprs.len, operands);
+            ir_ret(builder, count, operands);
         } break;
-        case EXPR_BINARY: {
-            ASTExpression_Binary* expr_binary = (ASTExpression_Binary*) _expression;
-
-            IRValue left_value = generate_expression(context, expr_binary->left, 0);
-            IRValue right_value = generate_expression(context, expr_binary->right, 0);
+        case FLAT_BINARY: {
+            IRValue left_value = generate_expression(context, node->a, 0);
+            IRValue right_value = generate_expression(context, node->b, 0);
 
             ir_value.regnum = allocate_register(context);
 
-            switch (expr_binary->op_kind) {
+            switch (node->sub_kind) {
                 case EXPR_OP_ADD: {
                     ir_add(builder, ir_value.regnum, left_value.regnum, right_value.regnum, IR_TYPE_S64);
                 } break;
@@ -558,15 +625,13 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
             free_register(context, left_value.regnum);
             free_register(context, right_value.regnum);
         } break;
-         case EXPR_UNARY: {
-            ASTExpression_Unary* expr_unary = (ASTExpression_Unary*) _expression;
-
-            IRValue left_value = generate_expression(context, expr_unary->expr, 0);
+         case FLAT_UNARY: {
+            IRValue left_value = generate_expression(context, node->a, 0);
 
             IRValue temp_value = {};
             temp_value.regnum = allocate_register(context);
 
-            switch (expr_unary->op_kind) {
+            switch (node->sub_kind) {
                 case EXPR_OP_SUB: {
                     ir_imm32(builder, temp_value.regnum, 0, IR_TYPE_S64);
                     ir_sub(builder, left_value.regnum, temp_value.regnum, left_value.regnum, IR_TYPE_S64);
@@ -577,22 +642,22 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
             free_register(context, temp_value.regnum);
             ir_value = left_value;
         } break;
-        case EXPR_ASSIGN: {
-            ASTExpression_Assign* expr_assign = (ASTExpression_Assign*) _expression;
+        case FLAT_ASSIGN: {
+            const FlatNode* value = flat_node(flat, node->b);
 
 
-            #define GEN_REF IRValue ref = generate_reference(context, expr_assign->ref);
+            #define GEN_REF IRValue ref = generate_reference(context, node->a);
 
-            if (expr_assign->value->kind == EXPR_LITERAL) {
+            if (value->kind == FLAT_LITERAL) {
                 GEN_REF
 
-                ASTExpression_Literal* value = (ASTExpression_Literal*) expr_assign->value;
-                switch (value->literal_kind) {
+                switch (value->sub_kind) {
                     case EXPR_LITERAL_STRING: {
                         // @TODO Check type of ref. Is it pointer to char[], pointer to string or something else?
 
-                        int length = value->string_value.len;
-                        int offset = submit_rodata_string(context, cstr(value->string_value));
+                        cstring str = flat_string(flat, value->a);
+                        int length = str.len;
+                        int offset = submit_rodata_string(context, str);
 
                         int reg_length = allocate_register(context);
                         int reg_ptr = allocate_register(context);
@@ -608,14 +673,14 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                     } break;
                     case EXPR_LITERAL_INTEGER: {
                         int reg_value = allocate_register(context);
-                        ir_imm32(&context->builder, reg_value, value->int_value, IR_TYPE_S64);
+                        ir_imm32(&context->builder, reg_value, flat_int(value), IR_TYPE_S64);
                         ir_store(&context->builder, ref.regnum, reg_value, 0, IR_TYPE_S64);
                         free_register(context, ref.regnum);
                         free_register(context, reg_value);
                     } break;
                     case EXPR_LITERAL_FLOAT: {
                         int reg_value = allocate_register(context);
-                        float lit_value = value->float_value;
+                        float lit_value = flat_float(value);
                         ir_imm32(&context->builder, reg_value, *(u32*)&lit_value, IR_TYPE_F64);
                         ir_store(&context->builder, ref.regnum, reg_value, 0, IR_TYPE_F64);
                         free_register(context, ref.regnum);
@@ -623,23 +688,23 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
                     } break;
                     default: ASSERT(false);
                 }
-                // IRValue val = generate_expression(context, expr_assign->value, 0);
+                // IRValue val = generate_expression(context, node->b, 0);
                 // // @TODO Handle structs and what not
                 // ir_store(&context->builder, ref.regnum, val.regnum, 0, IR_TYPE_S64);
 
                 // free_register(context, ref.regnum);
                 // free_register(context, val.regnum);
-            } else if (expr_assign->value->kind == EXPR_CALL) {
-                IRValue value = generate_call(context, (ASTExpression_Call*)expr_assign->value);
-                ASSERT(value.regnum != -1);
+            } else if (value->kind == FLAT_CALL) {
+                IRValue call_value = generate_call(context, node->b);
+                ASSERT(call_value.regnum != -1);
 
                 GEN_REF
 
                 // @TODO Handle struct
 
-                ir_store(&context->builder, ref.regnum, value.regnum, 0, IR_TYPE_S64);
+                ir_store(&context->builder, ref.regnum, call_value.regnum, 0, IR_TYPE_S64);
                 free_register(context, ref.regnum);
-                free_register(context, value.regnum);
+                free_register(context, call_value.regnum);
 
                 // @TODO How to return multiple IR values?
                 //    Only assignment allows multiple IR values
@@ -647,8 +712,8 @@ IRValue generate_expression(GenIRContext* context, ASTExpression* _expression, G
 
             // return no IR value
         } break;
-        case EXPR_CALL: {
-            IRValue value = generate_call(context, (ASTExpression_Call*) _expression);
+        case FLAT_CALL: {
+            IRValue value = generate_call(context, index);
 
             if (value.regnum != INVALID_REG_NUM && (flags & GEN_IGNORE_VALUE)) {
                 free_register(context, value.regnum);
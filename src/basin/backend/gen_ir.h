@@ -6,5 +6,10 @@
 
 typedef struct Driver Driver;
 typedef struct AST AST;
+typedef struct ASTFunction ASTFunction;
 
-Result generate_ir(Compilation* compilation, AST* ast, IRProgram* program);
+// Generates the functions of the AST, only 'function' if it isn't NULL.
+// With lazy IR the functions are the roots (main) and functions reached from them are queued.
+// A function with an error is reported with comp_report_error and skipped, the others are still
+// generated until the compilation is cancelled. The returned failure has no message.
+Result generate_ir(Compilation* compilation, AST* ast, ASTFunction* function, IRProgram* program);
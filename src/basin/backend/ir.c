@@ -186,8 +186,8 @@ void ir_address_of_variable(IRBuilder* builder, int reg, IRSectionID section, in
 void print_ir_function(IRProgram* program, IRFunction* function) {
     int head = 0;
 
-    #define print(...) printf("  " __VA_ARGS__)
-    #define aprint(...) printf(__VA_ARGS__)
+    #define print(...) log__dump("  " __VA_ARGS__)
+    #define aprint(...) log__dump(__VA_ARGS__)
 
     while (head < function->code_len) {
         IROpcode* opcode = &function->code[head];
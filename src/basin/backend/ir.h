@@ -255,6 +255,9 @@ typedef struct {
     u8* code;
     int code_len;
     int code_cap;
+
+    // Set by the first caller that reaches the function when IR is generated lazily, see comp_reach_function
+    volatile u32 reached;
 } IRFunction;
 
 typedef struct IRDataObject {
@@ -26,7 +26,7 @@ void generate_elf(ObjectContext* context);
 void generate_object_file(Compilation* compilation) {
     PROFILE_START()
 
-    debug("Gen object file %s\n", compilation->options->output_file);
+    debug("Gen object file %s\n", compilation->output_file.ptr);
 
     ObjectContext context = {};
     context.compilation = compilation;
@@ -54,26 +54,26 @@ void generate_object_file(Compilation* compilation) {
 void print_compilation(ObjectContext* context) {
     
 
-    printf("Sections [%d]\n", atomic_array_size(&context->ir_program->sections));
+    log__dump("Sections [%d]\n", atomic_array_size(&context->ir_program->sections));
     for (int i=0;i<atomic_array_size(&context->ir_program->sections);i++) {
         IRSection* ir_section = atomic_array_getptr(&context->ir_program->sections, i);
 
-        printf("  %s, %d bytes\n", ir_section->name.ptr, (int)ir_section->data_len);
+        log__dump("  %s, %d bytes\n", ir_section->name.ptr, (int)ir_section->data_len);
     }
     
-    printf("Functions [%d]\n", atomic_array_size(&context->machine_program->functions));
+    log__dump("Functions [%d]\n", atomic_array_size(&context->machine_program->functions));
     for (int i=0;i<atomic_array_size(&context->machine_program->functions);i++) {
         MachineFunction* function = atomic_array_getptr(&context->machine_program->functions, i);
         IRFunction* ir_function = atomic_array_getptr(&context->ir_program->functions, function->function_id);
 
-        printf("  %s, %d bytes\n", ir_function->name.ptr, (int)function->code_len);
+        log__dump("  %s, %d bytes\n", ir_function->name.ptr, (int)function->code_len);
     }
 
-    printf("Data Objects [%d]\n", atomic_array_size(&context->ir_program->variables));
+    log__dump("Data Objects [%d]\n", atomic_array_size(&context->ir_program->variables));
     for (int i=0;i<atomic_array_size(&context->ir_program->variables);i++) {
         IRDataObject* ir_variable = atomic_array_getptr(&context->ir_program->variables, i);
 
-        printf("  %s, %d bytes\n", ir_variable->name.ptr, (int)ir_variable->size);
+        log__dump("  %s, %d bytes\n", ir_variable->name.ptr, (int)ir_variable->size);
     }
 }
 
@@ -103,7 +103,7 @@ void generate_coff(ObjectContext* context) {
         print_compilation(context);
     }
 
-    const char* obj_path = context->compilation->options->output_file;
+    const char* obj_path = context->compilation->output_file.ptr;
     FSHandle handle = fs__open(obj_path, FS_WRITE);
     if (handle == FS_INVALID_HANDLE) {
         log__printf("Could not write %s\n", obj_path);
@@ -178,9 +178,24 @@ void generate_coff(ObjectContext* context) {
         fs__write(handle, COFF_File_Header_SIZE + (i) * Section_Header_SIZE, &section, Section_Header_SIZE);
     }
 
+    // With lazy IR every function of an import used by the program has an id but only the
+    // ones that were reached have code or are called. The others would look like externals
+    // so they get no symbol.
+    int functions_len = atomic_array_size(&context->ir_program->functions);
+    int* function_symbols = HEAP_ALLOC_ARRAY(int, functions_len + 1);
+    int symbol_count = atomic_array_size(&context->ir_program->sections);
+    for (int fi=0;fi<functions_len;fi++) {
+        IRFunction* ir_function = atomic_array_getptr(&context->ir_program->functions, fi);
+        if (context->compilation->lazy_ir && !ir_function->reached && get_machine_id_from_ir_id(context, fi) == -1) {
+            function_symbols[fi] = -1;
+        } else {
+            function_symbols[fi] = symbol_count++;
+        }
+    }
+
     header.PointerToSymbolTable = fileOffset;
     // header.NumberOfSymbols = atomic_array_size(&context->ir_program->sections) + atomic_array_size(&context->machine_program->functions) + atomic_array_size(&context->ir_program->variables);
-    header.NumberOfSymbols = atomic_array_size(&context->ir_program->sections) + atomic_array_size(&context->ir_program->functions) + atomic_array_size(&context->ir_program->variables);
+    header.NumberOfSymbols = symbol_count + atomic_array_size(&context->ir_program->variables);
 
     fileOffset += header.NumberOfSymbols * Symbol_Record_SIZE;
     
@@ -191,14 +206,16 @@ void generate_coff(ObjectContext* context) {
     // +1 because text section is not included in IR section and stack section is not really a section
     #define IR_SECTION_TO_SYMBOL_INDEX(ID) (ID)
 
-    // +2 because above
-    int symbol_index_start_of_functions = atomic_array_size(&context->ir_program->sections);
-
     int exec_offset = exec_section.PointerToRawData;
+    int relocation_index = 0;
+    // Functions are written in the order machine code was generated, which is not the IR id order
+    int* function_text_offsets = HEAP_ALLOC_ARRAY(int, atomic_array_size(&context->machine_program->functions) + 1);
     // for (int i=0;i<atomic_array_size(&context->machine_program->functions);i++) {
     for (int i=0;i<atomic_array_size(&context->machine_program->functions);i++) {
         MachineFunction* function = atomic_array_getptr(&context->machine_program->functions, i);
         int function_data_offset = exec_offset;
+        int function_text_offset = exec_offset - exec_section.PointerToRawData;
+        function_text_offsets[i] = function_text_offset;
         fs__write(handle, function_data_offset, function->code, function->code_len);
         exec_offset += function->code_len;
 
@@ -208,18 +225,20 @@ void generate_coff(ObjectContext* context) {
             switch (rel->type) {
                 case RELOCATION_TYPE_FUNCTION: {
                     relocation.Type = IMAGE_REL_AMD64_REL32;
-                    relocation.SymbolTableIndex = symbol_index_start_of_functions + rel->function_id;
-                    relocation.VirtualAddress = rel->code_offset;
+                    ASSERT(function_symbols[rel->function_id] != -1);
+                    relocation.SymbolTableIndex = function_symbols[rel->function_id];
+                    relocation.VirtualAddress = function_text_offset + rel->code_offset;
                 } break;
                 case RELOCATION_TYPE_DATA_OBJECT: {
                     relocation.Type = IMAGE_REL_AMD64_REL32;
                     relocation.SymbolTableIndex = IR_SECTION_TO_SYMBOL_INDEX(rel->section_id);
-                    relocation.VirtualAddress = rel->code_offset;
+                    relocation.VirtualAddress = function_text_offset + rel->code_offset;
                     int value = rel->value_offset;
                     fs__write(handle, function_data_offset + rel->code_offset, &value, sizeof(int));
                 } break;
             }
-            fs__write(handle, exec_section.PointerToRelocations + ri * COFF_Relocation_SIZE, &relocation, COFF_Relocation_SIZE);
+            fs__write(handle, exec_section.PointerToRelocations + relocation_index * COFF_Relocation_SIZE, &relocation, COFF_Relocation_SIZE);
+            relocation_index++;
         }
     }
 
@@ -268,8 +287,9 @@ void generate_coff(ObjectContext* context) {
         next_symbol_index++;
     }
 
-    int current_function_text_offset = 0;
-    for (int fi=0;fi<atomic_array_size(&context->ir_program->functions);fi++) {
+    for (int fi=0;fi<functions_len;fi++) {
+        if (function_symbols[fi] == -1)
+            continue;
         IRFunction* ir_function = atomic_array_getptr(&context->ir_program->functions, fi);
         int mi = get_machine_id_from_ir_id(context, fi);
         MachineFunction* function = NULL;
@@ -284,11 +304,8 @@ void generate_coff(ObjectContext* context) {
             symbol.SectionNumber = 1;
             // symbol.StorageClass = IMAGE_SYM_CLASS_STATIC;
             symbol.StorageClass = IMAGE_SYM_CLASS_EXTERNAL;
-            symbol.Value = current_function_text_offset;
-            current_function_text_offset += function->code_len;
-            printf("avail %s\n", ir_function->name.ptr);
+            symbol.Value = function_text_offsets[mi];
         } else {
-            printf("ext %s\n", ir_function->name.ptr);
             symbol.SectionNumber = 0;
             symbol.StorageClass = IMAGE_SYM_CLASS_EXTERNAL;
         }
@@ -319,6 +336,9 @@ void generate_coff(ObjectContext* context) {
     fs__write(handle, 0, &header, COFF_File_Header_SIZE);
 
     fs__close(handle);
+
+    mem__free(function_symbols);
+    mem__free(function_text_offsets);
     
     PROFILE_END()
 }
@@ -44,35 +44,299 @@ const char* basin_build_date() {
 }
 
 
+struct BasinContext {
+    Driver* driver;
+    int     thread_count;
+
+    // Compilations between basin_begin_compile and basin_end_compile
+    bool               compiling;
+    Array_CompilationP compilations;
+};
+
+BasinContext* basin_create_context(int thread_count) {
+    TracyCZone(zone, 1);
+
+    BasinContext* context = HEAP_ALLOC_OBJECT(BasinContext);
+    context->driver       = driver_create();
+    context->thread_count = thread_count;
+
+    TracyCZoneEnd(zone);
+    return context;
+}
+
+void basin_destroy_context(BasinContext* context) {
+    TracyCZone(zone, 1);
+
+    if (context->compiling) {
+        // Threads must be done with the compilation before they are stopped
+        BasinResult result = basin_end_compile(context);
+        basin_free_result(&result);
+    }
+    array_cleanup(&context->compilations);
+    driver_cleanup(context->driver);
+    mem__free(context);
+
+    TracyCZoneEnd(zone);
+}
+
 BasinResult basin_compile(const BasinCompileOptions* options) {
+    return basin_compile_many(NULL, options, 1);
+}
+
+BasinResult basin_compile_with_context(BasinContext* context, const BasinCompileOptions* options) {
+    return basin_compile_many(context, options, 1);
+}
+
+// input_text or input_file is the first input, input_files are the rest
+static int count_inputs(const BasinCompileOptions* options) {
+    int count = options->input_files_len;
+    if (options->input_text || options->input_file)
+        count++;
+    return count;
+}
+
+static const char* get_input(const BasinCompileOptions* options, int index) {
+    if (options->input_text || options->input_file) {
+        if (index == 0)
+            return options->input_file ? options->input_file : "<unknown>";
+        index--;
+    }
+    return options->input_files[index];
+}
+
+// Object file of an input, see BasinCompileOptions. Empty if we don't write one.
+static string get_output(const BasinCompileOptions* options, const char* input, int input_count) {
+    if (input_count == 1) {
+        if (!options->output_file)
+            return (string){};
+        return string_clone_cptr(options->output_file);
+    }
+
+    int input_len = strlen(input);
+    int slash_pos = string_rfind(input, input_len-1, "/");
+    int dot_pos   = string_rfind(input, input_len-1, ".");
+    const char* stem = input + slash_pos + 1;
+    int stem_len = (dot_pos > slash_pos ? dot_pos : input_len) - (slash_pos + 1);
+
+    string path = {};
+    if (options->output_file) {
+        string_append_cptr(&path, options->output_file);
+    } else if (slash_pos != -1) {
+        string_append(&path, input, slash_pos);
+    } else {
+        string_append_cptr(&path, ".");
+    }
+    string_append_char(&path, '/');
+    string_append(&path, stem, stem_len);
+    string_append_cptr(&path, ".o");
+    return path;
+}
+
+typedef struct {
+    string      path; // empty if we don't write one
+    const char* input;
+} InputOutput;
+DEF_ARRAY(InputOutput)
+
+static int compare_output_path(const void* a_ptr, const void* b_ptr) {
+    const InputOutput* a = a_ptr;
+    const InputOutput* b = b_ptr;
+    return strcmp(a->path.ptr ? a->path.ptr : "", b->path.ptr ? b->path.ptr : "");
+}
+
+// Finds two inputs with the same object file, returns false if there are none.
+static bool find_output_collision(const Array_InputOutput* outputs, InputOutput* out_a, InputOutput* out_b) {
+    Array_InputOutput sorted = {};
+    for (int i=0;i<outputs->len;i++) {
+        if (outputs->ptr[i].path.len)
+            array_push(&sorted, &outputs->ptr[i]);
+    }
+    qsort(sorted.ptr, sorted.len, sizeof(InputOutput), compare_output_path);
+
+    bool found = false;
+    for (int i=1;i<sorted.len && !found;i++) {
+        if (string_equal(cstr(sorted.ptr[i-1].path), cstr(sorted.ptr[i].path))) {
+            *out_a = sorted.ptr[i-1];
+            *out_b = sorted.ptr[i];
+            found = true;
+        }
+    }
+    array_cleanup(&sorted);
+    return found;
+}
+
+BasinResult basin_compile_many(BasinContext* context, const BasinCompileOptions* options_list, int options_len) {
+    TracyCZone(zone, 1);
+
+    BasinContext* temp_context = NULL;
+    if (!context)
+        context = temp_context = basin_create_context(options_len > 0 ? options_list[0].threads : 0);
+
+    BasinResult result = basin_begin_compile(context, options_list, options_len);
+    if (result.error_type == BASIN_SUCCESS)
+        result = basin_end_compile(context);
+
+    if (temp_context)
+        basin_destroy_context(temp_context);
+    
+    TracyCZoneEnd(zone);
+    return result;
+}
+
+BasinResult basin_begin_compile(BasinContext* context, const BasinCompileOptions* options_list, int options_len) {
     TracyCZone(zone, 1);
     
     BasinResult result = {};
 
-    Driver* driver = driver_create();
+    if (context->compiling) {
+        FORMAT_ERROR(result, BASIN_INVALID_COMPILE_OPTIONS, "ERROR: Context is already compiling, call basin_end_compile first%s\n", "");
+        TracyCZoneEnd(zone);
+        return result;
+    }
+
+    // Check everything before we add tasks, nothing should be compiled if an option is wrong.
+    for (int i=0;i<options_len;i++) {
+        const BasinCompileOptions* options = &options_list[i];
+        int input_count = count_inputs(options);
+        if (input_count == 0) {
+            FORMAT_ERROR(result, BASIN_INVALID_COMPILE_OPTIONS, "ERROR: No input file%s\n", "");
+            TracyCZoneEnd(zone);
+            return result;
+        }
+        if (input_count > 1 && options->output_file) {
+            FSInfo info;
+            if (!fs__path_info(options->output_file, &info) || !info.is_directory) {
+                FORMAT_ERROR(result, BASIN_INVALID_COMPILE_OPTIONS, "ERROR: Output '%s' must be a directory when compiling several files\n", options->output_file);
+                TracyCZoneEnd(zone);
+                return result;
+            }
+        }
+    }
+
+    // Object files are named after the inputs, 'a/util.bsn' and 'b/util.bsn' in one output directory
+    // (or the same input twice) would overwrite each other.
+    Array_InputOutput outputs = {};
+    for (int i=0;i<options_len;i++) {
+        const BasinCompileOptions* options = &options_list[i];
+        int input_count = count_inputs(options);
+        for (int j=0;j<input_count;j++) {
+            InputOutput output = {};
+            output.input = get_input(options, j);
+            output.path  = get_output(options, output.input, input_count);
+            array_push(&outputs, &output);
+        }
+    }
+    InputOutput first, second;
+    if (find_output_collision(&outputs, &first, &second)) {
+        FORMAT_ERROR(result, BASIN_INVALID_COMPILE_OPTIONS, "ERROR: '%s' and '%s' would both be compiled to '%s', rename one of them or compile them separately\n", first.input, second.input, first.path.ptr);
+        for (int i=0;i<outputs.len;i++)
+            string_cleanup(&outputs.ptr[i].path);
+        array_cleanup(&outputs);
+        TracyCZoneEnd(zone);
+        return result;
+    }
+
+    Driver* driver = context->driver;
 
-    Compilation* comp = driver_create_compilation(driver, options);
+    driver->ordered_output = false;
+    for (int i=0;i<options_len;i++) {
+        if (options_list[i].ordered_output)
+            driver->ordered_output = true;
+    }
+
+    // Every input gets a compilation. They share the driver's threads and imports
+    // (if their import directories are the same, see Compilation.import_group).
+    Array_CompilationP* compilations = &context->compilations;
+    context->compiling = true;
+
+    int output_index = 0;
+    for (int i=0;i<options_len;i++) {
+        const BasinCompileOptions* options = &options_list[i];
+        int input_count = count_inputs(options);
+        for (int j=0;j<input_count;j++) {
+            const char* input = get_input(options, j);
 
+            Compilation* comp = driver_create_compilation(driver, options);
+            comp->output_file = outputs.ptr[output_index++].path; // the compilation owns it now
+            array_push(compilations, &comp);
+
+            // The input is parsed for every compilation, imports it reaches are reused.
+            comp->root_import = driver_create_import_id(driver, cstr_cptr(input));
+
+            if (options->input_text && j == 0) {
+                comp->root_import->text = string_clone(options->input_text, options->input_text_len);
+            }
 
-    cstring c_path;
-    if (options->input_file)
-        c_path = cstr_cptr(options->input_file);
-    else
-        c_path = cstr_cptr("<unknown>");
+            Task task = {};
+            task.compilation = comp;
+            task.kind = TASK_LEX_AND_PARSE;
+            task.lex_and_parse.import = comp->root_import;
+            driver_add_task(driver, &task);
 
-    Task task = {};
-    task.compilation = comp;
-    task.kind = TASK_LEX_AND_PARSE;
-    task.lex_and_parse.import = driver_create_import_id(driver, c_path);
+            driver_add_gen_ir_tasks(driver, comp, comp->root_import);
 
-    if (options->input_text) {
-        task.lex_and_parse.import->text = string_clone(options->input_text, options->input_text_len);
+            if (comp->output_file.len) {
+                Task object_task = {};
+                object_task.compilation = comp;
+                object_task.kind = TASK_GEN_OBJECT;
+                driver_add_final_task(driver, &object_task);
+            }
+        }
     }
+    array_cleanup(&outputs);
 
-    driver_add_task(driver, &task);
+    TracyCZoneEnd(zone);
+    return result;
+}
 
-    // 0, 0 means: Use all CPU threads and process all tasks
-    driver_run(driver, 0, 0);
+// Errors of all compilations in one allocation, pointers first and then the text.
+static void collect_compile_errors(BasinResult* result, const Array_CompilationP* compilations) {
+    int count = 0;
+    u64 text_size = 0;
+    for (int i=0;i<compilations->len;i++) {
+        const Array_string* errors = &compilations->ptr[i]->errors;
+        count += errors->len;
+        for (int j=0;j<errors->len;j++)
+            text_size += errors->ptr[j].len + 1;
+    }
+    if (count == 0)
+        return;
+
+    char** table = mem__alloc(count * sizeof(char*) + text_size);
+    char* text = (char*)(table + count);
+    int index = 0;
+    for (int i=0;i<compilations->len;i++) {
+        const Array_string* errors = &compilations->ptr[i]->errors;
+        for (int j=0;j<errors->len;j++) {
+            table[index++] = text;
+            memcpy(text, errors->ptr[j].ptr, errors->ptr[j].len + 1);
+            text += errors->ptr[j].len + 1;
+        }
+    }
+    result->error_type         = BASIN_COMPILE_ERROR;
+    result->compile_errors     = table;
+    result->compile_errors_len = count;
+}
+
+bool basin_step_compile(BasinContext* context, int max_tasks, int max_microseconds) {
+    if (!context->compiling)
+        return true;
+    return driver_run(context->driver, context->thread_count, max_tasks, max_microseconds);
+}
+
+BasinResult basin_end_compile(BasinContext* context) {
+    TracyCZone(zone, 1);
+
+    BasinResult result = {};
+    if (!context->compiling) {
+        TracyCZoneEnd(zone);
+        return result;
+    }
+
+    Driver* driver = context->driver;
+
+    // 0 tasks means: process all tasks
+    driver_run(driver, context->thread_count, 0, 0);
 
     // Driver finished compiling code
     // user metaprograms finished executing
@@ -81,7 +345,13 @@ BasinResult basin_compile(const BasinCompileOptions* options) {
     
     // write it to a file
 
-    driver_cleanup(driver);
+    collect_compile_errors(&result, &context->compilations);
+
+    for (int i=0;i<context->compilations.len;i++) {
+        driver_destroy_compilation(driver, context->compilations.ptr[i]);
+    }
+    context->compilations.len = 0;
+    context->compiling = false;
     
     TracyCZoneEnd(zone);
 
@@ -187,6 +457,14 @@ BasinResult basin_parse_arguments(const char* arguments, BasinCompileOptions* op
     return result;
 }
 
+void basin_free_options(BasinCompileOptions* options) {
+    if (options->_allocation)
+        mem__free(options->_allocation);
+    options->_allocation     = NULL;
+    options->input_files     = NULL;
+    options->input_files_len = 0;
+}
+
 BasinResult basin_parse_argv(int argc, const char** argv, BasinCompileOptions* options) {
     BasinResult result = { 0 };
     result.error_type = BASIN_SUCCESS;
@@ -345,19 +623,45 @@ BasinResult basin_parse_argv(int argc, const char** argv, BasinCompileOptions* o
                 return result;
             }
         
+        DEF_ARG_CHOICE("-max-errors", "ERROR: Missing error count after '%s'\n")
+
+            options->max_errors = atoi(value);
+
+        DEF_ARG_CHOICE("-threads", "ERROR: Missing thread count after '%s'\n")
+
+            options->threads = atoi(value);
+
         } else if(!strcmp(arg, "-silent")) {
             options->silent = true;
+        } else if(!strcmp(arg, "-ordered-output")) {
+            options->ordered_output = true;
+        } else if(!strcmp(arg, "-stream-tokens")) {
+            options->stream_tokens = true;
+        } else if(!strcmp(arg, "-all-functions")) {
+            options->all_functions = true;
+        } else if(!strcmp(arg, "-dump-tokens")) {
+            options->dump_tokens = true;
         } else if(!strcmp(arg, "-run")) {
             options->run_output = true;
         } else if(arg[0] == '-') {
             FORMAT_ERROR(result, BASIN_INVALID_COMPILE_OPTIONS, "ERROR: Unknown argument '%s'. See --help\n", arg);
             return result;
         } else {
-            if (options->input_file) {
-                FORMAT_ERROR(result, BASIN_INVALID_COMPILE_OPTIONS, "ERROR: Multiple input files are not allowed, '%s'\n", arg);
-                return result;
+            if (!options->input_file && options->input_files_len == 0) {
+                options->input_file = arg;
+                continue;
+            }
+            // Several inputs go in input_files, first one included
+            if (!options->_allocation) {
+                // Room for every argument, we don't know how many are inputs
+                const char** files = mem__alloc(argc * sizeof(const char*));
+                files[0] = options->input_file;
+                options->_allocation     = files;
+                options->input_files     = files;
+                options->input_files_len = 1;
+                options->input_file      = NULL;
             }
-            options->input_file = arg;
+            ((const char**)options->_allocation)[options->input_files_len++] = arg;
         }
     }
 
@@ -64,14 +64,57 @@ typedef struct {
     
 } MachineProgram;
 
+typedef enum {
+    IMPORT_PENDING, // parse task is queued or running
+    IMPORT_PARSED,  // ast is complete and won't change
+    IMPORT_FAILED,  // file couldn't be read or had syntax errors, error has been reported
+} ImportState;
+
+typedef struct WaitingTask WaitingTask;
+typedef WaitingTask* WaitingTaskP;
+typedef struct TaskQueue TaskQueue;
+DEF_ARRAY(WaitingTaskP)
+
+// Position where each line of an import's text starts, line N starts at starts[N-1].
+typedef struct {
+    int len;
+    int starts[];
+} LineTable;
+
 typedef struct {
     ImportID import_id;
     string path; // sometimes we don't have path, for small code created through metaprogramming for example.
     string text; // text may be empty, in this case the driver needs to look at path and read the file
+    bool   text_mapped; // text points to a read-only mapping of the file (fs__map_file) instead of the heap
     TokenStream* stream;
     AST* ast;
+    // Built the first time a line number is needed (errors), successful compiles never build it.
+    // Published with atomic_cas, threads racing to build it free their copy if they lose.
+    LineTable* volatile lines;
+
+    // Imports are kept between compilations and found by path (driver_find_or_create_import).
+    // The input of a compilation isn't, it's recycled when the compilation is destroyed.
+    bool shared;
+    u32  import_group; // shared imports are only used by compilations with the same import group
+    u32  failed_in;    // id of the compilation that reported the errors if state is IMPORT_FAILED
+    // File when the shared import was created, a compilation that finds the file changed parses it again.
+    u64  file_size;
+    u64  file_time;
+    u32  checked_in;   // id of the last compilation that compared the file, it uses this import from now on
+
+    // Modified with driver->import_mutex locked
+    volatile ImportState state;
+    Array_WaitingTaskP   waiting_tasks; // tasks that can't run until this import is parsed
+
+    // Where the queued parse task is, NULL if it isn't queued (see driver_boost_import).
+    // Modified with the queue's mutex locked.
+    TaskQueue* volatile parse_queue;
+    u32                 parse_queue_index;
 } Import;
 
+typedef Import* ImportP;
+DEF_ARRAY(ImportP)
+
 
 DEF_BUCKET_ARRAY(Import)
 
@@ -88,7 +131,10 @@ DEF_BUCKET_ARRAY(Import)
       - link object file into executable
 */
 typedef struct Compilation {
+    u32 id; // unique in the driver, compilation structs are reused
     const BasinCompileOptions* options;
+    Import* root_import;
+    string  output_file; // object file, empty if we don't write one
     // build options
     //    output paths
     //    import paths
@@ -107,12 +153,36 @@ typedef struct Compilation {
     IRSectionID sectionid_data;
 
     MachineProgram* machine_program;
+
+    // IR function id of the first function of each import, indexed by import id.
+    // Assigned the first time a function from the import is needed, see comp_function_id.
+    Array_int function_bases;
+    Mutex     function_bases_mutex;
+
+    // Executables only generate IR for functions reachable from main, or from every function
+    // of the input if it has no main. Functions that aren't reached aren't checked either,
+    // their errors aren't reported. Off with the all_functions option.
+    bool lazy_ir;
     
     Array_string import_dirs;
     Array_string library_dirs;
+    // Compilations with the same import directories resolve imports to the same
+    // files so they can share parsed imports. Index in driver->import_groups.
+    u32          import_group;
 
     volatile u32 pending_tasks;
     volatile u32 active_tasks;
+    // Tasks that are waiting, queued or running. Unlike pending_tasks + active_tasks
+    // it's changed with one atomic operation so exactly one thread sees it reach zero.
+    volatile int unfinished_tasks;
+    WaitingTask* volatile final_task; // queued when unfinished_tasks reaches zero (TASK_GEN_OBJECT)
+
+    volatile u32 error_count;
+    // Set when error_count reaches the max_errors option. Queued tasks of the
+    // compilation are dropped and running tasks stop at the next function.
+    volatile u32 cancelled;
+    Array_string errors; // returned in BasinResult.compile_errors, see comp_report_error
+    Mutex        errors_mutex;
 
     // Keeping driver here lets us pass around Compilation to functions
     // without also specifying the driver.
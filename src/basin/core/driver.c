@@ -3,6 +3,7 @@
 #include "basin/logger.h"
 #include "basin/frontend/lexer.h"
 #include "basin/frontend/parser.h"
+#include "basin/frontend/ast.h"
 #include "basin/backend/gen_ir.h"
 #include "basin/backend/ir.h"
 #include "basin/backend/codegen.h"
@@ -14,43 +15,641 @@
 #include "platform/platform.h"
 #include "util/assert.h"
 #include "util/file.h"
+#include "util/hash.h"
 
 
+// Driver thread running on the current thread, NULL if we aren't a driver thread.
+static THREAD_LOCAL DriverThread* current_driver_thread;
+
+#define IMPORT_PATH_MAX 1024
+
+// Imports are split in chunks of at least this size so idle threads can help lexing them
+#define LEX_CHUNK_MIN_SIZE (512 * 1024)
+#define LEX_MAX_CHUNKS     64
+
+// Function bodies of imports with this many tokens are parsed in batches by several threads
+#define PARSE_BATCH_MIN_TOKENS (32 * 1024)
+#define PARSE_MAX_BATCHES      64
+
+static void task_queue_init(TaskQueue* queue) {
+    memset(queue, 0, sizeof(*queue));
+    thread__create_mutex(&queue->mutex);
+}
+
+static void task_queue_cleanup(TaskQueue* queue) {
+    mem__free(queue->tasks);
+    thread__cleanup_mutex(&queue->mutex);
+    memset(queue, 0, sizeof(*queue));
+}
+
+static inline bool queued_task_before(const QueuedTask* a, const QueuedTask* b) {
+    if (a->task.priority != b->task.priority)
+        return a->task.priority > b->task.priority;
+    // Newest first among equals, it's data is more likely to be in the cache
+    return (i32)(a->sequence - b->sequence) > 0;
+}
+
+// Puts the item in a slot of the heap, parse tasks tell their import where they are.
+static inline void task_queue_place(TaskQueue* queue, u32 index, const QueuedTask* item) {
+    queue->tasks[index] = *item;
+    if (item->task.kind == TASK_LEX_AND_PARSE) {
+        Import* import = item->task.lex_and_parse.import;
+        import->parse_queue_index = index;
+        atomic_store(&import->parse_queue, queue);
+    }
+}
+
+static void task_queue_sift_up(TaskQueue* queue, u32 index) {
+    QueuedTask item = queue->tasks[index];
+    while (index > 0) {
+        u32 parent = (index - 1) / 2;
+        if (!queued_task_before(&item, &queue->tasks[parent]))
+            break;
+        task_queue_place(queue, index, &queue->tasks[parent]);
+        index = parent;
+    }
+    task_queue_place(queue, index, &item);
+}
+
+static void task_queue_sift_down(TaskQueue* queue, u32 index) {
+    QueuedTask item = queue->tasks[index];
+    while (true) {
+        u32 child = index * 2 + 1;
+        if (child >= queue->len)
+            break;
+        if (child + 1 < queue->len && queued_task_before(&queue->tasks[child + 1], &queue->tasks[child]))
+            child++;
+        if (!queued_task_before(&queue->tasks[child], &item))
+            break;
+        task_queue_place(queue, index, &queue->tasks[child]);
+        index = child;
+    }
+    task_queue_place(queue, index, &item);
+}
+
+static void task_queue_push(TaskQueue* queue, Task* tasks, int count) {
+    thread__lock_mutex(&queue->mutex);
+    if (queue->len + count > queue->cap) {
+        u32 new_cap = queue->cap * 2 + count + 64;
+        queue->tasks = mem__realloc(new_cap * sizeof(QueuedTask), queue->tasks);
+        ASSERT(queue->tasks);
+        queue->cap = new_cap;
+    }
+    for (int i=0;i<count;i++) {
+        QueuedTask* item = &queue->tasks[queue->len];
+        item->task     = tasks[i];
+        item->sequence = queue->next_sequence++;
+        queue->len++;
+        task_queue_sift_up(queue, queue->len - 1);
+    }
+    thread__unlock_mutex(&queue->mutex);
+}
+
+// Pops the task with the highest priority
+static bool task_queue_pop(TaskQueue* queue, Task* out_task) {
+    if (queue->len == 0)
+        return false; // cheap check without the lock, we check again after locking
+    bool found = false;
+    thread__lock_mutex(&queue->mutex);
+    if (queue->len > 0) {
+        *out_task = queue->tasks[0].task;
+        if (out_task->kind == TASK_LEX_AND_PARSE)
+            atomic_store(&out_task->lex_and_parse.import->parse_queue, NULL);
+        queue->len--;
+        if (queue->len > 0) {
+            queue->tasks[0] = queue->tasks[queue->len];
+            task_queue_sift_down(queue, 0);
+        }
+        found = true;
+    }
+    thread__unlock_mutex(&queue->mutex);
+    return found;
+}
+
+// Returns false if the import's parse task moved to another queue (or left) before we locked this one
+static bool task_queue_boost_import(TaskQueue* queue, Import* import) {
+    thread__lock_mutex(&queue->mutex);
+    bool found = import->parse_queue == queue;
+    if (found) {
+        Task* task = &queue->tasks[import->parse_queue_index].task;
+        ASSERT_DEBUG(task->kind == TASK_LEX_AND_PARSE && task->lex_and_parse.import == import);
+        if (!(task->priority & TASK_PRIORITY_BOOST)) {
+            task->priority |= TASK_PRIORITY_BOOST;
+            task_queue_sift_up(queue, import->parse_queue_index);
+        }
+    }
+    thread__unlock_mutex(&queue->mutex);
+    return found;
+}
+
+// Longest processing time first. Big tasks start early so they don't end up running
+// alone at the end while other threads idle. The estimate is the work (in bytes)
+// left on the way to the object file, parsing a file is followed by generating IR
+// and machine code for it.
+static u64 task_estimate_priority(const Task* task) {
+    switch(task->kind) {
+        case TASK_LEX_AND_PARSE: {
+            const Import* import = task->lex_and_parse.import;
+            u64 size = import->text.len;
+            if (!import->text.ptr) {
+                FSInfo info;
+                if (fs__path_info(import->path.ptr, &info))
+                    size = info.file_size;
+            }
+            return 1 + size * 3;
+        }
+        case TASK_LEX_CHUNK: {
+            const LexChunk* chunk = &task->lex_chunk.job->chunks[task->lex_chunk.chunk_index];
+            return 1 + (u64)(chunk->end - chunk->start) * 3;
+        }
+        case TASK_PARSE_BODIES: {
+            const BodyBatch* batch = &task->parse_bodies.job->batches[task->parse_bodies.batch_index];
+            return 1 + (u64)batch->text_len * 2;
+        }
+        case TASK_GEN_IR: {
+            u64 size = task->gen_ir.import->text.len;
+            // One function, guess its share of the import
+            if (task->gen_ir.function)
+                size /= task->gen_ir.import->ast->functions.len;
+            return 1 + size * 2;
+        }
+        case TASK_GEN_MACHINE: return 1 + task->gen_machine.ir_function->code_len;
+        default: break;
+    }
+    return 1;
+}
+
+// Returns true if the thread was parked and is now woken up.
+static bool driver_wake_thread(DriverThread* thread) {
+    if (thread->parked && atomic_cas(&thread->parked, 1, 0)) {
+        thread__signal_semaphore(&thread->park_semaphore, 1);
+        return true;
+    }
+    return false;
+}
+
+// Wakes up to 'count' parked threads.
+static void driver_wake_threads(Driver* driver, int count) {
+    for (int i=0;i<driver->threads_len && count > 0;i++) {
+        if (driver_wake_thread(&driver->threads[i]))
+            count--;
+    }
+}
+
+// Sleeps until another thread adds a task. Thread 0 (the caller of driver_run) also wakes
+// when the driver runs out of work or is paused with no running tasks, the other threads when the driver is stopping.
+static void driver_park_thread(Driver* driver, DriverThread* thread) {
+    atomic_store(&thread->parked, 1);
+    bool is_caller = thread == &driver->threads[0];
+    // A task may have been added after we looked through the queues but before we
+    // marked ourselves as parked. The adding thread wouldn't have seen us so we check again.
+    if ((driver->queued_tasks > 0 && !driver->paused) || driver->stopping
+        || (is_caller && (driver->unfinished_tasks == 0 || (driver->paused && driver->running_tasks == 0)))) {
+        if (atomic_cas(&thread->parked, 1, 0))
+            return;
+        // Another thread claimed us and will signal the semaphore, consume that signal below.
+    }
+    thread__wait_semaphore(&thread->park_semaphore);
+}
+
+// Takes one task from the budget of the current run. Pauses the driver if the budget is used up.
+static bool driver_take_budget(Driver* driver) {
+    if (driver->paused)
+        return false;
+    if (driver->run_deadline && time__now() >= driver->run_deadline) {
+        atomic_store(&driver->paused, 1);
+        return false;
+    }
+    if (atomic_add(&driver->processed_tasks, 1) >= driver->task_process_limit) {
+        atomic_store(&driver->paused, 1);
+        return false;
+    }
+    return true;
+}
+
+// Called when a thread is done picking or performing a task.
+static void driver_stop_running(Driver* driver) {
+    if (atomic_add(&driver->running_tasks, -1) == 1 && driver->paused) {
+        // driver_run waits for running tasks before returning
+        driver_wake_thread(&driver->threads[0]);
+    }
+}
+
+// Own queue first, then the injected queue, then steal from other threads.
+static bool driver_pick_task(Driver* driver, int id, Task* out_task, int* out_victim) {
+    *out_victim = id;
+    if (task_queue_pop(&driver->threads[id].queue, out_task))
+        return true;
+
+    *out_victim = -1;
+    if (task_queue_pop(&driver->injected_tasks, out_task))
+        return true;
+
+    for (int i=1;i<driver->threads_len;i++) {
+        int victim = (id + i) % driver->threads_len;
+        if (task_queue_pop(&driver->threads[victim].queue, out_task)) {
+            *out_victim = victim;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Writes output captured while performing a task or keeps it for later if output is ordered.
+static void driver_flush_task_output(Driver* driver, const Task* task) {
+    LogCapture capture = log__end_capture();
+    if (capture.text_len == 0 && capture.dump_len == 0)
+        return;
+    if (!driver->ordered_output) {
+        log__write_dump(capture.dump, capture.dump_len);
+        log__write(capture.text, capture.text_len);
+        return;
+    }
+
+    TaskOutput output = {};
+    output.kind     = task->kind;
+    output.compilation_id = task->compilation->id;
+    output.sequence = atomic_add(&driver->next_task_output, 1);
+    output.text     = mem__alloc(capture.text_len + capture.dump_len);
+    output.text_len = capture.text_len;
+    output.dump     = output.text + capture.text_len;
+    output.dump_len = capture.dump_len;
+    if (capture.text_len)
+        memcpy(output.text, capture.text, capture.text_len);
+    if (capture.dump_len)
+        memcpy(output.dump, capture.dump, capture.dump_len);
+    switch(task->kind) {
+        case TASK_LEX_AND_PARSE:
+        case TASK_PARSE_BODIES:
+            output.import = task->kind == TASK_LEX_AND_PARSE ? task->lex_and_parse.import : task->parse_bodies.import;
+            // Which compilation got to a shared import first varies between runs
+            if (output.import->shared)
+                output.compilation_id = 0;
+            break;
+        case TASK_GEN_IR:
+            output.import = task->gen_ir.import;
+            if (task->gen_ir.function)
+                output.function_id = comp_function_id(task->compilation, task->gen_ir.function);
+            break;
+        case TASK_GEN_MACHINE:
+            output.import      = task->gen_machine.import;
+            output.function_id = task->gen_machine.ir_function->id;
+            break;
+        default: break;
+    }
+
+    thread__lock_mutex(&driver->task_outputs_mutex);
+    array_push(&driver->task_outputs, &output);
+    thread__unlock_mutex(&driver->task_outputs_mutex);
+}
+
+static int compare_task_output(const void* a_ptr, const void* b_ptr) {
+    const TaskOutput* a = a_ptr;
+    const TaskOutput* b = b_ptr;
+    // Import ids depend on which thread got to an import first, paths don't.
+    if (a->import != b->import) {
+        if (!a->import) return 1;
+        if (!b->import) return -1;
+        int diff = strcmp(a->import->path.ptr, b->import->path.ptr);
+        if (diff)
+            return diff;
+    }
+    if (a->kind != b->kind)
+        return a->kind - b->kind;
+    // Compilations are created in the same order every run
+    if (a->compilation_id != b->compilation_id)
+        return a->compilation_id < b->compilation_id ? -1 : 1;
+    // Functions get ids in the order they appear in the import
+    if (a->function_id != b->function_id)
+        return a->function_id < b->function_id ? -1 : 1;
+    return a->sequence < b->sequence ? -1 : 1;
+}
+
+static void driver_print_ordered_output(Driver* driver) {
+    qsort(driver->task_outputs.ptr, driver->task_outputs.len, sizeof(TaskOutput), compare_task_output);
+    for (int i=0;i<driver->task_outputs.len;i++) {
+        TaskOutput* output = &driver->task_outputs.ptr[i];
+        log__write_dump(output->dump, output->dump_len);
+        log__write(output->text, output->text_len);
+        mem__free(output->text);
+    }
+    driver->task_outputs.len = 0;
+}
+
 Driver* driver_create() {
     TracyCZone(zone, 1);
     
     Driver* driver = HEAP_ALLOC_OBJECT(Driver);
-    barray_init(&driver->tasks, 100, 50);
+    // Tasks can be added before the first run, nothing is performed until then.
+    driver->paused = 1;
     barray_init(&driver->imports, 100, 50);
     barray_init(&driver->compilations, 10, 10);
 
     thread__create_mutex(&driver->compilations_mutex);
     thread__create_mutex(&driver->import_mutex);
-    thread__create_mutex(&driver->tasks_mutex);
-    thread__create_semaphore(&driver->may_have_task_semaphore, 0, 1000000);
+    interner_init(&driver->interner);
+    for (int i=0;i<IMPORT_TABLE_SHARDS;i++) {
+        thread__create_mutex(&driver->import_table[i].mutex);
+    }
+    task_queue_init(&driver->injected_tasks);
+    thread__create_mutex(&driver->task_outputs_mutex);
 
     TracyCZoneEnd(zone);
     return driver;
 }
 
+// Puts tasks that are already counted as unfinished in a queue.
+static void driver_queue_tasks(Driver* driver, Task* tasks, int count, int thread_number) {
+    TaskQueue* queue = &driver->injected_tasks;
+    if (thread_number == -1 && current_driver_thread && current_driver_thread->driver == driver) {
+        queue = &current_driver_thread->queue;
+        thread_number = current_driver_thread - driver->threads;
+    } else if (thread_number >= 0 && thread_number < driver->threads_len) {
+        queue = &driver->threads[thread_number].queue;
+    }
+
+    for (int i=0;i<count;i++) {
+        if (tasks[i].priority == 0)
+            tasks[i].priority = task_estimate_priority(&tasks[i]);
+    }
+
+    atomic_add(&driver->queued_tasks, count);
+
+    task_queue_push(queue, tasks, count);
+
+    driver_wake_threads(driver, count);
+
+    if(enabled_logging_driver) {
+        if (count == 1)
+            debug("[%d] Add task %s\n", thread_number, task_kind_names[tasks[0].kind]);
+        else
+            debug("[%d] Add %d tasks %s...\n", thread_number, count, task_kind_names[tasks[0].kind]);
+    }
+}
+
+static inline void driver_queue_task(Driver* driver, Task* task, int thread_number) {
+    driver_queue_tasks(driver, task, 1, thread_number);
+}
+
+// Counts a new task as unfinished in the compilation and driver.
+// Counters are incremented before the task is visible so that no thread
+// can finish it and see zero unfinished tasks before we are done here.
+static void driver_count_task(Driver* driver, Compilation* compilation) {
+    atomic_add(&compilation->unfinished_tasks, 1);
+    atomic_add(&compilation->pending_tasks, 1);
+    atomic_add(&driver->unfinished_tasks, 1);
+}
+
+// Called when a task has been performed or dropped.
+static void driver_finish_task(Driver* driver, Compilation* compilation) {
+    if (atomic_add(&compilation->unfinished_tasks, -1) == 1) {
+        // Nothing left in the compilation, the final task can run.
+        WaitingTask* final_task = compilation->final_task;
+        if (final_task && atomic_cas(&compilation->final_task, final_task, NULL)) {
+            // Driver already counts the final task as unfinished
+            atomic_add(&compilation->unfinished_tasks, 1);
+            atomic_add(&compilation->pending_tasks, 1);
+            driver_queue_task(driver, &final_task->task, final_task->thread_number);
+            mem__free(final_task);
+        }
+    }
+
+    if (atomic_add(&driver->unfinished_tasks, -1) == 1 && driver->threads_len > 0) {
+        // Last task is done, driver_run can return. The other threads stay parked.
+        driver_wake_thread(&driver->threads[0]);
+    }
+}
+
+// Queues the waiting task if every import reachable from its root is parsed.
+// Otherwise it's registered on the imports that aren't and we try again when they are.
+static void driver_try_release_task(Driver* driver, WaitingTask* waiting) {
+    TracyCZone(zone, 1);
+
+    // Read before the task is registered on imports, the thread that releases it frees it
+    Compilation* compilation = waiting->task.compilation;
+
+    Array_ImportP stack = {};
+    Array_ImportP pending = {};
+    Array_ImportP reached = {}; // only filled if the task is per import
+    Import* failed_import = NULL;
+
+    thread__lock_mutex(&driver->import_mutex);
+
+    // Imports can't be created while we hold the mutex so the id range is fixed.
+    u8* visited = mem__alloc(driver->next_import_id);
+    memset(visited, 0, driver->next_import_id);
+
+    array_push(&stack, &waiting->root);
+    visited[waiting->root->import_id] = true;
+    while (stack.len > 0 && !failed_import) {
+        Import* import = array_last(&stack);
+        array_pop(&stack);
+        if (waiting->per_import)
+            array_push(&reached, &import);
+        if (import->state == IMPORT_FAILED) {
+            failed_import = import;
+        } else if (import->state == IMPORT_PENDING) {
+            // We don't know what it imports yet, we look again once it's parsed.
+            array_push(&pending, &import);
+        } else {
+            Array_ImportP* imports = &import->ast->imports;
+            for (int i=0;i<imports->len;i++) {
+                Import* next = imports->ptr[i];
+                if (!visited[next->import_id]) {
+                    visited[next->import_id] = true;
+                    array_push(&stack, &next);
+                }
+            }
+        }
+    }
+
+    int missing = 0;
+    if (!failed_import) {
+        missing = pending.len;
+        // Set before anyone can see the task, imports can't finish while we hold the mutex.
+        waiting->missing = missing;
+        for (int i=0;i<pending.len;i++) {
+            array_push(&pending.ptr[i]->waiting_tasks, &waiting);
+        }
+    }
+
+    thread__unlock_mutex(&driver->import_mutex);
+
+    mem__free(visited);
+    array_cleanup(&stack);
+
+    if (missing > 0) {
+        // Imports we wait for are on the critical path, parse them before other work.
+        for (int i=0;i<pending.len;i++) {
+            driver_boost_import(driver, pending.ptr[i]);
+        }
+    }
+    array_cleanup(&pending);
+
+    if (failed_import) {
+        // The failing import reported its errors, the task would only produce more noise.
+        // Unless the import failed in an earlier compilation, then this one hasn't heard about it.
+        if (failed_import->failed_in != compilation->id) {
+            char message[IMPORT_PATH_MAX + 64];
+            snprintf(message, sizeof(message), "\033[31mERROR:\033[0m Import '%s' has errors\n", failed_import->path.ptr);
+            comp_report_error(compilation, message);
+        }
+        if(enabled_logging_driver) {
+            debug("[-] Drop task %s, import failed\n", task_kind_names[waiting->task.kind]);
+        }
+        atomic_add(&compilation->pending_tasks, -1);
+        driver_finish_task(driver, compilation);
+        mem__free(waiting);
+    } else if (missing == 0 && waiting->per_import) {
+        Array_Task tasks = {};
+        for (int i=0;i<reached.len;i++) {
+            Task task = waiting->task;
+            task.gen_ir.import = reached.ptr[i];
+            array_push(&tasks, &task);
+        }
+        driver_add_tasks(driver, tasks.ptr, tasks.len, waiting->thread_number);
+        array_cleanup(&tasks);
+
+        // The copies replace the waiting task. They are counted so the compilation can't finish here.
+        atomic_add(&compilation->pending_tasks, -1);
+        driver_finish_task(driver, compilation);
+        mem__free(waiting);
+    } else if (missing == 0) {
+        driver_queue_task(driver, &waiting->task, waiting->thread_number);
+        mem__free(waiting);
+    }
+    // else: another thread owns 'waiting' now, don't touch it
+    array_cleanup(&reached);
+
+    TracyCZoneEnd(zone);
+}
+
+// Marks the import as parsed or failed and releases tasks waiting for it.
+static void driver_finish_import(Driver* driver, Import* import, ImportState state) {
+    thread__lock_mutex(&driver->import_mutex);
+    import->state = state;
+    Array_WaitingTaskP waiting_tasks = import->waiting_tasks;
+    memset(&import->waiting_tasks, 0, sizeof(import->waiting_tasks));
+    thread__unlock_mutex(&driver->import_mutex);
+
+    for (int i=0;i<waiting_tasks.len;i++) {
+        WaitingTask* waiting = waiting_tasks.ptr[i];
+        if (atomic_add(&waiting->missing, -1) == 1) {
+            driver_try_release_task(driver, waiting);
+        }
+    }
+    array_cleanup(&waiting_tasks);
+}
+
+void driver_boost_import(Driver* driver, Import* import) {
+    TracyCZone(zone, 1);
+    // The task may be running or not queued yet, then there is nothing to boost.
+    // Queues are only locked one at a time so the task can't move while we look, try again if it did.
+    while (true) {
+        TaskQueue* queue = import->parse_queue;
+        if (!queue || task_queue_boost_import(queue, import))
+            break;
+    }
+    TracyCZoneEnd(zone);
+}
+
 void driver_add_task_with_thread_id(Driver* driver, Task* task, int thread_number) {
     TracyCZone(zone, 1);
 
     ASSERT_DEBUG(task->compilation);
 
-    thread__lock_mutex(&driver->tasks_mutex);
-    
-    barray_push(&driver->tasks, task);
+    driver_count_task(driver, task->compilation);
+    driver_queue_task(driver, task, thread_number);
+
+    TracyCZoneEnd(zone);
+}
 
-    // we try to signal in case threads are waiting
-    // if there already is a thread getting semaphore then that's fine.
-    thread__signal_semaphore(&driver->may_have_task_semaphore, 1);
+void driver_add_tasks(Driver* driver, Task* tasks, int count, int thread_number) {
+    TracyCZone(zone, 1);
 
-    thread__unlock_mutex(&driver->tasks_mutex);
+    if (count <= 0) {
+        TracyCZoneEnd(zone);
+        return;
+    }
 
-    if(enabled_logging_driver) {
-        debug("[%d] Add task %s\n", thread_number, task_kind_names[task->kind]);
+    // Tasks almost always belong to the same compilation, count them together.
+    int start = 0;
+    for (int i=1;i<=count;i++) {
+        if (i == count || tasks[i].compilation != tasks[start].compilation) {
+            Compilation* compilation = tasks[start].compilation;
+            ASSERT_DEBUG(compilation);
+            atomic_add(&compilation->unfinished_tasks, i - start);
+            atomic_add(&compilation->pending_tasks, i - start);
+            start = i;
+        }
+    }
+    atomic_add(&driver->unfinished_tasks, count);
+
+    driver_queue_tasks(driver, tasks, count, thread_number);
+
+    TracyCZoneEnd(zone);
+}
+
+static void driver_add_waiting_task(Driver* driver, Task* task, Import* import, bool per_import) {
+    ASSERT_DEBUG(task->compilation);
+
+    driver_count_task(driver, task->compilation);
+
+    WaitingTask* waiting = HEAP_ALLOC_OBJECT(WaitingTask);
+    waiting->task = *task;
+    waiting->thread_number = -1;
+    waiting->root = import;
+    waiting->per_import = per_import;
+
+    driver_try_release_task(driver, waiting);
+}
+
+void driver_add_task_after_parse(Driver* driver, Task* task, Import* import) {
+    TracyCZone(zone, 1);
+    driver_add_waiting_task(driver, task, import, false);
+    TracyCZoneEnd(zone);
+}
+
+void driver_add_gen_ir_tasks(Driver* driver, Compilation* compilation, Import* root) {
+    TracyCZone(zone, 1);
+
+    Task task = {};
+    task.kind = TASK_GEN_IR;
+    task.compilation = compilation;
+    task.gen_ir.import = root;
+    // With lazy IR the root's task generates main and queues the functions it reaches
+    driver_add_waiting_task(driver, &task, root, !compilation->lazy_ir);
+
+    TracyCZoneEnd(zone);
+}
+
+void driver_add_final_task(Driver* driver, Task* task) {
+    TracyCZone(zone, 1);
+
+    Compilation* compilation = task->compilation;
+    ASSERT_DEBUG(compilation);
+
+    WaitingTask* waiting = HEAP_ALLOC_OBJECT(WaitingTask);
+    waiting->task = *task;
+    waiting->thread_number = -1;
+
+    // Counted by the driver so threads don't stop while it waits.
+    // The compilation counts it once it's queued.
+    atomic_add(&driver->unfinished_tasks, 1);
+
+    bool yes = atomic_cas(&compilation->final_task, NULL, waiting);
+    ASSERT(yes); // only one final task per compilation
+
+    if (compilation->unfinished_tasks == 0) {
+        // Compilation has no tasks (or they finished already), nobody else will queue it.
+        if (atomic_cas(&compilation->final_task, waiting, NULL)) {
+            atomic_add(&compilation->unfinished_tasks, 1);
+            atomic_add(&compilation->pending_tasks, 1);
+            driver_queue_task(driver, &waiting->task, waiting->thread_number);
+            mem__free(waiting);
+        }
     }
+
     TracyCZoneEnd(zone);
 }
 
@@ -60,12 +659,26 @@ Compilation* driver_create_compilation(Driver* driver, const BasinCompileOptions
     thread__lock_mutex(&driver->compilations_mutex);
 
     Compilation _empty_comp = {};
-    Compilation* comp = barray_push(&driver->compilations, &_empty_comp);
+    Compilation* comp;
+    if (driver->free_compilations.len > 0) {
+        comp = array_last(&driver->free_compilations);
+        array_pop(&driver->free_compilations);
+        *comp = _empty_comp;
+    } else {
+        comp = barray_push(&driver->compilations, &_empty_comp);
+    }
+    // Ids start at 1 so that zero means no compilation
+    comp->id = ++driver->next_compilation_id;
 
     thread__unlock_mutex(&driver->compilations_mutex);
 
     comp->driver  = driver;
     comp->options = options;
+    // Only an executable knows every caller, objects and libraries export every function
+    comp->lazy_ir = !options->all_functions
+                 && options->binary_output_type == BASIN_BINARY_executable;
+    thread__create_mutex(&comp->function_bases_mutex);
+    thread__create_mutex(&comp->errors_mutex);
 
     for (int i=0;i<options->import_dirs_len;i++) {
         string s = string_clone_cptr(options->import_dirs[i]);
@@ -110,6 +723,32 @@ Compilation* driver_create_compilation(Driver* driver, const BasinCompileOptions
 
     string_cleanup(&exe_path);
 
+    {
+        string key = {};
+        for (int i=0;i<comp->import_dirs.len;i++) {
+            string_append_cstr(&key, cstr(comp->import_dirs.ptr[i]));
+            string_append_char(&key, '\n');
+        }
+
+        thread__lock_mutex(&driver->compilations_mutex);
+        int group = -1;
+        for (int i=0;i<driver->import_groups.len;i++) {
+            if (string_equal(cstr(driver->import_groups.ptr[i]), cstr(key))) {
+                group = i;
+                break;
+            }
+        }
+        if (group == -1) {
+            group = driver->import_groups.len;
+            array_push(&driver->import_groups, &key);
+        } else {
+            string_cleanup(&key);
+        }
+        thread__unlock_mutex(&driver->compilations_mutex);
+
+        comp->import_group = group;
+    }
+
     // Made where and when?
     comp->program = HEAP_ALLOC_OBJECT(IRProgram);
     atomic_array_init(&comp->program->functions, 1000, 1000);
@@ -147,66 +786,444 @@ Compilation* driver_create_compilation(Driver* driver, const BasinCompileOptions
     return comp;
 }
 
+// Frees the import's text, tokens and AST. The AST is an arena so this doesn't depend on its size.
+static void driver_free_import(Import* import) {
+    if (import->ast)
+        ast_cleanup(import->ast);
+    else if (import->stream)
+        token_stream_cleanup(import->stream);
+    string_cleanup(&import->path);
+    if (import->text_mapped)
+        fs__unmap_file(import->text.ptr, import->text.len);
+    else
+        string_cleanup(&import->text);
+    if (import->lines)
+        mem__free(import->lines);
+    array_cleanup(&import->waiting_tasks);
+}
+
+// Frees what the import got from its compilation and lets driver_create_import_id reuse it.
+static void driver_recycle_import(Driver* driver, Import* import) {
+    ASSERT(!import->shared);
+    ASSERT(import->waiting_tasks.len == 0);
+
+    driver_free_import(import);
+
+    ImportID import_id = import->import_id;
+    memset(import, 0, sizeof(*import));
+    import->import_id = import_id;
+
+    thread__lock_mutex(&driver->import_mutex);
+    array_push(&driver->free_imports, &import);
+    thread__unlock_mutex(&driver->import_mutex);
+}
+
+void driver_destroy_compilation(Driver* driver, Compilation* comp) {
+    TracyCZone(zone, 1);
+
+    ASSERT(comp->unfinished_tasks == 0);
+
+    IRProgram* program = comp->program;
+    for (int i=0;i<atomic_array_size(&program->functions);i++) {
+        IRFunction* func = atomic_array_getptr(&program->functions, i);
+        string_cleanup(&func->name);
+        mem__free(func->code);
+    }
+    for (int i=0;i<atomic_array_size(&program->sections);i++) {
+        IRSection* section = atomic_array_getptr(&program->sections, i);
+        string_cleanup(&section->name);
+        mem__free(section->data);
+    }
+    for (int i=0;i<atomic_array_size(&program->variables);i++) {
+        IRDataObject* object = atomic_array_getptr(&program->variables, i);
+        string_cleanup(&object->name);
+    }
+    atomic_array_cleanup(&program->functions);
+    atomic_array_cleanup(&program->sections);
+    atomic_array_cleanup(&program->variables);
+    mem__free(program);
+
+    MachineProgram* machine_program = comp->machine_program;
+    for (int i=0;i<atomic_array_size(&machine_program->functions);i++) {
+        MachineFunction* func = atomic_array_getptr(&machine_program->functions, i);
+        mem__free(func->code);
+        array_cleanup(&func->relocations);
+    }
+    atomic_array_cleanup(&machine_program->functions);
+    mem__free(machine_program);
+
+    for (int i=0;i<comp->import_dirs.len;i++)
+        string_cleanup(&comp->import_dirs.ptr[i]);
+    array_cleanup(&comp->import_dirs);
+    for (int i=0;i<comp->library_dirs.len;i++)
+        string_cleanup(&comp->library_dirs.ptr[i]);
+    array_cleanup(&comp->library_dirs);
+
+    array_cleanup(&comp->function_bases);
+    thread__cleanup_mutex(&comp->function_bases_mutex);
+
+    string_cleanup(&comp->output_file);
+
+    for (int i=0;i<comp->errors.len;i++)
+        string_cleanup(&comp->errors.ptr[i]);
+    array_cleanup(&comp->errors);
+    thread__cleanup_mutex(&comp->errors_mutex);
+
+    if (comp->root_import)
+        driver_recycle_import(driver, comp->root_import);
+
+    memset(comp, 0, sizeof(*comp));
+
+    thread__lock_mutex(&driver->compilations_mutex);
+    array_push(&driver->free_compilations, &comp);
+    thread__unlock_mutex(&driver->compilations_mutex);
+
+    TracyCZoneEnd(zone);
+}
+
+void comp_report_error(Compilation* compilation, const char* message) {
+    string error = string_clone_cptr(message);
+    thread__lock_mutex(&compilation->errors_mutex);
+    array_push(&compilation->errors, &error);
+    thread__unlock_mutex(&compilation->errors_mutex);
+
+    if (atomic_add(&compilation->error_count, 1) + 1 >= comp_max_errors(compilation) && !compilation->cancelled) {
+        atomic_store(&compilation->cancelled, 1);
+        if(enabled_logging_driver) {
+            debug("[-] Cancel compilation %u\n", compilation->id);
+        }
+    }
+}
+
+u32 comp_max_errors(Compilation* compilation) {
+    return compilation->options->max_errors > 0 ? compilation->options->max_errors : 1;
+}
+
+IRFunction_id comp_function_id(Compilation* compilation, const ASTFunction* function) {
+    ImportID import_id = function->location.import_id;
+
+    thread__lock_mutex(&compilation->function_bases_mutex);
+
+    while (compilation->function_bases.len <= import_id) {
+        int none = -1;
+        array_push(&compilation->function_bases, &none);
+    }
+
+    int base = compilation->function_bases.ptr[import_id];
+    if (base == -1) {
+        // First function we need from the import. Every function in it gets an id now
+        // so they are contiguous and in source order. Nobody else pushes IR functions.
+        Import* import = driver_get_import(compilation->driver, import_id);
+        ASSERT(import->ast);
+
+        AtomicArray_IRFunction* functions = &compilation->program->functions;
+        base = atomic_array_size(functions);
+        for (int i=0;i<import->ast->functions.len;i++) {
+            ASTFunction* ast_func = import->ast->functions.ptr[i];
+            IRFunction empty_func = {};
+            IRFunction_id id = atomic_array_push(functions, &empty_func);
+            IRFunction* ir_func = atomic_array_getptr(functions, id);
+            ir_func->id   = id;
+            ir_func->name = string_clone_cstr(interner_get(&compilation->driver->interner, ast_func->name));
+        }
+        compilation->function_bases.ptr[import_id] = base;
+    }
+
+    thread__unlock_mutex(&compilation->function_bases_mutex);
+
+    return base + function->function_index;
+}
+
+bool comp_reach_function(Compilation* compilation, const ASTFunction* function) {
+    IRFunction_id id = comp_function_id(compilation, function);
+    IRFunction* ir_func = atomic_array_getptr(&compilation->program->functions, id);
+    return !ir_func->reached && atomic_cas(&ir_func->reached, 0, 1);
+}
+
 u32 driver_thread_run(DriverThread* thread_driver);
 
-void driver_run(Driver* driver, u32 thread_count, u32 task_process_limit) {
+// Adds a TASK_LEX_CHUNK for each chunk of a big import. Returns false if the import
+// is too small to split, the caller lexes it in one piece.
+static bool driver_add_lex_chunk_tasks(Driver* driver, const Task* task) {
+    Import* import = task->lex_and_parse.import;
+
+    int max_chunks = import->text.len / LEX_CHUNK_MIN_SIZE;
+    if (max_chunks > (int)driver->threads_len)
+        max_chunks = driver->threads_len;
+    if (max_chunks > LEX_MAX_CHUNKS)
+        max_chunks = LEX_MAX_CHUNKS;
+    if (max_chunks < 2)
+        return false;
+
     TracyCZone(zone, 1);
 
-    // the meat and potatoes of the compiler, the game loop if you will
-    
-    driver->idle_threads = 0;
-    if (task_process_limit == 0)
-        driver->task_process_limit = 0xFFFFFFFF;
+    ChunkedLex* job = HEAP_ALLOC_OBJECT(ChunkedLex);
+    job->chunks     = mem__alloc(max_chunks * sizeof(LexChunk));
+    job->chunks_len = split_lex_chunks(import, max_chunks, job->chunks);
+    if (job->chunks_len < 2) {
+        // Long lines or one big comment
+        mem__free(job->chunks);
+        mem__free(job);
+        TracyCZoneEnd(zone);
+        return false;
+    }
+    job->chunks_left = job->chunks_len;
+
+    Task tasks[LEX_MAX_CHUNKS];
+    for (int i=0;i<job->chunks_len;i++) {
+        memset(&tasks[i], 0, sizeof(Task));
+        tasks[i].kind                  = TASK_LEX_CHUNK;
+        tasks[i].compilation           = task->compilation;
+        tasks[i].lex_chunk.import      = import;
+        tasks[i].lex_chunk.job         = job;
+        tasks[i].lex_chunk.chunk_index = i;
+    }
+    driver_add_tasks(driver, tasks, job->chunks_len, -1);
+
+    TracyCZoneEnd(zone);
+    return true;
+}
+
+// Adds a TASK_PARSE_BODIES for each batch of the bodies the parser skipped. Returns false if
+// there are too few tokens in the bodies to split, the caller parses them in one piece.
+static bool driver_add_parse_body_tasks(Driver* driver, Compilation* compilation, Import* import, AST* ast) {
+    int tokens = 0;
+    for (int i=0;i<ast->skipped_bodies.len;i++)
+        tokens += ast->skipped_bodies.ptr[i].tokens;
+
+    int max_batches = tokens / PARSE_BATCH_MIN_TOKENS;
+    if (max_batches > (int)driver->threads_len)
+        max_batches = driver->threads_len;
+    if (max_batches > PARSE_MAX_BATCHES)
+        max_batches = PARSE_MAX_BATCHES;
+    if (max_batches < 2)
+        return false;
+
+    TracyCZone(zone, 1);
 
+    BatchedBodies* job = HEAP_ALLOC_OBJECT(BatchedBodies);
+    job->ast         = ast;
+    job->batches     = mem__alloc(max_batches * sizeof(BodyBatch));
+    job->batches_len = split_body_batches(ast, max_batches, job->batches);
+    if (job->batches_len < 2) {
+        // One body with most of the tokens
+        mem__free(job->batches);
+        mem__free(job);
+        TracyCZoneEnd(zone);
+        return false;
+    }
+    job->batches_left = job->batches_len;
+
+    Task tasks[PARSE_MAX_BATCHES];
+    for (int i=0;i<job->batches_len;i++) {
+        memset(&tasks[i], 0, sizeof(Task));
+        tasks[i].kind                     = TASK_PARSE_BODIES;
+        tasks[i].compilation              = compilation;
+        tasks[i].parse_bodies.import      = import;
+        tasks[i].parse_bodies.job         = job;
+        tasks[i].parse_bodies.batch_index = i;
+    }
+    driver_add_tasks(driver, tasks, job->batches_len, -1);
+
+    TracyCZoneEnd(zone);
+    return true;
+}
+
+// Reports the lex error and fails the import, the parser reports its own errors.
+static void driver_fail_parse(Driver* driver, Compilation* compilation, Import* import, Result* result) {
+    // We are done with this series of tasks
+    if (result->message.ptr)
+        comp_report_error(compilation, result->message.ptr);
+    string_cleanup(&result->message);
+    import->failed_in = compilation->id;
+    driver_finish_import(driver, import, IMPORT_FAILED);
+}
+
+// The AST is complete, bodies included
+static void driver_finish_parse(Driver* driver, Import* import, AST* ast) {
+    import->ast = ast;
+
+    if (should_debug_print()) {
+        print_ast(ast);
+    }
+    // fprintf(stderr, "Parse success\n");
+
+    // IR is generated per compilation, see driver_add_gen_ir_tasks.
+    // The import may be reused by other compilations from here on.
+    driver_finish_import(driver, import, IMPORT_PARSED);
+}
+
+// Parses the tokens of an import and finishes it. The import fails if lexing or parsing reported errors.
+static void driver_parse_import(Driver* driver, Compilation* compilation, Import* import, Result lex_result, TokenStream* stream) {
+    Result result = lex_result;
+    AST* ast = NULL;
+    if(result.kind == SUCCESS && compilation->options->dump_tokens && !stream->streaming) {
+        print_token_stream(stream);
+    }
+    if(result.kind == SUCCESS) {
+        // Other threads can help with the function bodies of a big import, a streamed import has no tokens to skip ahead to
+        bool skip_bodies = !stream->streaming && driver->threads_len > 1 && stream->tokens_len >= 2 * PARSE_BATCH_MIN_TOKENS;
+        result = parse_stream(compilation, stream, skip_bodies, &ast);
+    }
+    if(result.kind != SUCCESS) {
+        driver_fail_parse(driver, compilation, import, &result);
+        return;
+    }
+
+    if (ast->skipped_bodies.len > 0) {
+        if (driver_add_parse_body_tasks(driver, compilation, import, ast)) {
+            // Finished by the last batch task
+            return;
+        }
+        BodyBatch batch;
+        split_body_batches(ast, 1, &batch);
+        result = parse_body_batch(compilation, ast, &batch);
+        if(result.kind != SUCCESS) {
+            report_parse_errors(compilation, &batch.errors);
+            ast_cleanup(ast);
+            driver_fail_parse(driver, compilation, import, &result);
+            return;
+        }
+        join_body_batches(ast, &batch, 1);
+    }
+    driver_finish_parse(driver, import, ast);
+}
+
+// Returns true if the task of a cancelled compilation can be skipped.
+static bool driver_drop_cancelled_task(Driver* driver, const Task* task) {
+    switch(task->kind) {
+        case TASK_LEX_AND_PARSE: {
+            // Shared imports are parsed anyway, other compilations may be waiting for them.
+            Import* import = task->lex_and_parse.import;
+            if (import->shared)
+                return false;
+            // Tasks waiting for the import are dropped, the compilation already reported its errors.
+            import->failed_in = task->compilation->id;
+            driver_finish_import(driver, import, IMPORT_FAILED);
+            return true;
+        }
+        case TASK_LEX_CHUNK:
+        case TASK_PARSE_BODIES:
+            // The last chunk or batch finishes the import, the others skip their work instead
+            return false;
+        case TASK_GEN_OBJECT:
+            // Cheap, reports that the object file is skipped
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void driver_start_threads(Driver* driver, u32 thread_count) {
     // Starting threads is slow (15 threads roughly ~10ms depending on computer).
     // But doing work in parallel is very beneficial so this static cost is fine.
+    // It's paid once, the threads are kept until driver_cleanup.
     if (thread_count == 0) {
         thread_count = sys__cpu_count();
     }
 
-    // @TODO Temporary Buggy printing without this
-    thread_count = 1;
-    
-    if (thread_count > driver->threads_cap) {
-        int new_max = thread_count;
-        driver->threads = mem__allocate(new_max * sizeof(DriverThread), driver->threads);
-        driver->threads_cap = new_max;
+    driver->threads = mem__alloc(thread_count * sizeof(DriverThread));
+    driver->threads_cap = thread_count;
+    memset(driver->threads, 0, driver->threads_cap * sizeof(DriverThread));
+
+    // Queues must exist before any thread starts stealing
+    for (int i = 0; i<thread_count; i++) {
+        driver->threads[i].driver = driver;
+        task_queue_init(&driver->threads[i].queue);
+        thread__create_semaphore(&driver->threads[i].park_semaphore, 0, 1);
     }
     driver->threads_len = thread_count;
-    
-    memset(driver->threads, 0, driver->threads_cap * sizeof(DriverThread));
 
+    // threads[0] is not spawned, it's the thread calling driver_run
     for (int i = 1; i<driver->threads_len; i++) {
-        driver->threads[i].driver = driver;
         thread__spawn(&driver->threads[i].thread, (u32(*)(void*))driver_thread_run, &driver->threads[i]);
     }
+}
+
+bool driver_run(Driver* driver, u32 thread_count, u32 task_process_limit, u64 time_limit_us) {
+    TracyCZone(zone, 1);
+
+    // the meat and potatoes of the compiler, the game loop if you will
     
-    driver->threads[0].driver = driver;
+    driver->task_process_limit = task_process_limit == 0 ? 0xFFFFFFFF : task_process_limit;
+    driver->processed_tasks    = 0;
+    driver->run_deadline       = time_limit_us == 0 ? 0 : time__now() + time_limit_us * 1000;
+
+    if (driver->threads_len == 0) {
+        driver_start_threads(driver, thread_count);
+    }
+
+    atomic_store(&driver->paused, 0);
+    driver_wake_threads(driver, driver->queued_tasks);
+
+    // Returns when every task is done or the budget is used up.
     driver_thread_run(&driver->threads[0]);
 
-    for (int i = 1; i < driver->threads_len; i++) {
-        thread__join(&driver->threads[i].thread);
+    // Other threads may still be performing a task. They don't pick new ones
+    // once we're paused and thread 0 is woken when the last one is done.
+    atomic_store(&driver->paused, 1);
+    while (driver->running_tasks > 0) {
+        driver_park_thread(driver, &driver->threads[0]);
+    }
+
+    bool finished = driver->unfinished_tasks == 0;
+
+    if (finished && driver->ordered_output) {
+        driver_print_ordered_output(driver);
     }
     
     if(enabled_logging_driver) {
-        debug("Threads finished\n");
+        if (finished)
+            debug("Tasks finished\n");
+        else
+            debug("Tasks paused, %d left\n", driver->unfinished_tasks);
     }
     TracyCZoneEnd(zone);
+    return finished;
 }
 
 void driver_cleanup(Driver* driver) {
     TracyCZone(zone, 1);
 
-    // @TODO We need to cleanup allocations in imports
+    if (driver->threads_len > 0) {
+        ASSERT(driver->unfinished_tasks == 0);
+        atomic_store(&driver->stopping, 1);
+        driver_wake_threads(driver, driver->threads_len);
+
+        for (int i = 1; i < driver->threads_len; i++) {
+            thread__join(&driver->threads[i].thread);
+        }
+
+        for (int i = 0; i<driver->threads_len; i++) {
+            task_queue_cleanup(&driver->threads[i].queue);
+            thread__cleanup_semaphore(&driver->threads[i].park_semaphore);
+        }
+        driver->threads_len = 0;
+    }
+
+    // Recycled imports are zeroed, the rest are shared imports
+    for (int i=0;i<barray_count(&driver->imports);i++)
+        driver_free_import(barray_get(&driver->imports, i));
 
     barray_cleanup(&driver->imports);
+    array_cleanup(&driver->free_imports);
     thread__cleanup_mutex(&driver->import_mutex);
+    interner_cleanup(&driver->interner);
+    for (int i=0;i<IMPORT_TABLE_SHARDS;i++) {
+        mem__free(driver->import_table[i].entries);
+        thread__cleanup_mutex(&driver->import_table[i].mutex);
+    }
+
+    task_queue_cleanup(&driver->injected_tasks);
 
-    barray_cleanup(&driver->tasks);
-    thread__cleanup_mutex(&driver->tasks_mutex);
-    thread__cleanup_semaphore(&driver->may_have_task_semaphore);
+    array_cleanup(&driver->task_outputs);
+    thread__cleanup_mutex(&driver->task_outputs_mutex);
     
     barray_cleanup(&driver->compilations);
+    array_cleanup(&driver->free_compilations);
+    for (int i=0;i<driver->import_groups.len;i++)
+        string_cleanup(&driver->import_groups.ptr[i]);
+    array_cleanup(&driver->import_groups);
     thread__cleanup_mutex(&driver->compilations_mutex);
     
     
@@ -224,130 +1241,175 @@ u32 driver_thread_run(DriverThread* thread_driver) {
 
     int id = ((u64)thread_driver - (u64)driver->threads) / sizeof(*thread_driver);
 
+    current_driver_thread = thread_driver;
+
     if(enabled_logging_driver) {
         debug("[%d] Started\n", id);
     }
 
     while(true) {
-        // NOTE: We only modify and check idle_threads here in the beginning of the loop.
-
-        int prev_value = atomic_add(&driver->idle_threads, 1);
-        if(prev_value + 1 == driver->threads_len) {
-            // It seems like every thread is idling BUT WE CAN'T NOW FOR SURE because in theory (very unlikely)
-            // a thread may be stuck between wait_semapore and atomic_add(idle_threads).
-            // So we signal the semaphore to make sure.
-            thread__signal_semaphore(&driver->may_have_task_semaphore, 1);
-        }
-
-        if(enabled_logging_driver) {
-            debug("[%d] waiting\n", id);
+        Task task = {};
+        int victim;
+        // Counted before the budget is checked so that driver_run, which pauses the
+        // driver and then waits for zero running tasks, can't miss a task being picked.
+        atomic_add(&driver->running_tasks, 1);
+        bool picked = driver_take_budget(driver);
+        if (picked) {
+            picked = driver_pick_task(driver, id, &task, &victim);
+            if (!picked)
+                atomic_add(&driver->processed_tasks, -1);
         }
-
-        thread__wait_semaphore(&driver->may_have_task_semaphore);
-
-        thread__lock_mutex(&driver->tasks_mutex);
-        int prev_idling_threads = atomic_add(&driver->idle_threads, -1);
-
-        // @TODO Handle task_process_limit
-
-        if(barray_count(&driver->tasks) == 0) {
-            // TODO: If we read idle_threads here,
-            if (prev_idling_threads == driver->threads_len) {
-                atomic_add(&driver->idle_threads, 1);
-                thread__unlock_mutex(&driver->tasks_mutex);
-                thread__signal_semaphore(&driver->may_have_task_semaphore, 1);
+        if (!picked) {
+            driver_stop_running(driver);
+            if (id == 0 && (driver->unfinished_tasks == 0 || driver->paused)) {
+                // Nothing queued, nothing running, nothing can be added. Or the budget is used up.
                 break;
             }
-
-            thread__unlock_mutex(&driver->tasks_mutex);
+            if (id != 0 && driver->stopping) {
+                break;
+            }
+            if(enabled_logging_driver) {
+                debug("[%d] waiting\n", id);
+            }
+            driver_park_thread(driver, thread_driver);
             continue;
         }
 
-        // We pop last task.
-        //   We may  need to pick a task where dependencies are fulfilled.
-        //   perhaps we won't add the task until dependencies are completed.
-        //   dependencies would be parsing after tokenizing.
-        //   compile time exec after function declaration checking
-
-        // Check fulfilled tasks, if none.
+        int tasks_left = atomic_add(&driver->queued_tasks, -1) - 1;
 
-        // Calculate dependencies for a task and run it.
-
-        Task task = {};
-        barray_pop(&driver->tasks, &task);
-        int tasks_left = barray_count(&driver->tasks);
+        // Everything the task prints is written at once when it's done
+        log__begin_capture();
 
         atomic_add(&task.compilation->active_tasks, 1);
         atomic_add(&task.compilation->pending_tasks, -1);
 
-        thread__unlock_mutex(&driver->tasks_mutex);
-
-
         if(enabled_logging_driver) {
-            debug("[%d] pick %s (%d left)\n", id, task_kind_names[task.kind], tasks_left);
+            if (victim == id || victim == -1)
+                debug("[%d] pick %s (%d left)\n", id, task_kind_names[task.kind], tasks_left);
+            else
+                debug("[%d] steal %s from %d (%d left)\n", id, task_kind_names[task.kind], victim, tasks_left);
+        }
+
+        if (task.compilation->cancelled && driver_drop_cancelled_task(driver, &task)) {
+            if(enabled_logging_driver) {
+                debug("[%d] Drop %s, compilation cancelled\n", id, task_kind_names[task.kind]);
+            }
+            goto task_done;
         }
 
         // Perform task
         switch(task.kind) {
             case TASK_LEX_AND_PARSE: {
-                if (!task.lex_and_parse.import->text.ptr) {
+                Import* import = task.lex_and_parse.import;
+                if (!import->text.ptr) {
+                    // Tokenize straight from the page cache, files that can't be mapped are read
+                    u64 mapped_size = 0;
+                    char* mapped = fs__map_file(import->path.ptr, &mapped_size);
+                    if (mapped) {
+                        ASSERT(mapped_size < 0xFFFFFFFF);
+                        import->text        = (string){ mapped, (u32)mapped_size, 0 };
+                        import->text_mapped = true;
+                    }
+                }
+                if (!import->text.ptr) {
                     BasinResult result = {};
-                    string text = util_read_whole_file(task.lex_and_parse.import->path.ptr);
+                    string text = util_read_whole_file(import->path.ptr);
                     if(!text.ptr) {
-                        FORMAT_ERROR(result, BASIN_FILE_NOT_FOUND, "\033[31mERROR:\033[0m Cannot read '%s'\n", task.lex_and_parse.import->path.ptr);
-                        fprintf(stderr, "%s", result.error_message);
+                        FORMAT_ERROR(result, BASIN_FILE_NOT_FOUND, "\033[31mERROR:\033[0m Cannot read '%s'\n", import->path.ptr);
+                        comp_report_error(task.compilation, result.error_message);
+                        mem__free(result.error_message);
+                        import->failed_in = task.compilation->id;
+                        driver_finish_import(driver, import, IMPORT_FAILED);
                         break;
                     }
-                    task.lex_and_parse.import->text = text;
+                    import->text = text;
+                }
+
+                // A streamed import is lexed by the parser as it goes, it isn't split into chunks
+                bool streaming = task.compilation->options->stream_tokens;
+                if (!streaming && driver_add_lex_chunk_tasks(driver, &task)) {
+                    // Parsed by the last chunk task
+                    break;
                 }
+
                 TokenStream* stream = NULL;
-                Result result = tokenize(task.lex_and_parse.import, &stream);
-                if(result.kind != SUCCESS) {
-                    // Print message. We are done with this series of tasks
-                    fprintf(stderr, "%s", result.message.ptr);
+                Result result;
+                if (streaming)
+                    result = tokenize_streaming(&driver->interner, import, &stream);
+                else
+                    result = tokenize(&driver->interner, import, &stream);
+                driver_parse_import(driver, task.compilation, import, result, stream);
+            } break;
+            case TASK_LEX_CHUNK: {
+                Import* import  = task.lex_chunk.import;
+                ChunkedLex* job = task.lex_chunk.job;
+
+                if (!task.compilation->cancelled || import->shared) {
+                    tokenize_chunk(&driver->interner, import, &job->chunks[task.lex_chunk.chunk_index]);
+                }
+                if (atomic_add(&job->chunks_left, -1) != 1) {
                     break;
                 }
 
-                AST* ast = NULL;
-                result = parse_stream(task.compilation, stream, &ast);
-                if(result.kind != SUCCESS) {
-                    // Print message. We are done with this series of tasks
-                    fprintf(stderr, "%s", result.message.ptr);
+                // Last chunk, every other chunk is lexed (or skipped if the compilation was cancelled)
+                if (task.compilation->cancelled && !import->shared) {
+                    for (int i=0;i<job->chunks_len;i++)
+                        lex_chunk_cleanup(&job->chunks[i]);
+                    import->failed_in = task.compilation->id;
+                    driver_finish_import(driver, import, IMPORT_FAILED);
+                } else {
+                    TokenStream* stream = NULL;
+                    Result result = join_lex_chunks(&driver->interner, import, job->chunks, job->chunks_len, &stream);
+                    driver_parse_import(driver, task.compilation, import, result, stream);
+                }
+                mem__free(job->chunks);
+                mem__free(job);
+            } break;
+            case TASK_PARSE_BODIES: {
+                Import* import     = task.parse_bodies.import;
+                BatchedBodies* job = task.parse_bodies.job;
+
+                if (!task.compilation->cancelled || import->shared) {
+                    BodyBatch* batch = &job->batches[task.parse_bodies.batch_index];
+                    Result result = parse_body_batch(task.compilation, job->ast, batch);
+                    if (result.kind != SUCCESS) {
+                        atomic_store(&job->failed, true);
+                    }
+                } else {
+                    atomic_store(&job->failed, true);
+                }
+                if (atomic_add(&job->batches_left, -1) != 1) {
                     break;
                 }
-                task.lex_and_parse.import->ast = ast;
 
-                if (should_debug_print()) {
-                    print_ast(ast);
+                // Last batch, every other batch is parsed (or failed)
+                if (job->failed) {
+                    // Batches are in file order, the errors are reported like when one thread parses the bodies
+                    for (int i=0;i<job->batches_len;i++) {
+                        BodyBatch* batch = &job->batches[i];
+                        if (batch->part)
+                            ast_cleanup(batch->part);
+                        report_parse_errors(task.compilation, &batch->errors);
+                    }
+                    ast_cleanup(job->ast);
+                    import->failed_in = task.compilation->id;
+                    driver_finish_import(driver, import, IMPORT_FAILED);
+                } else {
+                    join_body_batches(job->ast, job->batches, job->batches_len);
+                    driver_finish_parse(driver, import, job->ast);
                 }
-                // fprintf(stderr, "Parse success\n");
-                
-                task.kind = TASK_GEN_IR;
-                task.gen_ir.import = task.lex_and_parse.import;
-                driver_add_task_with_thread_id(driver, &task, id);
+                mem__free(job->batches);
+                mem__free(job);
             } break;
             case TASK_GEN_IR: {
-                // All previous parse tasks for the compilation unit must be done at this point.
+                // Every import reachable from this one is parsed at this point (see driver_add_task_after_parse).
                 // If we in comp time add parse tasks we are kind of doomed. off-sync.
-                
-                // We cannot add dependency check here and add it back to the task queue.
-                // It's a waste of CPU time. We would need to add it to the front too.
-                
-                // Tasks for next phase, do we put them in a temp queue and then add
-                // them to the real queue when all tasks are done?
 
-
-                Result result = generate_ir(task.compilation, task.gen_ir.import->ast, task.compilation->program);
-                if(result.kind != SUCCESS) {
-                    // Print message. We are done with this series of tasks
-                    fprintf(stderr, "%s", result.message.ptr);
-                } else {
+                // Errors are reported by generate_ir
+                Result result = generate_ir(task.compilation, task.gen_ir.import->ast, task.gen_ir.function, task.compilation->program);
+                if(result.kind == SUCCESS) {
                     debug("Gen ir success\n");
                 }
-                
-                // task.kind = TASK_GEN_MACHINE;
-                // task.gen_machine.import = task.gen_ir.import;
-                // driver_add_task_with_thread_id(driver, &task, id);
             } break;
             case TASK_GEN_MACHINE: {
                 
@@ -355,19 +1417,18 @@ u32 driver_thread_run(DriverThread* thread_driver) {
                 // This function adds the MachineFunction to machine program.
                 CodegenResult result = codegen_generate_function(task.compilation, task.gen_machine.ir_function, &func);
                 if(result.error_type != CODEGEN_SUCCESS) {
-                    // Print message. We are done with this series of tasks
-                    fprintf(stderr, "%s", result.error_message);
+                    // We are done with this series of tasks
+                    comp_report_error(task.compilation, result.error_message ? result.error_message : "\033[31mERROR:\033[0m Code generation failed\n");
                 } else {
                     debug("Gen machine success\n");
                 }
-
-                // if not tasks in compilation unit
-
-                // If last task then gen object.
-                // Well, what if we add another gen machine task.
-
             } break;
             case TASK_GEN_OBJECT: {
+                // Added with driver_add_final_task, every other task in the compilation is done.
+                if (task.compilation->error_count > 0) {
+                    debug("Skipping object file, compilation has %u errors\n", task.compilation->error_count);
+                    break;
+                }
 
                 generate_object_file(task.compilation);
 
@@ -378,16 +1439,16 @@ u32 driver_thread_run(DriverThread* thread_driver) {
             }
         }
 
+    task_done:
+        driver_flush_task_output(driver, &task);
+
         atomic_add(&task.compilation->active_tasks, -1);
 
-        // once done, we may add new tasks, atomically, with mutex
-        // loop again find a new task
+        driver_finish_task(driver, task.compilation);
+        driver_stop_running(driver);
     }
 
-    // @TODO Temporary
-    if (id == 0) {
-        generate_object_file(barray_get(&driver->compilations, 0));
-    }
+    current_driver_thread = NULL;
 
     if(enabled_logging_driver) {
         debug("[%d] Stopped\n", id);
@@ -398,88 +1459,186 @@ u32 driver_thread_run(DriverThread* thread_driver) {
     return 0;
 }
 
+// Import id is the index in driver->imports so we assign it with the mutex locked.
+static Import* driver_push_import_locked(Driver* driver, Import* import) {
+    Import* ptr;
+    if (driver->free_imports.len > 0) {
+        ptr = array_last(&driver->free_imports);
+        array_pop(&driver->free_imports);
+        import->import_id = ptr->import_id;
+        *ptr = *import;
+    } else {
+        ASSERT(driver->next_import_id+1 <= 0xFFFF);
+        import->import_id = driver->next_import_id++;
+        ptr = barray_push(&driver->imports, import);
+    }
+    return ptr;
+}
+
 Import* driver_create_import_id(Driver* driver, cstring path) {
     TracyCZone(zone, 1);
-    ASSERT(driver->next_import_id+1 <= 0xFFFF);
-
-    // If we run driver again for incremental linking
-    // we may already have added the import, if so
-    // we can check if it was updated on disc
-    // if it was we create new import otherwise
-    // we reuse the import?
-
-    // @TODO Check if path already exists!
 
     Import import = {};
     import.path = string_clone_cstr(path);
-    import.import_id = atomic_add(&driver->next_import_id, 1);
+    import.state = IMPORT_PENDING;
 
     thread__lock_mutex(&driver->import_mutex);
+    Import* ptr = driver_push_import_locked(driver, &import);
+    thread__unlock_mutex(&driver->import_mutex);
 
-    Import* ptr = barray_push(&driver->imports, &import);
+    TracyCZoneEnd(zone);
+    return ptr;
+}
 
+Import* driver_get_import(Driver* driver, ImportID import_id) {
+    // The bucket array may get a new bucket while we look
+    thread__lock_mutex(&driver->import_mutex);
+    Import* import = barray_get(&driver->imports, import_id);
     thread__unlock_mutex(&driver->import_mutex);
+    return import;
+}
+
+// Returns the slot with the path or the empty slot where it belongs. Shard must be locked.
+static ImportTableEntry* import_table_probe(ImportTableShard* shard, u32 hash, u32 import_group, cstring path) {
+    u32 mask = shard->cap - 1;
+    // The low bits picked the shard, use the high bits for the slot
+    u32 index = (hash >> 8) & mask;
+    while (true) {
+        ImportTableEntry* entry = &shard->entries[index];
+        if (!entry->import)
+            return entry;
+        if (entry->hash == hash && entry->import->import_group == import_group && string_equal(cstr(entry->import->path), path))
+            return entry;
+        index = (index + 1) & mask;
+    }
+}
+
+static void import_table_grow(ImportTableShard* shard) {
+    ImportTableEntry* old_entries = shard->entries;
+    u32 old_cap = shard->cap;
+
+    shard->cap = old_cap ? old_cap * 2 : 32;
+    shard->entries = mem__alloc(shard->cap * sizeof(ImportTableEntry));
+    memset(shard->entries, 0, shard->cap * sizeof(ImportTableEntry));
+
+    for (int i=0;i<old_cap;i++) {
+        ImportTableEntry* old = &old_entries[i];
+        if (old->import)
+            *import_table_probe(shard, old->hash, old->import->import_group, cstr(old->import->path)) = *old;
+    }
+    mem__free(old_entries);
+}
+
+Import* driver_find_or_create_import(Driver* driver, Compilation* compilation, cstring path, bool* created) {
+    TracyCZone(zone, 1);
+
+    u32 import_group = compilation->import_group;
+    u32 hash = hash_fnv1a(path.ptr, path.len) ^ (import_group * 0x9E3779B9u);
+    ImportTableShard* shard = &driver->import_table[hash % IMPORT_TABLE_SHARDS];
+
+    // Zero if the file is missing, reading it fails and reports the error
+    FSInfo info = {};
+    fs__path_info(path.ptr, &info);
+
+    thread__lock_mutex(&shard->mutex);
+
+    // Keep the load below 50% so probes stay short
+    if ((shard->len + 1) * 2 > shard->cap)
+        import_table_grow(shard);
+
+    ImportTableEntry* entry = import_table_probe(shard, hash, import_group, path);
+    Import* old = entry->import;
+    bool stale = false;
+    if (old && old->checked_in != compilation->id) {
+        // Once per compilation so every file of it sees the same import
+        stale = old->file_size != info.file_size || old->file_time != info.last_write_time
+            || (old->state == IMPORT_FAILED && old->failed_in != compilation->id);
+        old->checked_in = compilation->id;
+    }
+
+    *created = !old || stale;
+    if (*created) {
+        Import import = {};
+        import.path   = string_clone_cstr(path);
+        import.state  = IMPORT_PENDING;
+        import.shared = true;
+        import.import_group = import_group;
+        import.file_size    = info.file_size;
+        import.file_time    = info.last_write_time;
+        import.checked_in   = compilation->id;
+
+        thread__lock_mutex(&driver->import_mutex);
+        entry->import = driver_push_import_locked(driver, &import);
+        thread__unlock_mutex(&driver->import_mutex);
+
+        entry->hash = hash;
+        if (!old)
+            shard->len++;
+    }
+    Import* ptr = entry->import;
+
+    // Other threads looking for the same path wait here until the import exists,
+    // only one of them creates it and adds the parse task.
+    thread__unlock_mutex(&shard->mutex);
 
     TracyCZoneEnd(zone);
     return ptr;
 }
 
+// Writes dir/path to out and adds .bsn if the file has no extension.
+// Returns false if it doesn't fit.
+static bool join_import_path(cstring dir, cstring path, char* out, int out_cap) {
+    int len = dir.len + 1 + path.len;
+    if (len + 5 > out_cap)
+        return false;
+    memcpy(out, dir.ptr, dir.len);
+    out[dir.len] = '/';
+    memcpy(out + dir.len + 1, path.ptr, path.len);
+    out[len] = '\0';
+
+    int slash_pos = string_rfind(out, len-1, "/");
+    int dot_pos = string_rfind(out, len-1, ".");
+    if (slash_pos > dot_pos || dot_pos == -1) {
+        // no file extension, add implicit .bsn
+        memcpy(out + len, ".bsn", 5);
+    }
+    return true;
+}
+
 string comp_resolve_import_path(Compilation* compilation, const Import* origin, cstring path) {
     TracyCZone(zone, 1);
-    // 1. if path has . then relative to origin
+    // 1. if path has . then relative to the directory of origin
     // 2. otherwise search import directories
-    string str = {};
+    // The found file goes through fs__abspath so that every way of reaching
+    // it ("./x", "../dir/x", symlinked import directories) gives one path.
+    char joined[IMPORT_PATH_MAX];
+    bool found = false;
     if (path.len == 0 || path.ptr[0] == '/') {
         // empty/invalid
-    } else if (path.ptr[0] == '.' && path.ptr[1] == '/') {
-        str.max = origin->path.len + path.len - 1;
-        str.ptr = mem__alloc(str.max + 1);
-        str.len = str.max;
-        memcpy(str.ptr, origin->path.ptr, origin->path.len);
-        memcpy(str.ptr + origin->path.len, path.ptr+1, path.len-1);
-        str.ptr[str.len] = '\0';
+    } else if (path.ptr[0] == '.' && (path.ptr[1] == '/' || (path.ptr[1] == '.' && path.ptr[2] == '/'))) {
+        cstring dir = cstr_cptr(".");
+        int slash_pos = string_rfind(origin->path.ptr, (int)origin->path.len-1, "/");
+        if (slash_pos != -1) {
+            dir.ptr = origin->path.ptr;
+            dir.len = slash_pos;
+        }
+        found = join_import_path(dir, path, joined, sizeof(joined)) && fs__exists(joined);
     } else {
-        str.max = 300;
-        str.ptr = mem__alloc(str.max + 1);
-        bool found = false;
         for (int i=compilation->import_dirs.len-1;i>=0;i--) {
-            string dir = compilation->import_dirs.ptr[i];
-            
-            // @TODO Buffer overflow if directory is longer than str.max
-            //   DO NOT ASSUME IT FITS
-            memcpy(str.ptr, dir.ptr, dir.len);
-            str.ptr[dir.len] = '/';
-            memcpy(str.ptr + dir.len + 1, path.ptr, path.len);
-            str.len = dir.len + 1 + path.len;
-            str.ptr[str.len] = '\0';
-            
-            int slash_pos = string_rfind(str.ptr, str.len-1, "/");
-            int dot_pos = string_rfind(str.ptr, str.len-1, ".");
-            
-            if (slash_pos > dot_pos || dot_pos == -1) {
-                // no file extension, add implicit .bsn
-                memcpy(str.ptr + str.len, ".bsn", 4);
-                str.len += 4;
-                str.ptr[str.len] = '\0';
-            }
-            
-            ASSERT(str.len < str.max);
-            
-            if (fs__exists(str.ptr)) {
+            cstring dir = cstr(compilation->import_dirs.ptr[i]);
+            if (join_import_path(dir, path, joined, sizeof(joined)) && fs__exists(joined)) {
                 found = true;
                 break;
             }
         }
-        if (!found) {
-            // Most of the time the path will be resolved.
-            // If it wasn't then we might not want to heap allocate
-            // just to free it later.
-            // @TODO We want to use an optimized linear string allocator.
-            mem__free(str.ptr);
-            str.ptr = NULL;
-            str.len = 0;
-            str.max = 0;
-        }
+    }
+
+    string str = {};
+    if (found) {
+        char canonical[IMPORT_PATH_MAX];
+        fs__abspath(joined, sizeof(canonical), canonical);
+        if (canonical[0])
+            str = string_clone_cptr(canonical);
     }
     TracyCZoneEnd(zone);
     return str;
@@ -488,6 +1647,8 @@ string comp_resolve_import_path(Compilation* compilation, const Import* origin,
 const char* const task_kind_names[TASK_COUNT] = {
     "TASK_INVALID",
     "TASK_LEX_AND_PARSE",
+    "TASK_LEX_CHUNK",
+    "TASK_PARSE_BODIES",
     "TASK_GEN_IR",
     "TASK_GEN_MACHINE",
     "TASK_GEN_OBJECT",
@@ -7,6 +7,8 @@
 
     User starts the driver which launches threads (unless thread count is set to 1).
     The driver performs tasks and modifies the driver state until list is empty.
+    The threads are parked afterwards and reused the next time the driver runs,
+    along with imports that were parsed (see BasinContext).
 
     Driver now has source text, AST, IR, machine code in memory and intermediate
     files written to the disc.
@@ -18,6 +20,7 @@
 
 #include "basin/common.h"
 #include "basin/frontend/lexer.h"
+#include "basin/frontend/parser.h"
 #include "basin/basin.h"
 #include "basin/backend/ir.h"
 
@@ -26,10 +29,31 @@
 #include "platform/platform.h"
 
 typedef struct AST AST;
+typedef struct ASTFunction ASTFunction;
+
+// A big import lexed on several threads, one TASK_LEX_CHUNK per chunk.
+// The last chunk to finish joins the tokens and parses the import.
+typedef struct {
+    LexChunk*    chunks;
+    int          chunks_len;
+    volatile int chunks_left;
+} ChunkedLex;
+
+// Function bodies of a big import parsed on several threads, one TASK_PARSE_BODIES per batch.
+// The last batch to finish joins the bodies into the AST and finishes the import.
+typedef struct {
+    AST*         ast;
+    BodyBatch*   batches;
+    int          batches_len;
+    volatile int batches_left;
+    volatile int failed; // a batch had syntax errors or was skipped, the import fails
+} BatchedBodies;
 
 typedef enum {
     TASK_INVALID,
     TASK_LEX_AND_PARSE,
+    TASK_LEX_CHUNK,
+    TASK_PARSE_BODIES,
     TASK_GEN_IR,
     TASK_GEN_MACHINE,
     TASK_GEN_OBJECT,
@@ -41,15 +65,28 @@ extern const char* const task_kind_names[TASK_COUNT];
 typedef struct Task {
     TaskKind kind;
     Compilation* compilation;
+    // Tasks with higher priority run first. Zero lets the driver estimate it when the task is queued.
+    u64 priority;
     union {
         struct {
             Import* import;
         } lex_and_parse;
         struct {
-            Import* import;
+            Import*     import;
+            ChunkedLex* job;
+            int         chunk_index;
+        } lex_chunk;
+        struct {
+            Import*        import;
+            BatchedBodies* job;
+            int            batch_index;
+        } parse_bodies;
+        struct {
+            Import*      import;
+            ASTFunction* function; // only this function (lazy IR), NULL for the functions of the import
         } gen_ir;
         struct {
-            // Import* import;
+            const Import* import; // import the function came from
             IRFunction* ir_function;
         } gen_machine;
         struct {
@@ -59,36 +96,128 @@ typedef struct Task {
 } Task;
 
 DEF_BUCKET_ARRAY(Task)
+DEF_ARRAY(Task)
+
+// Task that is queued once the things it depends on are done.
+struct WaitingTask {
+    Task         task;
+    int          thread_number;
+    volatile int missing;    // imports that we wait for
+    Import*      root;       // every import reachable from root must be parsed
+    bool         per_import; // queue a copy of the task for each reachable import instead (TASK_GEN_IR)
+};
 
 
 typedef struct Driver Driver;
 
+// Tasks with this bit run before all other tasks, see driver_boost_import
+#define TASK_PRIORITY_BOOST (1ull << 62)
+
+typedef struct {
+    Task task;
+    u32  sequence; // tie breaker for tasks with the same priority
+} QueuedTask;
+
+// Queue of tasks ordered by priority (binary max-heap).
+// The owning thread pushes and pops, other threads steal
+// the top task when they run out of work.
+typedef struct TaskQueue {
+    QueuedTask*  tasks;
+    volatile u32 len;
+    u32          cap;
+    u32          next_sequence;
+    Mutex        mutex;
+} TaskQueue;
+
 typedef struct {
     Driver* driver;
     Thread thread;
+
+    TaskQueue    queue;
+    Semaphore    park_semaphore; // signaled when the thread is parked and there is new work
+    volatile u32 parked;
 } DriverThread;
 
 
+// Shared imports by canonical path. Split in shards with their own lock
+// so parse tasks that find imports at the same time rarely wait for each other.
+#define IMPORT_TABLE_SHARDS 16
+
+typedef struct {
+    u32     hash;
+    Import* import; // NULL if the slot is empty
+} ImportTableEntry;
+
+typedef struct {
+    ImportTableEntry* entries; // open addressing, cap is a power of two
+    u32               len;
+    u32               cap;
+    Mutex             mutex;
+} ImportTableShard;
+
 DEF_BUCKET_ARRAY(Compilation)
+typedef Compilation* CompilationP;
+DEF_ARRAY(CompilationP)
+
+// Output captured from a task, printed in import/function order
+// when the driver is done if ordered_output is enabled.
+typedef struct {
+    const Import* import; // NULL if output isn't tied to an import
+    TaskKind      kind;
+    u32           compilation_id; // zero for parsing a shared import, it's done once for all compilations
+    u32           function_id;
+    u32           sequence; // tie breaker
+    char*         text; // for stderr
+    int           text_len;
+    char*         dump; // for stdout
+    int           dump_len;
+} TaskOutput;
+
+DEF_ARRAY(TaskOutput)
 
 typedef struct Driver {
+    // Threads are started by the first driver_run and live until driver_cleanup.
+    // threads[0] is whoever calls driver_run, the rest park when there is no work.
     DriverThread* threads;
     u32           threads_len;
     u32           threads_cap;
+    volatile u32  stopping;
 
-    BucketArray_Task tasks;
-    Mutex            tasks_mutex;
-    Semaphore        may_have_task_semaphore;
+    // Tasks added from threads that aren't driver threads (basin_compile for example).
+    // Driver threads steal from this queue like any other queue.
+    TaskQueue    injected_tasks;
+    volatile int queued_tasks;     // tasks sitting in a queue
+    volatile int unfinished_tasks; // tasks that are queued or running, driver threads stop at zero
 
     BucketArray_Compilation compilations;
+    Array_CompilationP      free_compilations; // destroyed, reused by driver_create_compilation
+    u32                     next_compilation_id;
+    Array_string            import_groups; // import directories of each group joined by newlines
     Mutex                   compilations_mutex;
     
     BucketArray_Import imports;
+    Array_ImportP      free_imports; // recycled inputs of destroyed compilations
     ImportID           next_import_id;
     Mutex              import_mutex;
+    ImportTableShard   import_table[IMPORT_TABLE_SHARDS];
+
+    Interner interner; // identifiers of every import and compilation, outlives the ASTs
     
-    volatile u32 idle_threads;
-    volatile u32 task_process_limit;
+    // Budget of the current driver_run. Threads stop picking tasks when it's used up
+    // and the driver stays paused (tasks are queued but not performed) until the next run.
+    volatile u32 paused;
+    volatile u32 task_process_limit; // tasks per run
+    volatile u32 processed_tasks;    // tasks picked this run
+    u64          run_deadline;       // time__now() when the run ends, 0 for no limit
+    volatile int running_tasks;      // threads that are picking or performing a task
+
+    // Output from tasks is always buffered per task and written in one go.
+    // With ordered_output it's kept until driver_run finishes and then
+    // printed in import/function order which is the same between runs.
+    bool             ordered_output;
+    Array_TaskOutput task_outputs;
+    Mutex            task_outputs_mutex;
+    volatile u32     next_task_output;
     
 } Driver;
 
@@ -97,14 +226,39 @@ typedef struct Driver {
 // ##########################
 
 Driver* driver_create();
-void    driver_run(Driver* driver, u32 thread_count, u32 task_process_limit);
+// Performs tasks until every task is done or the budget is used up, at most
+// task_process_limit tasks and time_limit_us microseconds (zero means no limit).
+// Tasks that already started finish before returning so the time may be exceeded by one task.
+// Returns true if every task is done, otherwise call it again to continue.
+// Threads are started the first time, thread_count is ignored after that.
+bool    driver_run(Driver* driver, u32 thread_count, u32 task_process_limit, u64 time_limit_us);
 void    driver_cleanup(Driver* driver);
 
+// Thread number -1 puts the task in the queue of the calling driver thread
+// (or the injected queue if the caller isn't a driver thread).
 #define driver_add_task(...) driver_add_task_with_thread_id(__VA_ARGS__, -1)
 void driver_add_task_with_thread_id(Driver* driver, Task* task, int thread_number);
+// Same as driver_add_task_with_thread_id for many tasks. The queue is locked once
+// and at most 'count' parked threads are woken. Use it when a task produces lots of tasks.
+void driver_add_tasks(Driver* driver, Task* tasks, int count, int thread_number);
+// Adds a task that is queued once 'import' and every import it reaches are parsed.
+// The task is dropped if one of them fails to parse.
+void driver_add_task_after_parse(Driver* driver, Task* task, Import* import);
+// Adds a TASK_GEN_IR for the root and every import it reaches once all of them are parsed.
+// Imports parsed by earlier compilations are reused, only their IR is generated again.
+void driver_add_gen_ir_tasks(Driver* driver, Compilation* compilation, Import* root);
+// Adds a task that is queued once every other task in the task's compilation is done.
+// One per compilation (TASK_GEN_OBJECT).
+void driver_add_final_task(Driver* driver, Task* task);
+// Raises the priority of the queued parse task for the import above all unboosted tasks.
+// Used for imports that other tasks wait for since they hold back the rest of the compilation.
+void driver_boost_import(Driver* driver, Import* import);
 
 
 Compilation* driver_create_compilation(Driver* driver, const BasinCompileOptions* options);
+// Frees the IR and machine code of a compilation that is done and recycles its root import.
+// The driver must not be running.
+void         driver_destroy_compilation(Driver* driver, Compilation* compilation);
 // Compilation* driver_submit_compilation(Driver* driver, const BasinCompileOptions* options);
 
 
@@ -113,8 +267,31 @@ Compilation* driver_create_compilation(Driver* driver, const BasinCompileOptions
 // ############################
 
 // THREAD SAFE
+// Creates an import that belongs to one compilation (the input file or text).
 Import* driver_create_import_id(Driver* driver, cstring path);
 // THREAD SAFE
+Import* driver_get_import(Driver* driver, ImportID import_id);
+// THREAD SAFE
+// Returns the shared import with the path, created is set if it didn't exist and must be parsed.
+// The path must be canonical (comp_resolve_import_path) so each file has one import per import group.
+// The first time a compilation finds an import, the file's size and write time are compared.
+// If the file changed or the import failed in another compilation, a new import replaces it
+// in the table. Compilations that use the old import keep it, it's freed in driver_cleanup.
+Import* driver_find_or_create_import(Driver* driver, Compilation* compilation, cstring path, bool* created);
+// THREAD SAFE
+// Id of the function's IR function in the compilation. The AST must be parsed.
+IRFunction_id comp_function_id(Compilation* compilation, const ASTFunction* function);
+// THREAD SAFE
+// Returns true the first time the function is reached, the caller generates its IR (Compilation.lazy_ir).
+bool comp_reach_function(Compilation* compilation, const ASTFunction* function);
+// THREAD SAFE
+// Records an error of the compilation and cancels it once it has max_errors errors.
+void comp_report_error(Compilation* compilation, const char* message);
+// THREAD SAFE
+// Errors the compilation reports before it's cancelled, at least one.
+u32 comp_max_errors(Compilation* compilation);
+// THREAD SAFE
+// Returns the canonical absolute path of the imported file or an empty string if it doesn't exist.
 string comp_resolve_import_path(Compilation* compilation, const Import* origin, cstring path);
 // THREAD SAFE
 // string comp_resolve_library_path(Compilation* compilation, const Import* origin, cstring path);
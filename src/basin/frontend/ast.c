@@ -1,72 +1,140 @@
 #include "basin/frontend/ast.h"
 
+#include "util/hash.h"
 
+void ast_cleanup(AST* ast) {
+    for (int i=0;i<ast->body_parts.len;i++)
+        ast_cleanup(ast->body_parts.ptr[i]);
+    array_cleanup(&ast->body_parts);
+    array_cleanup(&ast->skipped_bodies);
+    arena_cleanup(&ast->arena);
+    flat_cleanup(&ast->flat);
+    if (ast->stream)
+        token_stream_cleanup(ast->stream);
+    mem__free(ast);
+}
 
-bool find_identifier(cstring name, AST* ast, ASTExpression_Block* block, FindResult* result) {
-    memset(result, 0, sizeof(*result));
-    
-    // This is the slowest function you've ever seen.
-    // We need some serious optimizations here.
-
-    // @TODO This functions finds the first identifier.
-    //    This would allow duplicates which is bad.
-    //    We need to search all scopes and if we find two items
-    //    with the same name return an error.
-    //    It might be more efficient to perform this duplicate check
-    //    in an earlier stage instead of each instance of an identifier
-    //    in expression performing this check.
-    
-    #define FIND(B_FIELD, R_FIELD, T, K)                            \
-        for (int i=0;i<block->B_FIELD.len;i++) {                    \
-            T* v = block->B_FIELD.ptr[i];                          \
-            if (string_equal(name, cstr(v->name))) {                \
-                result->block = block;                              \
-                result->R_FIELD = v;                                \
-                result->kind = K;                                   \
-                return true;                                        \
-            }                                                       \
-        }
-    #define FINDP(B_FIELD, R_FIELD, T, K)                            \
-        for (int i=0;i<block->B_FIELD.len;i++) {                    \
-            T* v = &block->B_FIELD.ptr[i];                          \
-            if (string_equal(name, cstr(v->name))) {                \
-                result->block = block;                              \
-                result->R_FIELD = v;                                \
-                result->kind = K;                                   \
-                return true;                                        \
-            }                                                       \
-        }
 
-    FIND(constants, f_constant, ASTConstant, FOUND_CONSTANT)
-    FIND(globals,   f_global,   ASTGlobal,   FOUND_GLOBAL)
-    FIND(variables, f_variable, ASTVariable, FOUND_VARIABLE)
-    FIND(structs,   f_struct,   ASTStruct,   FOUND_STRUCT)
-    FIND(functions, f_function, ASTFunction, FOUND_FUNCTION)
-    FINDP(libraries, f_library,  ASTLibrary,  FOUND_LIBRARY)
+static const ScopeEntry* scope_find(const ScopeTable* table, Atom name) {
+    if (table->cap == 0)
+        return NULL;
+    u32 mask = table->cap - 1;
+    u32 slot = hash_u32(name) & mask;
+    while (true) {
+        const ScopeEntry* entry = &table->slots[slot];
+        if (entry->name == name)
+            return entry;
+        if (entry->name == 0)
+            return NULL;
+        slot = (slot + 1) & mask;
+    }
+}
 
+// Returns the entry with the same name if there is one, the new entry isn't added then
+static const ScopeEntry* scope_insert(ScopeTable* table, Atom name, FoundKind kind, void* decl) {
+    u32 mask = table->cap - 1;
+    u32 slot = hash_u32(name) & mask;
+    while (table->slots[slot].name != 0) {
+        if (table->slots[slot].name == name)
+            return &table->slots[slot];
+        slot = (slot + 1) & mask;
+    }
+    table->slots[slot].name = name;
+    table->slots[slot].kind = kind;
+    table->slots[slot].decl = decl;
+    table->len++;
+    return NULL;
+}
+
+bool build_scope_table(Arena* arena, ASTExpression_Block* block, ScopeEntry* duplicate) {
+    ScopeTable* table = &block->scope;
+
+    int count = block->constants.len + block->globals.len + block->variables.len
+              + block->structs.len + block->functions.len + block->libraries.len + block->enums.len;
     for (int i=0;i<block->enums.len;i++) {
-        ASTEnum* v = block->enums.ptr[i];
-        if (string_equal(name, cstr(v->name))) {
-            result->block = block;
-            result->f_enum = v;
-            result->kind = FOUND_ENUM;
-            return true;
+        if (block->enums.ptr[i]->share)
+            count += block->enums.ptr[i]->members.len;
+    }
+    if (count == 0)
+        return true;
+
+    // Load factor at most 50%
+    u32 cap = 4;
+    while (cap < (u32)count * 2)
+        cap *= 2;
+    table->cap   = cap;
+    table->len   = 0;
+    table->slots = arena_alloc(arena, cap * sizeof(ScopeEntry));
+    memset(table->slots, 0, cap * sizeof(ScopeEntry));
+
+    // Declarations are inserted by kind, the one later in the file is reported
+    #define INSERT(NAME, KIND, DECL) {                                        \
+            ScopeEntry entry = { NAME, KIND, DECL };                          \
+            const ScopeEntry* existing = scope_insert(table, NAME, KIND, DECL); \
+            if (existing) {                                                   \
+                bool existing_later = scope_entry_location(existing).position > scope_entry_location(&entry).position; \
+                *duplicate = existing_later ? *existing : entry;              \
+                return false;                                                 \
+            }                                                                 \
         }
-        if (v->share) {
-            for (int j=0;j<block->enums.len;j++) {
-                ASTEnum_Member* m = &block->enums.ptr[i]->members.ptr[j];
-                
-                if (string_equal(name, cstr(m->name))) {
-                    result->block = block;
-                    result->f_enum_member = m;
-                    result->kind = FOUND_ENUM_MEMBER;
-                    return true;
-                }
-            }
+
+    for (int i=0;i<block->constants.len;i++) INSERT(block->constants.ptr[i]->name, FOUND_CONSTANT, block->constants.ptr[i])
+    for (int i=0;i<block->globals.len;i++)   INSERT(block->globals.ptr[i]->name,   FOUND_GLOBAL,   block->globals.ptr[i])
+    for (int i=0;i<block->variables.len;i++) INSERT(block->variables.ptr[i]->name, FOUND_VARIABLE, block->variables.ptr[i])
+    for (int i=0;i<block->structs.len;i++)   INSERT(block->structs.ptr[i]->name,   FOUND_STRUCT,   block->structs.ptr[i])
+    for (int i=0;i<block->functions.len;i++) INSERT(block->functions.ptr[i]->name, FOUND_FUNCTION, block->functions.ptr[i])
+    for (int i=0;i<block->libraries.len;i++) INSERT(block->libraries.ptr[i].name,  FOUND_LIBRARY,  &block->libraries.ptr[i])
+    for (int i=0;i<block->enums.len;i++) {
+        ASTEnum* enu = block->enums.ptr[i];
+        INSERT(enu->name, FOUND_ENUM, enu)
+        if (enu->share) {
+            // Members of shared enums are used without the enum name
+            for (int j=0;j<enu->members.len;j++)
+                INSERT(enu->members.ptr[j].name, FOUND_ENUM_MEMBER, &enu->members.ptr[j])
         }
     }
+    #undef INSERT
+    return true;
+}
 
-    #undef FIND
+SourceLocation scope_entry_location(const ScopeEntry* entry) {
+    switch (entry->kind) {
+        case FOUND_VARIABLE:    return ((ASTVariable*)entry->decl)->location;
+        case FOUND_GLOBAL:      return ((ASTGlobal*)entry->decl)->location;
+        case FOUND_CONSTANT:    return ((ASTConstant*)entry->decl)->location;
+        case FOUND_FUNCTION:    return ((ASTFunction*)entry->decl)->location;
+        case FOUND_LIBRARY:     return ((ASTLibrary*)entry->decl)->location;
+        case FOUND_STRUCT:      return ((ASTStruct*)entry->decl)->location;
+        case FOUND_ENUM:        return ((ASTEnum*)entry->decl)->location;
+        case FOUND_ENUM_MEMBER: return ((ASTEnum_Member*)entry->decl)->location;
+        default: ASSERT(false);
+    }
+    SourceLocation none = {};
+    return none;
+}
+
+bool find_identifier(Atom name, AST* ast, ASTExpression_Block* block, FindResult* result) {
+    memset(result, 0, sizeof(*result));
+
+    // Names are unique within a block, build_scope_table rejects duplicates
+    // so the first declaration we find is the only one in its block.
+    const ScopeEntry* entry = scope_find(&block->scope, name);
+    if (entry) {
+        result->block = block;
+        result->kind  = entry->kind;
+        switch (entry->kind) {
+            case FOUND_VARIABLE:    result->f_variable    = entry->decl; break;
+            case FOUND_GLOBAL:      result->f_global      = entry->decl; break;
+            case FOUND_CONSTANT:    result->f_constant    = entry->decl; break;
+            case FOUND_FUNCTION:    result->f_function    = entry->decl; break;
+            case FOUND_LIBRARY:     result->f_library     = entry->decl; break;
+            case FOUND_STRUCT:      result->f_struct      = entry->decl; break;
+            case FOUND_ENUM:        result->f_enum        = entry->decl; break;
+            case FOUND_ENUM_MEMBER: result->f_enum_member = entry->decl; break;
+            default: ASSERT(false);
+        }
+        return true;
+    }
 
     if (block->parent) {
         bool res = find_identifier(name, ast, block->parent, result);
@@ -77,7 +145,7 @@ bool find_identifier(cstring name, AST* ast, ASTExpression_Block* block, FindRes
     for (int i=0;i<block->imports.len;i++) {
         ASTImport* v = &block->imports.ptr[i];
 
-        if (string_equal(name, cstr(v->name))) {
+        if (name == v->name) {
             result->block = block;
             result->f_import = v;
             result->kind = FOUND_IMPORT;
@@ -87,8 +155,9 @@ bool find_identifier(cstring name, AST* ast, ASTExpression_Block* block, FindRes
         // Driver, task system has a bug if AST isn't available.
         // lex_and_parse needs to run for all imports that find_identifier
         // can reach on the provided ast and block.
-        ASSERT(v->import->ast);
+        ASSERT(v->import->state == IMPORT_PARSED && v->import->ast);
 
+        // The file scope table of the import is what it exports
         bool res = find_identifier(name, v->import->ast, v->import->ast->global_block, result);
         if (res)
             return true;
@@ -97,10 +166,10 @@ bool find_identifier(cstring name, AST* ast, ASTExpression_Block* block, FindRes
     return false;
 }
 
-int find_function_parameter(cstring name, ASTFunction* func) {
+int find_function_parameter(Atom name, ASTFunction* func) {
     for(int i=0;i<func->parameters.len;i++) {
         ASTFunction_Parameter* param = &func->parameters.ptr[i];
-        if (string_equal(cstr(param->name), name)) {
+        if (param->name == name) {
             return i;
         }
     }
@@ -109,266 +178,279 @@ int find_function_parameter(cstring name, ASTFunction* func) {
 
 static void print_indent(int depth) {
     for (int i=0;i<depth;i++) {
-        printf("  ");
+        log__dump("  ");
     }
 }
 
+// Names are atoms, print_ast sets the interner they come from
+static THREAD_LOCAL Interner* print_interner;
+
 void print_ast(AST* ast) {
-    printf("root: ");
+    print_interner = ast->stream->interner;
+    log__dump("root: ");
     print_expression((ASTExpression*)ast->global_block, 1);
 }
 
-void print_expression(ASTExpression* _expr, int depth) {
-    switch(_expr->kind) {
-        case EXPR_BLOCK: {
-            ASTExpression_Block* expr = (ASTExpression_Block*)_expr;
-            printf("BLOCK\n");
-            for (int i=0;i<expr->imports.len;i++) {
-                print_indent(depth);
-                print_import(&expr->imports.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->functions.len;i++) {
-                print_indent(depth);
-                print_function(expr->functions.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->structs.len;i++) {
-                print_indent(depth);
-                print_struct(expr->structs.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->enums.len;i++) {
-                print_indent(depth);
-                print_enum(expr->enums.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->globals.len;i++) {
-                print_indent(depth);
-                print_global(expr->globals.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->constants.len;i++) {
-                print_indent(depth);
-                print_constant(expr->constants.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->variables.len;i++) {
-                print_indent(depth);
-                print_variable(expr->variables.ptr[i], depth + 1);
-            }
-            for (int i=0;i<expr->expressions.len;i++) {
+static void print_block_declarations(ASTExpression_Block* expr, int depth) {
+    for (int i=0;i<expr->imports.len;i++) {
+        print_indent(depth);
+        print_import(&expr->imports.ptr[i], depth + 1);
+    }
+    for (int i=0;i<expr->functions.len;i++) {
+        print_indent(depth);
+        print_function(expr->functions.ptr[i], depth + 1);
+    }
+    for (int i=0;i<expr->structs.len;i++) {
+        print_indent(depth);
+        print_struct(expr->structs.ptr[i], depth + 1);
+    }
+    for (int i=0;i<expr->enums.len;i++) {
+        print_indent(depth);
+        print_enum(expr->enums.ptr[i], depth + 1);
+    }
+    for (int i=0;i<expr->globals.len;i++) {
+        print_indent(depth);
+        print_global(expr->globals.ptr[i], depth + 1);
+    }
+    for (int i=0;i<expr->constants.len;i++) {
+        print_indent(depth);
+        print_constant(expr->constants.ptr[i], depth + 1);
+    }
+    for (int i=0;i<expr->variables.len;i++) {
+        print_indent(depth);
+        print_variable(expr->variables.ptr[i], depth + 1);
+    }
+}
+
+static void print_unary_operator(OperatorKind op_kind) {
+    switch (op_kind) {
+               case EXPR_OP_ADDRESS_OF:     log__dump("ADDRESS_OF\n");
+        break; case EXPR_OP_DEREF:          log__dump("DEREF\n");
+        break; case EXPR_OP_BITWISE_NEGATE: log__dump("BITWISE_NEGATE\n");
+        break; case EXPR_OP_LOGICAL_NOT:    log__dump("LOGICAL_NOT\n");
+        break; case EXPR_OP_SUB:            log__dump("SUB\n");
+        break; default: fprintf(stderr, "print unary, missing op kind %d\n", op_kind); ASSERT(false);
+    }
+}
+
+static void print_binary_operator(OperatorKind op_kind) {
+    switch (op_kind) {
+               case EXPR_OP_ADD:            log__dump("ADD\n");
+        break; case EXPR_OP_SUB:            log__dump("SUB\n");
+        break; case EXPR_OP_MUL:            log__dump("MUL\n");
+        break; case EXPR_OP_DIV:            log__dump("DIV\n");
+        break; case EXPR_OP_MODULO:         log__dump("MODULO\n");
+        break; case EXPR_OP_LESS:           log__dump("LESS\n");
+        break; case EXPR_OP_GREATER:        log__dump("GREATER\n");
+        break; case EXPR_OP_LESS_EQUAL:     log__dump("LESS_EQUAL\n");
+        break; case EXPR_OP_GREATER_EQUAL:  log__dump("GREATER_EQUAL\n");
+        break; case EXPR_OP_EQUAL:          log__dump("EQUAL\n");
+        break; case EXPR_OP_NOT_EQUAL:      log__dump("NOT_EQUAL\n");
+        break; case EXPR_OP_BITWISE_OR:     log__dump("BITWISE_OR\n");
+        break; case EXPR_OP_BITWISE_AND:    log__dump("BITWISE_AND\n");
+        break; case EXPR_OP_BITWISE_XOR:    log__dump("BITWISE_XOR\n");
+        break; case EXPR_OP_BITWISE_LSHIFT: log__dump("BITWISE_LSHIFT\n");
+        break; case EXPR_OP_BITWISE_RSHIFT: log__dump("BITWISE_RSHIFT\n");
+        break; case EXPR_OP_LOGICAL_AND:    log__dump("LOGICAL_AND\n");
+        break; case EXPR_OP_LOGICAL_OR:     log__dump("LOGICAL_OR\n");
+        break; default: fprintf(stderr, "print binary, missing op kind %d\n", op_kind); ASSERT(false);
+    }
+}
+
+// Pointer nodes (the global block, values of globals and constants) are
+// flattened and printed the same way as function bodies
+void print_expression(ASTExpression* expr, int depth) {
+    FlatAST flat = {};
+    FlatIndex index = flatten_expression(&flat, expr, false);
+    print_flat(&flat, index, depth);
+    flat_cleanup(&flat);
+}
+
+void print_flat(const FlatAST* flat, FlatIndex index, int depth) {
+    const FlatNode* node = flat_node(flat, index);
+    switch(node->kind) {
+        case FLAT_NONE: {
+            log__dump("NONE\n");
+        } break;
+        case FLAT_BLOCK: {
+            log__dump("BLOCK\n");
+            print_block_declarations(flat_block(flat, node), depth);
+            for (int i=0;i<flat_list_len(flat, node->b);i++) {
                 print_indent(depth);
-                print_expression(expr->expressions.ptr[i], depth + 1);
+                print_flat(flat, flat_list_get(flat, node->b, i), depth + 1);
             }
         } break;
-        case EXPR_FOR: {
-            ASTExpression_For* expr = (ASTExpression_For*)_expr;
-            printf("FOR\n");
-            
+        case FLAT_FOR: {
+            log__dump("FOR\n");
+
             print_indent(depth);
-            printf("item: %s\n", expr->item_name.ptr);
+            log__dump("item: %s\n", interner_name(print_interner, flat_extra(flat, node->b, 1)));
             print_indent(depth);
-            printf("index: %s\n", expr->index_name.ptr);
+            log__dump("index: %s\n", interner_name(print_interner, flat_extra(flat, node->b, 2)));
 
             print_indent(depth);
-            printf("condition: ");
-            print_expression(expr->condition_expr, depth + 1);
+            log__dump("condition: ");
+            print_flat(flat, node->a, depth + 1);
 
             print_indent(depth);
-            printf("body: ");
-            print_expression(expr->body_expr, depth + 1);
+            log__dump("body: ");
+            print_flat(flat, flat_extra(flat, node->b, 0), depth + 1);
         } break;
-        case EXPR_WHILE: {
-            ASTExpression_While* expr = (ASTExpression_While*)_expr;
-            printf("WHILE\n");
-            
+        case FLAT_WHILE: {
+            log__dump("WHILE\n");
+
             print_indent(depth);
-            printf("condition: ");
-            print_expression(expr->condition_expr, depth + 1);
+            log__dump("condition: ");
+            print_flat(flat, node->a, depth + 1);
 
             print_indent(depth);
-            printf("body: ");
-            print_expression(expr->body_expr, depth + 1);
+            log__dump("body: ");
+            print_flat(flat, node->b, depth + 1);
         } break;
-        case EXPR_IF: {
-            ASTExpression_If* expr = (ASTExpression_If*)_expr;
-            printf("IF\n");
-            
+        case FLAT_IF: {
+            log__dump("IF\n");
+
             print_indent(depth);
-            printf("condition: ");
-            print_expression(expr->condition_expr, depth + 1);
+            log__dump("condition: ");
+            print_flat(flat, node->a, depth + 1);
 
             print_indent(depth);
-            printf("body: ");
-            print_expression(expr->body_expr, depth + 1);
-            
+            log__dump("body: ");
+            print_flat(flat, flat_extra(flat, node->b, 0), depth + 1);
+
             print_indent(depth);
-            printf("else: ");
-            print_expression(expr->else_expr, depth + 1);
+            log__dump("else: ");
+            print_flat(flat, flat_extra(flat, node->b, 1), depth + 1);
         } break;
-        case EXPR_SWITCH: {
-            ASTExpression_Switch* expr = (ASTExpression_Switch*)_expr;
-            printf("SWITCH\n");
-            
+        case FLAT_SWITCH: {
+            log__dump("SWITCH\n");
+
             print_indent(depth);
-            printf("selector: ");
-            print_expression(expr->selector, depth + 1);
-            
-            for (int i=0;i<expr->cases.len;i++) {
+            log__dump("selector: ");
+            print_flat(flat, node->a, depth + 1);
+
+            for (int i=0;i<flat_list_len(flat, node->b);i++) {
+                const FlatNode* case_node = flat_node(flat, flat_list_get(flat, node->b, i));
+                int conditions = flat_list_len(flat, case_node->a);
                 print_indent(depth);
-                if (expr->cases.ptr[i].conditions.len != 0) {
-                    printf("case_%d: ", i);
+                if (conditions != 0) {
+                    log__dump("case_%d: ", i);
                 }
-                for (int ic=0;ic<expr->cases.ptr[i].conditions.len;ic++) {
-                    print_expression(expr->cases.ptr[i].conditions.ptr[ic], depth + 2);
+                for (int ic=0;ic<conditions;ic++) {
+                    print_flat(flat, flat_list_get(flat, case_node->a, ic), depth + 2);
                 }
-                if (expr->cases.ptr[i].conditions.len == 0) {
-                    printf("default:\n");
+                if (conditions == 0) {
+                    log__dump("default:\n");
                 }
                 print_indent(depth+1);
-                if (expr->cases.ptr[i].body) {
-                    print_expression(expr->cases.ptr[i].body, depth + 2);
+                if (case_node->b) {
+                    print_flat(flat, case_node->b, depth + 2);
                 } else {
-                    printf("empty");
+                    log__dump("empty");
                 }
             }
         } break;
-        case EXPR_CALL: {
-            ASTExpression_Call* expr = (ASTExpression_Call*)_expr;
-            printf("CALL ");
-            print_expression(expr->expr, depth + 1);
+        case FLAT_CALL: {
+            log__dump("CALL ");
+            print_flat(flat, node->a, depth + 1);
 
-            for (int i=0;i<expr->polymorphic_args.len;i++) {
+            u32 polyargs  = flat_extra(flat, node->b, 0);
+            u32 arguments = flat_extra(flat, node->b, 1);
+            for (int i=0;i<flat_list_len(flat, polyargs);i++) {
                 print_indent(depth);
-                printf("polyarg%d: ", i);
-                print_expression(expr->polymorphic_args.ptr[i].expr, depth + 1);
+                log__dump("polyarg%d: ", i);
+                print_flat(flat, flat_list_get(flat, polyargs, i), depth + 1);
             }
 
-            for (int i=0;i<expr->arguments.len;i++) {
+            for (int i=0;i<flat_list_len(flat, arguments);i++) {
+                const FlatNode* arg = flat_node(flat, flat_list_get(flat, arguments, i));
                 print_indent(depth);
 
-                if (expr->arguments.ptr[i].name.ptr)
-                    printf("%s: ", expr->arguments.ptr[i].name.ptr);
+                if (arg->a)
+                    log__dump("%s: ", interner_name(print_interner, arg->a));
                 else
-                    printf("arg%d: ", i);
-                print_expression(expr->arguments.ptr[i].expr, depth + 1);
-            }
-        } break;
-        case EXPR_RETURN: {
-            ASTExpression_Return* expr = (ASTExpression_Return*)_expr;
-            printf("RETURN\n");
-
-            for (int i=0;i<expr->exprs.len;i++) {
-                print_indent(depth);
-                print_expression(expr->exprs.ptr[i], depth + 1);
+                    log__dump("arg%d: ", i);
+                print_flat(flat, arg->b, depth + 1);
             }
         } break;
-        case EXPR_YIELD: {
-            ASTExpression_Yield* expr = (ASTExpression_Yield*)_expr;
-            printf("YIELD\n");
+        case FLAT_RETURN:
+        case FLAT_YIELD: {
+            log__dump(node->kind == FLAT_RETURN ? "RETURN\n" : "YIELD\n");
 
-            for (int i=0;i<expr->exprs.len;i++) {
+            for (int i=0;i<flat_list_len(flat, node->a);i++) {
                 print_indent(depth);
-                print_expression(expr->exprs.ptr[i], depth + 1);
+                print_flat(flat, flat_list_get(flat, node->a, i), depth + 1);
             }
         } break;
-        case EXPR_CONTINUE: {
-            printf("CONTINUE\n");
+        case FLAT_CONTINUE: {
+            log__dump("CONTINUE\n");
         } break;
-        case EXPR_BREAK: {
-            printf("BREAK\n");
+        case FLAT_BREAK: {
+            log__dump("BREAK\n");
         } break;
-        case EXPR_ASSEMBLY: {
-            printf("ASSEMBLY\n");
+        case FLAT_ASSEMBLY: {
+            log__dump("ASSEMBLY\n");
         } break;
-        case EXPR_ASSIGN: {
-            ASTExpression_Assign* expr = (ASTExpression_Assign*)_expr;
-            printf("ASSIGN\n");
-            
+        case FLAT_ASSIGN: {
+            log__dump("ASSIGN\n");
+
             print_indent(depth);
-            print_expression(expr->ref, depth + 1);
-            
+            print_flat(flat, node->a, depth + 1);
+
             print_indent(depth);
-            print_expression(expr->value, depth + 1);
+            print_flat(flat, node->b, depth + 1);
         } break;
-        case EXPR_MEMBER: {
-            ASTExpression_Member* expr = (ASTExpression_Member*)_expr;
-            printf("MEMBER %s\n", expr->name.ptr);
-            
+        case FLAT_MEMBER: {
+            log__dump("MEMBER %s\n", interner_name(print_interner, node->b));
+
             print_indent(depth);
-            print_expression(expr->expr, depth + 1);
+            print_flat(flat, node->a, depth + 1);
         } break;
-        case EXPR_IDENTIFIER: {
-            ASTExpression_Identifier* expr = (ASTExpression_Identifier*)_expr;
-            printf("IDENTIFIER %s\n", expr->name.ptr);
+        case FLAT_IDENTIFIER: {
+            log__dump("IDENTIFIER %s\n", interner_name(print_interner, node->a));
         } break;
-        case EXPR_INITIALIZER: {
-            ASTExpression_Initializer* expr = (ASTExpression_Initializer*)_expr;
-            printf("INITIALIZER\n");
+        case FLAT_INITIALIZER: {
+            log__dump("INITIALIZER\n");
 
-            for (int i=0;i<expr->elements.len;i++) {
+            for (int i=0;i<flat_list_len(flat, node->a);i++) {
+                const FlatNode* element = flat_node(flat, flat_list_get(flat, node->a, i));
                 print_indent(depth);
-                if (expr->elements.ptr[i].name.len)
-                    printf("%s: ", expr->elements.ptr[i].name.ptr);
-                print_expression(expr->elements.ptr[i].expr, depth + 1);
+                if (element->a)
+                    log__dump("%s: ", interner_name(print_interner, element->a));
+                print_flat(flat, element->b, depth + 1);
             }
         } break;
-        case EXPR_LITERAL: {
-            ASTExpression_Literal* expr = (ASTExpression_Literal*)_expr;
-            switch (expr->literal_kind) {
+        case FLAT_LITERAL: {
+            switch (node->sub_kind) {
                 case EXPR_LITERAL_INTEGER:
-                    printf("LITERAL %lld\n", (long long int)expr->int_value);
+                    log__dump("LITERAL %lld\n", (long long int)flat_int(node));
                     break;
                 case EXPR_LITERAL_FLOAT:
-                    printf("LITERAL %lf\n", expr->float_value);
+                    log__dump("LITERAL %lf\n", flat_float(node));
                     break;
                 case EXPR_LITERAL_STRING:
-                    printf("LITERAL \"%s\"\n", expr->string_value.ptr);
+                    log__dump("LITERAL \"%s\"\n", flat_string(flat, node->a).ptr);
                     break;
-                default: fprintf(stderr, "print literal, missing literal kind %d\n", expr->literal_kind); ASSERT(false);
+                default: fprintf(stderr, "print literal, missing literal kind %d\n", node->sub_kind); ASSERT(false);
             }
         } break;
-        case EXPR_UNARY: {
-            ASTExpression_Unary* expr = (ASTExpression_Unary*)_expr;
-            switch (expr->op_kind) {
-                       case EXPR_OP_ADDRESS_OF:     printf("ADDRESS_OF\n");
-                break; case EXPR_OP_DEREF:          printf("DEREF\n");
-                break; case EXPR_OP_BITWISE_NEGATE: printf("BITWISE_NEGATE\n");
-                break; case EXPR_OP_LOGICAL_NOT:    printf("LOGICAL_NOT\n");
-                break; case EXPR_OP_SUB:            printf("SUB\n");
-                break; default: fprintf(stderr, "print unary, missing op kind %d\n", expr->op_kind); ASSERT(false);
-            }
+        case FLAT_UNARY: {
+            print_unary_operator(node->sub_kind);
             print_indent(depth);
-            print_expression(expr->expr, depth + 1);
+            print_flat(flat, node->a, depth + 1);
         } break;
-        case EXPR_BINARY: {
-            ASTExpression_Binary* expr = (ASTExpression_Binary*)_expr;
-            switch (expr->op_kind) {
-                       case EXPR_OP_ADD:            printf("ADD\n");
-                break; case EXPR_OP_SUB:            printf("SUB\n");
-                break; case EXPR_OP_MUL:            printf("MUL\n");
-                break; case EXPR_OP_DIV:            printf("DIV\n");
-                break; case EXPR_OP_MODULO:         printf("MODULO\n");
-                break; case EXPR_OP_LESS:           printf("LESS\n");
-                break; case EXPR_OP_GREATER:        printf("GREATER\n");
-                break; case EXPR_OP_LESS_EQUAL:     printf("LESS_EQUAL\n");
-                break; case EXPR_OP_GREATER_EQUAL:  printf("GREATER_EQUAL\n");
-                break; case EXPR_OP_EQUAL:          printf("EQUAL\n");
-                break; case EXPR_OP_NOT_EQUAL:      printf("NOT_EQUAL\n");
-                break; case EXPR_OP_BITWISE_OR:     printf("BITWISE_OR\n");
-                break; case EXPR_OP_BITWISE_AND:    printf("BITWISE_AND\n");
-                break; case EXPR_OP_BITWISE_XOR:    printf("BITWISE_XOR\n");
-                break; case EXPR_OP_BITWISE_LSHIFT: printf("BITWISE_LSHIFT\n");
-                break; case EXPR_OP_BITWISE_RSHIFT: printf("BITWISE_RSHIFT\n");
-                break; case EXPR_OP_LOGICAL_AND:    printf("LOGICAL_AND\n");
-                break; case EXPR_OP_LOGICAL_OR:     printf("LOGICAL_OR\n");
-                break; default: fprintf(stderr, "print unary, missing op kind %d\n", expr->op_kind); ASSERT(false);
-            }
+        case FLAT_BINARY: {
+            print_binary_operator(node->sub_kind);
             print_indent(depth);
-            print_expression(expr->left, depth + 1);
+            print_flat(flat, node->a, depth + 1);
             print_indent(depth);
-            print_expression(expr->right, depth + 1);
+            print_flat(flat, node->b, depth + 1);
         } break;
-        default: fprintf(stderr, "print_expression, missing expr kind %d\n", _expr->kind); ASSERT(false);
+        default: fprintf(stderr, "print_flat, missing node kind %d\n", node->kind); ASSERT(false);
     }
 }
 void print_function(ASTFunction* func, int depth) {
-    printf("FUNCTION %s\n", func->name.ptr);
+    log__dump("FUNCTION %s\n", interner_name(print_interner, func->name));
 
     // for (int i=0;i<func->parameters.len;i++) {
     //     print_indent(depth);
@@ -379,32 +461,32 @@ void print_function(ASTFunction* func, int depth) {
     //     print_struct(expr->structs.ptr[i], depth + 1);
     // }
 
-    if (func->body) {
-        // no body means external function
+    // no body means external function
+    if (func->flat_body) {
         print_indent(depth);
-        print_expression(func->body, depth + 1);
+        print_flat(func->flat, func->flat_body, depth + 1);
     }
 }
 void print_struct(ASTStruct* struc, int depth) {
-    printf("STRUCT %s\n", struc->name.ptr);
+    log__dump("STRUCT %s\n", interner_name(print_interner, struc->name));
 }
 void print_enum(ASTEnum* enu, int depth) {
-    printf("ENUM %s : %s\n", enu->name.ptr, enu->type_name.ptr);
+    log__dump("ENUM %s : %s\n", interner_name(print_interner, enu->name), enu->type_name.ptr);
 }
 void print_global(ASTGlobal* object, int depth) {
-    printf("GLOBAL %s : %s\n", object->name.ptr, object->type_name.ptr);
+    log__dump("GLOBAL %s : %s\n", interner_name(print_interner, object->name), object->type_name.ptr);
     if (object->value)
         print_expression(object->value, depth + 1);
 }
 void print_constant(ASTConstant* object, int depth) {
-    printf("CONST %s : %s\n", object->name.ptr, object->type_name.ptr);
+    log__dump("CONST %s : %s\n", interner_name(print_interner, object->name), object->type_name.ptr);
     print_expression(object->value, depth + 1);
 }
 void print_variable(ASTVariable* object, int depth) {
-    printf("VARIABLE %s : %s\n", object->name.ptr, object->type_name.ptr);
+    log__dump("VARIABLE %s : %s\n", interner_name(print_interner, object->name), object->type_name.ptr);
 }
 void print_import(ASTImport* imp, int depth) {
-    printf("IMPORT %s (shared: %d)\n", imp->name.ptr, (int)imp->shared);
+    log__dump("IMPORT %s (shared: %d)\n", interner_name(print_interner, imp->name), (int)imp->shared);
 }
 
 
@@ -2,8 +2,10 @@
 
 #include "basin/common.h"
 #include "basin/frontend/lexer.h" // SourceLocation
+#include "basin/frontend/flat_ast.h"
 #include "basin/backend/ir.h"
 #include "util/array.h"
+#include "util/arena.h"
 
 #define DEBUG_BUILD
 
@@ -91,7 +93,7 @@ typedef struct {
     NODE_BASE
 
     ASTExpression* expr;
-    string name;
+    Atom   name;
 } ASTExpression_Member;
 
 typedef struct {
@@ -130,7 +132,7 @@ typedef struct {
 } ASTExpression_Literal;
 
 typedef struct {
-    string name;
+    Atom   name;
     ASTExpression* expr;
 } ASTExpression_Initializer_Element;
 
@@ -146,13 +148,13 @@ typedef struct {
 typedef struct {
     NODE_BASE
 
-    string name;
+    Atom   name;
 
 } ASTExpression_Identifier;
 
 typedef struct {
     SourceLocation location; // points at name if exists, otherwise expr
-    string name; // named argument
+    Atom   name; // named argument
     ASTExpression* expr;
 } ASTExpression_Call_Argument;
 
@@ -176,14 +178,8 @@ typedef struct {
 
 typedef struct ASTExpression_Block ASTExpression_Block;
 
-// Memory owner
-typedef struct AST {
-    TokenStream* stream;
-    ASTExpression_Block* global_block;
-} AST;
-
 typedef struct ASTAnnotation {
-    string name;
+    Atom   name;
     string content;
 } ASTAnnotation;
 
@@ -199,8 +195,8 @@ typedef ASTExpression ASTExpression_Break;
 typedef struct {
     NODE_BASE
 
-    string index_name;
-    string item_name;
+    Atom   index_name;
+    Atom   item_name;
 
     ASTExpression* condition_expr;
     ASTExpression* body_expr;
@@ -268,7 +264,7 @@ typedef struct {
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     ASTType type_name;
     ASTExpression* default_value;
 } ASTFunction_Parameter;
@@ -277,47 +273,50 @@ DEF_ARRAY(ASTFunction_Parameter);
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     ASTType type_name;
     ASTExpression* default_value;
 } ASTStruct_Field;
 
 DEF_ARRAY(ASTStruct_Field);
 
-typedef struct {
+typedef struct ASTFunction {
     SourceLocation location;
-    string name;
+    Atom   name;
     FunctionSignature signature;
     Array_ASTFunction_Parameter parameters;
     Array_ASTFunction_Parameter return_values;
-    ASTExpression* body;
+    FlatIndex      flat_body; // body in 'flat', zero if the function has no body (external)
+    const FlatAST* flat;      // AST.flat of the file or of the body part the body was parsed in
 
-    IRFunction_id ir_function_id;
+    // Index in AST.functions. The AST is shared between compilations so
+    // the IR function id is looked up with comp_function_id.
+    u32 function_index;
 } ASTFunction;
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     ASTType type_name;
     ASTExpression* value;
 } ASTGlobal, ASTConstant;
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     ASTType type_name;
     int frame_offset;
 } ASTVariable;
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     Array_ASTStruct_Field fields;
 } ASTStruct;
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     ASTExpression* default_value;
 } ASTEnum_Member;
 
@@ -325,7 +324,7 @@ DEF_ARRAY(ASTEnum_Member);
 
 typedef struct {
     SourceLocation location;
-    string name;
+    Atom   name;
     ASTType type_name; // base type, i8,u32...
     Array_ASTEnum_Member members;
     bool share;
@@ -334,7 +333,7 @@ typedef struct {
 
 typedef struct {
     SourceLocation location;
-    string         name; // may be empty otherwise name comes from 'import "util" as name'
+    Atom           name; // may be zero otherwise name comes from 'import "util" as name'
     bool           shared;
     Import*        import;
 } ASTImport;
@@ -342,7 +341,7 @@ typedef struct {
 
 typedef struct {
     SourceLocation location;
-    string name;         // as name
+    Atom   name;         // as name
     string library_name;
 } ASTLibrary;
 
@@ -364,6 +363,71 @@ DEF_ARRAY(ASTGlobalP)
 DEF_ARRAY(ASTImport)
 DEF_ARRAY(ASTLibrary)
 
+// Body of a top-level function that parse_stream skipped, parsed later by parse_body_batch
+typedef struct {
+    ASTFunction*         function;
+    ASTExpression_Block* parent; // block the function is declared in
+    int                  token;  // the '{' of the body
+    int                  tokens; // tokens in the body, braces included
+    int                  functions; // functions declared in the body, set by parse_body_batch
+} SkippedBody;
+
+DEF_ARRAY(SkippedBody)
+
+typedef AST* ASTP;
+DEF_ARRAY(ASTP)
+
+// Memory owner, nodes, names and arrays in the nodes are allocated in the arena.
+// Freed with ast_cleanup, the nodes are never freed one by one.
+typedef struct AST {
+    Arena arena;
+    FlatAST flat; // function bodies
+    TokenStream* stream;
+    ASTExpression_Block* global_block;
+    Array_ImportP imports;        // every import in the file, from all blocks
+    Array_ASTFunctionP functions; // every function in the file in the order they were parsed
+
+    // Bodies skipped by the file scope pass, empty once they are joined (see join_body_batches).
+    Array_SkippedBody skipped_bodies;
+    // Nodes of bodies parsed by other tasks. A part is an AST without a
+    // stream or global block, its functions and imports are moved to the file's AST.
+    Array_ASTP        body_parts;
+} AST;
+
+// Frees the AST, its nodes, its body parts and its token stream
+void ast_cleanup(AST* ast);
+
+// Adds the expression and everything below it to the flat AST, returns its node.
+// With detach the blocks forget their expressions, done when the pointer nodes are freed.
+FlatIndex flatten_expression(FlatAST* flat, ASTExpression* expr, bool detach);
+
+
+typedef enum {
+    FOUND_NONE = 0,
+    FOUND_VARIABLE,
+    FOUND_GLOBAL,
+    FOUND_CONSTANT,
+    FOUND_FUNCTION,
+    FOUND_IMPORT,
+    FOUND_LIBRARY,
+    FOUND_STRUCT,
+    FOUND_ENUM,
+    FOUND_ENUM_MEMBER,
+} FoundKind;
+
+// Declaration in the scope of a block
+typedef struct {
+    Atom      name; // zero if the slot is empty
+    FoundKind kind;
+    void*     decl; // ASTVariable, ASTFunction... depending on kind
+} ScopeEntry;
+
+// Open addressing table from name to declaration
+typedef struct {
+    ScopeEntry* slots; // allocated in the AST's arena
+    u32         cap;   // power of two, zero if the block declares nothing
+    u32         len;
+} ScopeTable;
 
 struct ASTExpression_Block {
     NODE_BASE
@@ -385,22 +449,14 @@ struct ASTExpression_Block {
     Array_ASTEnumP       enums;
     Array_ASTStructP     structs;
 
+    // Declarations above (and members of shared enums) by name, imports aren't in it.
+    // Built when the block has been parsed.
+    ScopeTable           scope;
+
     // list of expressions
     Array_ASTExpressionP expressions;
 };
 
-typedef enum {
-    FOUND_NONE = 0,
-    FOUND_VARIABLE,
-    FOUND_GLOBAL,
-    FOUND_CONSTANT,
-    FOUND_FUNCTION,
-    FOUND_IMPORT,
-    FOUND_LIBRARY,
-    FOUND_STRUCT,
-    FOUND_ENUM,
-    FOUND_ENUM_MEMBER,
-} FoundKind;
 typedef struct {
     FoundKind        kind;
     ASTVariable*     f_variable;
@@ -415,15 +471,22 @@ typedef struct {
 
     ASTExpression_Block* block;
 } FindResult;
-bool find_identifier(cstring name, AST* ast, ASTExpression_Block* block, FindResult* result);
+bool find_identifier(Atom name, AST* ast, ASTExpression_Block* block, FindResult* result);
+
+// Fills in block->scope from the declarations in the block.
+// Returns false if two declarations have the same name, duplicate is the one later in the file.
+bool build_scope_table(Arena* arena, ASTExpression_Block* block, ScopeEntry* duplicate);
+// Location of the declaration in the entry
+SourceLocation scope_entry_location(const ScopeEntry* entry);
 
 // returns index of parameter
 // -1 if not found
-int find_function_parameter(cstring name, ASTFunction* func);
+int find_function_parameter(Atom name, ASTFunction* func);
 
 
 void print_ast(AST* ast);
 void print_expression(ASTExpression* expr, int depth);
+void print_flat(const FlatAST* flat, FlatIndex index, int depth);
 void print_import(ASTImport* imp, int depth);
 void print_function(ASTFunction* func, int depth);
 void print_struct(ASTStruct* struc, int depth);
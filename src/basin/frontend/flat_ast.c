@@ -0,0 +1,262 @@
+#include "basin/frontend/flat_ast.h"
+
+#include "basin/frontend/ast.h"
+
+void flat_cleanup(FlatAST* flat) {
+    array_cleanup(&flat->nodes);
+    array_cleanup(&flat->extra);
+    array_cleanup(&flat->data);
+    array_cleanup(&flat->blocks);
+    memset(flat, 0, sizeof(*flat));
+}
+
+static void shrink_array(Array* array, int element_size) {
+    if (array->len == 0 || array->len == array->cap)
+        return;
+    array->ptr = mem__realloc(array->len * element_size, array->ptr);
+    array->cap = array->len;
+}
+
+void flat_shrink(FlatAST* flat) {
+    shrink_array((Array*)&flat->nodes,  sizeof(*flat->nodes.ptr));
+    shrink_array((Array*)&flat->extra,  sizeof(*flat->extra.ptr));
+    shrink_array((Array*)&flat->data,   sizeof(*flat->data.ptr));
+    shrink_array((Array*)&flat->blocks, sizeof(*flat->blocks.ptr));
+}
+
+// Node 0 and the empty list
+static inline void flat_prepare(FlatAST* flat) {
+    if (flat->nodes.len != 0)
+        return;
+    FlatNode none = {};
+    array_push(&flat->nodes, &none);
+    u32 empty = 0;
+    array_push(&flat->extra, &empty);
+}
+
+FlatIndex flat_add_node(FlatAST* flat, FlatKind kind, u8 sub_kind, SourceLocation location) {
+    flat_prepare(flat);
+    ASSERT(flat->nodes.len == 1 || flat->import_id == location.import_id);
+    flat->import_id = location.import_id;
+
+    FlatNode node = {};
+    node.kind     = kind;
+    node.sub_kind = sub_kind;
+    node.position = location.position;
+    array_push(&flat->nodes, &node);
+    return flat->nodes.len - 1;
+}
+
+u32 flat_add_extra(FlatAST* flat, int count) {
+    flat_prepare(flat);
+    u32 first = flat->extra.len;
+    for (int i=0;i<count;i++)
+        array_pushv(&flat->extra, 0);
+    return first;
+}
+
+u32 flat_add_list(FlatAST* flat, int count) {
+    if (count == 0)
+        return 0; // the empty list
+    u32 list = flat_add_extra(flat, 1 + count);
+    flat->extra.ptr[list] = count;
+    return list;
+}
+
+u32 flat_add_string(FlatAST* flat, const char* ptr, int len) {
+    u32 offset = flat->data.len;
+    for (int i=0;i<len;i++)
+        array_pushv(&flat->data, ptr[i]);
+    array_pushv(&flat->data, '\0');
+
+    u32 str = flat_add_extra(flat, 2);
+    flat->extra.ptr[str]     = offset;
+    flat->extra.ptr[str + 1] = len;
+    return str;
+}
+
+static inline void flat_set(FlatAST* flat, FlatIndex index, u32 a, u32 b) {
+    flat->nodes.ptr[index].a = a;
+    flat->nodes.ptr[index].b = b;
+}
+
+// Children are added after the parent, the parent is filled in when they are done.
+// Adding nodes may move the arrays, results are stored in locals before they are written.
+FlatIndex flatten_expression(FlatAST* flat, ASTExpression* _expr, bool detach) {
+    if (!_expr)
+        return 0;
+
+    switch(_expr->kind) {
+        case EXPR_BLOCK: {
+            ASTExpression_Block* expr = (ASTExpression_Block*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_BLOCK, 0, expr->location);
+            u32 block_index = flat->blocks.len;
+            array_push(&flat->blocks, &expr);
+
+            u32 list = flat_add_list(flat, expr->expressions.len);
+            for (int i=0;i<expr->expressions.len;i++)
+                flat_set_item(flat, list, i, flatten_expression(flat, expr->expressions.ptr[i], detach));
+            flat_set(flat, node, block_index, list);
+
+            // The block is kept for its declarations, the expressions go away with the parser's arena
+            if (detach)
+                memset(&expr->expressions, 0, sizeof(expr->expressions));
+            return node;
+        }
+        case EXPR_FOR: {
+            ASTExpression_For* expr = (ASTExpression_For*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_FOR, 0, expr->location);
+            u32 extra = flat_add_extra(flat, 3);
+            FlatIndex condition = flatten_expression(flat, expr->condition_expr, detach);
+            FlatIndex body      = flatten_expression(flat, expr->body_expr, detach);
+            flat->extra.ptr[extra]     = body;
+            flat->extra.ptr[extra + 1] = expr->item_name;
+            flat->extra.ptr[extra + 2] = expr->index_name;
+            flat_set(flat, node, condition, extra);
+            return node;
+        }
+        case EXPR_WHILE: {
+            ASTExpression_While* expr = (ASTExpression_While*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_WHILE, 0, expr->location);
+            FlatIndex condition = flatten_expression(flat, expr->condition_expr, detach);
+            FlatIndex body      = flatten_expression(flat, expr->body_expr, detach);
+            flat_set(flat, node, condition, body);
+            return node;
+        }
+        case EXPR_IF: {
+            ASTExpression_If* expr = (ASTExpression_If*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_IF, 0, expr->location);
+            u32 extra = flat_add_extra(flat, 2);
+            FlatIndex condition = flatten_expression(flat, expr->condition_expr, detach);
+            FlatIndex body      = flatten_expression(flat, expr->body_expr, detach);
+            FlatIndex else_body = flatten_expression(flat, expr->else_expr, detach);
+            flat->extra.ptr[extra]     = body;
+            flat->extra.ptr[extra + 1] = else_body;
+            flat_set(flat, node, condition, extra);
+            return node;
+        }
+        case EXPR_SWITCH: {
+            ASTExpression_Switch* expr = (ASTExpression_Switch*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_SWITCH, 0, expr->location);
+            FlatIndex selector = flatten_expression(flat, expr->selector, detach);
+            u32 cases = flat_add_list(flat, expr->cases.len);
+            for (int i=0;i<expr->cases.len;i++) {
+                ASTExpression_Switch_Case* switch_case = &expr->cases.ptr[i];
+                // Cases don't have a location of their own
+                FlatIndex case_node = flat_add_node(flat, FLAT_CASE, 0, expr->location);
+                u32 conditions = flat_add_list(flat, switch_case->conditions.len);
+                for (int j=0;j<switch_case->conditions.len;j++)
+                    flat_set_item(flat, conditions, j, flatten_expression(flat, switch_case->conditions.ptr[j], detach));
+                FlatIndex body = flatten_expression(flat, switch_case->body, detach);
+                flat_set(flat, case_node, conditions, body);
+                flat_set_item(flat, cases, i, case_node);
+            }
+            flat_set(flat, node, selector, cases);
+            return node;
+        }
+        case EXPR_CALL: {
+            ASTExpression_Call* expr = (ASTExpression_Call*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_CALL, 0, expr->location);
+            u32 extra = flat_add_extra(flat, 2);
+            FlatIndex callee = flatten_expression(flat, expr->expr, detach);
+
+            u32 polyargs = flat_add_list(flat, expr->polymorphic_args.len);
+            for (int i=0;i<expr->polymorphic_args.len;i++)
+                flat_set_item(flat, polyargs, i, flatten_expression(flat, expr->polymorphic_args.ptr[i].expr, detach));
+
+            u32 arguments = flat_add_list(flat, expr->arguments.len);
+            for (int i=0;i<expr->arguments.len;i++) {
+                ASTExpression_Call_Argument* arg = &expr->arguments.ptr[i];
+                FlatIndex arg_node = flat_add_node(flat, FLAT_NAMED, 0, arg->location);
+                flat_set(flat, arg_node, arg->name, flatten_expression(flat, arg->expr, detach));
+                flat_set_item(flat, arguments, i, arg_node);
+            }
+            flat->extra.ptr[extra]     = polyargs;
+            flat->extra.ptr[extra + 1] = arguments;
+            flat_set(flat, node, callee, extra);
+            return node;
+        }
+        case EXPR_RETURN:
+        case EXPR_YIELD: {
+            ASTExpression_Return* expr = (ASTExpression_Return*)_expr;
+            FlatIndex node = flat_add_node(flat, expr->kind == EXPR_RETURN ? FLAT_RETURN : FLAT_YIELD, 0, expr->location);
+            u32 list = flat_add_list(flat, expr->exprs.len);
+            for (int i=0;i<expr->exprs.len;i++)
+                flat_set_item(flat, list, i, flatten_expression(flat, expr->exprs.ptr[i], detach));
+            flat_set(flat, node, list, 0);
+            return node;
+        }
+        case EXPR_CONTINUE: return flat_add_node(flat, FLAT_CONTINUE, 0, _expr->location);
+        case EXPR_BREAK:    return flat_add_node(flat, FLAT_BREAK,    0, _expr->location);
+        case EXPR_ASSEMBLY: return flat_add_node(flat, FLAT_ASSEMBLY, 0, _expr->location);
+        case EXPR_ASSIGN: {
+            ASTExpression_Assign* expr = (ASTExpression_Assign*)_expr;
+            FlatIndex node  = flat_add_node(flat, FLAT_ASSIGN, 0, expr->location);
+            FlatIndex ref   = flatten_expression(flat, expr->ref, detach);
+            FlatIndex value = flatten_expression(flat, expr->value, detach);
+            flat_set(flat, node, ref, value);
+            return node;
+        }
+        case EXPR_MEMBER: {
+            ASTExpression_Member* expr = (ASTExpression_Member*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_MEMBER, 0, expr->location);
+            flat_set(flat, node, flatten_expression(flat, expr->expr, detach), expr->name);
+            return node;
+        }
+        case EXPR_CAST: {
+            ASTExpression_Cast* expr = (ASTExpression_Cast*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_CAST, 0, expr->location);
+            FlatIndex value = flatten_expression(flat, expr->expr, detach);
+            flat_set(flat, node, value, flat_add_string(flat, expr->type_name.ptr, expr->type_name.len));
+            return node;
+        }
+        case EXPR_IDENTIFIER: {
+            ASTExpression_Identifier* expr = (ASTExpression_Identifier*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_IDENTIFIER, 0, expr->location);
+            flat_set(flat, node, expr->name, 0);
+            return node;
+        }
+        case EXPR_INITIALIZER: {
+            ASTExpression_Initializer* expr = (ASTExpression_Initializer*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_INITIALIZER, 0, expr->location);
+            u32 list = flat_add_list(flat, expr->elements.len);
+            for (int i=0;i<expr->elements.len;i++) {
+                // Elements don't have a location of their own
+                FlatIndex element = flat_add_node(flat, FLAT_NAMED, 0, expr->location);
+                flat_set(flat, element, expr->elements.ptr[i].name, flatten_expression(flat, expr->elements.ptr[i].expr, detach));
+                flat_set_item(flat, list, i, element);
+            }
+            flat_set(flat, node, list, 0);
+            return node;
+        }
+        case EXPR_LITERAL: {
+            ASTExpression_Literal* expr = (ASTExpression_Literal*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_LITERAL, expr->literal_kind, expr->location);
+            u64 bits = 0;
+            switch (expr->literal_kind) {
+                case EXPR_LITERAL_INTEGER: bits = (u64)expr->int_value; break;
+                case EXPR_LITERAL_FLOAT:   memcpy(&bits, &expr->float_value, sizeof(bits)); break;
+                case EXPR_LITERAL_STRING:  bits = flat_add_string(flat, expr->string_value.ptr, expr->string_value.len); break;
+                default: ASSERT(false);
+            }
+            flat_set(flat, node, (u32)bits, (u32)(bits >> 32));
+            return node;
+        }
+        case EXPR_UNARY: {
+            ASTExpression_Unary* expr = (ASTExpression_Unary*)_expr;
+            FlatIndex node = flat_add_node(flat, FLAT_UNARY, expr->op_kind, expr->location);
+            flat_set(flat, node, flatten_expression(flat, expr->expr, detach), 0);
+            return node;
+        }
+        case EXPR_BINARY: {
+            ASTExpression_Binary* expr = (ASTExpression_Binary*)_expr;
+            FlatIndex node  = flat_add_node(flat, FLAT_BINARY, expr->op_kind, expr->location);
+            FlatIndex left  = flatten_expression(flat, expr->left, detach);
+            FlatIndex right = flatten_expression(flat, expr->right, detach);
+            flat_set(flat, node, left, right);
+            return node;
+        }
+        default: fprintf(stderr, "flatten_expression, missing expr kind %d\n", _expr->kind); ASSERT(false);
+    }
+    return 0;
+}
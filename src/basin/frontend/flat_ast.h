@@ -0,0 +1,131 @@
+/*
+    Flat representation of function bodies.
+
+    Nodes are 16 bytes, stored in one array per AST and linked by 32-bit indices.
+    Names, numbers and single children are stored in the node. Lists, strings
+    and nodes with more than two children use the side buffers. There are no
+    pointers (except to the scopes) so passes over a body walk a few arrays.
+
+    Nodes are stored in pre-order, a parent comes before its children.
+    Node 0 is FLAT_NONE and extra[0] is the empty list.
+
+    Declarations (variables, functions, structs...) stay in the ASTExpression_Block
+    of each block, FLAT_BLOCK refers to it for scope lookups.
+*/
+
+#pragma once
+
+#include "basin/common.h"
+#include "basin/frontend/lexer.h" // SourceLocation
+#include "util/array.h"
+
+// What a and b of a node are, 'list' and 'string' are indices into extra.
+typedef enum {
+    FLAT_NONE,        // missing node, the else of an if without one
+    FLAT_BLOCK,       // a: index in blocks, b: list of expressions
+    FLAT_FOR,         // a: condition, b: extra [body, item_name, index_name]
+    FLAT_WHILE,       // a: condition, b: body
+    FLAT_IF,          // a: condition, b: extra [body, else]
+    FLAT_SWITCH,      // a: selector, b: list of FLAT_CASE
+    FLAT_CASE,        // a: list of conditions (empty for default), b: body (may be none)
+    FLAT_CALL,        // a: callee, b: extra [list of polymorphic args, list of FLAT_NAMED]
+    FLAT_NAMED,       // a: name (zero if not named), b: expression. Arguments and initializer elements
+    FLAT_RETURN,      // a: list of expressions
+    FLAT_YIELD,       // a: list of expressions
+    FLAT_CONTINUE,
+    FLAT_BREAK,
+    FLAT_ASSEMBLY,
+    FLAT_ASSIGN,      // a: reference, b: value
+    FLAT_MEMBER,      // a: expression, b: name
+    FLAT_CAST,        // a: expression, b: string with the type name
+    FLAT_IDENTIFIER,  // a: name
+    FLAT_INITIALIZER, // a: list of FLAT_NAMED
+    FLAT_LITERAL,     // sub_kind: literal kind, a: string or a and b: low and high bits of the integer/float
+    FLAT_UNARY,       // sub_kind: operator, a: expression
+    FLAT_BINARY,      // sub_kind: operator, a: left, b: right
+} _FlatKind;
+
+typedef u8  FlatKind;
+typedef u32 FlatIndex;
+
+typedef struct {
+    FlatKind kind;
+    u8       sub_kind; // OperatorKind or LiteralKind
+    u16      _reserved;
+    int      position; // in the text of FlatAST.import_id
+    u32      a;
+    u32      b;
+} FlatNode;
+
+typedef struct ASTExpression_Block* ASTExpression_BlockP;
+
+DEF_ARRAY(FlatNode)
+DEF_ARRAY(u32)
+DEF_ARRAY(char)
+DEF_ARRAY(ASTExpression_BlockP)
+
+// Zero initialized is empty, the first node added sets up node 0 and extra[0].
+typedef struct FlatAST {
+    ImportID                   import_id;
+    Array_FlatNode             nodes;
+    Array_u32                  extra;  // lists are [count, items...], strings are [offset in data, length]
+    Array_char                 data;   // characters of strings, null terminated
+    Array_ASTExpression_BlockP blocks; // scope of each FLAT_BLOCK
+} FlatAST;
+
+void flat_cleanup(FlatAST* flat);
+// Frees the space the arrays grew into but didn't use, done when the AST is complete
+void flat_shrink(FlatAST* flat);
+
+// Building, the returned indices stay valid when more is added.
+FlatIndex flat_add_node(FlatAST* flat, FlatKind kind, u8 sub_kind, SourceLocation location);
+// Returns the list, items are zero until set with flat_set_item
+u32 flat_add_list(FlatAST* flat, int count);
+// Returns the first of 'count' zeroed extra slots
+u32 flat_add_extra(FlatAST* flat, int count);
+u32 flat_add_string(FlatAST* flat, const char* ptr, int len);
+
+static inline void flat_set_item(FlatAST* flat, u32 list, int index, u32 value) {
+    ASSERT_INDEX(index < (int)flat->extra.ptr[list]);
+    flat->extra.ptr[list + 1 + index] = value;
+}
+
+//##############################
+//      TRAVERSAL
+//##############################
+
+static inline const FlatNode* flat_node(const FlatAST* flat, FlatIndex index) {
+    return &flat->nodes.ptr[index];
+}
+static inline SourceLocation flat_location(const FlatAST* flat, FlatIndex index) {
+    SourceLocation loc = {};
+    loc.import_id = flat->import_id;
+    loc.position  = flat->nodes.ptr[index].position;
+    return loc;
+}
+static inline int flat_list_len(const FlatAST* flat, u32 list) {
+    return flat->extra.ptr[list];
+}
+static inline FlatIndex flat_list_get(const FlatAST* flat, u32 list, int index) {
+    ASSERT_INDEX(index < (int)flat->extra.ptr[list]);
+    return flat->extra.ptr[list + 1 + index];
+}
+static inline u32 flat_extra(const FlatAST* flat, u32 extra, int index) {
+    return flat->extra.ptr[extra + index];
+}
+static inline cstring flat_string(const FlatAST* flat, u32 str) {
+    cstring out = { flat->data.ptr + flat->extra.ptr[str], flat->extra.ptr[str + 1] };
+    return out;
+}
+static inline struct ASTExpression_Block* flat_block(const FlatAST* flat, const FlatNode* node) {
+    return flat->blocks.ptr[node->a];
+}
+static inline i64 flat_int(const FlatNode* node) {
+    return (i64)((u64)node->a | ((u64)node->b << 32));
+}
+static inline double flat_float(const FlatNode* node) {
+    u64 bits = (u64)node->a | ((u64)node->b << 32);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
@@ -1,18 +1,114 @@
 
 #include "basin/frontend/lexer.h"
+#include "basin/frontend/lexer_scan.h"
 
 #include "platform/platform.h"
 
 #include "util/string.h"
 #include "util/array.h"
 
-Result tokenize(const Import* import, TokenStream** out_stream) {
-    TracyCZone(zone, 1);
+#include <limits.h>
 
-    ASSERT(out_stream);
+// Keywords are found with a perfect hash on the length and the first and last character.
+// The table is built from token_name_table the first time we tokenize, a new keyword
+// only has to be added to _TokenKind and token_name_table.
+#define KEYWORD_HASH_SIZE 128
+
+// The hash is masked to the size and the slots hold the TokenKind in a byte. Half of the slots
+// free keeps the seed search short, it must find a seed (lexer_keywords test) or we abort.
+_Static_assert((KEYWORD_HASH_SIZE & (KEYWORD_HASH_SIZE - 1)) == 0, "KEYWORD_HASH_SIZE must be a power of two");
+_Static_assert((KEYWORD_END - KEYWORD_BEGIN) * 2 <= KEYWORD_HASH_SIZE, "Too many keywords for KEYWORD_HASH_SIZE, double it");
+_Static_assert(KEYWORD_END < 256, "TokenKind of keywords must fit in u8");
+
+static u8  keyword_table[KEYWORD_HASH_SIZE]; // TokenKind of each slot, T_END_OF_FILE if empty
+static u8  keyword_lens[KEYWORD_END];
+static u32 keyword_seed; // multiplier of the first character in the low byte, last character in the high byte
+static volatile u32 keyword_table_state; // 0 = not built, 1 = building, 2 = ready
+
+static inline u32 keyword_hash(u32 seed, const char* word, int len) {
+    u32 hash = (u8)word[0] * (seed & 0xFF) + (u8)word[len-1] * (seed >> 8) + len;
+    return hash & (KEYWORD_HASH_SIZE - 1);
+}
+
+static void build_keyword_table() {
+    for (int kind = KEYWORD_BEGIN; kind < KEYWORD_END; kind++) {
+        keyword_lens[kind] = strlen(token_name_table[kind]);
+    }
+    // Try multipliers until every keyword gets its own slot
+    for (u32 seed = 0x0101; seed <= 0xFFFF; seed++) {
+        if ((seed & 0xFF) == 0)
+            continue;
+        memset(keyword_table, 0, sizeof(keyword_table));
+        bool collision = false;
+        for (int kind = KEYWORD_BEGIN; kind < KEYWORD_END && !collision; kind++) {
+            u32 slot = keyword_hash(seed, token_name_table[kind], keyword_lens[kind]);
+            collision = keyword_table[slot] != 0;
+            keyword_table[slot] = kind;
+        }
+        if (!collision) {
+            keyword_seed = seed;
+            return;
+        }
+    }
+    // Every keyword would lex as an identifier, ASSERT may be compiled out
+    fprintf(stderr, "ERROR: No perfect hash for the keywords, increase KEYWORD_HASH_SIZE\n");
+    abort();
+}
+
+static void init_keyword_table() {
+    if (keyword_table_state == 2)
+        return;
+    if (atomic_cas(&keyword_table_state, 0, 1)) {
+        build_keyword_table();
+        atomic_store(&keyword_table_state, 2);
+    } else {
+        // Another thread is building it, takes a few microseconds
+        while (keyword_table_state != 2)
+            thread__sleep_ns(1000);
+    }
+}
+
+// Value of eight ASCII digits in one u64, combined in pairs, then fours, then all eight.
+static inline u64 parse_eight_digits(const char* digits) {
+    u64 chunk;
+    memcpy(&chunk, digits, sizeof(chunk));
+    chunk -= 0x3030303030303030ULL;
+    chunk = chunk * 10 + (chunk >> 8);
+    chunk = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+             (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return chunk;
+}
+
+// Value of [0-9] digits, eight at a time, false if it doesn't fit in 64 bits.
+static bool parse_decimal(const char* digits, int len, u64* out_value) {
+    u64 value = 0;
+    int i = 0;
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= len; i += 8) {
+        if (__builtin_mul_overflow(value, 100000000ULL, &value) || __builtin_add_overflow(value, parse_eight_digits(digits + i), &value))
+            return false;
+    }
+    #endif
+    for (; i < len; i++) {
+        if (__builtin_mul_overflow(value, 10ULL, &value) || __builtin_add_overflow(value, (u64)(digits[i] - '0'), &value))
+            return false;
+    }
+    *out_value = value;
+    return true;
+}
 
+// Returns the keyword or T_IDENTIFIER
+static inline TokenKind find_keyword(const char* word, int len) {
+    TokenKind kind = keyword_table[keyword_hash(keyword_seed, word, len)];
+    if (kind != T_END_OF_FILE && keyword_lens[kind] == len && !memcmp(token_name_table[kind], word, len))
+        return kind;
+    return T_IDENTIFIER;
+}
+
+static TokenStream* create_token_stream(Interner* interner, const Import* import, int tokens_max, int data_max) {
     TokenStream* stream = (TokenStream*)HEAP_ALLOC_OBJECT(TokenStream);
-    stream->import = import;
+    stream->import   = import;
+    stream->interner = interner;
     // if (optional_path) {
     //     stream->stream_path = *optional_path;
     // } else {
@@ -20,74 +116,120 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
     //     snprintf(buffer, sizeof(buffer), "<import_id %u>", (unsigned)import_id);
     //     stream->stream_path = alloc_string(buffer);
     // }
-    string text = {};
-    text.ptr = import->text.ptr;
-    text.len = import->text.len;
-
     stream->tokens_len = 0;
-    stream->tokens_max = text.len / 2 + 10;
-    stream->tokens = mem__alloc(stream->tokens_max * sizeof(Token));
+    stream->tokens_max = tokens_max;
+    stream->kinds     = mem__alloc(stream->tokens_max * sizeof(u8));
+    stream->flags     = mem__alloc(stream->tokens_max * sizeof(u8));
+    stream->positions = mem__alloc(stream->tokens_max * sizeof(u32));
+    stream->aux       = mem__alloc(stream->tokens_max * sizeof(u32));
     
     stream->data_len = 0;
-    stream->data_max = text.len / 2 + 100;
+    stream->data_max = data_max;
     stream->data = mem__alloc(stream->data_max);
+    return stream;
+}
 
-    array_init(&stream->line_positions, import->text.len / 40);
-
-    // TODO: Optimize by reusing the int array per thread
-    Array_int curly_depth;
-    array_init(&curly_depth, 10);
-    Array_int paren_depth;
-    array_init(&paren_depth, 10);
-
-    #define RESERVE_TOKEN() if (stream->tokens_len + 1 > stream->tokens_max) { stream->tokens = mem__realloc((stream->tokens_max*2 + 20) * sizeof(Token), stream->tokens); }
-    #define RESERVE_TOKEN_EXT() if (stream->tokens_len + TOKEN_PER_EXT_TOKEN > stream->tokens_max) { stream->tokens = mem__realloc((stream->tokens_max*2 + sizeof(TokenExt) + 20) * sizeof(Token), stream->tokens); }
-    #define RESERVE_DATA(N) if (stream->data_len + (N) > stream->data_max) { stream->data = mem__realloc((stream->data_max*2 + (N) + 500), stream->data); }
-
-
-    #define ADD_TOKEN(KIND,POS) do {                                    \
-            RESERVE_TOKEN();                                            \
-            Token* new_token = &stream->tokens[stream->tokens_len];     \
-            stream->tokens_len++;                                       \
-            new_token->import_id = import->import_id;                   \
-            new_token->flags = 0;                                       \
-            new_token->kind = KIND;                                     \
-            new_token->position = POS;                                  \
-            if (had_newline) new_token->flags |= TF_PRE_NEWLINE;        \
-            if (had_space)   new_token->flags |= TF_PRE_SPACE;          \
-            had_newline = false; had_space = false;                     \
-            added_normal_token = true;                                  \
-        } while (0)
-        
-    #define ADD_EXT_TOKEN(KIND,POS) (TokenExt*)&stream->tokens[stream->tokens_len]; do { \
-            RESERVE_TOKEN_EXT();                                                  \
-            TokenExt* new_token = (TokenExt*)&stream->tokens[stream->tokens_len]; \
-            stream->tokens_len += TOKEN_PER_EXT_TOKEN;                            \
-            new_token->import_id = import->import_id;                             \
-            new_token->flags = 0;                                                 \
-            new_token->kind = KIND;                                               \
-            new_token->position = POS;                                            \
-            if (had_newline) new_token->flags |= TF_PRE_NEWLINE;                  \
-            if (had_space)   new_token->flags |= TF_PRE_SPACE;                    \
-            had_newline = false; had_space = false;                               \
-            added_normal_token = false;                                           \
-        } while (0)
-
-    int fstring_level = 0;
-    int brace_depth = 0;
-
-    bool had_newline = false;
-    bool had_space   = false;
-    bool added_normal_token = false;
-    int line = 1;
-    int head = 0;
+static void grow_tokens(TokenStream* stream, int count) {
+    stream->tokens_max = stream->tokens_max*2 + count + 20;
+    stream->kinds     = mem__realloc(stream->tokens_max * sizeof(u8),  stream->kinds);
+    stream->flags     = mem__realloc(stream->tokens_max * sizeof(u8),  stream->flags);
+    stream->positions = mem__realloc(stream->tokens_max * sizeof(u32), stream->positions);
+    stream->aux       = mem__realloc(stream->tokens_max * sizeof(u32), stream->aux);
+}
 
-    array_push(&stream->line_positions, &head);
+// Literals are offsets in the data, growing it doesn't touch the tokens. The parser holds
+// literals of streamed tokens while it asks for more, the old data is kept until token_stream_release.
+static void grow_data(TokenStream* stream, int count) {
+    stream->data_max = stream->data_max*2 + count + 500;
+    if (stream->streaming) {
+        char* old_data = stream->data;
+        stream->data = mem__alloc(stream->data_max);
+        memcpy(stream->data, old_data, stream->data_len);
+        array_push(&stream->retired, &old_data);
+    } else {
+        stream->data = mem__realloc(stream->data_max, stream->data);
+    }
+}
+
+static inline char opening_bracket(char close) {
+    return close == '}' ? '{' : close == ')' ? '(' : '[';
+}
+
+// Pairs the close about to be added with the last open bracket.
+// Closes with nothing open are kept for join_lex_chunks, an earlier chunk may have their open.
+static void close_bracket(TokenStream* stream, LexChunk* chunk, char close, int position) {
+    int index = stream->tokens_len;
+    if (chunk->open_brackets.len == 0) {
+        array_push(&chunk->stray_closes, &index);
+        return;
+    }
+    // Opens released from a streamed stream are -1, their kind is gone
+    int open = array_last(&chunk->open_brackets);
+    if (open >= 0 && stream->kinds[open] != opening_bracket(close)) {
+        if (!chunk->bad_close)
+            chunk->bad_close = position;
+        return;
+    }
+    array_pop(&chunk->open_brackets);
+    if (open >= 0)
+        stream->aux[open] = index - open;
+}
+
+// Appends a token and returns its index, aux is zero until the caller sets it.
+// The whitespace before the token goes into its flags and is cleared for the next token.
+static inline u32 add_token(TokenStream* stream, TokenKind kind, int position, bool* had_newline, bool* had_space) {
+    if (stream->tokens_len + 1 > stream->tokens_max)
+        grow_tokens(stream, 1);
+    u32 index = stream->tokens_len++;
+    stream->kinds[index]     = kind;
+    stream->flags[index]     = (*had_newline ? TF_PRE_NEWLINE : 0) | (*had_space ? TF_PRE_SPACE : 0);
+    stream->positions[index] = position;
+    stream->aux[index]       = 0;
+    *had_newline = false;
+    *had_space   = false;
+    return index;
+}
+
+// Tokenizes text[chunk->start, chunk->end) into chunk->stream, a new stream if it's NULL. Positions are in the whole text.
+// Stops once the stream has 'token_limit' tokens and continues from there the next call.
+static void tokenize_range(Interner* interner, const Import* import, LexChunk* chunk, int token_limit) {
+    TracyCZone(zone, 1);
+
+    init_keyword_table();
+
+    // Nothing past the end of the chunk is lexed
+    string text = {};
+    text.ptr = import->text.ptr;
+    text.len = chunk->end;
+    int range_len = chunk->end - chunk->start;
+
+    if (!chunk->stream)
+        chunk->stream = create_token_stream(interner, import, range_len / 4 + 16, range_len / 2 + 100);
+    TokenStream* stream = chunk->stream;
+
+    #define RESERVE_DATA(N) if (stream->data_len + (N) > stream->data_max) grow_data(stream, N);
+
+    // Evaluates to the index of the token
+    #define ADD_TOKEN(KIND,POS) add_token(stream, KIND, POS, &had_newline, &had_space)
+
+    if (!chunk->started) {
+        chunk->started = true;
+        chunk->head    = chunk->start;
+    }
+
+    int fstring_level = chunk->fstring_level;
+    int brace_depth = chunk->brace_depth;
+
+    bool had_newline = chunk->had_newline;
+    bool had_space   = chunk->had_space;
+    bool ended_in_literal = false;
+    int head = chunk->head;
 
-    #define UPDATE_POST_NEWLINE() (stream->tokens_len ? stream->tokens[stream->tokens_len-(added_normal_token ? 1 : TOKEN_PER_EXT_TOKEN)].flags |= TF_POST_NEWLINE : 0 )
-    #define UPDATE_POST_SPACE() (stream->tokens_len ? stream->tokens[stream->tokens_len-(added_normal_token ? 1 : TOKEN_PER_EXT_TOKEN)].flags |= TF_POST_SPACE : 0 )
+    // Space before the first token of a chunk belongs to the last token of the chunk before it
+    #define UPDATE_POST_NEWLINE() (stream->tokens_len ? (stream->flags[stream->tokens_len-1] |= TF_POST_NEWLINE) : (chunk->lead_flags |= TF_POST_NEWLINE) )
+    #define UPDATE_POST_SPACE() (stream->tokens_len ? (stream->flags[stream->tokens_len-1] |= TF_POST_SPACE) : (chunk->lead_flags |= TF_POST_SPACE) )
 
-    if (text.len >= 2 && text.ptr[head] == '#' && text.ptr[head+1] == '!') {
+    if (head == 0 && text.len >= 2 && text.ptr[head] == '#' && text.ptr[head+1] == '!') {
         // Skip shebang
         head += 2;
         while (head < text.len) {
@@ -102,6 +244,12 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
         char c = text.ptr[head];
         char c2 = head + 1 < text.len ? text.ptr[head + 1] : 0;
         char c3 = head + 2 < text.len ? text.ptr[head + 2] : 0;
+
+        // Stop in front of a token, the flags of the last token can't change after that
+        if (stream->tokens_len >= token_limit && c != ' ' && c != '\t' && c != '\r' && c != '\f' && c != '\n'
+            && !(c == '/' && (c2 == '/' || c2 == '*'))) {
+            break;
+        }
         head++;
 
         bool reached_end_brace = false;
@@ -131,6 +279,11 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
             bool reached_brace = false;
             int word_start = head;
             while(head < text.len) {
+                head = scan_find(text.ptr, head, text.len, '{', '"', '"');
+                if (head >= text.len) {
+                    ended_in_literal = true;
+                    break;
+                }
                 char chr = text.ptr[head];
                 head++;
 
@@ -143,10 +296,6 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
                     fstring_level--;
                     break;
                 }
-                if(chr == '\n') {
-                    array_push(&stream->line_positions, &head);
-                    line++;
-                }
             }
             int word_end = head - 1;
             int word_count = word_end - word_start;
@@ -155,7 +304,7 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
                 ADD_TOKEN(',', cur_head);
             }
             if ((!reached_end_brace && !reached_brace ) || word_count > 0) {
-                TokenExt* new_token = ADD_EXT_TOKEN(T_LITERAL_STRING, cur_head);
+                int new_token = ADD_TOKEN(T_LITERAL_STRING, cur_head);
 
                 if(word_count > 65536) {
                     // TODO: Proper error handling
@@ -166,12 +315,13 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
                 // TODO: Handle escape character
 
                 RESERVE_DATA(word_count + 2 + 1);
-                new_token->ptr_data = stream->data + stream->data_len;
+                stream->aux[new_token] = stream->data_len;
+                char* ptr_data = stream->data + stream->data_len;
                 stream->data_len += word_count + 2 + 1;
                 
-                *(u16*)new_token->ptr_data = word_count;
-                memcpy(new_token->ptr_data + 2, text.ptr + word_start, word_count);
-                new_token->ptr_data[2 + word_count] = '\0';
+                *(u16*)ptr_data = word_count;
+                memcpy(ptr_data + 2, text.ptr + word_start, word_count);
+                ptr_data[2 + word_count] = '\0';
             }
 
             if (reached_brace && (word_count > 0 || reached_end_brace)) {
@@ -183,28 +333,23 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
         if (c == '\n') {
             had_newline = true;
             UPDATE_POST_NEWLINE();
-            array_push(&stream->line_positions, &head);
-            line++;
             continue;
         } else if (c == ' ' || c == '\t' || c == '\r' || c == '\f') {
             had_space = true;
             UPDATE_POST_SPACE();
+            // Indentation and alignment come in runs
+            head = scan_spaces(text.ptr, head, text.len);
             continue;
         }
 
         if (c=='/' && c2 == '/') {
             had_space = true;
             head++;
-            while(head < text.len) {
-                char chr = text.ptr[head];
+            head = scan_find(text.ptr, head, text.len, '\n', '\n', '\n');
+            if (head < text.len) {
                 head++;
-                if(chr == '\n') {
-                    had_newline = true;
-                    UPDATE_POST_NEWLINE();
-                    array_push(&stream->line_positions, &head);
-                    line++;
-                    break;
-                }
+                had_newline = true;
+                UPDATE_POST_NEWLINE();
             }
             continue;
         }
@@ -214,14 +359,18 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
             head++;
             int depth = 1;
             while(head < text.len) {
+                // Only these characters matter, skip the rest of the comment
+                head = scan_find(text.ptr, head, text.len, '\n', '/', '*');
+                if (head >= text.len) {
+                    ended_in_literal = true;
+                    break;
+                }
                 char chr = text.ptr[head];
                 char chr2 = head+1 < text.len ? text.ptr[head+1] : 0;
                 head++;
                 if(chr == '\n') {
                     had_newline = true;
                     UPDATE_POST_NEWLINE();
-                    array_push(&stream->line_positions, &head);
-                    line++;
                 }
                 if(chr == '/' && chr2 == '*') {
                     head++;
@@ -239,64 +388,47 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
         }
 
         if(c >= '0' && c <= '9') {
-            // number
+            // number, we keep the value instead of the text
 
-            int word_start = cur_head;
-            if (c == '0' && c2 == 'x') {
+            u64 value = 0;
+            bool overflow = false;
+            if (c == '0' && (c2 == 'x' || c2 == 'o' || c2 == 'b')) {
                 head++;
+                int bits = c2 == 'x' ? 4 : c2 == 'o' ? 3 : 1;
                 while(head < text.len) {
                     char chr = text.ptr[head];
-                    if((chr < '0' || chr > '9') && ((chr|32) < 'a' || (chr|32) > 'f')) {
+                    u32 digit;
+                    if (chr >= '0' && chr <= '9') {
+                        digit = chr - '0';
+                    } else if (bits == 4 && (chr|32) >= 'a' && (chr|32) <= 'f') {
+                        digit = (chr|32) - 'a' + 10;
+                    } else {
                         break;
                     }
-                    head++;
-                }
-            } else if (c == '0' && c2 == 'o') {
-                head++;
-                while(head < text.len) {
-                    char chr = text.ptr[head];
-                    if(chr < '0' || chr > '7') {
+                    if (digit >= (1u << bits)) {
                         break;
                     }
-                    head++;
-                }
-            } else if (c == '0' && c2 == 'b') {
-                head++;
-                while(head < text.len) {
-                    char chr = text.ptr[head];
-                    if(chr < '0' || chr > '1') {
-                        break;
+                    if (value >> (64 - bits)) {
+                        overflow = true;
                     }
+                    value = (value << bits) | digit;
                     head++;
                 }
             } else {
-                while(head < text.len) {
-                    char chr = text.ptr[head];
-                    if(chr < '0' || chr > '9') {
-                        break;
-                    }
-                    head++;
-                }
+                head = scan_digits(text.ptr, head, text.len);
+                overflow = !parse_decimal(text.ptr + cur_head, head - cur_head, &value);
             }
-            int word_end = head;
-
-            TokenExt* new_token = ADD_EXT_TOKEN(T_LITERAL_INTEGER, cur_head);
 
-            int word_count = word_end - word_start;
-
-            if(word_count > 256) {
-                // TODO: Proper error handling
-                fprintf(stderr, "ERROR: Strings cannot be larger than 65536 characters (token was %d chars.)\n", word_count);
-                ASSERT(false);
+            int new_token = ADD_TOKEN(T_LITERAL_INTEGER, cur_head);
+            // Reported by the parser, it knows where the token is
+            if (overflow) {
+                stream->flags[new_token] |= TF_OVERFLOW;
             }
 
-            RESERVE_DATA(word_count + 1 + 1);
-            new_token->ptr_data = stream->data + stream->data_len;
-            stream->data_len += word_count + 1 + 1;
-            
-            *(u8*)new_token->ptr_data = word_count;
-            memcpy(new_token->ptr_data + 1, text.ptr + word_start, word_count);
-            new_token->ptr_data[1 + word_count] = '\0';
+            RESERVE_DATA(sizeof(u64));
+            stream->aux[new_token] = stream->data_len;
+            memcpy(stream->data + stream->data_len, &value, sizeof(u64));
+            stream->data_len += sizeof(u64);
             continue;
         }
 
@@ -304,31 +436,17 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
             // identifier or keyword
 
             int word_start = cur_head;
-            while(head < text.len) {
-                char chr = text.ptr[head];
-                if(!(chr >= '0' && chr <= '9') && !((chr|32) >= 'a' && (chr|32) <= 'z') && chr != '_') {
-                    break;
-                }
-                head++;
-                continue;
-            }
+            head = scan_identifier(text.ptr, head, text.len);
             int word_end = head;
 
             cstring word = {0};
             word.ptr = text.ptr + word_start;
             word.len = word_end - word_start;
 
-            // TODO: Optimize keyword comparison
-            TokenKind kind = KEYWORD_BEGIN;
-            while (kind < KEYWORD_END) {
-                if(string_equal_cstr(word, token_name_table[kind])) {
-                    break;
-                }
-                kind++;
-            }
+            TokenKind kind = find_keyword(word.ptr, word.len);
 
-            if(kind == KEYWORD_END) {
-                TokenExt* new_token = ADD_EXT_TOKEN(T_IDENTIFIER, cur_head);
+            if(kind == T_IDENTIFIER) {
+                int new_token = ADD_TOKEN(T_IDENTIFIER, cur_head);
 
                 int word_count = word_end - word_start;
 
@@ -338,13 +456,7 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
                     ASSERT(false);
                 }
 
-                RESERVE_DATA(word_count + 1 + 1);
-                new_token->ptr_data = stream->data + stream->data_len;
-                stream->data_len += word_count + 1 + 1;
-                
-                new_token->ptr_data[0] = word_count;
-                memcpy(new_token->ptr_data + 1, text.ptr + word_start, word_count);
-                new_token->ptr_data[1 + word_count] = '\0';
+                stream->aux[new_token] = interner_intern(interner, word.ptr, word.len);
             } else {
                 ADD_TOKEN(kind, cur_head);
             }
@@ -355,20 +467,23 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
             // string
 
             int word_start = cur_head + 1;
+            bool terminated = false;
             while(head < text.len) {
+                head = scan_find(text.ptr, head, text.len, '"', '"', '"');
+                if (head >= text.len)
+                    break;
                 char chr = text.ptr[head];
                 head++;
                 if(chr == '"' && text.ptr[head-2] != '\\') {
+                    terminated = true;
                     break;
                 }
-                if (chr == '\n') {
-                    array_push(&stream->line_positions, &head);
-                    line++;
-                }
             }
             int word_end = head - 1;
+            if (!terminated)
+                ended_in_literal = true;
 
-            TokenExt* new_token = ADD_EXT_TOKEN(T_LITERAL_STRING, cur_head);
+            int new_token = ADD_TOKEN(T_LITERAL_STRING, cur_head);
 
             int word_count = word_end - word_start;
 
@@ -380,10 +495,11 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
 
 
             RESERVE_DATA(word_count + 2 + 1);
-            new_token->ptr_data = stream->data + stream->data_len;
+            stream->aux[new_token] = stream->data_len;
+            char* ptr_data = stream->data + stream->data_len;
 
             // Handle escape character
-            char* ptr = new_token->ptr_data + 2;
+            char* ptr = ptr_data + 2;
             int index = 0;
             int real_count = 0;
             while (index < word_count) {
@@ -520,158 +636,411 @@ Result tokenize(const Import* import, TokenStream** out_stream) {
                 real_count++;
             }
             stream->data_len += real_count + 2 + 1;
-            *(u16*)new_token->ptr_data = real_count;
-            new_token->ptr_data[2 + word_count] = '\0';
+            *(u16*)ptr_data = real_count;
+            ptr_data[2 + word_count] = '\0';
             continue;
         }
-        
-        // if(c == '{' || c == '}' || c == '(' || c == ')') {
-        //     int token_index = stream->tokens_len;
-        //     TokenExt* new_token = ADD_EXT_TOKEN(c, cur_head);
-        //     switch(c) {
-        //         case '{': {
-        //             new_token->int_data = -1; // set later
-        //             array_push(&curly_depth, &token_index);
-        //         } break;
-        //         case '}': {
-        //             int index = array_last(&curly_depth);
-        //             array_pop(&curly_depth);
-
-        //             ASSERT_INDEX(index < stream->tokens_len);
-        //             TokenExt* prev = (void*)&stream->tokens[index];
-
-        //             new_token->int_data = index;
-        //             prev->int_data = token_index;
-        //         } break;
-        //         case '(': {
-        //             new_token->int_data = -1; // set later
-        //             array_push(&paren_depth,&token_index);
-        //         } break;
-        //         case ')': {
-        //             if (paren_depth.len == 0) {
-        //                 fprintf(stderr, "ERROR: Unterminated parenthesis.\n");
-        //                 ASSERT(false);
-        //             }
-        //             int index = array_last(&paren_depth);
-        //             array_pop(&paren_depth);
-
-        //             ASSERT_INDEX(index < stream->tokens_len);
-        //             TokenExt* prev = (void*)&stream->tokens[index];
-
-        //             new_token->int_data = index;
-        //             prev->int_data = token_index;
-        //         } break;
-        //         default: ASSERT(false);
-        //     }
-        // } else {
-        // }
+
+        if (c == '{' || c == '(' || c == '[') {
+            array_push(&chunk->open_brackets, &stream->tokens_len);
+        } else if (c == '}' || c == ')' || c == ']') {
+            close_bracket(stream, chunk, c, cur_head);
+        }
         ADD_TOKEN(c, cur_head);
     }
 
-    *out_stream = stream;
+    chunk->head               = head;
+    chunk->fstring_level      = fstring_level;
+    chunk->brace_depth        = brace_depth;
+    chunk->had_newline        = had_newline;
+    chunk->had_space          = had_space;
+    chunk->trail_flags = (had_newline ? TF_PRE_NEWLINE : 0) | (had_space ? TF_PRE_SPACE : 0);
+    chunk->ended_in_literal = ended_in_literal || fstring_level > 0;
 
-    // print_token_stream(stream);
+    TracyCZoneEnd(zone);
+}
 
+static void cleanup_brackets(LexChunk* chunk) {
+    array_cleanup(&chunk->open_brackets);
+    array_cleanup(&chunk->stray_closes);
+}
+
+void lex_chunk_cleanup(LexChunk* chunk) {
+    if (chunk->stream)
+        token_stream_cleanup(chunk->stream);
+    chunk->stream = NULL;
+    cleanup_brackets(chunk);
+}
+
+static inline void keep_first(int* error_position, int position) {
+    if (*error_position < 0 || position < *error_position)
+        *error_position = position;
+}
+
+// Reports the first close that is wrong, or the first unclosed bracket if the closes are fine.
+// An open is left unclosed after a wrong close, the close is the error to report.
+// A position is -1 if there is no such error. The stream is freed if there is an error.
+static Result check_brackets(TokenStream* stream, int stray_close, int bad_close, int unclosed) {
     Result result = {};
     result.kind = SUCCESS;
 
-    TracyCZoneEnd(zone);
+    int position = -1;
+    if (stray_close >= 0) keep_first(&position, stray_close);
+    if (bad_close >= 0)   keep_first(&position, bad_close);
+    if (position < 0)
+        position = unclosed;
+    if (position < 0)
+        return result;
+
+    char chr = stream->import->text.ptr[position];
+    char message[100];
+    if (position == stray_close)
+        snprintf(message, sizeof(message), "'%c' doesn't close anything.", chr);
+    else if (position == bad_close)
+        snprintf(message, sizeof(message), "'%c' doesn't match the bracket it closes.", chr);
+    else
+        snprintf(message, sizeof(message), "'%c' is never closed.", chr);
+
+    SourceLocation location = {};
+    location.import_id = stream->import->import_id;
+    location.position  = position;
+    result = source_error(stream, location, __FILE__, __LINE__, message);
+    token_stream_cleanup(stream);
     return result;
 }
 
-void print_token_stream(TokenStream* stream) {
-    printf("TokenStream, %d tokens\n", stream->tokens_len);
+Result tokenize(Interner* interner, const Import* import, TokenStream** out_stream) {
+    ASSERT(out_stream);
+
+    LexChunk chunk = {};
+    chunk.start = 0;
+    chunk.end   = import->text.len;
+    tokenize_range(interner, import, &chunk, INT_MAX);
+    TokenStream* stream = chunk.stream;
+
+    // print_token_stream(chunk.stream);
+
+    int stray_close = chunk.stray_closes.len  ? (int)stream->positions[chunk.stray_closes.ptr[0]]  : -1;
+    int unclosed    = chunk.open_brackets.len ? (int)stream->positions[chunk.open_brackets.ptr[0]] : -1;
+    Result result = check_brackets(stream, stray_close, chunk.bad_close ? chunk.bad_close : -1, unclosed);
+    cleanup_brackets(&chunk);
+
+    *out_stream = result.kind == SUCCESS ? stream : NULL;
+    return result;
+}
+
+Result tokenize_streaming(Interner* interner, const Import* import, TokenStream** out_stream) {
+    ASSERT(out_stream);
+
+    // A batch and its literals, buffers grow if a declaration needs more
+    TokenStream* stream = create_token_stream(interner, import, TOKEN_STREAM_BATCH * 2, TOKEN_STREAM_BATCH * 4);
+    stream->streaming = true;
+
+    LexChunk* chunk = HEAP_ALLOC_OBJECT(LexChunk);
+    chunk->start  = 0;
+    chunk->end    = import->text.len;
+    chunk->stream = stream;
+    stream->lexing = chunk;
+
+    token_stream_fill(stream);
+    *out_stream = stream;
+
+    Result result = {};
+    result.kind = SUCCESS;
+    return result;
+}
+
+bool token_stream_fill(TokenStream* stream) {
+    LexChunk* chunk = stream->lexing;
+    if (!chunk)
+        return false;
+
+    int tokens_len = stream->tokens_len;
+    tokenize_range(stream->interner, stream->import, chunk, tokens_len + TOKEN_STREAM_BATCH);
+    if (chunk->head >= chunk->end) {
+        cleanup_brackets(chunk);
+        mem__free(chunk);
+        stream->lexing = NULL;
+    }
+    return stream->tokens_len > tokens_len;
+}
+
+int token_stream_release(TokenStream* stream, int keep_from) {
+    TracyCZone(zone, 1);
+
+    for (int i=0;i<stream->retired.len;i++)
+        mem__free(stream->retired.ptr[i]);
+    stream->retired.len = 0;
+
+    ASSERT(keep_from >= 0 && keep_from <= stream->tokens_len);
+
+    // Literals are added in token order, the data of the kept tokens is at the end
+    int data_from = stream->data_len;
+    for (int i=keep_from;i<stream->tokens_len;i++) {
+        if (IS_LITERAL_TOKEN(stream->kinds[i])) {
+            data_from = stream->aux[i];
+            break;
+        }
+    }
 
-    bool less = true;
+    int len = stream->tokens_len - keep_from;
+    memmove(stream->kinds,     stream->kinds     + keep_from, len * sizeof(u8));
+    memmove(stream->flags,     stream->flags     + keep_from, len * sizeof(u8));
+    memmove(stream->positions, stream->positions + keep_from, len * sizeof(u32));
+    memmove(stream->aux,       stream->aux       + keep_from, len * sizeof(u32));
+    stream->tokens_len = len;
+
+    stream->data_len -= data_from;
+    memmove(stream->data, stream->data + data_from, stream->data_len);
+    for (int i=0;i<stream->tokens_len;i++) {
+        if (IS_LITERAL_TOKEN(stream->kinds[i]))
+            stream->aux[i] -= data_from;
+    }
+
+    // Brackets waiting for a close move with their tokens
+    if (stream->lexing) {
+        Array_int* open_brackets = &stream->lexing->open_brackets;
+        for (int i=0;i<open_brackets->len;i++)
+            open_brackets->ptr[i] = open_brackets->ptr[i] >= keep_from ? open_brackets->ptr[i] - keep_from : -1;
+    }
+
+    TracyCZoneEnd(zone);
+    return keep_from;
+}
+
+int split_lex_chunks(const Import* import, int max_chunks, LexChunk* out_chunks) {
+    TracyCZone(zone, 1);
 
+    const char* text = import->text.ptr;
+    int len = import->text.len;
+    int chunk_size = len / max_chunks;
+
+    int count = 0;
+    out_chunks[count++] = (LexChunk){ .start = 0 };
+
+    // Only quotes and slashes can start something a newline must not split,
+    // newlines are looked at once we are past the next split.
+    int next_split = chunk_size;
     int head = 0;
-    while(head < stream->tokens_len) {
-        TokenExt* tok = (TokenExt*)&stream->tokens[head];
-        if (IS_KEYWORD(tok->kind)) {
-            head++;
-            if (less) {
-                printf("%s", token_name_table[tok->kind]);
-            } else {
-                printf(" %s, import %d, pos %d\n", token_name_table[tok->kind], tok->import_id, tok->position);
+    while (head < len && count < max_chunks) {
+        char stop = head >= next_split ? '\n' : '/';
+        head = scan_find(text, head, len, '"', '/', stop);
+        if (head >= len)
+            break;
+        char chr  = text[head];
+        char chr2 = head + 1 < len ? text[head + 1] : 0;
+        head++;
+
+        if (chr == '\n') {
+            if (head < len) {
+                out_chunks[count-1].end = head;
+                out_chunks[count++] = (LexChunk){ .start = head };
+                next_split = head + chunk_size;
             }
-        } else if(IS_SPECIAL(tok->kind)) {
-            if(tok->kind == '{' || tok->kind == '}' || tok->kind == '(' || tok->kind == ')') {
-                head += 2;
-            } else {
+        } else if (chr == '"') {
+            // Same end as in tokenize_range, f-strings are treated like strings
+            while (head < len) {
+                head = scan_find(text, head, len, '"', '"', '"');
+                if (head >= len)
+                    break;
                 head++;
+                if (text[head-2] != '\\')
+                    break;
             }
-            if (less) {
-                printf("%c", (char)tok->kind);
-            } else {
-                printf(" special, '%c', import %d, pos %d\n", (char)tok->kind, tok->import_id, tok->position);
-            }
-        } else if (tok->kind == T_IDENTIFIER) {
-            head += TOKEN_PER_EXT_TOKEN;
-            int len = tok->ptr_data[0];
-            if (less) {
-                printf("%.*s", len, tok->ptr_data + 1);
-            } else {
-                printf(" identifier, data '%.*s', import %d, pos %d\n", len, tok->ptr_data + 1, tok->import_id, tok->position);
-            }
-        } else if (tok->kind == T_LITERAL_INTEGER) {
-            head += TOKEN_PER_EXT_TOKEN;
-            int len = tok->ptr_data[0];
-            
-            if (less) {
-                printf("%.*s", len, tok->ptr_data + 1);
-            } else {
-                printf(" number, data %.*s, import %d, pos %d\n", len, tok->ptr_data + 1, tok->import_id, tok->position);
+        } else if (chr2 == '/') {
+            // The newline ending the comment may be a split
+            head = scan_find(text, head + 1, len, '\n', '\n', '\n');
+        } else if (chr2 == '*') {
+            head++;
+            int depth = 1;
+            while (head < len && depth > 0) {
+                head = scan_find(text, head, len, '/', '*', '*');
+                if (head >= len)
+                    break;
+                char a = text[head];
+                char b = head + 1 < len ? text[head + 1] : 0;
+                head++;
+                if (a == '/' && b == '*') {
+                    head++;
+                    depth++;
+                } else if (a == '*' && b == '/') {
+                    head++;
+                    depth--;
+                }
             }
-        } else if (tok->kind == T_LITERAL_STRING) {
-            head += TOKEN_PER_EXT_TOKEN;
-            int len = *(u16*)tok->ptr_data;
-            if (less) {
-                printf(" \"%.*s\"", len, tok->ptr_data + 2);
-            } else {
-                printf(" string, data \"%.*s\", import %d, pos %d\n", len, tok->ptr_data + 2, tok->import_id, tok->position);
+        }
+    }
+    out_chunks[count-1].end = len;
+
+    TracyCZoneEnd(zone);
+    return count;
+}
+
+void tokenize_chunk(Interner* interner, const Import* import, LexChunk* chunk) {
+    tokenize_range(interner, import, chunk, INT_MAX);
+}
+
+Result join_lex_chunks(Interner* interner, const Import* import, LexChunk* chunks, int count, TokenStream** out_stream) {
+    TracyCZone(zone, 1);
+
+    // The pre-scan doesn't know about everything (strings in f-strings), if a chunk
+    // ended inside a literal the next one was lexed from the wrong state.
+    bool valid = true;
+    int tokens_len = 0, data_len = 0;
+    for (int i=0;i<count;i++) {
+        if (i + 1 < count && chunks[i].ended_in_literal)
+            valid = false;
+        tokens_len += chunks[i].stream->tokens_len;
+        data_len   += chunks[i].stream->data_len;
+    }
+    if (!valid) {
+        for (int i=0;i<count;i++)
+            lex_chunk_cleanup(&chunks[i]);
+        TracyCZoneEnd(zone);
+        return tokenize(interner, import, out_stream);
+    }
+
+    TokenStream* stream = create_token_stream(interner, import, tokens_len + 10, data_len + 100);
+
+    TokenFlags pending_flags = 0; // TF_PRE_* flags for the next token
+    Array_int open_brackets = {}; // opens of earlier chunks without a close yet
+    int stray_close = -1, bad_close = -1;
+    for (int i=0;i<count;i++) {
+        TokenStream* part = chunks[i].stream;
+        int first = stream->tokens_len;
+
+        if (first > 0)
+            stream->flags[first-1] |= chunks[i].lead_flags;
+
+        memcpy(stream->kinds     + first, part->kinds,     part->tokens_len * sizeof(u8));
+        memcpy(stream->flags     + first, part->flags,     part->tokens_len * sizeof(u8));
+        memcpy(stream->positions + first, part->positions, part->tokens_len * sizeof(u32));
+        memcpy(stream->aux       + first, part->aux,       part->tokens_len * sizeof(u32));
+        memcpy(stream->data + stream->data_len, part->data, part->data_len);
+        // Literals are offsets in the chunk's data
+        for (int j=first;j<first+part->tokens_len;j++) {
+            if (IS_LITERAL_TOKEN(stream->kinds[j]))
+                stream->aux[j] += stream->data_len;
+        }
+        if (part->tokens_len)
+            stream->flags[first] |= pending_flags;
+        pending_flags = part->tokens_len ? chunks[i].trail_flags : pending_flags | chunks[i].trail_flags;
+
+        stream->tokens_len += part->tokens_len;
+        stream->data_len   += part->data_len;
+
+        // Closes with nothing open in their chunk come before the chunk's unclosed opens
+        LexChunk* chunk = &chunks[i];
+        if (chunk->bad_close)
+            keep_first(&bad_close, chunk->bad_close);
+        for (int j=0;j<chunk->stray_closes.len;j++) {
+            int close = first + chunk->stray_closes.ptr[j];
+            if (open_brackets.len == 0) {
+                keep_first(&stray_close, stream->positions[close]);
+                continue;
             }
-        } else if(tok->kind == T_END_OF_FILE) {
-            head++;
-             if (less) {
-                printf(" EOF\n");
-            } else {
-                printf(" EOF, import %d, pos %d\n", tok->import_id, tok->position);
+            int open = array_last(&open_brackets);
+            if (stream->kinds[open] != opening_bracket(stream->kinds[close])) {
+                keep_first(&bad_close, stream->positions[close]);
+                continue;
             }
+            array_pop(&open_brackets);
+            stream->aux[open] = close - open;
+        }
+        for (int j=0;j<chunk->open_brackets.len;j++)
+            array_pushv(&open_brackets, first + chunk->open_brackets.ptr[j]);
+
+        lex_chunk_cleanup(chunk);
+    }
+
+    int unclosed = open_brackets.len ? (int)stream->positions[open_brackets.ptr[0]] : -1;
+    array_cleanup(&open_brackets);
+
+    Result result = check_brackets(stream, stray_close, bad_close, unclosed);
+    *out_stream = result.kind == SUCCESS ? stream : NULL;
+
+    TracyCZoneEnd(zone);
+    return result;
+}
+
+void print_token_stream(TokenStream* stream) {
+    // Import ids depend on which thread got to the import first, the path doesn't
+    log__dump("TokenStream %s, %d tokens\n", stream->import->path.ptr, stream->tokens_len);
+
+    int head = 0;
+    while(head < stream->tokens_len) {
+        TokenExt tok = token_at(stream, head);
+        head++;
+        log__dump("  pos %d, flags 0x%x,", tok.position, (int)tok.flags);
+        if (IS_KEYWORD(tok.kind)) {
+            log__dump(" %s\n", token_name_table[tok.kind]);
+        } else if(IS_SPECIAL(tok.kind)) {
+            log__dump(" special '%c'\n", (char)tok.kind);
+        } else if (tok.kind == T_IDENTIFIER) {
+            cstring name = NAME_FROM_IDENTIFIER(stream, tok);
+            log__dump(" identifier '%.*s'\n", (int)name.len, name.ptr);
+        } else if (tok.kind == T_LITERAL_INTEGER) {
+            log__dump(" number %llu\n", (unsigned long long)tok.int_data);
+        } else if (tok.kind == T_LITERAL_STRING) {
+            int len = *(u16*)tok.ptr_data;
+            log__dump(" string \"%.*s\"\n", len, tok.ptr_data + 2);
+        } else if(tok.kind == T_END_OF_FILE) {
+            log__dump(" EOF\n");
         } else {
-            fprintf(stderr, "%s: unhandled kind %d\n", __func__, tok->kind);
+            fprintf(stderr, "%s: unhandled kind %d\n", __func__, tok.kind);
             ASSERT(false);
         }
     }
 }
 
-static int pos_to_line_index(TokenStream* stream, int position) {
+// The lexer doesn't track lines, errors are rare and most compiles never need
+// a line number. The table is built from the text the first time one is asked for.
+static const LineTable* get_line_table(const Import* import) {
+    LineTable* table = import->lines;
+    if (table)
+        return table;
+
+    TracyCZone(zone, 1);
+    const char* text = import->text.ptr;
+    int len = import->text.len;
+
+    int count = 1 + scan_count(text, 0, len, '\n');
+    table = mem__alloc(sizeof(LineTable) + count * sizeof(int));
+    table->len = count;
+    table->starts[0] = 0;
+    int head = 0;
+    for (int i=1;i<count;i++) {
+        head = scan_find(text, head, len, '\n', '\n', '\n') + 1;
+        table->starts[i] = head;
+    }
+
+    // The import is shared but the table only depends on the text which doesn't change.
+    Import* mut_import = (Import*)import;
+    if (!atomic_cas(&mut_import->lines, NULL, table)) {
+        mem__free(table);
+        table = import->lines;
+    }
+    TracyCZoneEnd(zone);
+    return table;
+}
+
+static int pos_to_line_index(const LineTable* table, int position) {
     TracyCZone(zone, 1);
-    int* data = stream->line_positions.ptr;
-    int  len  = stream->line_positions.len;
-    int  high = len-1;
+    const int* data = table->starts;
+    int  high = table->len-1;
     int  low  = 0;
-    int  mid, val;
 
-    while (true) {
-        mid = (high+low)/2;
-        val = data[mid];
-        if (position < val) {
+    // Last line starting at or before the position
+    while (low < high) {
+        int mid = (low+high+1)/2;
+        if (data[mid] <= position) {
+            low = mid;
+        } else {
             high = mid-1;
-            if (position >= data[mid-1]) {
-                mid = mid-1;
-                break;
-            }
-        } else if(position > val) {
-            low = mid+1;
-            if (position < data[mid+1]) {
-                break;
-            }
-        } else if (high == low || position == val) {
-            break;
         }
     }
     TracyCZoneEnd(zone);
-    return mid;
+    return low;
 }
 
 bool compute_source_info(TokenStream* stream, SourceLocation location, int* out_line, int* out_column, string* out_code) {
@@ -702,11 +1071,12 @@ bool compute_source_info(TokenStream* stream, SourceLocation location, int* out_
         goto end;
     }
 
+    const LineTable* table = get_line_table(stream->import);
     int nr_tabs = 0;
-    int line_index = pos_to_line_index(stream, location.position);
+    int line_index = pos_to_line_index(table, location.position);
     int line = line_index + 1;
     int column = 1;
-    int head_at_line_start = stream->line_positions.ptr[line_index];
+    int head_at_line_start = table->starts[line_index];
     int head = head_at_line_start;
 
     while(head < text.len) {
@@ -766,23 +1136,49 @@ end:
     return result;
 }
 
-SourceLocation location_from_token(const TokenExt* tok) {
+Result source_error(TokenStream* stream, SourceLocation location, const char* c_path, int c_line, const char* message) {
+    int line, column;
+    string code;
+    compute_source_info(stream, location, &line, &column, &code);
+
+    char buffer[1024];
+    int len = 0;
+    len += snprintf(buffer + len, sizeof(buffer) - len, "\033[0;30m%s:%d\033[0m\n", c_path, c_line);
+    len += snprintf(buffer + len, sizeof(buffer) - len, "\033[0;31m%s:%d:%d:\033[0m %s\n%s", stream->import->path.ptr, line, column, message, code.ptr ? code.ptr : "");
+    string_cleanup(&code);
+
+    Result result = {};
+    result.kind = FAILURE;
+    result.message = string_clone_cptr(buffer);
+    return result;
+}
+
+SourceLocation location_from_token(TokenExt tok) {
     SourceLocation loc = {};
-    loc.position = tok->position;
-    loc.import_id = tok->import_id;
+    loc.position = tok.position;
+    loc.import_id = tok.import_id;
     return loc;
 }
 
 void token_stream_cleanup(TokenStream* stream) {
-    if(stream->tokens)
-        mem__free(stream->tokens);
+    mem__free(stream->kinds);
+    mem__free(stream->flags);
+    mem__free(stream->positions);
+    mem__free(stream->aux);
     if(stream->data)
         mem__free(stream->data);
+    for (int i=0;i<stream->retired.len;i++)
+        mem__free(stream->retired.ptr[i]);
+    array_cleanup(&stream->retired);
+    if (stream->lexing) {
+        cleanup_brackets(stream->lexing);
+        mem__free(stream->lexing);
+    }
     mem__free(stream);
 }
 
 const char* name_from_token(TokenKind kind) {
-    static char temp[8];
+    static THREAD_LOCAL char temp[8]; // called from several driver threads
     if (kind < 32) {
         return token_name_table[kind];
     }
@@ -3,6 +3,7 @@
 #include "basin/common.h"
 
 #include "util/array.h"
+#include "util/interner.h"
 
 #define DEBUG_BUILD
 
@@ -165,38 +166,24 @@ typedef enum {
     TF_POST_SPACE   = 0x2,
     TF_PRE_NEWLINE  = 0x4,
     TF_POST_NEWLINE = 0x8,
+    TF_OVERFLOW     = 0x10, // integer literal doesn't fit in 64 bits
 } _TokenFlags;
 
 typedef u8 TokenFlags;
 
 extern char* token_name_table[NORMAL_TOKEN_END];
 
+// A token read from a stream with token_at. Streams store the fields in separate arrays.
+// The kind is a plain u8 even in DEBUG_BUILD, cast it to _TokenKind in the debugger.
 typedef struct {
-    #ifdef DEBUG_BUILD
-        _TokenKind kind;
-        _TokenFlags flags;
-    #else
-        TokenKind  kind;
-        TokenFlags flags;
-    #endif
-    ImportID   import_id; // do we need import id since we don't have preprocessor?
-    int        position;
-} Token;
-
-typedef struct {
-    #ifdef DEBUG_BUILD
-        _TokenKind kind;
-        _TokenFlags flags;
-    #else
-        TokenKind  kind;
-        TokenFlags flags;
-    #endif
+    TokenKind  kind;
+    TokenFlags flags;
     ImportID   import_id;
     int        position;
 
     union {
-        char* ptr_data;
-        int  int_data;
+        char* ptr_data; // strings
+        u64   int_data; // value of integers, atom of identifiers
     };
 } TokenExt;
 
@@ -208,51 +195,138 @@ typedef struct {
 
 // #define IS_EXT_TOKEN(K) ((K >= T_IDENTIFIER && K <= T_LITERAL_STRING) || K == '{' || K == '}' || K == '(' || K == ')' )
 #define IS_EXT_TOKEN(K) (K >= T_IDENTIFIER && K <= T_LITERAL_STRING)
-#define IS_EOF(TOK) ((TOK) == &EOF_TOKEN_EXT)
+// Literals keep their text in the stream's data
+#define IS_LITERAL_TOKEN(K) (K >= T_LITERAL_INTEGER && K <= T_LITERAL_STRING)
+#define IS_EOF(TOK) ((TOK).kind == T_END_OF_FILE)
 
 #define IS_KEYWORD(K) (K >= KEYWORD_BEGIN && K < KEYWORD_END)
 
 #define IS_SPECIAL(K) (K >= KEYWORD_END)
 
-#define HAS_PRE_WHITESPACE(TOK) ((TOK)->flags & (TF_PRE_NEWLINE | TF_PRE_SPACE))
-
+#define HAS_PRE_WHITESPACE(TOK) ((TOK).flags & (TF_PRE_NEWLINE | TF_PRE_SPACE))
 
-#define DATA_FROM_TOKEN(T) { (T)->ptr_data+1, *((u8*)(T)->ptr_data) }
-#define DATA_FROM_STRING(T) { ( ASSERT((T)->kind == T_LITERAL_STRING), (T)->ptr_data+2), *((u16*)(T)->ptr_data) }
-#define DATA_FROM_IDENTIFIER(T) { (ASSERT((T)->kind == T_IDENTIFIER), (T)->ptr_data+1), *((u8*)(T)->ptr_data) }
 
-#define TOKEN_PER_EXT_TOKEN ((sizeof(TokenExt)+sizeof(Token)-1)/sizeof(Token))
+#define DATA_FROM_STRING(T) { ( ASSERT((T).kind == T_LITERAL_STRING), (T).ptr_data+2), *((u16*)(T).ptr_data) }
+// Identifiers carry their atom, the name is in the stream's interner
+#define ATOM_FROM_IDENTIFIER(T) (ASSERT((T).kind == T_IDENTIFIER), (Atom)(T).int_data)
+#define NAME_FROM_IDENTIFIER(S,T) interner_get((S)->interner, ATOM_FROM_IDENTIFIER(T))
 
 typedef struct TokenStream {
     const Import* import;
-
-    Token* tokens;
+    Interner*     interner; // names of identifiers (driver's interner)
+
+    // Token N is kinds[N], flags[N], positions[N] and aux[N], see token_at.
+    // Looking through kinds doesn't load the rest of the tokens.
+    u8*  kinds;
+    u8*  flags;
+    u32* positions;
+    u32* aux;       // atom of identifiers, offset in data of literals (u64 value of integers),
+                    // distance to the matching close of '{', '(' and '[' (see matching_token), zero for other tokens
     int tokens_len, tokens_max;
 
     char* data;
     int data_len, data_max;
 
-    Array_int line_positions;
+    // Streamed streams are lexed a batch at a time while the parser reads them (see tokenize_streaming)
+    bool streaming;
+    struct LexChunk* lexing; // lexer state, NULL once the whole text is lexed
+    Array_charP retired;     // old data buffers, literals read by the parser may still point into them
 } TokenStream;
 
-// static const Token EOF_TOKEN = { T_END_OF_FILE, 0, -1, -1 };
 static const TokenExt EOF_TOKEN_EXT = { T_END_OF_FILE, 0, -1, -1, NULL };
 
+// Token at 'index', EOF_TOKEN_EXT if the index is past the tokens
+static inline TokenExt token_at(const TokenStream* stream, int index) {
+    if (index >= stream->tokens_len)
+        return EOF_TOKEN_EXT;
+    TokenExt tok;
+    tok.kind      = stream->kinds[index];
+    tok.flags     = stream->flags[index];
+    tok.import_id = stream->import->import_id;
+    tok.position  = stream->positions[index];
+    tok.ptr_data  = NULL;
+    if (tok.kind == T_IDENTIFIER)
+        tok.int_data = stream->aux[index];
+    else if (tok.kind == T_LITERAL_INTEGER)
+        memcpy(&tok.int_data, stream->data + stream->aux[index], sizeof(u64));
+    else if (IS_EXT_TOKEN(tok.kind))
+        tok.ptr_data = stream->data + stream->aux[index];
+    return tok;
+}
+
+// Index of the token closing the '{', '(' or '[' at 'index'.
+// -1 if there is no close or it isn't lexed yet (streaming), the parser can skip a bracket without looking at its content.
+static inline int matching_token(const TokenStream* stream, int index) {
+    ASSERT(stream->kinds[index] == '{' || stream->kinds[index] == '(' || stream->kinds[index] == '[');
+    u32 distance = stream->aux[index];
+    return distance ? index + (int)distance : -1;
+}
+
 //###############################
 //       PUBLIC FUNCTIONS
 //###############################
 
-Result tokenize(const Import* import, TokenStream** out_stream);
+// Identifiers are interned in 'interner', tokens carry the atom.
+// Fails if the brackets don't match, the parser never sees unbalanced brackets.
+Result tokenize(Interner* interner, const Import* import, TokenStream** out_stream);
+
+// Big imports are lexed in chunks on several threads (see TASK_LEX_CHUNK).
+typedef struct LexChunk {
+    int start, end;          // range of the import's text, chunks after the first start at a line
+    TokenStream* stream;     // tokens of the chunk, positions are in the whole text
+    TokenFlags lead_flags;   // TF_POST_* flags of the last token before the chunk
+    TokenFlags trail_flags;  // TF_PRE_* flags of the first token after the chunk
+    bool ended_in_literal;   // the chunk ended inside a string, comment or f-string
+
+    // Where the lexer stopped, a streamed chunk is lexed in several calls
+    bool started;
+    int  head;
+    int  fstring_level, brace_depth;
+    bool had_newline, had_space;
+
+    // Brackets that couldn't be matched in the chunk, join_lex_chunks matches them across chunks
+    Array_int open_brackets; // tokens of '{', '(' and '[' without a close yet
+    Array_int stray_closes;  // closes lexed when nothing was open, an earlier chunk may have their open
+    int       bad_close;     // position of the first close of the wrong kind, zero if none (something is open before it)
+} LexChunk;
+
+// Splits the text at newlines outside of strings and comments. Returns the number of chunks (at most max_chunks).
+int split_lex_chunks(const Import* import, int max_chunks, LexChunk* out_chunks);
+// THREAD SAFE, each chunk can be tokenized on its own thread
+void tokenize_chunk(Interner* interner, const Import* import, LexChunk* chunk);
+// Joins the tokens of the chunks into one stream and matches brackets across chunks, the chunks are cleaned up.
+// The text is tokenized again in one piece if a split turned out to be inside a literal.
+Result join_lex_chunks(Interner* interner, const Import* import, LexChunk* chunks, int count, TokenStream** out_stream);
+// Frees the chunk's stream and bracket state, for chunks that won't be joined
+void lex_chunk_cleanup(LexChunk* chunk);
+
+// Number of tokens lexed at a time when streaming
+#define TOKEN_STREAM_BATCH 2048
+
+// Lexes the first batch of tokens, the parser lexes more with token_stream_fill when it runs out.
+// Token memory is bounded by the largest top-level declaration instead of the file size.
+// Brackets are matched as the batches are lexed, unbalanced brackets are left to the parser.
+Result tokenize_streaming(Interner* interner, const Import* import, TokenStream** out_stream);
+// Lexes another batch. Returns false if the whole text is lexed and no tokens were added.
+// Literals may move to a bigger buffer, pointers to the old one stay valid until token_stream_release.
+bool token_stream_fill(TokenStream* stream);
+// Drops tokens before 'keep_from' and the buffers the stream grew out of.
+// Nothing may point into the stream's data. Returns the number of tokens dropped.
+int token_stream_release(TokenStream* stream, int keep_from);
 
 // This is an expensive operation, we calculate line numbers
-void print_lines_from_token_stream(TokenStream* stream, Token token);
+void print_lines_from_token_stream(TokenStream* stream, TokenExt token);
 
 const char* name_from_token(TokenKind token);
 
-SourceLocation location_from_token(const TokenExt* tok);
+SourceLocation location_from_token(TokenExt tok);
 
 bool compute_source_info(TokenStream* stream, SourceLocation location, int* line, int* column, string* code);
 
+// Failed result with the message at path:line:column and the line of code under it.
+// c_path and c_line is where in the compiler the error was reported, printed first.
+Result source_error(TokenStream* stream, SourceLocation location, const char* c_path, int c_line, const char* message);
+
 void print_token_stream(TokenStream* stream);
 
 void token_stream_cleanup(TokenStream* stream);
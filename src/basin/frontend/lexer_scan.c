@@ -0,0 +1,244 @@
+#include "basin/frontend/lexer_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define SCAN_X86
+#endif
+
+typedef enum {
+    SCAN_LEVEL_UNKNOWN,
+    SCAN_LEVEL_SCALAR,
+    SCAN_LEVEL_SSE2,
+    SCAN_LEVEL_AVX2,
+} ScanLevel;
+
+static ScanLevel scan_level;
+
+// Every thread computes the same level so racing on it is fine.
+// BASIN_SCAN_SCALAR in the environment turns the vector loops off at runtime,
+// tests compare the tokens of both (see tests/run_tests.py).
+static inline ScanLevel get_scan_level() {
+    if (scan_level != SCAN_LEVEL_UNKNOWN)
+        return scan_level;
+
+    ScanLevel level = SCAN_LEVEL_SCALAR;
+    #if defined(SCAN_X86) && !defined(BASIN_SCAN_SCALAR)
+        if (!getenv("BASIN_SCAN_SCALAR")) {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                level = SCAN_LEVEL_AVX2;
+            else if (__builtin_cpu_supports("sse2"))
+                level = SCAN_LEVEL_SSE2;
+        }
+    #endif
+    atomic_store(&scan_level, level);
+    return level;
+}
+
+//##############################
+//      SCALAR
+//##############################
+
+// Same checks as the lexer did before, chars are signed so bytes >= 0x80 never match.
+static inline bool is_space_char(char chr) {
+    return chr == ' ' || chr == '\t' || chr == '\r' || chr == '\f';
+}
+static inline bool is_identifier_char(char chr) {
+    return (chr >= '0' && chr <= '9') || ((chr|32) >= 'a' && (chr|32) <= 'z') || chr == '_';
+}
+
+static int scan_spaces_scalar(const char* text, int head, int len) {
+    while (head < len && is_space_char(text[head]))
+        head++;
+    return head;
+}
+static int scan_identifier_scalar(const char* text, int head, int len) {
+    while (head < len && is_identifier_char(text[head]))
+        head++;
+    return head;
+}
+static int scan_digits_scalar(const char* text, int head, int len) {
+    while (head < len && text[head] >= '0' && text[head] <= '9')
+        head++;
+    return head;
+}
+static int scan_find_scalar(const char* text, int head, int len, char a, char b, char c) {
+    while (head < len && text[head] != a && text[head] != b && text[head] != c)
+        head++;
+    return head;
+}
+static int count_char_scalar(const char* text, int* head, int len, char chr) {
+    int count = 0;
+    for (int i=*head;i<len;i++)
+        count += text[i] == chr;
+    *head = len;
+    return count;
+}
+
+#ifdef SCAN_X86
+
+//##############################
+//      SSE2
+//##############################
+
+// The masks have a bit set for each byte that doesn't stop the scan.
+
+__attribute__((target("sse2")))
+static inline u32 spaces_mask_sse2(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\f'))));
+    return _mm_movemask_epi8(m);
+}
+__attribute__((target("sse2")))
+static inline u32 digits_mask_sse2(__m128i v) {
+    // Signed compares, same as comparing chars
+    __m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    return _mm_movemask_epi8(m);
+}
+__attribute__((target("sse2")))
+static inline u32 identifier_mask_sse2(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(32));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+    return digits_mask_sse2(v) | _mm_movemask_epi8(_mm_or_si128(alpha, under));
+}
+
+#define DEF_SCAN_SSE2(NAME, MASK_EXPR, ...)                                  \
+    __attribute__((target("sse2")))                                         \
+    static int NAME##_sse2(const char* text, int head, int len __VA_OPT__(,) __VA_ARGS__) { \
+        while (head + 16 <= len) {                                          \
+            __m128i v = _mm_loadu_si128((const __m128i*)(text + head));     \
+            u32 stop = ~(MASK_EXPR) & 0xFFFF;                               \
+            if (stop)                                                       \
+                return head + __builtin_ctz(stop);                          \
+            head += 16;                                                     \
+        }                                                                   \
+        return head;                                                        \
+    }
+
+DEF_SCAN_SSE2(scan_spaces,     spaces_mask_sse2(v))
+DEF_SCAN_SSE2(scan_identifier, identifier_mask_sse2(v))
+DEF_SCAN_SSE2(scan_digits,     digits_mask_sse2(v))
+DEF_SCAN_SSE2(scan_find,
+    ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(b))), _mm_cmpeq_epi8(v, _mm_set1_epi8(c)))),
+    char a, char b, char c)
+
+// Counts don't stop early, they advance head past the last full vector.
+__attribute__((target("sse2")))
+static int count_char_sse2(const char* text, int* head, int len, char chr) {
+    __m128i needle = _mm_set1_epi8(chr);
+    int count = 0;
+    int i = *head;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+    *head = i;
+    return count;
+}
+
+//##############################
+//      AVX2
+//##############################
+
+__attribute__((target("avx2")))
+static inline u32 spaces_mask_avx2(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f'))));
+    return _mm256_movemask_epi8(m);
+}
+__attribute__((target("avx2")))
+static inline u32 digits_mask_avx2(__m256i v) {
+    __m256i m = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    return _mm256_movemask_epi8(m);
+}
+__attribute__((target("avx2")))
+static inline u32 identifier_mask_avx2(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(32));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+    return digits_mask_avx2(v) | _mm256_movemask_epi8(_mm256_or_si256(alpha, under));
+}
+
+#define DEF_SCAN_AVX2(NAME, MASK_EXPR, ...)                                   \
+    __attribute__((target("avx2")))                                          \
+    static int NAME##_avx2(const char* text, int head, int len __VA_OPT__(,) __VA_ARGS__) { \
+        while (head + 32 <= len) {                                           \
+            __m256i v = _mm256_loadu_si256((const __m256i*)(text + head));   \
+            u32 stop = ~(MASK_EXPR);                                         \
+            if (stop)                                                        \
+                return head + __builtin_ctz(stop);                           \
+            head += 32;                                                      \
+        }                                                                    \
+        return head;                                                         \
+    }
+
+DEF_SCAN_AVX2(scan_spaces,     spaces_mask_avx2(v))
+DEF_SCAN_AVX2(scan_identifier, identifier_mask_avx2(v))
+DEF_SCAN_AVX2(scan_digits,     digits_mask_avx2(v))
+DEF_SCAN_AVX2(scan_find,
+    ~_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(a)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(b))), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)))),
+    char a, char b, char c)
+
+__attribute__((target("avx2,popcnt"))) // every AVX2 CPU has popcnt
+static int count_char_avx2(const char* text, int* head, int len, char chr) {
+    __m256i needle = _mm256_set1_epi8(chr);
+    int count = 0;
+    int i = *head;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    }
+    *head = i;
+    return count;
+}
+
+#endif // SCAN_X86
+
+//##############################
+//      DISPATCH
+//##############################
+
+// The vector loops stop when less than a vector is left or at the stopping byte.
+// The next level continues from there, the scalar loop handles the tail.
+#ifdef SCAN_X86
+    #define DISPATCH_SCAN(NAME, ...)                                              \
+        ScanLevel level = get_scan_level();                                       \
+        if (level >= SCAN_LEVEL_AVX2) {                                           \
+            head = NAME##_avx2(text, head, len __VA_OPT__(,) __VA_ARGS__);        \
+            if (head + 32 <= len)                                                 \
+                return head;                                                      \
+        }                                                                         \
+        if (level >= SCAN_LEVEL_SSE2) {                                           \
+            head = NAME##_sse2(text, head, len __VA_OPT__(,) __VA_ARGS__);        \
+            if (head + 16 <= len)                                                 \
+                return head;                                                      \
+        }                                                                         \
+        return NAME##_scalar(text, head, len __VA_OPT__(,) __VA_ARGS__);
+#else
+    #define DISPATCH_SCAN(NAME, ...) return NAME##_scalar(text, head, len __VA_OPT__(,) __VA_ARGS__);
+#endif
+
+int scan_spaces(const char* text, int head, int len) {
+    DISPATCH_SCAN(scan_spaces)
+}
+int scan_identifier(const char* text, int head, int len) {
+    DISPATCH_SCAN(scan_identifier)
+}
+int scan_digits(const char* text, int head, int len) {
+    DISPATCH_SCAN(scan_digits)
+}
+int scan_find(const char* text, int head, int len, char a, char b, char c) {
+    DISPATCH_SCAN(scan_find, a, b, c)
+}
+int scan_count(const char* text, int head, int len, char chr) {
+    int count = 0;
+    #ifdef SCAN_X86
+        ScanLevel level = get_scan_level();
+        if (level >= SCAN_LEVEL_AVX2)
+            count += count_char_avx2(text, &head, len, chr);
+        if (level >= SCAN_LEVEL_SSE2)
+            count += count_char_sse2(text, &head, len, chr);
+    #endif
+    return count + count_char_scalar(text, &head, len, chr);
+}
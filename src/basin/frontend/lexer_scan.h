@@ -0,0 +1,24 @@
+/*
+    Scanning functions for the lexer's hot loops (whitespace, identifiers, numbers,
+    comments and strings) and for line tables. They classify 16 or 32 bytes at a time with SSE2/AVX2
+    if the CPU has it (checked once at runtime) and fall back to a byte loop.
+
+    Every function takes the text, a start position and the text length and returns
+    the position of the first byte that stops the scan, 'len' if there is none.
+    Bytes at or after 'len' are never read.
+*/
+
+#pragma once
+
+#include "platform/platform.h"
+
+// Skips ' ', '\t', '\r' and '\f'. Newlines stop the scan since tokens are flagged after them.
+int scan_spaces(const char* text, int head, int len);
+// Skips [0-9a-zA-Z_]
+int scan_identifier(const char* text, int head, int len);
+// Skips [0-9]
+int scan_digits(const char* text, int head, int len);
+// Finds the first a, b or c. Pass the same character several times to find fewer.
+int scan_find(const char* text, int head, int len, char a, char b, char c);
+// Number of 'chr' from head to len. Doesn't stop, used to size tables before filling them.
+int scan_count(const char* text, int head, int len, char chr);
@@ -1,6 +1,6 @@
 /*
-    The parsing and matching pretty much always uses TokenExt since it encompasses
-    Token and TokenExt.
+    The parsing and matching works on TokenExt values, peek and advance read
+    them out of the stream's token arrays.
 */
 
 #include "basin/frontend/parser.h"
@@ -17,6 +17,7 @@
 
 // 0 current token
 #define peek(N) _peek(context, N)
+#define peek_kind(N) _peek_kind(context, N)
 #define advance() _advance(context)
 
 #define PROFILE_START() TracyCZone(zone, 1); push_profile_zone(context, zone)
@@ -38,6 +39,20 @@ typedef struct {
     
     ASTExpression_Block* previous_block;
     ASTFunction*         current_function;
+    AST*                 ast;
+
+    // Expressions are allocated here, the AST's arena or body_arena while
+    // parsing a function body, it's reset once the body is flattened (see parse_function_body).
+    Arena*               expr_arena;
+    Arena                body_arena;
+    bool                 skip_bodies; // top-level function bodies are parsed by parse_body_batch
+
+    Array_Task import_tasks; // parse tasks for imports, added to the driver in batches
+
+    // Errors in file order, a declaration (or body) with an error is skipped and parsing goes on
+    // with the next one until there are max_errors. Reported when parsing is done.
+    Array_string errors;
+    int          max_errors;
 
     ComptimeKind comptime_kind;
     
@@ -52,8 +67,9 @@ typedef struct {
     TracyCZoneCtx* zones;
 } ParserContext;
 
-static inline void cleanup_profile_zones(ParserContext* ctx) {
-    while (ctx->zones_len) {
+// Ends the zones left open by longjmp, the first 'keep' zones stay
+static inline void cleanup_profile_zones(ParserContext* ctx, int keep) {
+    while (ctx->zones_len > keep) {
         ctx->zones_len--;
         TracyCZoneEnd(ctx->zones[ctx->zones_len]);
     }
@@ -74,14 +90,24 @@ static inline void pop_profile_zone(ParserContext* ctx) {
     ctx->zones_len--;
 }
 
+// Nodes, names and the arrays in nodes are allocated in the AST's arena
+#define AST_ALLOC_OBJECT(T) ARENA_ALLOC_OBJECT(&context->ast->arena, T)
+#define ast_push(ARR, ELEMENTP) arena_array_push(&context->ast->arena, ARR, ELEMENTP)
+#define ast_clone_string(PTR, LEN) arena_clone_string(&context->ast->arena, PTR, LEN)
+
+// Expressions, their arrays and strings. Blocks and declarations use the AST's arena.
+#define EXPR_ALLOC_OBJECT(T) ARENA_ALLOC_OBJECT(context->expr_arena, T)
+#define expr_push(ARR, ELEMENTP) arena_array_push(context->expr_arena, ARR, ELEMENTP)
+#define expr_clone_string(PTR, LEN) arena_clone_string(context->expr_arena, PTR, LEN)
+
 #define CREATE_EXPR(V, T, KIND, TOK)      \
-    T* V = HEAP_ALLOC_OBJECT(T);          \
+    T* V = EXPR_ALLOC_OBJECT(T);          \
     V->kind = KIND;                       \
     V->location = location_from_token(TOK);
 
 
 #define SET_EXPR(V, T, KIND, TOK)         \
-    V = HEAP_ALLOC_OBJECT(T);          \
+    V = EXPR_ALLOC_OBJECT(T);             \
     V->kind = KIND;                       \
     V->location = location_from_token(TOK);
 
@@ -98,13 +124,55 @@ ASTFunction* parse_function(ParserContext* context);
 ASTEnum* parse_enum(ParserContext* context);
 ASTStruct* parse_struct(ParserContext* context);
 
+// Values of globals, constants and enum members are kept as pointer nodes,
+// they stay when the body they are declared in is flattened.
+static ASTExpression* parse_declaration_value(ParserContext* context) {
+    Arena* prev_arena = context->expr_arena;
+    context->expr_arena = &context->ast->arena;
+    ASTExpression* expr = parse_expression(context);
+    context->expr_arena = prev_arena;
+    return expr;
+}
+
+static void flush_import_tasks(ParserContext* context) {
+    driver_add_tasks(context->driver, context->import_tasks.ptr, context->import_tasks.len, -1);
+    context->import_tasks.len = 0;
+}
+
 // ASTExpression* create_expression(ParserContext* context, ExpressionKind kind) {
 //     // @TODO Use linear allocator?
-//     ASTExpression* expr = HEAP_ALLOC_OBJECT(ASTExpression);
+//     ASTExpression* expr = AST_ALLOC_OBJECT(ASTExpression);
 //     return expr;
 // }
 
-Result parse_stream(Compilation* compilation, TokenStream* stream, AST** out_ast) {
+// Called after longjmp from a parse error, keeps the error with the source line.
+// Returns true if there are enough errors to stop parsing.
+static bool add_parse_error(ParserContext* context, int keep_zones) {
+    cleanup_profile_zones(context, keep_zones);
+
+    Result error = source_error(context->stream, location_from_token(context->bad_token), context->c_location.path, context->c_location.line, context->error_message);
+    array_push(&context->errors, &error.message);
+
+    // Whatever was being parsed is abandoned, expressions go in the AST's arena again
+    context->current_function = NULL;
+    context->comptime_kind    = COMPTIME_NONE;
+    context->expr_arena       = &context->ast->arena;
+    arena_reset(&context->body_arena);
+
+    return context->errors.len >= context->max_errors || context->compilation->cancelled;
+}
+
+void report_parse_errors(Compilation* compilation, Array_string* errors) {
+    for (int i=0;i<errors->len;i++) {
+        // Errors after the compilation was cancelled wouldn't be reported by a serial parse either
+        if (!compilation->cancelled)
+            comp_report_error(compilation, errors->ptr[i].ptr);
+        string_cleanup(&errors->ptr[i]);
+    }
+    array_cleanup(errors);
+}
+
+Result parse_stream(Compilation* compilation, TokenStream* stream, bool skip_bodies, AST** out_ast) {
     TracyCZone(zone, 1);
     // We implement this recursively because it's easier to debug issues
     Result result = {};
@@ -121,28 +189,55 @@ Result parse_stream(Compilation* compilation, TokenStream* stream, AST** out_ast
     context.compilation = compilation;
     context.driver = compilation->driver;
     context.head = 0;
+    context.ast = ast;
+    context.expr_arena = &ast->arena;
+    context.skip_bodies = skip_bodies;
+    context.max_errors = comp_max_errors(compilation);
+    ASSERT(!skip_bodies || !stream->streaming);
 
     int res = setjmp(context.jump_state);
 
     if (res == 0) {
-
         ast->global_block = parse_block_expression(&context, true);
-
-        *out_ast = ast;
     } else {
-        cleanup_profile_zones(&context);
+        // Errors outside a declaration, names declared twice at file scope
+        add_parse_error(&context, 0);
+    }
 
-        int line, column;
-        string code;
-        bool yes = compute_source_info(stream, location_from_token(&context.bad_token), &line, &column, &code);
+    // Imports we created must be parsed even if we failed, other files may reach them.
+    flush_import_tasks(&context);
+
+    if (context.errors.len > 0 && skip_bodies) {
+        // A serial parse reports errors in the bodies and at file scope in file order,
+        // it's simpler to parse again than to merge them with the errors of the batches.
+        // The imports exist now so they don't get new tasks.
+        for (int i=0;i<context.errors.len;i++)
+            string_cleanup(&context.errors.ptr[i]);
+        array_cleanup(&context.errors);
+        array_cleanup(&context.import_tasks);
+        arena_cleanup(&context.body_arena);
+        ast->stream = NULL;
+        ast_cleanup(ast);
+        TracyCZoneEnd(zone);
+        return parse_stream(compilation, stream, false, out_ast);
+    }
 
-        char buffer[1024];
-        int len = 0;
-        len += snprintf(buffer + len, sizeof(buffer) - len, "\033[0;30m%s:%d\033[0m\n", context.c_location.path, context.c_location.line);
-        len += snprintf(buffer + len, sizeof(buffer) - len, "\033[0;31m%s:%d:%d:\033[0m %s\n%s", stream->import->path.ptr, line, column, context.error_message, code.ptr);
+    if (context.errors.len > 0) {
+        report_parse_errors(compilation, &context.errors);
         result.kind = FAILURE;
-        result.message = string_clone_cptr(buffer);
+
+        // The nodes parsed so far and the stream go away with the AST
+        ast_cleanup(ast);
+    } else {
+        if (stream->streaming)
+            token_stream_release(stream, stream->tokens_len);
+
+        flat_shrink(&ast->flat);
+
+        *out_ast = ast;
     }
+    array_cleanup(&context.import_tasks);
+    arena_cleanup(&context.body_arena);
     TracyCZoneEnd(zone);
     return result;
 }
@@ -150,10 +245,10 @@ Result parse_stream(Compilation* compilation, TokenStream* stream, AST** out_ast
 
 #define parse_error(TOK, FMT, ...) do { (context->c_location.path = __FILE__, context->c_location.line = __LINE__, _parse_error(context, TOK, FMT __VA_OPT__(,)  __VA_ARGS__)); } while (0)
 
-#define check_error_ext(T, ...) do { if ((T)->kind == T_END_OF_FILE) parse_error((const TokenExt*)(void*)(T), __VA_ARGS__); } while (0)
+#define check_error_ext(T, ...) do { if ((T).kind == T_END_OF_FILE) parse_error(T, __VA_ARGS__); } while (0)
 
-void _parse_error(ParserContext* context, const TokenExt* tok, char* fmt, ...) {
-    context->bad_token = *(const TokenExt*)tok;
+void _parse_error(ParserContext* context, TokenExt tok, char* fmt, ...) {
+    context->bad_token = tok;
 
     va_list ap;
     va_start(ap, fmt);
@@ -163,45 +258,65 @@ void _parse_error(ParserContext* context, const TokenExt* tok, char* fmt, ...) {
     longjmp(context->jump_state, 1);
 }
 
-static const TokenExt* _peek(ParserContext* context, int n) {
-    int head = context->head;
-    const TokenExt* tok = NULL;
-    while((n+1)) {
-        n--;
-        if (head >= context->stream->tokens_len)
-            return &EOF_TOKEN_EXT;
-        tok = (const TokenExt*)&context->stream->tokens[head];
-        if (IS_EXT_TOKEN(tok->kind))
-            head += TOKEN_PER_EXT_TOKEN;
-        else
-            head+=1;
-    }
+// For errors found after the tokens were parsed, only the position is used for the message.
+static TokenExt token_at_location(SourceLocation location) {
+    TokenExt tok = {};
+    tok.kind      = T_IDENTIFIER;
+    tok.import_id = location.import_id;
+    tok.position  = location.position;
     return tok;
 }
 
-static const TokenExt* _match(ParserContext* context, TokenKind kind) {
-    const TokenExt* tok = _peek(context, 0);
-    if (tok->kind == kind) {
-        context->head += 1 + (TOKEN_PER_EXT_TOKEN - 1) * IS_EXT_TOKEN(kind);
+// Streamed tokens are lexed when the parser gets to them
+static inline bool have_token(ParserContext* context, int index) {
+    while (index >= context->stream->tokens_len) {
+        if (!context->stream->lexing || !token_stream_fill(context->stream))
+            return false;
+    }
+    return true;
+}
+
+// Index of the token closing the bracket at 'index', see matching_token.
+// A streamed close may not be lexed yet, we lex until it is. -1 if the bracket is never closed.
+static int matching_close(ParserContext* context, int index) {
+    int close;
+    while ((close = matching_token(context->stream, index)) < 0) {
+        if (!context->stream->lexing || !token_stream_fill(context->stream))
+            return -1;
+    }
+    return close;
+}
+
+static TokenExt _peek(ParserContext* context, int n) {
+    if (!have_token(context, context->head + n))
+        return EOF_TOKEN_EXT;
+    return token_at(context->stream, context->head + n);
+}
+
+// Kind of a token ahead, only the kinds are read
+static inline TokenKind _peek_kind(ParserContext* context, int n) {
+    if (!have_token(context, context->head + n))
+        return T_END_OF_FILE;
+    return context->stream->kinds[context->head + n];
+}
+
+static TokenExt _match(ParserContext* context, TokenKind kind) {
+    TokenExt tok = _peek(context, 0);
+    if (tok.kind == kind) {
+        context->head++;
         return tok;
     } else {
-        _parse_error(context, (const TokenExt*)&context->stream->tokens[context->head], "Unexpected token, wanted '%s'", name_from_token(kind));
+        _parse_error(context, tok, "Unexpected token, wanted '%s'", name_from_token(kind));
         // unreachable
-        return &EOF_TOKEN_EXT;
+        return EOF_TOKEN_EXT;
     }
 }
 
 
-static const TokenExt* _advance(ParserContext* context) {
-    if (context->head >= context->stream->tokens_len)
-        return &EOF_TOKEN_EXT;
-    const TokenExt* tok;
-    tok = (const TokenExt*)&context->stream->tokens[context->head];
-    if (IS_EXT_TOKEN(tok->kind))
-        context->head += TOKEN_PER_EXT_TOKEN;
-    else
-        context->head += 1;
-    return tok;
+static TokenExt _advance(ParserContext* context) {
+    if (!have_token(context, context->head))
+        return EOF_TOKEN_EXT;
+    return token_at(context->stream, context->head++);
 }
 
 void enter_comptime_mode(ParserContext* context, ComptimeKind kind) {
@@ -216,69 +331,115 @@ void exit_comptime_mode(ParserContext* context) {
 #define IS_COMPTIME() (context->comptime_kind != COMPTIME_NONE)
 
 
+// Moves past the declaration that failed to parse, to the first token on a new line after the bad token.
+// Brackets are skipped as a whole so the rest of a function body isn't mistaken for declarations.
+static void skip_declaration(ParserContext* context, int start, int bad) {
+    int index = start;
+    while (true) {
+        TokenKind kind = _peek_kind(context, index - context->head);
+        if (kind == T_END_OF_FILE)
+            break;
+        if (index > bad && (context->stream->flags[index] & TF_PRE_NEWLINE))
+            break;
+        if (kind == '{' || kind == '(' || kind == '[') {
+            int close = matching_close(context, index);
+            if (close < 0)
+                break;
+            index = close + 1;
+        } else {
+            index++;
+        }
+    }
+    context->head = index;
+}
+
 ASTExpression_Block* parse_block_expression(ParserContext* context, ParseBlockFlags block_flags) {
     PROFILE_START();
 
     bool in_file_scope = block_flags & IN_FILE_SCOPE;
     bool in_case_scope = block_flags & IN_CASE_SCOPE;
 
-    const TokenExt* block_tok = peek(0);
+    TokenExt block_tok = peek(0);
     if (!in_file_scope && !in_case_scope) {
         match('{');
     }
     
-    CREATE_EXPR(block_expr, ASTExpression_Block, EXPR_BLOCK, block_tok);
+    // Blocks outlive the body's expressions, they hold the declarations
+    ASTExpression_Block* block_expr = AST_ALLOC_OBJECT(ASTExpression_Block);
+    block_expr->kind     = EXPR_BLOCK;
+    block_expr->location = location_from_token(block_tok);
     block_expr->parent = context->previous_block;
     context->previous_block = block_expr;
 
+    // Errors in a declaration at file scope come back here, the outer handler gets the others
+    jmp_buf outer_jump_state;
+    memcpy(&outer_jump_state, &context->jump_state, sizeof(jmp_buf));
+    int zones = context->zones_len;
+
     while (true) {
-        const TokenExt* tok  = peek(0);
-        const TokenExt* tok1 = peek(1);
+        if (in_file_scope && context->stream->streaming && context->head >= TOKEN_STREAM_BATCH) {
+            // Declarations before this one are parsed, nothing points to their tokens anymore
+            context->head -= token_stream_release(context->stream, context->head);
+        }
+
+        int start = context->head;
+        if (in_file_scope && setjmp(context->jump_state)) {
+            context->previous_block = block_expr;
+            int bad = context->head;
+            if (add_parse_error(context, zones))
+                break;
+            skip_declaration(context, start, bad);
+            continue;
+        }
+
+        TokenExt tok  = peek(0);
+        TokenKind kind1 = peek_kind(1);
+
+        if (tok.kind != T_IMPORT && context->import_tasks.len > 0) {
+            // Imports are usually grouped, add them together once the group ends
+            // so they can start while we parse the rest of the file.
+            flush_import_tasks(context);
+        }
 
         if (IS_EOF(tok) && in_file_scope) {
             break;
         }
 
-        if (tok->kind == '@') {
+        if (tok.kind == '@') {
             advance();
             ASTAnnotation anot = {};
             
-            const TokenExt* tok_ident = match(T_IDENTIFIER);
-            cstring anot_name = DATA_FROM_IDENTIFIER(tok_ident);
-            anot.name = string_clone_cstr(anot_name);
-
-            const TokenExt* tok_start = peek(0);
-            const TokenExt* tok_end = &EOF_TOKEN_EXT;
-            if (tok_start->kind == '(') {
-                advance();
-                while (true) {
-                    tok_end = peek(0);
-                    if (tok_end->kind == T_END_OF_FILE)
-                        break;
-                    if (tok_end->kind == ')') {
-                        break;
-                    }
-                    advance();
-                }
+            TokenExt tok_ident = match(T_IDENTIFIER);
+            anot.name = ATOM_FROM_IDENTIFIER(tok_ident);
+
+            TokenExt tok_start = peek(0);
+            TokenExt tok_end = EOF_TOKEN_EXT;
+            if (tok_start.kind == '(') {
+                // The content is kept as text, skip to the close
+                int close = matching_close(context, context->head);
+                if (close < 0)
+                    parse_error(tok_start, "Missing ')' for the annotation.");
+                context->head = close;
+                tok_end = peek(0);
                 match(')');
 
-                int start_pos = tok_start->position+1;
+                int start_pos = tok_start.position+1;
 
-                if (tok_end->position - start_pos > 0) {
-                    anot.content = string_clone(context->stream->import->text.ptr + start_pos, tok_end->position - start_pos);
+                if (tok_end.position - start_pos > 0) {
+                    anot.content = ast_clone_string(context->stream->import->text.ptr + start_pos, tok_end.position - start_pos);
                 }
             }
 
-            debug("ANOT %s '%.*s'\n", anot.name.ptr, anot.content.len, anot.content.ptr);
+            debug("ANOT %s '%.*s'\n", NAME_FROM_IDENTIFIER(context->stream, tok_ident).ptr, anot.content.len, anot.content.ptr);
 
             // TODO: Add annotations to the AST
             continue;
         }
 
-        if(tok->kind == T_IMPORT) {
+        if(tok.kind == T_IMPORT) {
             advance();
             
-            const TokenExt* tok = match(T_LITERAL_STRING);
+            TokenExt tok = match(T_LITERAL_STRING);
             
             cstring path = DATA_FROM_STRING(tok);
             
@@ -286,170 +447,169 @@ ASTExpression_Block* parse_block_expression(ParserContext* context, ParseBlockFl
             if (resolved_path.len == 0) {
                 parse_error(tok, "Could not resolve path '%s'. Use 'import \"linux\"' to resolve from import directories, use 'import \"./hello.bsn\"' to resolve from relative directory relative to current source file.", path.ptr);
             }
-        
-            // @TODO Check if import already exists.
-            Task task = {};
-            task.kind = TASK_LEX_AND_PARSE;
-            task.compilation = context->compilation;
-            task.lex_and_parse.import = driver_create_import_id(context->driver, cstr(resolved_path));
+
+            // Imports parsed by an earlier compilation (or another file) are reused
+            bool created;
+            Import* import = driver_find_or_create_import(context->driver, context->compilation, cstr(resolved_path), &created);
 
             string_cleanup(&resolved_path);
 
-            driver_add_task(context->driver, &task);
+            if (created) {
+                Task task = {};
+                task.kind = TASK_LEX_AND_PARSE;
+                task.compilation = context->compilation;
+                task.lex_and_parse.import = import;
+                array_push(&context->import_tasks, &task);
+            }
 
             ASTImport new_import = {};
             new_import.location = location_from_token(tok);
             new_import.shared = false; // set from annontation @shared
-            new_import.import = task.lex_and_parse.import;
+            new_import.import = import;
             
             // @TODO Implement annotation '@external(libc) import "unistd.h"'
             //   We don't reserve T_FROM anymore
             // tok = peek(0);
-            // if (tok->kind == T_FROM) {
+            // if (tok.kind == T_FROM) {
             //     advance();
             //     parse_error(tok, "@TODO implement 'import \"main\" from lib'");
             // }
 
             tok = peek(0);
-            if (tok->kind == T_AS) {
+            if (tok.kind == T_AS) {
                 advance();
                 tok = match(T_IDENTIFIER);
-                cstring name = DATA_FROM_STRING(tok);
-                new_import.name = string_clone_cstr(name);
+                new_import.name = ATOM_FROM_IDENTIFIER(tok);
             }
 
-            array_push(&block_expr->imports, &new_import);
+            ast_push(&block_expr->imports, &new_import);
+            ast_push(&context->ast->imports, &new_import.import);
 
             tok = peek(0);
-            if (tok->kind == T_AS) {
+            if (tok.kind == T_AS) {
                 advance();
                 tok = match(T_IDENTIFIER);
 
-                cstring name = DATA_FROM_STRING(tok);
-                new_import.name = string_clone_cstr(name);
+                new_import.name = ATOM_FROM_IDENTIFIER(tok);
             }
 
             // @TODO Add import to scope tree
-        } else if(tok->kind == T_LIBRARY) {
+        } else if(tok.kind == T_LIBRARY) {
             advance();
             
-            const TokenExt* tok_str = match(T_LITERAL_STRING);
+            TokenExt tok_str = match(T_LITERAL_STRING);
             cstring path = DATA_FROM_STRING(tok_str);
 
             ASTLibrary new_library = {};
             new_library.location = location_from_token(tok);
-            new_library.library_name = string_clone_cstr(path);
+            new_library.library_name = ast_clone_string(path.ptr, path.len);
 
-            const TokenExt* tok_as = peek(0);
-            if (tok_as->kind == T_AS) {
+            TokenExt tok_as = peek(0);
+            if (tok_as.kind == T_AS) {
                 advance();
                 tok_as = match(T_IDENTIFIER);
-                cstring name = DATA_FROM_IDENTIFIER(tok_as);
-                new_library.name = string_clone_cstr(name);
+                new_library.name = ATOM_FROM_IDENTIFIER(tok_as);
             }
             
-            array_push(&block_expr->libraries, &new_library);
+            ast_push(&block_expr->libraries, &new_library);
 
-        } else if (tok->kind == T_GLOBAL) {
+        } else if (tok.kind == T_GLOBAL) {
             advance();
             
-            const TokenExt* ident_tok = match(T_IDENTIFIER);
+            TokenExt ident_tok = match(T_IDENTIFIER);
             match(':');
             
-            ASTGlobal* data_object = HEAP_ALLOC_OBJECT(ASTGlobal);
+            ASTGlobal* data_object = AST_ALLOC_OBJECT(ASTGlobal);
             data_object->location = location_from_token(ident_tok);
             
-            cstring name = DATA_FROM_TOKEN(ident_tok);
-            data_object->name = string_clone_cstr(name);
+            data_object->name = ATOM_FROM_IDENTIFIER(ident_tok);
             
-            const TokenExt* equal_tok = peek(0);
+            TokenExt equal_tok = peek(0);
 
             bool res = parse_type(context, &data_object->type_name);
             ASSERT(res);
             
             equal_tok = peek(0);
-            if (equal_tok->kind == '=') {
+            if (equal_tok.kind == '=') {
                 advance();
-                data_object->value = parse_expression(context);
+                data_object->value = parse_declaration_value(context);
             }
 
-            array_push(&block_expr->globals, &data_object);
-        } else if (tok->kind == T_CONST) {
+            ast_push(&block_expr->globals, &data_object);
+        } else if (tok.kind == T_CONST) {
             advance();
             
-            const TokenExt* ident_tok = match(T_IDENTIFIER);
+            TokenExt ident_tok = match(T_IDENTIFIER);
             
-            ASTConstant* data_object = HEAP_ALLOC_OBJECT(ASTConstant);
+            ASTConstant* data_object = AST_ALLOC_OBJECT(ASTConstant);
             data_object->location = location_from_token(ident_tok);
-            cstring name = DATA_FROM_TOKEN(ident_tok);
-            data_object->name = string_clone_cstr(name);
+            data_object->name = ATOM_FROM_IDENTIFIER(ident_tok);
 
-            const TokenExt* colon_tok = peek(0);
-            if (colon_tok->kind == ':') {
+            TokenExt colon_tok = peek(0);
+            if (colon_tok.kind == ':') {
                 advance();
                 bool res = parse_type(context, &data_object->type_name);
                 ASSERT(res);
             }
             
             match('=');
-            data_object->value = parse_expression(context);
+            data_object->value = parse_declaration_value(context);
             
-            array_push(&block_expr->constants, &data_object);
-        } else if (tok->kind == T_IDENTIFIER && tok1->kind == ':') {
+            ast_push(&block_expr->constants, &data_object);
+        } else if (tok.kind == T_IDENTIFIER && kind1 == ':') {
             advance();
             advance();
             
-            ASTVariable* data_object = HEAP_ALLOC_OBJECT(ASTVariable);
+            ASTVariable* data_object = AST_ALLOC_OBJECT(ASTVariable);
             data_object->location = location_from_token(tok);
             
-            cstring name = DATA_FROM_TOKEN(tok);
-            data_object->name = string_clone_cstr(name);
+            data_object->name = ATOM_FROM_IDENTIFIER(tok);
 
-            const TokenExt* equal_tok = peek(0);
-            if (equal_tok->kind != '=') {
+            TokenExt equal_tok = peek(0);
+            if (equal_tok.kind != '=') {
                 bool res = parse_type(context, &data_object->type_name);
                 ASSERT(res);
             }
             
             equal_tok = peek(0);
-            if (equal_tok->kind == '=') {
+            if (equal_tok.kind == '=') {
                 advance();
 
                 ASTExpression* rvalue = parse_expression(context);
 
                 CREATE_EXPR(expr_lval, ASTExpression_Identifier, EXPR_IDENTIFIER, tok);
-                expr_lval->name = string_clone_cstr(name);
+                expr_lval->name = data_object->name;
 
                 CREATE_EXPR(expr_assign, ASTExpression_Assign, EXPR_ASSIGN, equal_tok);
                 expr_assign->ref = (ASTExpression*) expr_lval;
                 expr_assign->value = rvalue;
 
-                array_push(&block_expr->expressions, (ASTExpression**)&expr_assign);
+                expr_push(&block_expr->expressions, (ASTExpression**)&expr_assign);
             }
 
-            array_push(&block_expr->variables, &data_object);
+            ast_push(&block_expr->variables, &data_object);
 
-        } else if (tok->kind == T_ENUM) {
+        } else if (tok.kind == T_ENUM) {
             
             ASTEnum* enu = parse_enum(context);
-            array_push(&block_expr->enums, &enu);
+            ast_push(&block_expr->enums, &enu);
 
-        } else if (tok->kind == T_STRUCT) {
+        } else if (tok.kind == T_STRUCT) {
             
             ASTStruct* struc = parse_struct(context);
-            array_push(&block_expr->structs, &struc);
+            ast_push(&block_expr->structs, &struc);
 
-        } else if (tok->kind == T_FN) {
+        } else if (tok.kind == T_FN) {
             
             ASTFunction* function = parse_function(context);
-            array_push(&block_expr->functions, &function);
+            ast_push(&block_expr->functions, &function);
 
-        } else if (tok->kind == '}') {
+        } else if (tok.kind == '}') {
             if (!in_file_scope) {
                 break;
             }
             parse_error(tok, "Unexpected closing brace. (at file scope)");
-        } else if (tok->kind == T_CASE || tok->kind == T_DEFAULT) {
+        } else if (tok.kind == T_CASE || tok.kind == T_DEFAULT) {
             if (in_case_scope) {
                 break;
             }
@@ -457,8 +617,8 @@ ASTExpression_Block* parse_block_expression(ParserContext* context, ParseBlockFl
         } else {
             ASTExpression* expr = parse_expression(context);
 
-            const TokenExt* equal_tok = peek(0);
-            if (equal_tok->kind == '=') {
+            TokenExt equal_tok = peek(0);
+            if (equal_tok.kind == '=') {
                 advance();
                 ASTExpression* rvalue = parse_expression(context);
 
@@ -466,17 +626,26 @@ ASTExpression_Block* parse_block_expression(ParserContext* context, ParseBlockFl
                 expr_assign->ref = expr;
                 expr_assign->value = rvalue;
 
-                array_push(&block_expr->expressions, (ASTExpression**)&expr_assign);
+                expr_push(&block_expr->expressions, (ASTExpression**)&expr_assign);
             } else {
-                array_push(&block_expr->expressions, &expr);
+                expr_push(&block_expr->expressions, &expr);
             }
         }
     }
 
+    if (in_file_scope) {
+        memcpy(&context->jump_state, &outer_jump_state, sizeof(jmp_buf));
+    }
+
     if (!in_file_scope && !in_case_scope) {
         match('}');
     }
 
+    ScopeEntry duplicate;
+    if (!build_scope_table(&context->ast->arena, block_expr, &duplicate)) {
+        parse_error(token_at_location(scope_entry_location(&duplicate)), "'%s' is already declared in this scope.", interner_get(context->stream->interner, duplicate.name).ptr);
+    }
+
     context->previous_block = block_expr->parent;
     
     PROFILE_END();
@@ -521,22 +690,22 @@ int op_precedence(int op_kind) {
 ASTExpression* parse_expression(ParserContext* context) {
     PROFILE_START();
 
-    const TokenExt* tok = peek(0);
+    TokenExt tok = peek(0);
 
     // TODO: Parse annotations
 
     ASTExpression* ret_expr;
 
-    if (tok->kind == T_RETURN) {
+    if (tok.kind == T_RETURN) {
         advance();
 
-        ASTExpression_Return* out_expr = HEAP_ALLOC_OBJECT(ASTExpression_Return);
+        ASTExpression_Return* out_expr = EXPR_ALLOC_OBJECT(ASTExpression_Return);
         out_expr->kind                 = EXPR_RETURN;
         out_expr->location             = location_from_token(tok);
 
-        const TokenExt* tok0 = peek(0);
+        TokenExt tok0 = peek(0);
         ASTExpression* expr = NULL;
-        if ((tok->flags & TF_POST_NEWLINE) || tok0->kind == ';') {
+        if ((tok.flags & TF_POST_NEWLINE) || tok0.kind == ';') {
             // no expression
         } else {
             while (1) {
@@ -545,10 +714,10 @@ ASTExpression* parse_expression(ParserContext* context) {
                     parse_error(tok0, "Expected an expression (if condition).");
                 }
 
-                array_push(&out_expr->exprs, &expr);
+                expr_push(&out_expr->exprs, &expr);
 
                 tok0 = peek(0);
-                if (tok0->kind == ',') {
+                if (tok0.kind == ',') {
                     advance();
                     continue;
                 }
@@ -558,16 +727,16 @@ ASTExpression* parse_expression(ParserContext* context) {
 
         ret_expr = (ASTExpression*)out_expr;
 
-    } else if (tok->kind == T_YIELD) {
+    } else if (tok.kind == T_YIELD) {
         advance();
 
-        ASTExpression_Yield* out_expr = HEAP_ALLOC_OBJECT(ASTExpression_Yield);
+        ASTExpression_Yield* out_expr = EXPR_ALLOC_OBJECT(ASTExpression_Yield);
         out_expr->kind                = EXPR_YIELD;
         out_expr->location            = location_from_token(tok);
 
-        const TokenExt* tok0 = peek(0);
+        TokenExt tok0 = peek(0);
         ASTExpression* expr = NULL;
-        if ((tok->flags & TF_POST_NEWLINE) || tok0->kind == ';') {
+        if ((tok.flags & TF_POST_NEWLINE) || tok0.kind == ';') {
             // no expression
         } else {
             while (1) {
@@ -576,10 +745,10 @@ ASTExpression* parse_expression(ParserContext* context) {
                     parse_error(tok0, "Expected an expression (if condition).");
                 }
 
-                array_push(&out_expr->exprs, &expr);
+                expr_push(&out_expr->exprs, &expr);
 
                 tok0 = peek(0);
-                if (tok0->kind == ',') {
+                if (tok0.kind == ',') {
                     advance();
                     continue;
                 }
@@ -589,27 +758,27 @@ ASTExpression* parse_expression(ParserContext* context) {
 
         ret_expr = (ASTExpression*)out_expr;
 
-    } else if (tok->kind == T_IF) {
+    } else if (tok.kind == T_IF) {
         advance();
 
         CREATE_EXPR(out_expr, ASTExpression_If, EXPR_IF, tok)
 
-        const TokenExt* tok0 = peek(0);
+        TokenExt tok0 = peek(0);
         ASTExpression* expr = parse_expression(context);
         if (!expr)
             parse_error(tok0, "Expected an expression (if condition).");
 
-        const TokenExt* tok1 = peek(0);
+        TokenExt tok1 = peek(0);
         ASTExpression* body = parse_expression(context);
         if (!body)
             parse_error(tok1, "Expected an expression (if body).");
         
         ASTExpression* else_body = NULL;
 
-        const TokenExt* tok2 = peek(0);
-        if (tok2->kind == T_ELSE) {
+        TokenExt tok2 = peek(0);
+        if (tok2.kind == T_ELSE) {
             advance();
-            const TokenExt* else_expr_tok = peek(0);
+            TokenExt else_expr_tok = peek(0);
             else_body = parse_expression(context);
             if (!else_body) {
                 parse_error(else_expr_tok, "Expected an expression (else body).");
@@ -622,10 +791,10 @@ ASTExpression* parse_expression(ParserContext* context) {
 
         ret_expr = (ASTExpression*)out_expr;
     
-    } else if (tok->kind == T_SWITCH) {
+    } else if (tok.kind == T_SWITCH) {
         advance();
 
-        const TokenExt* tok0 = peek(0);
+        TokenExt tok0 = peek(0);
         ASTExpression* expr = parse_expression(context);
         if (!expr)
             parse_error(tok0, "Expected an expression (if condition).");
@@ -638,37 +807,37 @@ ASTExpression* parse_expression(ParserContext* context) {
         bool has_default = false;
 
         while (true) {
-            const TokenExt* tok = peek(0);
+            TokenExt tok = peek(0);
 
             ASTExpression_Switch_Case switch_case = {};
 
-            if (tok->kind == '}') {
+            if (tok.kind == '}') {
                 advance();
                 break;
 
-            } else if(tok->kind == T_CASE) {
+            } else if(tok.kind == T_CASE) {
                 advance();
                 
                 while (true) {
                     ASTExpression* expr = parse_expression(context);
 
-                    array_push(&switch_case.conditions, &expr);
+                    expr_push(&switch_case.conditions, &expr);
 
-                    const TokenExt* tok = peek(0);
-                    if (tok->kind != ',') {
+                    TokenExt tok = peek(0);
+                    if (tok.kind != ',') {
                         break;
                     }
                     advance();
                 }
                 
-                const TokenExt* tok0 = peek(0);
-                if (tok0->kind == '}' || tok0->kind == T_CASE || tok0->kind == T_DEFAULT) {
+                TokenExt tok0 = peek(0);
+                if (tok0.kind == '}' || tok0.kind == T_CASE || tok0.kind == T_DEFAULT) {
                     // no body
                 } else {
                     switch_case.body = (ASTExpression*)parse_block_expression(context, IN_CASE_SCOPE);
                 }
 
-            } else if(tok->kind == T_DEFAULT) {
+            } else if(tok.kind == T_DEFAULT) {
                 advance();
                 
                 if (has_default) {
@@ -677,8 +846,8 @@ ASTExpression* parse_expression(ParserContext* context) {
                 }
                 has_default = true;
                 
-                const TokenExt* tok0 = peek(0);
-                if (tok0->kind == '}' || tok0->kind == T_CASE || tok0->kind == T_DEFAULT) {
+                TokenExt tok0 = peek(0);
+                if (tok0.kind == '}' || tok0.kind == T_CASE || tok0.kind == T_DEFAULT) {
                     // no body
                 } else {
                     switch_case.body = (ASTExpression*)parse_block_expression(context, IN_CASE_SCOPE);
@@ -687,47 +856,44 @@ ASTExpression* parse_expression(ParserContext* context) {
             } else {
                 parse_error(tok, "Expected '}' to close switch or 'case' to define a case and some code to run.");
             }
-            array_push(&out_expr->cases, &switch_case);
+            expr_push(&out_expr->cases, &switch_case);
         }
 
         ret_expr = (ASTExpression*)out_expr;
 
-    } else if (tok->kind == T_FOR) {
+    } else if (tok.kind == T_FOR) {
         advance();
 
         // @TODO Reverse annotation
 
-        const TokenExt* tok0 = peek(0);
-        const TokenExt* tok1 = peek(1);
-        const TokenExt* tok2 = peek(2);
-        const TokenExt* tok3 = peek(3);
+        TokenExt tok0 = peek(0);
+        TokenExt tok1 = peek(1);
+        TokenExt tok2 = peek(2);
+        TokenExt tok3 = peek(3);
 
         // for NR,IT in ITEMS BODY
         // for IT in ITEMS BODY
         // for ITEMS BODY
 
-        string index_name = {};
-        string item_name = {};
+        Atom index_name = 0;
+        Atom item_name = 0;
 
-        if (tok0->kind == T_IDENTIFIER && tok1->kind == ',' && tok2->kind == T_IDENTIFIER && tok3->kind == T_IN) {
+        if (tok0.kind == T_IDENTIFIER && tok1.kind == ',' && tok2.kind == T_IDENTIFIER && tok3.kind == T_IN) {
             advance();
             advance();
             advance();
             advance();
-            cstring temp = DATA_FROM_IDENTIFIER(tok0);
-            cstring temp2 = DATA_FROM_IDENTIFIER(tok2);
-            item_name = string_clone_cstr(temp);
-            index_name = string_clone_cstr(temp2);
-        } else if (tok0->kind == T_IDENTIFIER && tok1->kind == T_IN) {
+            item_name = ATOM_FROM_IDENTIFIER(tok0);
+            index_name = ATOM_FROM_IDENTIFIER(tok2);
+        } else if (tok0.kind == T_IDENTIFIER && tok1.kind == T_IN) {
             advance();
             advance();
 
-            cstring temp = DATA_FROM_IDENTIFIER(tok0);
-            index_name = string_clone_cptr("nr");
-            item_name = string_clone_cstr(temp);
+            index_name = interner_intern(context->stream->interner, "nr", 2);
+            item_name = ATOM_FROM_IDENTIFIER(tok0);
         } else {
-            index_name = string_clone_cptr("nr");
-            item_name = string_clone_cptr("it");
+            index_name = interner_intern(context->stream->interner, "nr", 2);
+            item_name = interner_intern(context->stream->interner, "it", 2);
         }
 
         ASTExpression* cond = parse_expression(context);
@@ -741,13 +907,13 @@ ASTExpression* parse_expression(ParserContext* context) {
 
         ret_expr = (ASTExpression*)expr;
 
-    } else if (tok->kind == T_WHILE) {
+    } else if (tok.kind == T_WHILE) {
         advance();
         
         ASTExpression* cond = NULL;
         
-        const TokenExt* tok0 = peek(0);
-        if (tok0->kind == '{') {
+        TokenExt tok0 = peek(0);
+        if (tok0.kind == '{') {
             // infinite loop, no condition
         } else {
             cond = parse_expression(context);
@@ -761,7 +927,7 @@ ASTExpression* parse_expression(ParserContext* context) {
         
         ret_expr = (ASTExpression*)expr;
 
-    // } else if (tok->kind == '#') {
+    // } else if (tok.kind == '#') {
     //     // compile time expression
     //     advance();
 
@@ -772,7 +938,7 @@ ASTExpression* parse_expression(ParserContext* context) {
     //     ComptimeKind compttime_kind = COMPTIME_NORMAL;
 
     //     tok = peek(0);
-    //     if (tok->kind == T_IDENTIFIER) {
+    //     if (tok.kind == T_IDENTIFIER) {
     //         cstring data = DATA_FROM_TOKEN(tok);
             
     //         if(string_equal_cstr(data, "emit")) {
@@ -791,13 +957,13 @@ ASTExpression* parse_expression(ParserContext* context) {
     //     // Find out from current imports which 
 
     //     // generate code
-    } else if (tok->kind == T_CONTINUE) {
+    } else if (tok.kind == T_CONTINUE) {
         advance();
 
         CREATE_EXPR(expr, ASTExpression_Continue, EXPR_CONTINUE, tok);
         
         ret_expr = (ASTExpression*)expr;
-    } else if (tok->kind == T_BREAK) {
+    } else if (tok.kind == T_BREAK) {
         advance();
         
         CREATE_EXPR(expr, ASTExpression_Break, EXPR_BREAK, tok);
@@ -815,25 +981,26 @@ ASTExpression* parse_expression(ParserContext* context) {
         bool end_of_expression = false;
 
         while (true) {
-            const TokenExt* tok0 = peek(0);
-            const TokenExt* tok1 = peek(1);
+            TokenExt tok0 = peek(0);
+            TokenKind kind1 = peek_kind(1);
             
             if (expect_value) {
             
-                if (tok0->kind == T_IDENTIFIER) {
+                if (tok0.kind == T_IDENTIFIER) {
                     advance();
 
-                    cstring name = DATA_FROM_IDENTIFIER(tok0);
+                    cstring name = NAME_FROM_IDENTIFIER(context->stream, tok0);
                     if (string_equal_cstr(name, "__FUNC__")) {
                         CREATE_EXPR(expr, ASTExpression_Literal, EXPR_LITERAL, tok0);
                         expr->literal_kind = EXPR_LITERAL_STRING;
 
                         if (context->current_function) {
-                            expr->string_value = string_clone_cstr(cstr(context->current_function->name));
+                            cstring func_name = interner_get(context->stream->interner, context->current_function->name);
+                            expr->string_value = expr_clone_string(func_name.ptr, func_name.len);
                         } else {
                             // @TODO No function means top scope.
                             //    Would empty string be better?
-                            expr->string_value = string_clone_cptr("__topexpr__");
+                            expr->string_value = expr_clone_string("__topexpr__", strlen("__topexpr__"));
                         }
 
                         array_push(&exprs, (ASTExpression**)&expr);
@@ -847,8 +1014,8 @@ ASTExpression* parse_expression(ParserContext* context) {
                         ASSERT(res);
                         
                         char buffer[13];
-                        snprintf(buffer, sizeof(buffer), "%d", line);
-                        expr->string_value = string_clone_cptr(buffer);
+                        int len = snprintf(buffer, sizeof(buffer), "%d", line);
+                        expr->string_value = expr_clone_string(buffer, len);
 
                         array_push(&exprs, (ASTExpression**)&expr);
                     } else if (string_equal_cstr(name, "__COLUMN__")) {
@@ -861,51 +1028,50 @@ ASTExpression* parse_expression(ParserContext* context) {
                         ASSERT(res);
 
                         char buffer[13];
-                        snprintf(buffer, sizeof(buffer), "%d", column);
-                        expr->string_value = string_clone_cptr(buffer);
+                        int len = snprintf(buffer, sizeof(buffer), "%d", column);
+                        expr->string_value = expr_clone_string(buffer, len);
 
                         array_push(&exprs, (ASTExpression**)&expr);
                     } else if (string_equal_cstr(name, "__FILE__")) {
                         CREATE_EXPR(expr, ASTExpression_Literal, EXPR_LITERAL, tok0);
                         expr->literal_kind = EXPR_LITERAL_STRING;
-                        expr->string_value = string_clone_cstr(cstr(context->stream->import->path));
+                        expr->string_value = expr_clone_string(context->stream->import->path.ptr, context->stream->import->path.len);
 
                         array_push(&exprs, (ASTExpression**)&expr);
                     } else {
                         CREATE_EXPR(expr, ASTExpression_Identifier, EXPR_IDENTIFIER, tok0);
-                        expr->name = string_clone_cstr(name);
+                        expr->name = ATOM_FROM_IDENTIFIER(tok0);
                         array_push(&exprs, (ASTExpression**)&expr);
                     }
 
-                } else if (tok0->kind == '[') {
+                } else if (tok0.kind == '[') {
                     advance();
                     
                     CREATE_EXPR(expr, ASTExpression_Initializer, EXPR_INITIALIZER, tok0);
 
                     while (true) {
-                        const TokenExt* tok = peek(0);
+                        TokenExt tok = peek(0);
 
-                        if (tok->kind == ']') {
+                        if (tok.kind == ']') {
                             advance();
                             break;
                         }
 
                         ASTExpression_Initializer_Element element = {};
                         
-                        if (tok->kind == T_IDENTIFIER && tok1->kind == '=') {
+                        if (tok.kind == T_IDENTIFIER && kind1 == '=') {
                             advance();
                             advance();
-                            cstring name = DATA_FROM_IDENTIFIER(tok);
-                            element.name = string_clone_cstr(name);
+                            element.name = ATOM_FROM_IDENTIFIER(tok);
                         }
 
                         element.expr = parse_expression(context);
-                        array_push(&expr->elements, &element);
+                        expr_push(&expr->elements, &element);
 
                         tok = peek(0);
-                        if (tok->kind == ']') {
+                        if (tok.kind == ']') {
                             continue;
-                        } else if (tok->kind == ',') {
+                        } else if (tok.kind == ',') {
                             advance();
                             continue;
                         } else {
@@ -914,11 +1080,11 @@ ASTExpression* parse_expression(ParserContext* context) {
                     }
 
                     array_push(&exprs, (ASTExpression**)&expr);
-                } else if (tok0->kind == '{') {
+                } else if (tok0.kind == '{') {
                     ASTExpression* expr = (ASTExpression*)parse_block_expression(context, false);
 
                     array_push(&exprs, &expr);
-                } else if (tok0->kind == '(') {
+                } else if (tok0.kind == '(') {
                     advance();
 
                     ASTExpression* expr = parse_expression(context);
@@ -926,42 +1092,31 @@ ASTExpression* parse_expression(ParserContext* context) {
                     match(')');
 
                     array_push(&exprs, &expr);
-                } else if (tok0->kind == T_LITERAL_INTEGER) {
+                } else if (tok0.kind == T_LITERAL_INTEGER) {
+                    if (tok0.flags & TF_OVERFLOW) {
+                        parse_error(tok0, "Integer literal doesn't fit in 64 bits.");
+                    }
                     advance();
 
                     CREATE_EXPR(expr, ASTExpression_Literal, EXPR_LITERAL, tok0);
                     expr->literal_kind = EXPR_LITERAL_INTEGER;
-
-                    cstring text = DATA_FROM_TOKEN(tok0);
-                    
-                    char c = text.ptr[0], c2 = text.len >= 1 ? text.ptr[1] : 0;
-                    char* endptr;
-                    if (c == '0' && c2 == 'x') {
-                        expr->int_value = strtoul(text.ptr+2, &endptr, 16);
-                    } else if (c == '0' && c2 == 'o') {
-                        expr->int_value = strtoul(text.ptr+2, &endptr, 8);
-                    } else if (c == '0' && c2 == 'b') {
-                        expr->int_value = strtoul(text.ptr+2, &endptr, 2);
-                    } else {
-                        expr->int_value = strtoul(text.ptr, &endptr, 10);
-                    }
-                    // We should have parsed text.len characters
-                    ASSERT((int)(endptr - text.ptr) == text.len);
+                    // The lexer computed the value
+                    expr->int_value = tok0.int_data;
 
                     array_push(&exprs, (ASTExpression**)&expr);
-                } else if (tok0->kind == T_LITERAL_FLOAT) {
+                } else if (tok0.kind == T_LITERAL_FLOAT) {
                     advance();
                     ASSERT((false,"parse literal float"));
-                } else if (tok0->kind == T_LITERAL_STRING) {
+                } else if (tok0.kind == T_LITERAL_STRING) {
                     advance();
                     CREATE_EXPR(expr, ASTExpression_Literal, EXPR_LITERAL, tok0);
                     expr->literal_kind = EXPR_LITERAL_STRING;
 
                     cstring text = DATA_FROM_STRING(tok0);
-                    expr->string_value = string_clone_cstr(text);
+                    expr->string_value = expr_clone_string(text.ptr, text.len);
 
                     array_push(&exprs, (ASTExpression**)&expr);
-                } else if (tok0->kind == '-') {
+                } else if (tok0.kind == '-') {
                     advance();
 
                     CREATE_EXPR(expr, ASTExpression_Unary, EXPR_UNARY, tok0);
@@ -976,16 +1131,16 @@ ASTExpression* parse_expression(ParserContext* context) {
                 continue;
             } else {
                 ASTExpression_Unary* unary_op = NULL;
-                if (tok0->kind == '&' && !HAS_PRE_WHITESPACE(tok0)) {
+                if (tok0.kind == '&' && !HAS_PRE_WHITESPACE(tok0)) {
                     SET_EXPR(unary_op, ASTExpression_Unary, EXPR_UNARY, tok0);
                     unary_op->op_kind = EXPR_OP_ADDRESS_OF;
-                } else if (tok0->kind == '^' && !HAS_PRE_WHITESPACE(tok0)) {
+                } else if (tok0.kind == '^' && !HAS_PRE_WHITESPACE(tok0)) {
                     SET_EXPR(unary_op, ASTExpression_Unary, EXPR_UNARY, tok0);
                     unary_op->op_kind = EXPR_OP_DEREF;
-                } else if (tok0->kind == '~') {
+                } else if (tok0.kind == '~') {
                     SET_EXPR(unary_op, ASTExpression_Unary, EXPR_UNARY, tok0);
                     unary_op->op_kind = EXPR_OP_BITWISE_NEGATE;
-                } else if (tok0->kind == '!') {
+                } else if (tok0.kind == '!') {
                     SET_EXPR(unary_op, ASTExpression_Unary, EXPR_UNARY, tok0);
                     unary_op->op_kind = EXPR_OP_LOGICAL_NOT;
                 }
@@ -998,81 +1153,80 @@ ASTExpression* parse_expression(ParserContext* context) {
 
                 ASTExpression_Binary* operation = NULL;
                 
-                if (tok0->kind == '+') {
+                if (tok0.kind == '+') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_ADD;
-                } else if (tok0->kind == '-') {
+                } else if (tok0.kind == '-') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_SUB;
-                } else if (tok0->kind == '*') {
+                } else if (tok0.kind == '*') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_MUL;
-                } else if (tok0->kind == '/') {
+                } else if (tok0.kind == '/') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_DIV;
-                } else if (tok0->kind == '%') {
+                } else if (tok0.kind == '%') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_MODULO;
-                } else if (tok0->kind == '&' && tok1->kind == '&') {
+                } else if (tok0.kind == '&' && kind1 == '&') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_LOGICAL_AND;
-                } else if (tok0->kind == '|' && tok1->kind == '|') {
+                } else if (tok0.kind == '|' && kind1 == '|') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_LOGICAL_OR;
-                } else if (tok0->kind == '=' && tok1->kind == '=') {
+                } else if (tok0.kind == '=' && kind1 == '=') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_EQUAL;
-                } else if (tok0->kind == '!' && tok1->kind == '=') {
+                } else if (tok0.kind == '!' && kind1 == '=') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_NOT_EQUAL;
-                } else if (tok0->kind == '<' && tok1->kind == '=') {
+                } else if (tok0.kind == '<' && kind1 == '=') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_LESS_EQUAL;
-                } else if (tok0->kind == '>' && tok1->kind == '=') {
+                } else if (tok0.kind == '>' && kind1 == '=') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_GREATER_EQUAL;
-                } else if (tok0->kind == '<' && tok1->kind == '<') {
+                } else if (tok0.kind == '<' && kind1 == '<') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_BITWISE_LSHIFT;
-                } else if (tok0->kind == '>' && tok1->kind == '>') {
+                } else if (tok0.kind == '>' && kind1 == '>') {
                     advance();
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_BITWISE_RSHIFT;
-                } else if (tok0->kind == '<') {
+                } else if (tok0.kind == '<') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_LESS;
-                } else if (tok0->kind == '>') {
+                } else if (tok0.kind == '>') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_GREATER;
-                } else if (tok0->kind == '^') {
+                } else if (tok0.kind == '^') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_BITWISE_XOR;
-                } else if (tok0->kind == '&') {
+                } else if (tok0.kind == '&') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_BITWISE_AND;
-                } else if (tok0->kind == '|') {
+                } else if (tok0.kind == '|') {
                     SET_EXPR(operation, ASTExpression_Binary, EXPR_BINARY, tok0);
                     operation->op_kind = EXPR_OP_BITWISE_OR;
-                } else if (tok0->kind == '.') {
+                } else if (tok0.kind == '.') {
                     advance();
-                    const TokenExt* tok = match(T_IDENTIFIER);
+                    TokenExt tok = match(T_IDENTIFIER);
 
-                    cstring name = DATA_FROM_IDENTIFIER(tok);
                     CREATE_EXPR(expr, ASTExpression_Member, EXPR_MEMBER, tok0);
-                    expr->name = string_clone_cstr(name);
+                    expr->name = ATOM_FROM_IDENTIFIER(tok);
 
                     ASTExpression* last_expr = array_last(&exprs);
                     expr->expr = last_expr;
                     exprs.ptr[exprs.len-1] = (ASTExpression*)expr;
                     continue;
-                } else if (tok0->kind == ':') {
+                } else if (tok0.kind == ':') {
                     advance();
                     CREATE_EXPR(expr, ASTExpression_Cast, EXPR_CAST, tok0);
                     
@@ -1090,25 +1244,25 @@ ASTExpression* parse_expression(ParserContext* context) {
                     Array_ASTExpression_Call_PolyArgument polyargs = {};
                     
                     bool parsed_poly_args = false;
-                    if (tok0->kind == '<' && !HAS_PRE_WHITESPACE(tok0)) {
+                    if (tok0.kind == '<' && !HAS_PRE_WHITESPACE(tok0)) {
                         advance();
                         parsed_poly_args = true;
                         
                         while (true) {
-                            const TokenExt* tok = peek(0);
-                            if (tok->kind == '>') {
+                            TokenExt tok = peek(0);
+                            if (tok.kind == '>') {
                                 advance();
                                 break;
                             }
                             ASTExpression_Call_PolyArgument arg = {};
                             arg.expr = parse_expression(context);
-                            array_push(&polyargs, &arg);
+                            expr_push(&polyargs, &arg);
 
                             tok = peek(0);
 
-                            if (tok->kind == '>') {
+                            if (tok.kind == '>') {
                                 continue;
-                            } else if (tok->kind == ',') {
+                            } else if (tok.kind == ',') {
                                 advance();
                                 continue;
                             } else {
@@ -1117,14 +1271,14 @@ ASTExpression* parse_expression(ParserContext* context) {
                         }
                     }
 
-                    if (tok0->kind == '(' || parsed_poly_args) {
+                    if (tok0.kind == '(' || parsed_poly_args) {
                         match('(');
                         CREATE_EXPR(expr, ASTExpression_Call, EXPR_CALL, tok0);
                         expr->polymorphic_args = polyargs;
                         
                         while (true) {
-                            const TokenExt* tok = peek(0);
-                            if (tok->kind == ')') {
+                            TokenExt tok = peek(0);
+                            if (tok.kind == ')') {
                                 advance();
                                 break;
                             }
@@ -1132,24 +1286,23 @@ ASTExpression* parse_expression(ParserContext* context) {
                             ASTExpression_Call_Argument arg = {};
                             arg.location = location_from_token(tok);
 
-                            const TokenExt* tok1 = peek(1);
+                            TokenExt tok1 = peek(1);
 
-                            if (tok->kind == T_IDENTIFIER && tok1->kind == '=') {
+                            if (tok.kind == T_IDENTIFIER && tok1.kind == '=') {
                                 advance();
                                 advance();
-                                cstring name = DATA_FROM_IDENTIFIER(tok);
-                                arg.name = string_clone_cstr(name);
+                                arg.name = ATOM_FROM_IDENTIFIER(tok);
                                 arg.location = location_from_token(tok);
                             }
 
                             arg.expr = parse_expression(context);
-                            array_push(&expr->arguments, &arg);
+                            expr_push(&expr->arguments, &arg);
                             
                             tok = peek(0);
 
-                            if (tok->kind == ')') {
+                            if (tok.kind == ')') {
                                 continue;
-                            } else if (tok->kind == ',') {
+                            } else if (tok.kind == ',') {
                                 advance();
                                 continue;
                             } else {
@@ -1231,24 +1384,40 @@ ASTExpression* parse_expression(ParserContext* context) {
         }
 
         ret_expr = exprs.ptr[0];
+        array_cleanup(&exprs);
+        array_cleanup(&ops);
     }
     PROFILE_END();
     return ret_expr;
 }
 
 
+// Parses the body at the head into the flat AST of the context's AST
+static void parse_function_body(ParserContext* context, ASTFunction* function) {
+    // The pointer nodes are only kept until the body is flattened,
+    // the arena is reused when the outermost function is done.
+    Arena* prev_arena = context->expr_arena;
+    context->expr_arena = &context->body_arena;
+
+    ASTExpression* body = (ASTExpression*)parse_block_expression(context, false);
+    function->flat_body = flatten_expression(&context->ast->flat, body, true);
+    function->flat      = &context->ast->flat;
+
+    context->expr_arena = prev_arena;
+    if (prev_arena != &context->body_arena)
+        arena_reset(&context->body_arena);
+}
+
 ASTFunction* parse_function(ParserContext* context) {
     PROFILE_START();
 
     match(T_FN);
 
-    const TokenExt* tok = match(T_IDENTIFIER);
+    TokenExt tok = match(T_IDENTIFIER);
     check_error_ext(tok, "Expected an identifier.");
         
-    cstring name = DATA_FROM_IDENTIFIER(tok);
-
-    ASTFunction* out_function = HEAP_ALLOC_OBJECT(ASTFunction);
-    out_function->name      = string_clone_cstr(name);
+    ASTFunction* out_function = AST_ALLOC_OBJECT(ASTFunction);
+    out_function->name      = ATOM_FROM_IDENTIFIER(tok);
     out_function->location  = location_from_token(tok);
 
     match('(');
@@ -1259,13 +1428,13 @@ ASTFunction* parse_function(ParserContext* context) {
     // Parse arguments
     while (true) {
 
-        const TokenExt* tok_ident = peek(0);
-        if (tok_ident->kind == ')') {
+        TokenExt tok_ident = peek(0);
+        if (tok_ident.kind == ')') {
             advance();
             break;
         }
 
-        if (tok_ident->kind == T_IDENTIFIER) {
+        if (tok_ident.kind == T_IDENTIFIER) {
             advance();
 
             match(':');
@@ -1274,26 +1443,25 @@ ASTFunction* parse_function(ParserContext* context) {
             bool res = parse_type(context, &type_name);
             ASSERT(res);
 
-            const TokenExt* tok = peek(0);
-            if (tok->kind == ';') {
+            TokenExt tok = peek(0);
+            if (tok.kind == ';') {
                 advance();
             }
             ASTFunction_Parameter parameter;
-            cstring field_name      = DATA_FROM_IDENTIFIER(tok_ident);
-            parameter.name          = string_clone_cstr(field_name);
+            parameter.name          = ATOM_FROM_IDENTIFIER(tok_ident);
             parameter.location      = location_from_token(tok);
             parameter.default_value = NULL;
             parameter.type_name     = type_name;
 
-            array_push(&out_function->parameters, &parameter);
+            ast_push(&out_function->parameters, &parameter);
         } else {
             parse_error(tok_ident, "Expected a parameter, 'item : i32;'");
         }
-        const TokenExt* tok = peek(0);
-        if (tok->kind == ',') {
+        TokenExt tok = peek(0);
+        if (tok.kind == ',') {
             advance();
             continue;
-        } else if(tok->kind == ')') {
+        } else if(tok.kind == ')') {
             continue;
         } else {
             parse_error(tok, "Expected a ')' or ','");
@@ -1301,38 +1469,37 @@ ASTFunction* parse_function(ParserContext* context) {
     }
 
     // Parse return values
-    const TokenExt* tok0 = peek(0);
-    const TokenExt* tok1 = peek(1);
-    if (tok0->kind == '-' && tok1->kind == '>') {
+    TokenExt tok0 = peek(0);
+    TokenExt tok1 = peek(1);
+    if (tok0.kind == '-' && tok1.kind == '>') {
         advance();
         advance();
         while (true) {
 
-            const TokenExt* tok0 = peek(0);
-            const TokenExt* tok1 = peek(1);
+            TokenExt tok0 = peek(0);
+            TokenExt tok1 = peek(1);
 
             ASTFunction_Parameter parameter = {};
             parameter.location = location_from_token(tok0);
 
-            if (tok0->kind == T_IDENTIFIER && tok1->kind == ':') {
+            if (tok0.kind == T_IDENTIFIER && tok1.kind == ':') {
                 advance();
                 advance();
 
-                cstring field_name     = DATA_FROM_IDENTIFIER(tok0);
-                parameter.name         = string_clone_cstr(field_name);
+                parameter.name         = ATOM_FROM_IDENTIFIER(tok0);
             }
             
             bool res = parse_type(context, &parameter.type_name);
             ASSERT(res);
 
-            array_push(&out_function->return_values, &parameter);
+            ast_push(&out_function->return_values, &parameter);
             
-            if (tok->kind == ';') {
+            if (tok.kind == ';') {
                 advance();
                 break;
-            } else if (tok->kind == '{') {
+            } else if (tok.kind == '{') {
                 break;
-            } else if (tok->kind == ',') {
+            } else if (tok.kind == ',') {
                 advance();
                 continue;
             } else {
@@ -1368,20 +1535,28 @@ ASTFunction* parse_function(ParserContext* context) {
         }
     }
 
-    const TokenExt* tok_body = peek(0);
-    if (tok_body->kind == '{') {
-        ASTExpression* body = (ASTExpression*)parse_block_expression(context, false);
-        out_function->body = body;
+    TokenExt tok_body = peek(0);
+    if (tok_body.kind == '{' && context->skip_bodies && !prev_func) {
+        // Parsed by another task, the lexer matched the braces so we know where the body ends
+        int close = matching_close(context, context->head);
+        if (close < 0)
+            parse_error(tok_body, "Missing '}' for the function body.");
+
+        SkippedBody skipped = {};
+        skipped.function = out_function;
+        skipped.parent   = context->previous_block;
+        skipped.token    = context->head;
+        skipped.tokens   = close + 1 - context->head;
+        array_push(&context->ast->skipped_bodies, &skipped);
+
+        context->head = close + 1;
+    } else if (tok_body.kind == '{') {
+        parse_function_body(context, out_function);
     }
     
-    IRFunction empty_func = {};
-
-    IRFunction_id func_id = atomic_array_push(&context->compilation->program->functions, &empty_func);
-    IRFunction* ir_func = atomic_array_getptr(&context->compilation->program->functions, func_id);
-
-    ir_func->id = func_id;
-    ir_func->name = string_clone_cstr(cstr(out_function->name));
-    out_function->ir_function_id = func_id;
+    // IR functions are created per compilation when IR is generated, see comp_function_id
+    out_function->function_index = context->ast->functions.len;
+    ast_push(&context->ast->functions, &out_function);
 
     context->current_function = prev_func;
     
@@ -1389,23 +1564,148 @@ ASTFunction* parse_function(ParserContext* context) {
     return out_function;
 }
 
+int split_body_batches(const AST* ast, int max_batches, BodyBatch* out_batches) {
+    const Array_SkippedBody* bodies = &ast->skipped_bodies;
+    int total = 0;
+    for (int i=0;i<bodies->len;i++)
+        total += bodies->ptr[i].tokens;
+
+    int count = 0;
+    int taken = 0;
+    int index = 0;
+    while (index < bodies->len) {
+        // Each batch takes its share of the tokens that are left, the last batch takes the rest
+        int batches_left = max_batches - count;
+        int share = (total - taken + batches_left - 1) / batches_left;
+
+        BodyBatch* batch = &out_batches[count++];
+        memset(batch, 0, sizeof(*batch));
+        batch->first = index;
+        while (index < bodies->len && (batch->tokens < share || count == max_batches)) {
+            batch->tokens += bodies->ptr[index].tokens;
+            batch->count++;
+            index++;
+        }
+        taken += batch->tokens;
+
+        const SkippedBody* first = &bodies->ptr[batch->first];
+        const SkippedBody* last  = &bodies->ptr[index - 1];
+        batch->text_len = ast->stream->positions[last->token + last->tokens - 1] - ast->stream->positions[first->token] + 1;
+    }
+    return count;
+}
+
+Result parse_body_batch(Compilation* compilation, AST* ast, BodyBatch* batch) {
+    TracyCZone(zone, 1);
+    Result result = {};
+    result.kind = SUCCESS;
+
+    // Blocks, declarations and the flat bodies go in the part, the AST is only read
+    AST* part = HEAP_ALLOC_OBJECT(AST);
+
+    ParserContext context = {0};
+    context.stream = ast->stream;
+    context.compilation = compilation;
+    context.driver = compilation->driver;
+    context.ast = part;
+    context.expr_arena = &part->arena;
+
+    context.max_errors = comp_max_errors(compilation);
+
+    for (int i=batch->first;i<batch->first + batch->count;i++) {
+        SkippedBody* body = &ast->skipped_bodies.ptr[i];
+        if (setjmp(context.jump_state)) {
+            body->functions = 0;
+            if (add_parse_error(&context, 0))
+                break;
+            continue;
+        }
+        context.head             = body->token;
+        context.previous_block   = body->parent;
+        context.current_function = body->function;
+        int functions = part->functions.len;
+        parse_function_body(&context, body->function);
+        body->functions = part->functions.len - functions;
+    }
+
+    // Imports we created must be parsed even if we failed
+    flush_import_tasks(&context);
+
+    if (context.errors.len > 0) {
+        batch->errors = context.errors;
+        result.kind = FAILURE;
+        ast_cleanup(part);
+    } else {
+        flat_shrink(&part->flat);
+
+        batch->part = part;
+    }
+    array_cleanup(&context.import_tasks);
+    arena_cleanup(&context.body_arena);
+    TracyCZoneEnd(zone);
+    return result;
+}
+
+void join_body_batches(AST* ast, BodyBatch* batches, int count) {
+    TracyCZone(zone, 1);
+
+    // Functions declared in a body go right before the function that owns the body,
+    // the order a serial parse pushes them in. Bodies and batches are in file order.
+    Array_ASTFunctionP top_level = ast->functions;
+    memset(&ast->functions, 0, sizeof(ast->functions));
+    int body_index  = 0;
+    int batch_index = 0;
+    int part_index  = 0;
+    for (int i=0;i<top_level.len;i++) {
+        ASTFunction* owner = top_level.ptr[i];
+        if (body_index < ast->skipped_bodies.len && ast->skipped_bodies.ptr[body_index].function == owner) {
+            for (int j=0;j<ast->skipped_bodies.ptr[body_index].functions;j++) {
+                while (part_index == batches[batch_index].part->functions.len) {
+                    batch_index++;
+                    part_index = 0;
+                }
+                ASTFunction* function = batches[batch_index].part->functions.ptr[part_index++];
+                function->function_index = ast->functions.len;
+                arena_array_push(&ast->arena, &ast->functions, &function);
+            }
+            body_index++;
+        }
+        owner->function_index = ast->functions.len;
+        arena_array_push(&ast->arena, &ast->functions, &owner);
+    }
+    ASSERT(body_index == ast->skipped_bodies.len);
+
+    for (int i=0;i<count;i++) {
+        AST* part = batches[i].part;
+        ASSERT(part);
+
+        for (int j=0;j<part->imports.len;j++) {
+            arena_array_push(&ast->arena, &ast->imports, &part->imports.ptr[j]);
+        }
+
+        array_push(&ast->body_parts, &part);
+        batches[i].part = NULL;
+    }
+    array_cleanup(&ast->skipped_bodies);
+    memset(&ast->skipped_bodies, 0, sizeof(ast->skipped_bodies));
+    TracyCZoneEnd(zone);
+}
+
 ASTEnum* parse_enum(ParserContext* context) {
     PROFILE_START();
     match(T_ENUM);
 
     advance();
 
-    const TokenExt* tok = match(T_IDENTIFIER);
+    TokenExt tok = match(T_IDENTIFIER);
     check_error_ext(tok, "Expected an identifier.");
     
-    cstring name = DATA_FROM_IDENTIFIER(tok);
-    
-    ASTEnum* out_enum = HEAP_ALLOC_OBJECT(ASTEnum);
-    out_enum->name      = string_clone_cstr(name);
+    ASTEnum* out_enum = AST_ALLOC_OBJECT(ASTEnum);
+    out_enum->name      = ATOM_FROM_IDENTIFIER(tok);
     out_enum->location  = location_from_token(tok);
 
     tok = peek(0);
-    if (tok->kind == ':') {
+    if (tok.kind == ':') {
         advance();
         bool res = parse_type(context, &out_enum->type_name);
         ASSERT(res);
@@ -1415,30 +1715,29 @@ ASTEnum* parse_enum(ParserContext* context) {
 
     while (true) {
 
-        const TokenExt* tok = peek(0);
+        TokenExt tok = peek(0);
 
-        if (tok->kind == T_IDENTIFIER) {
+        if (tok.kind == T_IDENTIFIER) {
             advance();
 
             ASTEnum_Member member = {};
 
-            cstring member_name  = DATA_FROM_IDENTIFIER(tok);
-            member.name          = string_clone_cstr(member_name);
+            member.name          = ATOM_FROM_IDENTIFIER(tok);
             member.location      = location_from_token(tok);
             
-            const TokenExt* tok = peek(0);
-            if (tok->kind == '=') {
+            TokenExt tok = peek(0);
+            if (tok.kind == '=') {
                 advance();
-                member.default_value = parse_expression(context);
+                member.default_value = parse_declaration_value(context);
             }
 
             tok = peek(0);
-            if (tok->kind == ',') {
+            if (tok.kind == ',') {
                 advance();
             }
 
-            array_push(&out_enum->members, &member);
-        } else if (tok->kind == '}') {
+            ast_push(&out_enum->members, &member);
+        } else if (tok.kind == '}') {
             advance();
             break;
         } else {
@@ -1456,41 +1755,38 @@ ASTStruct* parse_struct(ParserContext* context) {
 
     advance();
 
-    const TokenExt* tok = match(T_IDENTIFIER);
+    TokenExt tok = match(T_IDENTIFIER);
     check_error_ext(tok, "Expected an identifier.");
         
-    cstring name = DATA_FROM_IDENTIFIER(tok);
-
-    ASTStruct* out_struct = HEAP_ALLOC_OBJECT(ASTStruct);
-    out_struct->name      = string_clone_cstr(name);
+    ASTStruct* out_struct = AST_ALLOC_OBJECT(ASTStruct);
+    out_struct->name      = ATOM_FROM_IDENTIFIER(tok);
     out_struct->location  = location_from_token(tok);
 
     match('{');
 
     while (true) {
 
-        const TokenExt* tok = peek(0);
+        TokenExt tok = peek(0);
 
-        if (tok->kind == T_IDENTIFIER) {
+        if (tok.kind == T_IDENTIFIER) {
             advance();
 
             match(':');
 
             ASTStruct_Field field = {};
-            cstring field_name = DATA_FROM_IDENTIFIER(tok);
-            field.name         = string_clone_cstr(field_name);
+            field.name         = ATOM_FROM_IDENTIFIER(tok);
             field.location     = location_from_token(tok);
             bool res = parse_type(context, &field.type_name);
             ASSERT(res);
 
-            array_push(&out_struct->fields, &field);
+            ast_push(&out_struct->fields, &field);
 
-            const TokenExt* tok = peek(0);
-            if (tok->kind == ';') {
+            TokenExt tok = peek(0);
+            if (tok.kind == ';') {
                 advance();
             }
 
-        } else if (tok->kind == '}') {
+        } else if (tok.kind == '}') {
             advance();
             break;
         } else {
@@ -1508,17 +1804,17 @@ bool parse_type(ParserContext* context, ASTType* typename) {
     string acc = {};
     // @TODO Disallow 'text: char*int'
     while (true) {
-        const TokenExt* tok = peek(0);
-        if (tok->kind == T_IDENTIFIER) {
+        TokenExt tok = peek(0);
+        if (tok.kind == T_IDENTIFIER) {
             advance();
-            cstring str = DATA_FROM_IDENTIFIER(tok);
+            cstring str = NAME_FROM_IDENTIFIER(context->stream, tok);
             string_append_cstr(&acc, str);
-        } else if (tok->kind == '*') {
+        } else if (tok.kind == '*') {
             advance();
-            string_append_char(&acc, tok->kind);
-        } else if (tok->kind == '[') {
-            const TokenExt* tok1 = peek(1);
-            if (tok1->kind == ']') {
+            string_append_char(&acc, tok.kind);
+        } else if (tok.kind == '[') {
+            TokenExt tok1 = peek(1);
+            if (tok1.kind == ']') {
                 advance();
                 advance();
                 string_append_cstr(&acc, cstr_cptr("[]"));
@@ -1529,7 +1825,8 @@ bool parse_type(ParserContext* context, ASTType* typename) {
             break;
         }
     }
-    *typename = acc;
+    *typename = ast_clone_string(acc.ptr, acc.len);
+    string_cleanup(&acc);
     PROFILE_END();
     return true;
 }
@@ -24,5 +24,30 @@ typedef struct Driver Driver;
 typedef struct AST AST;
 typedef struct TokenStream TokenStream;
 
-Result parse_stream(Compilation* compilation, TokenStream* stream, AST** out_ast);
+// The AST takes the stream, it's freed with the AST (or right away if parsing fails)
+// With skip_bodies the bodies of top-level functions are skipped and listed in
+// AST.skipped_bodies, the stream must be fully lexed (not streamed).
+// A declaration with an error is skipped and parsing continues until there are max_errors,
+// the errors are reported with comp_report_error and the returned failure has no message.
+Result parse_stream(Compilation* compilation, TokenStream* stream, bool skip_bodies, AST** out_ast);
+// Reports the errors in order until the compilation is cancelled and frees them.
+void report_parse_errors(Compilation* compilation, Array_string* errors);
 void print_ast(AST* ast);
+
+// Skipped bodies of a big import are parsed in batches on several threads (see TASK_PARSE_BODIES).
+typedef struct {
+    int  first, count; // range of AST.skipped_bodies
+    int  tokens;
+    int  text_len;     // bytes of text the bodies span
+    AST* part;         // nodes of the bodies, NULL until the batch is parsed
+    Array_string errors; // kept until every batch is done so they're reported in file order
+} BodyBatch;
+
+// Splits the skipped bodies in batches of about the same number of tokens. Returns the number of batches (at most max_batches).
+int split_body_batches(const AST* ast, int max_batches, BodyBatch* out_batches);
+// THREAD SAFE, each batch can be parsed on its own thread. Nothing but the batch's functions is changed in the AST.
+// A body with an error is skipped, the batch fails with up to max_errors errors in batch->errors.
+Result parse_body_batch(Compilation* compilation, AST* ast, BodyBatch* batch);
+// Moves the functions and imports found in the bodies to the AST, it owns the parts from here on.
+// Every batch must be parsed.
+void join_body_batches(AST* ast, BodyBatch* batches, int count);
@@ -9,21 +9,21 @@ bool enabled_logging_driver = true;
 
 void dump_hex(void* address, int size, int stride) {
     u8* data = address;
-    log__printf("hexdump 0x"FL"x + 0x%x:\n", (uint64_t)address, size);
+    log__dump("hexdump 0x"FL"x + 0x%x:\n", (uint64_t)address, size);
     int col = 0;
     uint64_t head = 0;
     while (head < size) {
         // if (col == 0)
-        //     log__printf("  "FL"x: ", (char*)address + head);
+        //     log__dump("  "FL"x: ", (char*)address + head);
 
-        log__printf("%x%x ", data[head] >> 4, data[head] & 0xF);
+        log__dump("%x%x ", data[head] >> 4, data[head] & 0xF);
         col++;
         if (col >= stride) {
             col = 0;
-            log__printf("\n");
+            log__dump("\n");
         }
         head++;
     }
     if (col != 0)
-        log__printf("\n");
+        log__dump("\n");
 }
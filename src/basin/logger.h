@@ -4,7 +4,11 @@ extern bool enabled_logging_driver;
 
 void dump_hex(void* address, int size, int stride);
 
-#define debug(...) fprintf(stderr, __VA_ARGS__)
+// from platform/platform.h, the driver captures them per task so output from threads doesn't interleave
+void log__printf(const char* format, ...);
+void log__dump(const char* format, ...);
+
+#define debug(...) log__printf(__VA_ARGS__)
 // #define debug(...)
 
 #define should_debug_print() true
@@ -46,11 +46,12 @@ int main(int argc, char** argv) {
 
     if (result.error_type != BASIN_SUCCESS) {
         fprintf(stderr, "%s", result.error_message);
+        basin_free_options(&options);
         return 1;
     }
 
     // @TEMP
-    if (!options.output_file)
+    if (!options.output_file && options.input_files_len == 0)
         options.output_file = "dev.o";
 
     // TODO: Measure compile time.
@@ -62,13 +63,15 @@ int main(int argc, char** argv) {
     } else if(result.error_type == BASIN_FILE_NOT_FOUND) {
         fprintf(stderr, "Cannot read '%s'\n", options.input_file);
     } else {
-        fprintf(stderr, "Errors:");
+        if (result.error_message)
+            fprintf(stderr, "%s", result.error_message);
         for(int i=0;i<result.compile_errors_len;i++) {
             fprintf(stderr, "%s", result.compile_errors[i]);
         }
     }
 
     basin_free_result(&result);
+    basin_free_options(&options);
 
     #ifdef TRACY_ENABLE
         // sleep so tracy has time to communicate the profiler data,
@@ -80,13 +83,18 @@ int main(int argc, char** argv) {
 }
 
 void print_help() {
-    printf("Usage: basin [OPTIONS...] <input_file>\n"
+    printf("Usage: basin [OPTIONS...] <input_files...>\n"
         "Options: (WIP, most are not implemented)\n"
-        "  -o <path>    Path to output file\n"
+        "  -o <path>    Path to output file (directory with several input files)\n"
         "  -debug       Debug info\n"
         "  -run         Run program\n"
         "  -O <N>       Optimize level\n"
         "  -silent      Silence success and compile time info\n"
+        "  -ordered-output Print compiler output in the same order every run\n"
+        "  -max-errors <N> Stop compiling a file after N errors (default 1)\n"
+        "  -threads <N>    Compile with N threads (default all CPU threads)\n"
+        "  -stream-tokens  Lex while parsing, less memory for big files\n"
+        "  -all-functions  Generate and check functions main doesn't reach (only executables skip them)\n"
         "  -type        File code type. object, static library, executable...\n"
         "  -target      Short-hand target\n"
         "  -mos         Target OS\n"
@@ -95,6 +103,7 @@ void print_help() {
         "  -mformat     Target File Format\n"
         "  -dformat     Debug format\n"
         "  -mfeature    CPU extension features\n"
+        "  -dump-tokens Dump the tokens of each file (not with -stream-tokens)\n"
         "  -dump-ast    Dump AST\n"
         "  -dump-ir     Dump Intermediate Representation code\n"
         "  -dump-driver Dump compiler task scheduling\n"
@@ -12,6 +12,8 @@
 #ifdef OS_LINUX
     #include <unistd.h>
     #include "sys/mman.h"
+    #include <sys/stat.h>
+    #include <fcntl.h>
     #include "linux/limits.h"
     #include <stdarg.h>
     #include <stdio.h>
@@ -34,8 +36,7 @@
 
 #if defined(OS_WINDOWS) || defined(OS_LINUX)
     #define MAX_FILE_HANDLES 100
-    static FILE* handles[MAX_FILE_HANDLES];
-    static int handles_len;
+    static FILE* volatile handles[MAX_FILE_HANDLES];
 #endif
 
 FSHandle fs__open(const char* path, uint32_t flags) {
@@ -50,12 +51,18 @@ FSHandle fs__open(const char* path, uint32_t flags) {
             return FS_INVALID_HANDLE;
 
 
-        // @TODO Atomic operation
-        if (handles_len >= MAX_FILE_HANDLES)
+        // Files are opened from several driver threads, claim a free slot atomically.
+        FSHandle handle = FS_INVALID_HANDLE;
+        for (int i=0;i<MAX_FILE_HANDLES;i++) {
+            if (!handles[i] && atomic_cas(&handles[i], NULL, file)) {
+                handle = i;
+                break;
+            }
+        }
+        if (handle == FS_INVALID_HANDLE) {
+            fclose(file);
             return FS_INVALID_HANDLE;
-        FSHandle handle = handles_len;
-        handles[handles_len] = file;
-        handles_len++;
+        }
 
         platform_log("Open [%d] = %s, %u\n", (int)handle, path, flags);
         return handle;
@@ -67,11 +74,7 @@ void fs__close(FSHandle handle) {
 
         int res = fclose(file);
 
-        // @TODO Atomic operation
-        handles[handle] = NULL;
-        while (handles_len > 0 && handles[handles_len-1] == NULL) {
-            handles_len--;
-        }
+        atomic_store(&handles[handle], NULL);
         platform_log("Close [%d]\n", (int)handle);
     #endif
 }
@@ -86,6 +89,7 @@ void fs__info(FSHandle handle, FSInfo* info) {
         fseek(file, cur_pos, SEEK_SET);
 
         info->file_size = file_size;
+        info->last_write_time = 0;
         info->is_directory = false;
 
         platform_log("FSInfo [%d] = %u\n", (int)handle, (unsigned)file_size);
@@ -127,10 +131,11 @@ void fs__abspath(const char* path, int out_path_cap, char* out_path) {
         if (out_path_cap < PATH_MAX + 1) {
             char temp_path[PATH_MAX+1];
             char* res = realpath(path, temp_path);
-            if (!res)
+            int len = res ? strlen(temp_path) : 0;
+            if (!res || len + 1 > out_path_cap)
                 out_path[0] = '\0';
             else
-                memcpy(out_path, temp_path, strlen(temp_path) + 1);
+                memcpy(out_path, temp_path, len + 1);
         } else {
             char* res = realpath(path, out_path);
             if (!res)
@@ -152,11 +157,13 @@ void fs__exepath(int out_path_cap, char* out_path) {
             }
         }
     #elif defined(OS_LINUX)
-		int len = readlink("/proc/self/exe", out_path, out_path_cap);
+		int len = readlink("/proc/self/exe", out_path, out_path_cap - 1);
         if (len < 0) {
             out_path[0] = '\0';
             return;
         }
+        // readlink doesn't null terminate
+        out_path[len] = '\0';
     #endif
 }
 
@@ -169,6 +176,92 @@ bool fs__exists(const char* path) {
     #endif
 }
 
+bool fs__path_info(const char* path, FSInfo* info) {
+    #if defined(OS_WINDOWS)
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+            return false;
+        info->file_size       = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        info->last_write_time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+        info->is_directory    = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        return true;
+    #elif defined(OS_LINUX)
+        struct stat st;
+        if (stat(path, &st) != 0)
+            return false;
+        info->file_size       = st.st_size;
+        info->last_write_time = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        info->is_directory    = S_ISDIR(st.st_mode);
+        return true;
+    #endif
+}
+
+void* fs__map_file(const char* path, uint64_t* out_size) {
+    #if defined(OS_WINDOWS)
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return NULL;
+        LARGE_INTEGER size;
+        SYSTEM_INFO sys;
+        GetSystemInfo(&sys);
+        // Bytes after the file in its last page are zero but a file filling
+        // the page has nothing after it, read those files instead.
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart % sys.dwPageSize == 0) {
+            CloseHandle(file);
+            return NULL;
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping)
+            return NULL;
+        // The view keeps the mapping alive
+        void* ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!ptr)
+            return NULL;
+        *out_size = size.QuadPart;
+        platform_log("Map %s = %u\n", path, (unsigned)size.QuadPart);
+        return ptr;
+    #elif defined(OS_LINUX)
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return NULL;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            close(fd);
+            return NULL;
+        }
+        uint64_t size = st.st_size;
+        uint64_t page_size = getpagesize();
+        uint64_t reserved_size = (size + 1 + page_size - 1) & ~(page_size - 1);
+
+        // Reserve zeroed pages with room for the terminator and put the file over them.
+        void* base = mmap(NULL, reserved_size, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+        void* ptr = mmap(base, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            munmap(base, reserved_size);
+            return NULL;
+        }
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        *out_size = size;
+        platform_log("Map %s = %u\n", path, (unsigned)size);
+        return ptr;
+    #endif
+}
+void fs__unmap_file(void* ptr, uint64_t size) {
+    #if defined(OS_WINDOWS)
+        UnmapViewOfFile(ptr);
+    #elif defined(OS_LINUX)
+        uint64_t page_size = getpagesize();
+        munmap(ptr, (size + 1 + page_size - 1) & ~(page_size - 1));
+    #endif
+}
+
 // ##########################
 //      Memory
 // ##########################
@@ -246,13 +339,84 @@ void mem__unmap(void* address, uint64_t size) {
 //      Debug/logging
 // ##########################
 
+typedef struct {
+    char* ptr;
+    int   len;
+    int   cap;
+} LogBuffer;
+
+// Capture buffers of the calling thread, see log__begin_capture
+static THREAD_LOCAL bool      log_capturing;
+static THREAD_LOCAL LogBuffer log_capture_text; // log__printf, for stderr
+static THREAD_LOCAL LogBuffer log_capture_dump; // log__dump, for stdout
+
+static void log_vprintf(FILE* stream, LogBuffer* buffer, const char* format, va_list va) {
+    if (!log_capturing) {
+        vfprintf(stream, format, va);
+        return;
+    }
+
+    va_list va_copy;
+    va_copy(va_copy, va);
+    int len = vsnprintf(buffer->ptr + buffer->len, buffer->cap - buffer->len, format, va);
+    if (len >= 0 && buffer->len + len + 1 > buffer->cap) {
+        // Didn't fit, grow and format again
+        int new_cap = buffer->cap * 2 + len + 0x1000;
+        buffer->ptr = mem__realloc(new_cap, buffer->ptr);
+        ASSERT(buffer->ptr);
+        buffer->cap = new_cap;
+        len = vsnprintf(buffer->ptr + buffer->len, buffer->cap - buffer->len, format, va_copy);
+    }
+    if (len > 0)
+        buffer->len += len;
+    va_end(va_copy);
+}
+
 void log__printf(const char* format, ...) {
     va_list va;
     va_start(va, format);
-    vfprintf(stderr, format, va);
+    log_vprintf(stderr, &log_capture_text, format, va);
+    va_end(va);
+}
+
+void log__dump(const char* format, ...) {
+    va_list va;
+    va_start(va, format);
+    log_vprintf(stdout, &log_capture_dump, format, va);
     va_end(va);
 }
 
+void log__begin_capture() {
+    ASSERT(!log_capturing);
+    log_capturing = true;
+    log_capture_text.len = 0;
+    log_capture_dump.len = 0;
+}
+
+LogCapture log__end_capture() {
+    ASSERT(log_capturing);
+    log_capturing = false;
+    LogCapture capture = {};
+    capture.text     = log_capture_text.ptr;
+    capture.text_len = log_capture_text.len;
+    capture.dump     = log_capture_dump.ptr;
+    capture.dump_len = log_capture_dump.len;
+    return capture;
+}
+
+void log__write(const char* text, int len) {
+    if (len <= 0)
+        return;
+    // One fwrite is done under the stream lock so the text won't interleave with other threads.
+    fwrite(text, 1, len, stderr);
+}
+
+void log__write_dump(const char* text, int len) {
+    if (len <= 0)
+        return;
+    fwrite(text, 1, len, stdout);
+}
+
 
 
 // #############################
@@ -355,24 +519,6 @@ void thread__lock_mutex(Mutex* mutex) {
         ASSERT(res == 0);
     #endif
 }
-bool thread__trylock_mutex(Mutex* mutex) {
-    #ifdef OS_WINDOWS
-        u32 res = WaitForSingleObject((HANDLE)mutex->handle, 0);
-        if (res == WAIT_TIMEOUT)
-            return false;
-        ASSERT(res != WAIT_FAILED);
-        return true;
-    #elif defined(OS_LINUX)
-        int res;
-        res = pthread_mutex_trylock((pthread_mutex_t*)mutex->handle);
-        if (res == 0)
-            return true;
-        if (res == EBUSY)
-            return false;
-        ASSERT(res == 0 || res == EBUSY);
-        return false;
-    #endif
-}
 void thread__unlock_mutex(Mutex* mutex) {
     #ifdef OS_WINDOWS
         bool yes = ReleaseMutex((HANDLE)mutex->handle);
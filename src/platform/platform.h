@@ -16,6 +16,7 @@ typedef uint32_t FSHandle;
 #define FS_INVALID_HANDLE 0xFFFFFFFF
 typedef struct {
     uint64_t file_size;
+    uint64_t last_write_time; // only meant to be compared, units depend on the platform (zero from fs__info)
     bool is_directory;
 } FSInfo;
 
@@ -30,6 +31,14 @@ uint64_t fs__write(FSHandle handle, uint64_t offset, const void* buffer, uint64_
 void fs__abspath(const char* path, int out_path_cap, char* out_path);
 void fs__exepath(int out_path_cap, char* out_path);
 bool fs__exists(const char* path);
+// Same as fs__info without opening the file, returns false if it doesn't exist
+bool fs__path_info(const char* path, FSInfo* out_info);
+
+// Maps a file read-only and hints that it will be read front to back.
+// The byte after the file is readable and zero. Returns NULL if the file
+// can't be mapped (empty, missing, not a regular file), read it instead.
+void* fs__map_file(const char* path, uint64_t* out_size);
+void fs__unmap_file(void* ptr, uint64_t size);
 
 // @TODO Iterate directory, recursively
 
@@ -69,7 +78,27 @@ static inline void* _heap_alloc_object(const int size) {
 //      Debug/logging
 // ##########################
 
+// Messages and diagnostics, written to stderr
 void log__printf(const char* format, ...);
+// Dumps of the AST, IR and machine code, written to stdout so they can be piped
+void log__dump(const char* format, ...);
+
+typedef struct {
+    const char* text; // from log__printf, not null terminated
+    int         text_len;
+    const char* dump; // from log__dump
+    int         dump_len;
+} LogCapture;
+
+// Output from log__printf and log__dump on the calling thread is collected in thread local
+// buffers until log__end_capture instead of being written to stderr and stdout. Captures do not nest.
+void log__begin_capture();
+// Returns the captured text, valid until the next capture on this thread.
+LogCapture log__end_capture();
+// Writes text to stderr in one go, it won't interleave with output from other threads.
+void log__write(const char* text, int len);
+// Writes a dump to stdout in one go
+void log__write_dump(const char* text, int len);
 
 
 
@@ -115,6 +144,12 @@ void thread__cleanup_semaphore(Semaphore* semaphore);
 #define atomic_add(PTR, VAL) __atomic_fetch_add(PTR, VAL, __ATOMIC_SEQ_CST)
 // returns previous value
 #define atomic_add64(PTR, VAL) __atomic_fetch_add(PTR, VAL, __ATOMIC_SEQ_CST)
+// returns true if *PTR was EXPECTED and is now DESIRED
+#define atomic_cas(PTR, EXPECTED, DESIRED) ({ __typeof__(__atomic_load_n(PTR, __ATOMIC_RELAXED)) _expected = (EXPECTED); __atomic_compare_exchange_n(PTR, &_expected, DESIRED, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+#define atomic_store(PTR, VAL) __atomic_store_n(PTR, VAL, __ATOMIC_SEQ_CST)
+
+// Variable with one instance per thread
+#define THREAD_LOCAL _Thread_local
 
 
 //##############################
@@ -0,0 +1,79 @@
+#include "util/arena.h"
+
+void arena_cleanup(Arena* arena) {
+    ArenaBlock* block = arena->block;
+    while (block) {
+        ArenaBlock* prev = block->prev;
+        mem__free(block);
+        block = prev;
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+void arena_reset(Arena* arena) {
+    ArenaBlock* block = arena->block;
+    if (!block)
+        return;
+    while (block->prev) {
+        ArenaBlock* prev = block->prev;
+        mem__free(block);
+        block = prev;
+    }
+    arena->block = block;
+    arena->head  = (char*)(block + 1);
+    arena->end   = block->end;
+}
+
+static inline char* align_up(char* ptr) {
+    return (char*)(((u64)ptr + ARENA_ALIGNMENT - 1) & ~(u64)(ARENA_ALIGNMENT - 1));
+}
+
+void* arena_alloc(Arena* arena, u64 size) {
+    char* ptr = align_up(arena->head);
+    if (!arena->block || ptr + size > arena->end) {
+        // Big allocations get a block of their own
+        u64 block_size = sizeof(ArenaBlock) + ARENA_ALIGNMENT + size;
+        if (block_size < ARENA_BLOCK_SIZE)
+            block_size = ARENA_BLOCK_SIZE;
+        ArenaBlock* block = mem__alloc(block_size);
+        block->prev  = arena->block;
+        block->end   = (char*)block + block_size;
+        arena->block = block;
+        arena->end   = block->end;
+        ptr = align_up((char*)(block + 1));
+    }
+    arena->head = ptr + size;
+    return ptr;
+}
+
+string arena_clone_string(Arena* arena, const char* text, int len) {
+    string out;
+    out.len = len;
+    out.max = 0;
+    out.ptr = arena_alloc(arena, len + 1);
+    if (len)
+        memcpy(out.ptr, text, len);
+    out.ptr[len] = '\0';
+    return out;
+}
+
+void _arena_array_push(Arena* arena, Array* array, int element_size, void* element) {
+    if (array->len >= array->cap) {
+        int new_cap = array->cap * 2 + 4;
+        char* old_end = (char*)array->ptr + array->cap * element_size;
+        if (array->ptr && old_end == arena->head && old_end + (new_cap - array->cap) * element_size <= arena->end) {
+            // Last allocation in the block, grow in place
+            arena->head = old_end + (new_cap - array->cap) * element_size;
+        } else {
+            void* new_ptr = arena_alloc(arena, (u64)new_cap * element_size);
+            if (array->len)
+                memcpy(new_ptr, array->ptr, array->len * element_size);
+            array->ptr = new_ptr;
+        }
+        array->cap = new_cap;
+    }
+    void* spot = (char*)array->ptr + array->len * element_size;
+    if (element)
+        memcpy(spot, element, element_size);
+    array->len++;
+}
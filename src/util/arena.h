@@ -0,0 +1,54 @@
+/*
+    Arena (bump) allocator. Memory is handed out from big blocks and everything
+    is freed at once, there is no way to free a single allocation.
+
+    Objects allocated one after another end up next to each other which is good
+    for code walking them in the same order. Arrays grown in an arena leave their
+    old elements behind, fine for arrays that are built once.
+
+    Not thread safe, an arena is used by one thread at a time.
+*/
+
+#pragma once
+
+#include "platform/platform.h"
+#include "util/string.h"
+#include "util/array.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT  16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    char*              end;
+} ArenaBlock;
+
+// Zero initialized arena is empty and ready to use
+typedef struct Arena {
+    ArenaBlock* block; // newest block, older blocks are linked through prev
+    char*       head;  // next free byte in block
+    char*       end;
+} Arena;
+
+// Frees every block, the arena is empty and can be used again
+void arena_cleanup(Arena* arena);
+// Frees every block but the first, the arena is empty and reuses the first block
+void arena_reset(Arena* arena);
+
+// Memory isn't cleared, aligned to ARENA_ALIGNMENT
+void* arena_alloc(Arena* arena, u64 size);
+
+#define ARENA_ALLOC_OBJECT(A, T) (T*)_arena_alloc_object(A, sizeof(T))
+static inline void* _arena_alloc_object(Arena* arena, u64 size) {
+    void* ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// Null terminated copy, string_cleanup must not be called on it (max is zero)
+string arena_clone_string(Arena* arena, const char* text, int len);
+
+// Same as array_push but the elements live in the arena, don't call array_cleanup on the array
+#define arena_array_push(A, ARR, ELEMENTP) ( _arena_array_push((A), (Array*)(ARR), sizeof(*(ARR)->ptr), (false && (((ARR)->ptr[0] = *(ELEMENTP)), false), ELEMENTP)))
+
+void _arena_array_push(Arena* arena, Array* array, int element_size, void* element);
@@ -66,6 +66,8 @@ void _atomic_array_init(AtomicArray* arr, int element_size, int initial_cap, int
     for (int i=0;i<arr->chunk_cap;i++) {
         arr->chunks[i] = mem__alloc(element_size * elements_per_chunk);
     }
+    // The chunks are ready, push doesn't need to allocate them again
+    arr->cap = arr->chunk_cap * elements_per_chunk;
 }
 // NOT THREAD SAFE
 void _atomic_array_cleanup(AtomicArray* arr) {
@@ -74,7 +76,10 @@ void _atomic_array_cleanup(AtomicArray* arr) {
         mem__free((void*)arr->chunks[i]);
     }
     mem__free((void*)arr->chunks);
+    if (arr->old_chunks)
+        mem__free((void*)arr->old_chunks);
     arr->chunks = NULL;
+    arr->old_chunks = NULL;
 }
 
 // THREAD SAFE
@@ -92,7 +92,7 @@ void* _barray_push(BucketArray* array, int element_size, void* element) {
         // memset(new_buckets + array->buckets_max, 0, (new_max - array->buckets_max) * sizeof(Bucket));
 
         for (int i = array->buckets_cap; i < new_bucket_cap; i++) {
-            Bucket* bucket = &array->buckets[i];
+            Bucket* bucket = &new_buckets[i];
             bucket->elements = mem__alloc(array->items_per_bucket * element_size);
             memset(bucket->elements, 0, array->items_per_bucket * element_size);
         }
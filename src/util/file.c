@@ -5,6 +5,7 @@
 string util_read_whole_file(const char* path) {
     TracyCZone(zone, 1);
     
+    string out = {};
     FSHandle handle = fs__open(path, FS_READ);
     if(handle == FS_INVALID_HANDLE) {
         goto end;
@@ -13,10 +14,12 @@ string util_read_whole_file(const char* path) {
     FSInfo info;
     fs__info(handle, &info);
 
-    string out = string_create(info.file_size + 1);
+    out = string_create(info.file_size + 1);
     
-    bool success = fs__read(handle, 0, out.ptr, info.file_size);
-    if(!success) {
+    u64 read_bytes = fs__read(handle, 0, out.ptr, info.file_size);
+    if(read_bytes != info.file_size) {
+        string_cleanup(&out);
+        fs__close(handle);
         goto end;
     }
 
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "platform/platform.h"
+
+// FNV-1a, fast for the short keys we have (paths, identifiers).
+static inline u32 hash_fnv1a(const void* data, u64 len) {
+    const u8* bytes = (const u8*)data;
+    u32 hash = 2166136261u;
+    for (u64 i=0;i<len;i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Atoms and indices are small numbers next to each other, the bits are mixed so they spread over a table.
+static inline u32 hash_u32(u32 x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
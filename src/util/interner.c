@@ -0,0 +1,146 @@
+#include "util/interner.h"
+
+#include "util/hash.h"
+
+#define INTERNER_TEXT_BLOCK (64 * 1024)
+
+static InternTable* intern_table_create(u32 cap) {
+    InternTable* table = HEAP_ALLOC_OBJECT(InternTable);
+    table->cap   = cap;
+    table->slots = mem__alloc(cap * sizeof(Atom));
+    memset((void*)table->slots, 0, cap * sizeof(Atom));
+    return table;
+}
+
+static void intern_table_destroy(InternTable* table) {
+    mem__free((void*)table->slots);
+    mem__free(table);
+}
+
+static inline const InternedName* interned_name(Interner* interner, Atom atom) {
+    return &interner->chunks[atom / INTERNER_CHUNK_NAMES][atom % INTERNER_CHUNK_NAMES];
+}
+
+void interner_init(Interner* interner) {
+    memset(interner, 0, sizeof(*interner));
+    interner->table = intern_table_create(1024);
+    // Atom zero is reserved for no name
+    interner->names_len = 1;
+    interner->chunks[0] = mem__alloc(INTERNER_CHUNK_NAMES * sizeof(InternedName));
+    memset(interner->chunks[0], 0, sizeof(InternedName));
+    thread__create_mutex(&interner->mutex);
+}
+
+void interner_cleanup(Interner* interner) {
+    intern_table_destroy(interner->table);
+    for (int i=0;i<interner->old_tables.len;i++)
+        intern_table_destroy(interner->old_tables.ptr[i]);
+    array_cleanup(&interner->old_tables);
+
+    for (int i=0;i<INTERNER_MAX_CHUNKS && interner->chunks[i];i++)
+        mem__free(interner->chunks[i]);
+
+    for (int i=0;i<interner->text_blocks.len;i++)
+        mem__free(interner->text_blocks.ptr[i]);
+    array_cleanup(&interner->text_blocks);
+
+    thread__cleanup_mutex(&interner->mutex);
+}
+
+// Probes the table, returns the atom or zero and the empty slot where the name would go.
+static Atom intern_table_probe(Interner* interner, InternTable* table, const char* str, u32 len, u32 hash, u32* out_slot) {
+    u32 mask = table->cap - 1;
+    u32 slot = hash & mask;
+    while (true) {
+        Atom atom = table->slots[slot];
+        if (atom == 0) {
+            *out_slot = slot;
+            return 0;
+        }
+        // The name is written before the atom is put in a slot
+        const InternedName* name = interned_name(interner, atom);
+        if (name->hash == hash && name->len == len && !memcmp(name->ptr, str, len))
+            return atom;
+        slot = (slot + 1) & mask;
+    }
+}
+
+Atom interner_find(Interner* interner, const char* str, u32 len) {
+    u32 hash = hash_fnv1a(str, len);
+    u32 slot;
+    return intern_table_probe(interner, interner->table, str, len, hash, &slot);
+}
+
+// Copy of the name in a text block, mutex must be held.
+static const char* interner_copy_text(Interner* interner, const char* str, u32 len) {
+    if (interner->text_left < len + 1) {
+        u32 size = len + 1 > INTERNER_TEXT_BLOCK ? len + 1 : INTERNER_TEXT_BLOCK;
+        interner->text      = mem__alloc(size);
+        interner->text_left = size;
+        array_push(&interner->text_blocks, &interner->text);
+    }
+    char* ptr = interner->text;
+    memcpy(ptr, str, len);
+    ptr[len] = '\0';
+    interner->text      += len + 1;
+    interner->text_left -= len + 1;
+    return ptr;
+}
+
+// Moves every atom to a table twice as big, mutex must be held.
+static void interner_grow_locked(Interner* interner) {
+    InternTable* old_table = interner->table;
+    InternTable* new_table = intern_table_create(old_table->cap * 2);
+    u32 mask = new_table->cap - 1;
+    for (Atom atom = 1; atom < interner->names_len; atom++) {
+        u32 slot = interned_name(interner, atom)->hash & mask;
+        while (new_table->slots[slot])
+            slot = (slot + 1) & mask;
+        new_table->slots[slot] = atom;
+    }
+    // Readers that loaded the old table keep using it, it's freed in interner_cleanup.
+    // They may miss names added from now on and then look again with the mutex held.
+    atomic_store(&interner->table, new_table);
+    array_push(&interner->old_tables, &old_table);
+}
+
+Atom interner_intern(Interner* interner, const char* str, u32 len) {
+    u32 hash = hash_fnv1a(str, len);
+    u32 slot;
+    Atom atom = intern_table_probe(interner, interner->table, str, len, hash, &slot);
+    if (atom)
+        return atom;
+
+    thread__lock_mutex(&interner->mutex);
+
+    // Another thread may have added it after we looked
+    InternTable* table = interner->table;
+    atom = intern_table_probe(interner, table, str, len, hash, &slot);
+    if (atom) {
+        thread__unlock_mutex(&interner->mutex);
+        return atom;
+    }
+
+    atom = interner->names_len;
+    u32 chunk_index = atom / INTERNER_CHUNK_NAMES;
+    ASSERT(chunk_index < INTERNER_MAX_CHUNKS);
+    if (!interner->chunks[chunk_index]) {
+        InternedName* chunk = mem__alloc(INTERNER_CHUNK_NAMES * sizeof(InternedName));
+        atomic_store(&interner->chunks[chunk_index], chunk);
+    }
+    InternedName* name = &interner->chunks[chunk_index][atom % INTERNER_CHUNK_NAMES];
+    name->ptr  = interner_copy_text(interner, str, len);
+    name->len  = len;
+    name->hash = hash;
+    atomic_store(&interner->names_len, atom + 1);
+
+    // Load factor at most 50%
+    if (interner->names_len * 2 > table->cap) {
+        interner_grow_locked(interner);
+    } else {
+        atomic_store(&table->slots[slot], atom);
+    }
+
+    thread__unlock_mutex(&interner->mutex);
+    return atom;
+}
@@ -0,0 +1,72 @@
+/*
+    String interner, each name is stored once and identified by an atom.
+    Comparing names is comparing atoms.
+
+    Looking up a name that exists doesn't lock. Adding a new name takes a
+    mutex, most lookups find an existing name since identifiers repeat.
+*/
+
+#pragma once
+
+#include "platform/platform.h"
+#include "util/string.h"
+#include "util/array.h"
+
+// Zero means no name
+typedef u32 Atom;
+
+typedef struct {
+    const char* ptr; // null terminated
+    u32         len;
+    u32         hash;
+} InternedName;
+
+typedef struct {
+    volatile Atom* slots; // open addressing, zero if the slot is empty
+    u32            cap;   // power of two
+} InternTable;
+
+typedef InternTable* InternTableP;
+DEF_ARRAY(InternTableP)
+typedef char* charP;
+DEF_ARRAY(charP)
+
+#define INTERNER_CHUNK_NAMES 4096
+#define INTERNER_MAX_CHUNKS  4096
+
+typedef struct Interner {
+    InternTable* volatile table;      // readers probe it without locking
+    Array_InternTableP    old_tables; // replaced by bigger tables, readers may still be using them
+    // Name of atom A is chunks[A / INTERNER_CHUNK_NAMES][A % INTERNER_CHUNK_NAMES]
+    InternedName* volatile chunks[INTERNER_MAX_CHUNKS];
+    volatile u32          names_len;
+
+    char*        text; // names are copied here
+    u32          text_left;
+    Array_charP  text_blocks;
+
+    Mutex mutex; // held when adding a name
+} Interner;
+
+void interner_init(Interner* interner);
+void interner_cleanup(Interner* interner);
+
+// THREAD SAFE
+// Returns the atom of the name, adds the name if it's new.
+Atom interner_intern(Interner* interner, const char* str, u32 len);
+// THREAD SAFE
+// Returns the atom of the name or zero if it hasn't been interned.
+Atom interner_find(Interner* interner, const char* str, u32 len);
+// THREAD SAFE
+// Name of an atom, valid until the interner is cleaned up. Empty for atom zero.
+static inline cstring interner_get(Interner* interner, Atom atom) {
+    if (atom == 0)
+        return (cstring){ "", 0 };
+    const InternedName* name = &interner->chunks[atom / INTERNER_CHUNK_NAMES][atom % INTERNER_CHUNK_NAMES];
+    return (cstring){ name->ptr, name->len };
+}
+// THREAD SAFE
+// Null terminated name of an atom, for printing.
+static inline const char* interner_name(Interner* interner, Atom atom) {
+    return interner_get(interner, atom).ptr;
+}
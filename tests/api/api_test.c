@@ -0,0 +1,222 @@
+/*
+    Compiles through the library functions (basin.h) the way an editor or build
+    server would, run by run_tests.py:
+
+        basin_api_test <work directory>
+
+    Sections start with a '== <name>' line on stderr, the driver's log of the
+    section follows (run_tests.py counts the tasks in it). Failed checks print
+    'FAIL <section>: <what>' and the exit code is the number of failed checks.
+*/
+
+#include "basin/basin.h"
+
+#ifdef OS_LINUX
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#endif
+
+static int failures = 0;
+static const char* section = "";
+static char work_dir[512];
+
+static void begin_section(const char* name) {
+    section = name;
+    fprintf(stderr, "== %s\n", name);
+    fflush(stderr);
+}
+
+static void check(bool ok, const char* what) {
+    if (ok)
+        return;
+    failures++;
+    fprintf(stderr, "FAIL %s: %s\n", section, what);
+    fflush(stderr);
+}
+
+static const char* work_path(const char* name) {
+    static char paths[8][600];
+    static int next = 0;
+    char* path = paths[next++ % 8];
+    snprintf(path, sizeof(paths[0]), "%s/%s", work_dir, name);
+    return path;
+}
+
+static void write_file(const char* name, const char* text) {
+    FILE* file = fopen(work_path(name), "wb");
+    if (!file) {
+        fprintf(stderr, "Can't write %s\n", work_path(name));
+        exit(1);
+    }
+    fwrite(text, 1, strlen(text), file);
+    fclose(file);
+}
+
+static bool file_exists(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file)
+        fclose(file);
+    return file != NULL;
+}
+
+static BasinCompileOptions default_options() {
+    BasinCompileOptions options = {};
+    options.target_format = BASIN_TARGET_FORMAT_COFF;
+    options.target_os     = BASIN_TARGET_OS_windows;
+    return options;
+}
+
+static BasinError compile(BasinContext* context, const char* input, const char* output, int* out_errors) {
+    BasinCompileOptions options = default_options();
+    options.input_file  = work_path(input);
+    options.output_file = work_path(output);
+    BasinResult result = basin_compile_with_context(context, &options);
+    BasinError error = result.error_type;
+    *out_errors = result.compile_errors_len;
+    basin_free_result(&result);
+    return error;
+}
+
+// Imports of the context are reused while the files stay the same, a changed
+// size or modification time (down to the nanosecond) parses the file again.
+static void test_context_reuse() {
+    write_file("main.bsn", "import \"./util.bsn\"\nimport \"./math.bsn\"\nfn main() -> i32 {\n    return seven()\n}\n");
+    write_file("util.bsn", "fn seven() -> i32 {\n    return 7\n}\n");
+    write_file("math.bsn", "fn two() -> i32 {\n    return 2\n}\n");
+
+    BasinContext* context = basin_create_context(2);
+    int errors;
+
+    begin_section("context_first");
+    check(compile(context, "main.bsn", "first.o", &errors) == BASIN_SUCCESS && errors == 0, "compiles");
+    check(file_exists(work_path("first.o")), "writes the object");
+
+    begin_section("context_same");
+    check(compile(context, "main.bsn", "same.o", &errors) == BASIN_SUCCESS && errors == 0, "compiles");
+    check(file_exists(work_path("same.o")), "writes the object");
+
+    begin_section("context_size");
+    write_file("util.bsn", "fn seven() -> i32 {\n    return 77\n}\n");
+    check(compile(context, "main.bsn", "size.o", &errors) == BASIN_SUCCESS && errors == 0, "compiles");
+
+#ifdef OS_LINUX
+    // Same size, only the modification time tells the file changed
+    struct stat info;
+    stat(work_path("math.bsn"), &info);
+    write_file("math.bsn", "fn two() -> i32 {\n    return 3\n}\n");
+    struct timespec times[2] = { info.st_atim, info.st_mtim };
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    utimensat(AT_FDCWD, work_path("math.bsn"), times, 0);
+#endif
+    begin_section("context_time");
+    check(compile(context, "main.bsn", "time.o", &errors) == BASIN_SUCCESS && errors == 0, "compiles");
+
+    // A failed import is parsed again even if it didn't change
+    begin_section("context_error");
+    write_file("util.bsn", "fn seven() -> i32 {\n    return * 7\n}\n");
+    check(compile(context, "main.bsn", "error.o", &errors) == BASIN_COMPILE_ERROR && errors == 1, "reports the error");
+
+    begin_section("context_error_again");
+    check(compile(context, "main.bsn", "error.o", &errors) == BASIN_COMPILE_ERROR && errors == 1, "reports the error again");
+
+    begin_section("context_fixed");
+    write_file("util.bsn", "fn seven() -> i32 {\n    return 7\n}\n");
+    check(compile(context, "main.bsn", "fixed.o", &errors) == BASIN_SUCCESS && errors == 0, "compiles");
+
+    basin_destroy_context(context);
+}
+
+static BasinError end_compile(BasinContext* context, int* out_errors) {
+    BasinResult result = basin_end_compile(context);
+    BasinError error = result.error_type;
+    *out_errors = result.compile_errors_len;
+    basin_free_result(&result);
+    return error;
+}
+
+static BasinError begin_compile(BasinContext* context, const BasinCompileOptions* options, int options_len) {
+    BasinResult result = basin_begin_compile(context, options, options_len);
+    BasinError error = result.error_type;
+    basin_free_result(&result);
+    return error;
+}
+
+// Incremental compilation, the work is done a few tasks (or microseconds) at a time
+static void test_step_compile() {
+    write_file("step.bsn", "import \"./step_a.bsn\"\nimport \"./step_b.bsn\"\nfn main() -> i32 {\n    return a() + b()\n}\n");
+    write_file("step_a.bsn", "fn a() -> i32 {\n    return 1\n}\nfn a2() -> i32 {\n    return 2\n}\n");
+    write_file("step_b.bsn", "fn b() -> i32 {\n    return 3\n}\nfn b2() -> i32 {\n    return 4\n}\n");
+
+    BasinContext* context = basin_create_context(2);
+    int errors;
+
+    begin_section("step_invalid");
+    {
+        // Nothing is compiled and the context can be used right away
+        BasinCompileOptions options = default_options();
+        check(begin_compile(context, &options, 1) == BASIN_INVALID_COMPILE_OPTIONS, "no input");
+
+        const char* inputs[] = { work_path("step_a.bsn"), work_path("step_b.bsn") };
+        options.input_files     = inputs;
+        options.input_files_len = 2;
+        options.output_file     = work_path("step.bsn");
+        check(begin_compile(context, &options, 1) == BASIN_INVALID_COMPILE_OPTIONS, "several inputs and the output isn't a directory");
+
+        check(basin_step_compile(context, 1, 0), "step without a compilation is done");
+        check(end_compile(context, &errors) == BASIN_SUCCESS && errors == 0, "end without a compilation");
+
+        options = default_options();
+        options.input_file  = work_path("step.bsn");
+        options.output_file = work_path("step_invalid.o");
+        check(begin_compile(context, &options, 1) == BASIN_SUCCESS, "begin");
+        check(begin_compile(context, &options, 1) == BASIN_INVALID_COMPILE_OPTIONS, "begin while compiling");
+        check(end_compile(context, &errors) == BASIN_SUCCESS && errors == 0, "end without steps");
+        check(file_exists(work_path("step_invalid.o")), "end without steps writes the object");
+    }
+
+    begin_section("step_direct");
+    check(compile(context, "step.bsn", "step_direct.o", &errors) == BASIN_SUCCESS && errors == 0, "compiles");
+
+    // At most two tasks per step, run_tests.py counts them between the pauses
+    begin_section("step_tasks");
+    {
+        BasinCompileOptions options = default_options();
+        options.input_file  = work_path("step.bsn");
+        options.output_file = work_path("step_tasks.o");
+        check(begin_compile(context, &options, 1) == BASIN_SUCCESS, "begin");
+        int steps = 1;
+        while (!basin_step_compile(context, 2, 0) && steps < 1000)
+            steps++;
+        check(steps > 1 && steps < 1000, "steps until done");
+        check(end_compile(context, &errors) == BASIN_SUCCESS && errors == 0, "end");
+    }
+
+    begin_section("step_time");
+    {
+        BasinCompileOptions options = default_options();
+        options.input_file  = work_path("step.bsn");
+        options.output_file = work_path("step_time.o");
+        check(begin_compile(context, &options, 1) == BASIN_SUCCESS, "begin");
+        int steps = 1;
+        while (!basin_step_compile(context, 0, 1) && steps < 1000000)
+            steps++;
+        check(steps > 1 && steps < 1000000, "steps until done");
+        check(end_compile(context, &errors) == BASIN_SUCCESS && errors == 0, "end");
+    }
+
+    basin_destroy_context(context);
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: basin_api_test <work directory>\n");
+        return 1;
+    }
+    snprintf(work_dir, sizeof(work_dir), "%s", argv[1]);
+
+    test_context_reuse();
+    test_step_compile();
+
+    fprintf(stderr, "== done\n");
+    return failures;
+}
@@ -1,5 +1,768 @@
 '''
 run one, a few or all tests
+
+    python3 tests/run_tests.py              all tests
+    python3 tests/run_tests.py lexer parse  tests with a name that starts with 'lexer' or 'parse'
+    python3 tests/run_tests.py -list        names of the tests
+
+Build the compiler with build.py first, the tests run the executable in releases
+and the program in int that compiles through the library functions (tests/api).
+
+Most tests compile the same sources through a fast path and through the path it
+replaced (or with the feature turned off) and check that the tokens, AST, IR,
+machine code, errors and object file are the same. Inputs are the .bsn files
+next to this script and sources the tests generate (same seed every run).
 '''
 
+import sys, os, glob, subprocess, tempfile, difflib, re, random, platform, dataclasses, struct
+
+COLOR_RED = "\033[31m"
+COLOR_GREEN = "\033[32m"
+COLOR_RESET = "\033[0m"
+
+TESTS_DIR = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(TESTS_DIR)
+
+# Objects are only written as COFF at the moment
+TARGET = ["-mformat", "coff", "-mos", "windows"]
+
+class TestFailure(Exception):
+    pass
+
+@dataclasses.dataclass
+class Output:
+    status: str   # 'Success' at the end of stdout or nothing
+    dump: str     # stdout before the status, the tokens, AST, IR and machine code
+    log: str      # stderr, messages and errors without the lines that vary between runs
+    driver: str   # the lines left out of log, which tasks ran
+    objects: dict # object file name -> bytes
+
+    def success(self):
+        return self.status == "Success"
+
+#############################
+#      COMPILING
+#############################
+
+def find_compiler():
+    exe = "basin.exe" if platform.system() == "Windows" else "basin"
+    paths = glob.glob(f"{ROOT}/releases/basin-*/bin/{exe}")
+    if len(paths) == 0:
+        print(f"{COLOR_RED}ERROR:{COLOR_RESET} No compiler in {ROOT}/releases, run build.py")
+        exit(1)
+    return paths[0]
+
+# Lines of the driver ('[0] pick TASK_GEN_IR (3 left)') depend on thread timing,
+# errors start with the line of the compiler that reported them
+SKIP_LINE = re.compile(r"^\[-?[0-9]*\] |^Tasks finished$|^Gen object file |^\033\[0;30m.*\.c:[0-9]+\033\[0m$")
+ADDRESS = re.compile(r"hexdump 0x[0-9a-f]+")
+
+work_dir = None
+compile_count = 0
+
+def compile(inputs, *flags, env = None, ordered = True):
+    global compile_count
+    compile_count += 1
+    if isinstance(inputs, str):
+        inputs = [ inputs ]
+
+    # Each compile gets its own folder so the object files have the same names
+    out_dir = f"{work_dir}/out{compile_count}"
+    os.makedirs(out_dir)
+    out = out_dir if len(inputs) > 1 else f"{out_dir}/out.o"
+
+    full_env = dict(os.environ)
+    full_env.update(env or {})
+    # Without ordered output the log has the tasks in the order they finished
+    command = [ compiler, *inputs, *TARGET, *([ "-ordered-output" ] if ordered else []), *flags, "-o", out ]
+    proc = subprocess.run(command, env=full_env, stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=300)
+    stdout = proc.stdout.decode("utf-8", "replace")
+    stderr = proc.stderr.decode("utf-8", "replace")
+
+    if proc.returncode != 0 or "[Assert]" in stdout or "[Assert]" in stderr:
+        raise TestFailure(f"Compiler crashed ({proc.returncode}): {' '.join(command)}\n{stderr[-2000:]}")
+
+    status = "Success" if stdout.endswith("Success") else ""
+    dump = ADDRESS.sub("hexdump", stdout.removesuffix(status))
+    lines = stderr.split("\n")
+    log = "\n".join(line for line in lines if not SKIP_LINE.match(line))
+    driver = "\n".join(line for line in lines if SKIP_LINE.match(line))
+
+    objects = {}
+    for path in glob.glob(out_dir + "/*.o"):
+        objects[os.path.basename(path)] = read_object(path)
+    return Output(status, dump, log, driver, objects)
+
+def run_api_test():
+    # Sections of tests/api/api_test.c, name -> what the driver logged
+    paths = glob.glob(f"{ROOT}/int/*/basin_api_test*")
+    if len(paths) == 0:
+        raise TestFailure(f"No basin_api_test in {ROOT}/int, run build.py")
+    api_dir = f"{work_dir}/api"
+    os.makedirs(api_dir)
+    proc = subprocess.run([ paths[0], api_dir ], stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=300)
+    stderr = proc.stderr.decode("utf-8", "replace")
+    failed = [ line for line in stderr.split("\n") if line.startswith("FAIL ") ]
+    if proc.returncode != 0 or failed or "== done" not in stderr:
+        raise TestFailure(f"basin_api_test exited with {proc.returncode}\n" + ("\n".join(failed) or stderr[-2000:]))
+    sections = {}
+    name = None
+    for line in stderr.split("\n"):
+        if line.startswith("== "):
+            name = line[3:]
+            sections[name] = ""
+        elif name:
+            sections[name] += line + "\n"
+    return sections
+
+def read_object(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    # COFF header has the time the file was written
+    return data[:4] + bytes(4) + data[8:]
+
+def write_source(name, text):
+    path = f"{work_dir}/{name}"
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "wb") as f:
+        f.write(text.encode("latin-1") if isinstance(text, str) else text)
+    return path
+
+def test_sources(folder):
+    return sorted(glob.glob(f"{TESTS_DIR}/{folder}/*.bsn"))
+
+#############################
+#      CHECKING
+#############################
+
+def diff(a, b, a_name, b_name):
+    lines = difflib.unified_diff(a.split("\n"), b.split("\n"), a_name, b_name, n=2, lineterm="")
+    out = "\n".join(list(lines)[:40])
+    return out
+
+def expect_same(a, b, what, a_name = "baseline", b_name = "fast path"):
+    if a.status != b.status:
+        raise TestFailure(f"{what}: '{a.status}' with {a_name}, '{b.status}' with {b_name}")
+    if a.dump != b.dump:
+        raise TestFailure(f"{what}: dump differs\n" + diff(a.dump, b.dump, a_name, b_name))
+    if a.log != b.log:
+        raise TestFailure(f"{what}: output differs\n" + diff(a.log, b.log, a_name, b_name))
+    if a.objects != b.objects:
+        raise TestFailure(f"{what}: object files differ, {sorted(a.objects)} and {sorted(b.objects)}")
+
+def expect_error(output, what, *parts):
+    for part in parts:
+        if part not in output.log:
+            raise TestFailure(f"{what}: expected '{part}' in the output:\n{output.log[-3000:]}")
+
+def expect_task(output, what, task_kind):
+    # A thread picks the task from its own queue or steals it from another thread's queue
+    if f"pick {task_kind} " not in output.driver and f"steal {task_kind} " not in output.driver:
+        raise TestFailure(f"{what}: no {task_kind}, the test doesn't reach the code it tests")
+
+def expect_success(output, what):
+    if not output.success():
+        raise TestFailure(f"{what}: expected success:\n{output.log[-3000:]}")
+
+def expect_header(output, path):
+    # First line of the source says what compiling it should give,
+    # '// expect: success' or '// expect: <line>:<column>: <error message>'
+    with open(path, "rb") as f:
+        expected = f.readline().decode().strip().removeprefix("// expect: ")
+    name = os.path.basename(path)
+    if expected == "success":
+        expect_success(output, name)
+    else:
+        location, message = expected.split(" ", 1)
+        expect_error(output, name, f"{name}:{location}\033[0m {message}")
+
+#############################
+#      TESTS
+#############################
+
+tests = []
+def test(func):
+    tests.append(func)
+    return func
+
+# Pieces of source the lexer tests are made of. Runs of each kind of character
+# cross the 16 and 32 byte boundaries of the vector loops at every offset.
+LEXER_PIECES = [
+    "fn", "main", "x", "a_b9", "Hello_World_identifier_long_name_1234567890abcdef", "_" * 33,
+    "0", "7", "123", "12345678", "123456789012345678", "18446744073709551615", "18446744073709551616", "98765432109876543210",
+    "0x1F", "0xffffffffffffffff", "0b101", "0o17",
+    '"str"', '"a long string with spaces and stuff in it ok ok ok ok ok ok ok ok"', '"esc \\" q"', '"tab\\tnew\\nline"',
+    "// comment to the end of the line\n", "/* block */", "/* nested /* inner */ outer */", "/* multi\n line\n comment ** / * */",
+    "+", "-", "*", "/", "=", "==", ",", ".", ":", "->", ";",
+    " ", "  ", "\t", " " * 40, "\t" * 20, "\r\n", "\n", "\n\n", "\f",
+    'f"plain format string long enough for the vector scan"', "\xc3\xa9", "\xff",
+    "return", "if", "while", "struct", "fn_", "returns", "whilex",
+]
+
+def lexer_source(seed, count):
+    rand = random.Random(seed)
+    out = []
+    for i in range(count):
+        out.append(rand.choice(LEXER_PIECES))
+        if rand.random() < 0.5:
+            out.append(" ")
+    return "".join(out)
+
+@test
+def lexer_vector_scan():
+    # Vector scans give the tokens of the byte loops (dumped before parsing, the sources don't parse)
+    sources = test_sources("lexer")
+    for seed in range(24):
+        tail = [ "", "// comment at the end", "/* unterminated", '"unterminated string', "ident", "123", "   " ][seed % 7]
+        sources.append(write_source(f"lexer/scan{seed}.bsn", lexer_source(seed, 50 + seed * 120) + tail))
+
+    for path in sources:
+        scalar = compile(path, "-dump-tokens", env = { "BASIN_SCAN_SCALAR": "1" })
+        vector = compile(path, "-dump-tokens")
+        expect_same(scalar, vector, os.path.basename(path), "scalar", "vector")
+
+def keywords():
+    # Spelling of the keywords from token_name_table in lexer.c, in the order of TokenKind
+    with open(f"{ROOT}/src/basin/frontend/lexer.c") as f:
+        text = f.read()
+    table = text[text.index("char* token_name_table[NORMAL_TOKEN_END] = {"):]
+    names = re.findall(r'"([a-z_]+)"', table[:table.index("};")])
+    return names[names.index("struct"):]
+
+@test
+def lexer_keywords():
+    # The keyword hash finds every keyword and nothing else, near misses included
+    names = keywords()
+    words = list(names)
+    for name in names:
+        words += [ name + "s", name[:-1], name[1:], name.upper(), name.capitalize(), "_" + name,
+                   name[:-1] + chr(ord(name[-1]) + 1), name[::-1], name + name ]
+    rand = random.Random(12)
+    letters = "".join(sorted(set("".join(names)))) + "_"
+    for i in range(4000):
+        words.append("".join(rand.choice(letters) for _ in range(rand.randint(2, 8))))
+    words = [ word for word in words if not word[0].isdigit() ]
+
+    path = write_source("keywords.bsn", "\n".join(words))
+    output = compile(path, "-dump-tokens")
+    tokens = re.findall(r"^  pos [0-9]+, flags 0x[0-9a-f]+, (.*)$", output.dump, re.M)
+    if len(tokens) != len(words):
+        raise TestFailure(f"{len(words)} words in keywords.bsn, {len(tokens)} tokens")
+    for word, token in zip(words, tokens):
+        expected = word if word in names else f"identifier '{word}'"
+        if token != expected:
+            raise TestFailure(f"'{word}' lexed as {token}, expected {expected}")
+
+@test
+def lexer_chunks():
+    # A big file lexed in chunks (512 KB or more each) gives the tokens and errors of one piece
+    body = lexer_source(15, 300000)
+    middle = len(body) // 2
+    sources = {
+        "chunks.bsn": body,
+        "unterminated_comment.bsn": body[:middle] + "\n/* never closed " + body[middle:],
+        "unterminated_string.bsn": body[:middle * 3 // 2] + '\n"never closed ' + body[middle * 3 // 2:],
+        "string_at_end.bsn": body + '\n"never closed',
+    }
+    for name, text in sources.items():
+        path = write_source(name, text)
+        serial = compile(path, "-dump-tokens", "-threads", "1")
+        chunked = compile(path, "-dump-tokens", "-threads", "4")
+        expect_task(chunked, name, "TASK_LEX_CHUNK")
+        expect_same(serial, chunked, name, "serial", "chunked")
+
+@test
+def lexer_numbers():
+    # Decimals get the value Python gives them, those that don't fit in 64 bits are errors
+    rand = random.Random(18)
+    numbers = []
+    for value in [ 0, 9, 10**8 - 1, 10**8, 10**16, 10**19, 2**64 - 1, 2**64, 2**64 + 1, 10**20 - 1, 10**20, 10**40 ]:
+        numbers += [ str(value), "0" * rand.randint(1, 30) + str(value) ]
+    for length in range(1, 26):
+        for i in range(20):
+            numbers.append("".join(rand.choice("0123456789") for _ in range(length)))
+    numbers += [ str(2**64 - 1 - rand.randint(0, 10**10)) for i in range(50) ]
+    numbers += [ str(2**64 + rand.randint(0, 10**10)) for i in range(50) ]
+
+    path = write_source("numbers.bsn", " ".join(numbers))
+    output = compile(path, "-dump-tokens")
+    tokens = re.findall(r"^  pos [0-9]+, flags 0x([0-9a-f]+), number ([0-9]+)$", output.dump, re.M)
+    if len(tokens) != len(numbers):
+        raise TestFailure(f"{len(numbers)} numbers in numbers.bsn, {len(tokens)} tokens")
+    for number, (flags, value) in zip(numbers, tokens):
+        overflow = (int(flags, 16) & 0x10) != 0 # TF_OVERFLOW
+        if overflow != (int(number) >= 2**64):
+            raise TestFailure(f"{number} has overflow flag {overflow}")
+        if not overflow and int(value) != int(number):
+            raise TestFailure(f"{number} lexed as {value}")
+
+    source = "fn main() -> i32 {\n    x := %s\n    return 0\n}\n"
+    output = compile(write_source("fits.bsn", source % (2**64 - 1)))
+    expect_success(output, "fits.bsn")
+    output = compile(write_source("too_big.bsn", source % 2**64))
+    expect_error(output, "too_big.bsn", "too_big.bsn:2:10:\033[0m Integer literal doesn't fit in 64 bits.")
+
+BRACKET_ERRORS = { "stray": "'%s' doesn't close anything.", "bad": "'%s' doesn't match the bracket it closes.", "open": "'%s' is never closed." }
+
+def bracket_source(rand, size):
+    # Balanced brackets between words, strings and comments with brackets in them.
+    # Returns the text and the position of each bracket that is a token.
+    out = []
+    brackets = []
+    length = 0
+    def add(text, bracket = False):
+        nonlocal length
+        if bracket:
+            brackets.append(length)
+        out.append(text)
+        length += len(text)
+    def block(depth):
+        for _ in range(rand.randint(1, 6)):
+            r = rand.random()
+            if r < 0.35 and depth < 40:
+                pair = rand.choice([ "{}", "()", "[]" ])
+                add(pair[0], True)
+                block(depth + 1)
+                add(pair[1], True)
+            elif r < 0.45: add('"str ( { ] "')
+            elif r < 0.5:  add("// comment } )\n")
+            elif r < 0.55: add("/* ( [ */")
+            elif r < 0.75: add(rand.choice([ "\n", "\n\t", "\r\n" ]))
+            else:          add(rand.choice([ "x", "foo", "12", "+", ",", ";", "a.b" ]))
+            add(" ")
+    while length < size:
+        block(0)
+        add("\n")
+    return "".join(out), brackets
+
+def first_bracket_error(text, brackets):
+    # The error check_brackets reports, (kind, position) or None
+    opens = []
+    close_errors = []
+    for position in brackets:
+        c = text[position]
+        if c in "{([":
+            opens.append(position)
+        elif len(opens) == 0:
+            close_errors.append(("stray", position))
+        elif text[opens[-1]] != { "}": "{", ")": "(", "]": "[" }[c]:
+            close_errors.append(("bad", position))
+        else:
+            opens.pop()
+    if close_errors:
+        return min(close_errors, key = lambda e: e[1])
+    return ("open", opens[0]) if opens else None
+
+def bracket_error_text(path, text, error):
+    kind, position = error
+    line = text.count("\n", 0, position) + 1
+    column = position - (text.rfind("\n", 0, position) + 1) + 1
+    return f"{os.path.basename(path)}:{line}:{column}:\033[0m " + BRACKET_ERRORS[kind] % text[position]
+
+@test
+def lexer_brackets():
+    # Bracket errors are at the same line and column with every scan and with chunks
+    for path in test_sources("brackets"):
+        name = os.path.basename(path)
+        scalar = compile(path, env = { "BASIN_SCAN_SCALAR": "1" })
+        vector = compile(path)
+        expect_header(vector, path)
+        expect_same(scalar, vector, name, "scalar", "vector")
+
+    # Big enough for chunks, the broken bracket is in the first, a middle or the last chunk
+    rand = random.Random(20)
+    text, brackets = bracket_source(rand, 1300 * 1024)
+    cases = [ ("balanced", text, brackets) ]
+    for part in range(3):
+        index = rand.randrange(len(brackets) * part // 3, len(brackets) * (part + 1) // 3)
+        position = brackets[index]
+        removed = text[:position] + " " + text[position + 1:]
+        cases.append((f"removed{part}", removed, brackets[:index] + brackets[index + 1:]))
+        swapped = text[:position] + { "{": "(", "(": "[", "[": "{", "}": "]", ")": "}", "]": ")" }[text[position]] + text[position + 1:]
+        cases.append((f"swapped{part}", swapped, brackets))
+    cases.append(("extra_close", text + "\n)", brackets + [ len(text) + 1 ]))
+
+    for name, text, brackets in cases:
+        path = write_source(name + ".bsn", text)
+        serial = compile(path, "-threads", "1")
+        chunked = compile(path, "-threads", "4")
+        expect_task(chunked, name, "TASK_LEX_CHUNK")
+        error = first_bracket_error(text, brackets)
+        if error:
+            expect_error(chunked, name, bracket_error_text(path, text, error))
+        elif "never closed" in chunked.log or "close" in chunked.log:
+            raise TestFailure(f"{name}: unexpected bracket error\n{chunked.log[-2000:]}")
+        expect_same(serial, chunked, name, "serial", "chunked")
+
+@test
+def ast_flat_bodies():
+    # Function bodies are kept in the flat AST and dumped like the pointer nodes they replaced.
+    # The .txt next to each source is the AST dump of the compiler from before, the IR
+    # and machine code dumped after it aren't compared.
+    for path in test_sources("ast"):
+        name = os.path.basename(path)
+        output = compile(path, "-type", "exe")
+        with open(path[:-len(".bsn")] + ".txt") as f:
+            expected = f.read()
+        if output.dump[:len(expected)] != expected:
+            raise TestFailure(f"{name}: dump differs\n" + diff(expected, output.dump[:len(expected)], "expected", "flat"))
+
+    # The printer from before crashed on an if without else. Its dump is the dump of
+    # the if with an else where the else block is NONE.
+    source = "fn check() -> i32 {\n    x := 1\n    if x == 1 {\n        x = 0\n    }%s\n    return x\n}\nfn main() -> i32 {\n    return 0\n}\n"
+    without_else = compile(write_source("if.bsn", source % ""), "-type", "exe")
+    with_else = compile(write_source("if_else.bsn", source % " else {\n        x = 2\n    }"), "-type", "exe")
+    lines = []
+    else_indent = None
+    for line in with_else.dump.split("\n"):
+        indent = len(line) - len(line.lstrip())
+        if else_indent is not None and indent > else_indent:
+            continue
+        else_indent = None
+        if line.strip().startswith("else:"):
+            else_indent = indent
+            line = line[:indent] + "else: NONE"
+        lines.append(line)
+    if without_else.dump != "\n".join(lines):
+        raise TestFailure("if.bsn: dump differs from the if with an else\n" + diff("\n".join(lines), without_else.dump, "if else", "if"))
+
+@test
+def parse_scopes():
+    # A name declared twice in a scope is an error at the second declaration
+    for path in test_sources("scopes"):
+        expect_header(compile(path, "-type", "exe"), path)
+
+    # Tables grow with the number of declarations
+    lines = [ f"    v{i} := {i}" for i in range(300) ]
+    source = "fn main() -> i32 {\n%s\n    return v299\n}\n"
+    expect_success(compile(write_source("many.bsn", source % "\n".join(lines)), "-type", "exe"), "many.bsn")
+    lines.append("    v150 := 0")
+    output = compile(write_source("many_duplicate.bsn", source % "\n".join(lines)), "-type", "exe")
+    expect_error(output, "many_duplicate.bsn", "many_duplicate.bsn:302:5:\033[0m 'v150' is already declared in this scope.")
+
+    functions = [ f"fn f{i}() -> i32 {{\n    return {i}\n}}" for i in range(200) ]
+    functions.insert(100, "fn f42() -> i32 {\n    return 0\n}")
+    output = compile(write_source("many_functions.bsn", "\n".join(functions) + "\nfn main() -> i32 {\n    return f7()\n}\n"), "-type", "exe")
+    expect_error(output, "many_functions.bsn", "many_functions.bsn:301:4:\033[0m 'f42' is already declared in this scope.")
+
+def function_source(rand, index):
+    body = [ f"    a := {index}", "    b := a * 2 + 1" ]
+    for i in range(rand.randint(0, 6)):
+        body.append(rand.choice([
+            f"    c{i} := a + b * {i}",
+            f"    while a > {i} {{\n        a = a - 1\n    }}",
+            f"    {{\n        inner := b - {i}\n        b = inner\n    }}",
+            f"    add(a, b = {i})",
+            f"    fn nested{i}() -> i32 {{\n        return {i}\n    }}",
+            f"    s{i} := \"text {i}\"",
+        ]))
+    body.append("    return b")
+    return f"fn f{index}() -> i32 {{\n" + "\n".join(body) + "\n}"
+
+@test
+def parse_body_batches():
+    # Bodies parsed in batches (files of 64K tokens or more) give the AST, IR and errors of one thread
+    rand = random.Random(24)
+    functions = [ function_source(rand, i) for i in range(3000) ]
+    # The bodies use what IR generation can't do yet so only main is generated. With more than
+    # one function the object lists them in the order the threads finished them.
+    head = "fn add(a: i32, b: i32) -> i32 {\n    return 0\n}\nfn main() -> i32 {\n    return 2\n}\n"
+    def source(errors):
+        out = list(functions)
+        for index, text in errors:
+            out[index] = out[index].replace("    return b", text + "\n    return b")
+        return head + "\n".join(out) + "\n"
+
+    # Errors in the first, a middle and the last body, the first one in the file is reported
+    # (or the first ones with -max-errors)
+    cases = {
+        "batches.bsn": [],
+        "syntax_first.bsn": [ (3, "    x := * 2") ],
+        "syntax_middle.bsn": [ (1500, "    x := + *"), (2900, "    y := 1 +") ],
+        "syntax_last.bsn": [ (2999, "    fn () {}") ],
+        "duplicate_middle.bsn": [ (1700, "    a := 3") ],
+    }
+    outputs = {}
+    for name, errors in cases.items():
+        path = write_source(name, source(errors))
+        serial = compile(path, "-type", "exe", "-threads", "1")
+        batched = compile(path, "-type", "exe", "-threads", "4")
+        expect_task(batched, name, "TASK_PARSE_BODIES")
+        if errors:
+            expect_error(batched, name, "\033[0;31m" + path)
+        else:
+            expect_success(batched, name)
+        expect_same(serial, batched, name, "serial", "batched")
+        outputs[name] = batched
+        if len(errors) > 1:
+            serial = compile(path, "-type", "exe", "-threads", "1", "-max-errors", "5")
+            batched = compile(path, "-type", "exe", "-threads", "4", "-max-errors", "5")
+            expect_same(serial, batched, name + " -max-errors 5", "serial", "batched")
+
+    # Streamed tokens can't be skipped ahead, bodies are parsed in order
+    streamed = compile(f"{work_dir}/batches.bsn", "-type", "exe", "-stream-tokens", "-threads", "4")
+    expect_same(streamed, outputs["batches.bsn"], "batches.bsn", "streamed", "batched")
+
+def coff_functions(data):
+    # Function symbols of a COFF object, name -> (code, [(offset in the code, called symbol)])
+    # or None for an external. .text is the first section.
+    _, _, _, symbol_table, symbols_len = struct.unpack_from("<HHIII", data, 0)
+    text_size, text_offset, relocations, _, relocations_len = struct.unpack_from("<IIIIH", data, 20 + 16)
+    strings = symbol_table + symbols_len * 18
+    names = {}
+    symbols = []
+    index = 0
+    while index < symbols_len:
+        record = symbol_table + index * 18
+        if data[record:record + 4] == bytes(4):
+            start = strings + struct.unpack_from("<I", data, record + 4)[0]
+            name = data[start:data.index(b"\0", start)].decode()
+        else:
+            name = data[record:record + 8].rstrip(b"\0").decode()
+        value, section, kind, _, aux = struct.unpack_from("<IhHBB", data, record + 8)
+        names[index] = name
+        if kind == 0x20:
+            symbols.append((name, section, value))
+        index += 1 + aux
+
+    calls = []
+    for i in range(relocations_len):
+        address, symbol, _ = struct.unpack_from("<IIH", data, relocations + i * 10)
+        if symbol not in names:
+            raise TestFailure(f"relocation at {address} uses symbol {symbol}, there are {symbols_len}")
+        calls.append((address, names[symbol]))
+
+    # A function's code goes up to the next function in .text
+    starts = sorted(value for _, section, value in symbols if section == 1) + [ text_size ]
+    functions = {}
+    for name, section, value in symbols:
+        if name in functions:
+            raise TestFailure(f"{name} has two symbols")
+        if section == 0:
+            functions[name] = None
+        else:
+            end = starts[starts.index(value) + 1]
+            code = data[text_offset + value:text_offset + end]
+            functions[name] = (code, [ (address - value, target) for address, target in calls if value <= address < end ])
+    return functions
+
+@test
+def gen_lazy_ir():
+    # An executable only has the functions main reaches, with the code they get when every function is generated
+    path = f"{TESTS_DIR}/lazy/reach.bsn"
+    lazy = compile(path, "-type", "exe")
+    everything = compile(path, "-type", "exe", "-all-functions")
+    expect_success(lazy, "reach.bsn")
+    expect_success(everything, "reach.bsn")
+    lazy_functions = coff_functions(lazy.objects["out.o"])
+    all_functions = coff_functions(everything.objects["out.o"])
+    if sorted(lazy_functions) != [ "greeting", "main", "total" ]:
+        raise TestFailure(f"reach.bsn: symbols {sorted(lazy_functions)}, main reaches greeting, main and total")
+    every_function = [ "eight", "farewell", "greeting", "main", "total", "unused" ]
+    if sorted(all_functions) != every_function:
+        raise TestFailure(f"reach.bsn: symbols {sorted(all_functions)} with -all-functions, expected {every_function}")
+    for name, function in lazy_functions.items():
+        if function is None or function != all_functions[name]:
+            raise TestFailure(f"reach.bsn: {name} is {function} without -all-functions, {all_functions[name]} with it")
+    if lazy_functions["main"][1] != [ (12, "total") ] or lazy_functions["total"][1] != [ (12, "greeting") ]:
+        raise TestFailure(f"reach.bsn: calls {lazy_functions['main'][1]} in main and {lazy_functions['total'][1]} in total")
+
+    # Objects and libraries are linked with code we don't see, they keep every function
+    for flags in [ ("-type", "obj"), ("-type", "lib") ]:
+        functions = coff_functions(compile(path, *flags).objects["out.o"])
+        if sorted(name for name, function in functions.items() if function is not None) != every_function:
+            raise TestFailure(f"reach.bsn: {' '.join(flags)} defines {sorted(functions)}, expected {every_function}")
+
+    # Functions main doesn't reach aren't checked, their errors only show with -all-functions
+    path = f"{TESTS_DIR}/lazy/unreached_error.bsn"
+    expect_success(compile(path, "-type", "exe"), "unreached_error.bsn")
+    error = "unreached_error.bsn:5:12:\033[0m Could not find 'missing'"
+    expect_error(compile(path, "-type", "exe", "-all-functions"), "unreached_error.bsn", error)
+    expect_error(compile(path), "unreached_error.bsn", error)
+
+def task_count(log, task_kind):
+    return len(re.findall(f"(pick|steal) {task_kind} ", log))
+
+@test
+def api_context():
+    # A context parses an import again only if its size or modification time changed or it failed
+    sections = run_api_test()
+    parses = {
+        "context_first": 3,       # main.bsn, util.bsn and math.bsn
+        "context_same": 1,        # the input is always parsed
+        "context_size": 2,        # util.bsn is longer
+        "context_time": 2,        # math.bsn has the same size, 1 ns newer
+        "context_error": 2,       # util.bsn has an error
+        "context_error_again": 2, # util.bsn failed
+        "context_fixed": 2,
+    }
+    for name, expected in parses.items():
+        found = task_count(sections[name], "TASK_LEX_AND_PARSE")
+        if found != expected:
+            raise TestFailure(f"{name}: {found} files parsed, expected {expected}\n{sections[name][-2000:]}")
+    # Functions are in the order the threads finished them
+    api_dir = f"{work_dir}/api"
+    first = coff_functions(read_object(f"{api_dir}/first.o"))
+    if coff_functions(read_object(f"{api_dir}/same.o")) != first:
+        raise TestFailure("context_same: functions differ from the first compile")
+    if coff_functions(read_object(f"{api_dir}/size.o")) == first:
+        raise TestFailure("context_size: object is the same as before util.bsn changed")
+
+@test
+def api_step_compile():
+    # basin_step_compile stops after max_tasks tasks or max_microseconds and the
+    # compilation continues with the next step, the object is the same as without steps
+    sections = run_api_test()
+    runs = re.split(r"^Tasks (?:paused, [0-9]+ left|finished)$", sections["step_tasks"], flags=re.M)
+    if len(runs) < 3:
+        raise TestFailure(f"step_tasks: done after {len(runs) - 1} steps\n{sections['step_tasks'][-2000:]}")
+    for run in runs:
+        if task_count(run, "TASK_[A-Z_]+") > 2:
+            raise TestFailure(f"step_tasks: more than 2 tasks in one step\n{run}")
+    if "Tasks paused" not in sections["step_time"]:
+        raise TestFailure(f"step_time: a step of 1 microsecond didn't pause\n{sections['step_time'][-2000:]}")
+
+    # Functions are in the order the threads finished them
+    api_dir = f"{work_dir}/api"
+    direct = coff_functions(read_object(f"{api_dir}/step_direct.o"))
+    for name in [ "step_invalid", "step_tasks", "step_time" ]:
+        if coff_functions(read_object(f"{api_dir}/{name}.o")) != direct:
+            raise TestFailure(f"{name}: object differs from compiling without steps")
+
+def error_lines(output):
+    return [ line for line in output.log.split("\n") if line.startswith("\033[0;31m") ]
+
+@test
+def max_errors():
+    # A function with an error is skipped and the next one is parsed or generated
+    # until the compilation has -max-errors errors
+    for name, errors in [
+        ("syntax.bsn", [ "syntax.bsn:5:10:", "syntax.bsn:10:1:", "syntax.bsn:12:10:" ]),
+        ("names.bsn", [ "names.bsn:5:12:", "names.bsn:8:12:", "names.bsn:11:12:" ]),
+    ]:
+        path = f"{TESTS_DIR}/errors/{name}"
+        for max_errors in [ 1, 2, 3, 10 ]:
+            flags = ("-max-errors", str(max_errors)) if max_errors > 1 else ()
+            output = compile(path, *flags)
+            found = [ re.search(r"[^/]*\.bsn:[0-9]+:[0-9]+:", line).group() for line in error_lines(output) ]
+            expected = errors[:max_errors]
+            if output.success() or found != expected:
+                raise TestFailure(f"{name} -max-errors {max_errors}: errors at {found}, expected {expected}")
+
+    # The compilation is cancelled at the last error, IR of the imports after it isn't generated
+    imports = []
+    for i in range(6):
+        write_source(f"cancel/lib{i}.bsn", f"fn lib{i}() -> i32 {{\n    return missing{i}\n}}\n")
+        imports.append(f'import "./lib{i}.bsn"')
+    path = write_source("cancel/main.bsn", "\n".join(imports) + "\nfn main() -> i32 {\n    return 0\n}\n")
+    for max_errors in [ 1, 2, 6 ]:
+        output = compile(path, "-threads", "1", "-max-errors", str(max_errors))
+        found = len(error_lines(output))
+        dropped = output.driver.count("Drop TASK_GEN_IR, compilation cancelled")
+        if found != max_errors or dropped != 6 - max_errors:
+            raise TestFailure(f"main.bsn -max-errors {max_errors}: {found} errors and {dropped} dropped TASK_GEN_IR, expected {max_errors} and {6 - max_errors}")
+
+@test
+def multi_input():
+    # Each input of one run gets an object named after it in the output directory,
+    # with the functions it gets when compiled alone
+    sources = {
+        "one/alpha.bsn": "fn alpha() -> i32 {\n    return 1\n}\n",
+        "two/beta.bsn": "fn beta() -> i32 {\n    return 2\n}\nfn beta2() -> i32 {\n    return beta()\n}\n",
+        "two/beta.v2.bsn": "fn beta() -> i32 {\n    return 22\n}\n",
+        "gamma.bsn": "fn gamma() -> i32 {\n    return 3\n}\n",
+    }
+    paths = [ write_source(name, text) for name, text in sources.items() ]
+    output = compile(paths, "-threads", "4")
+    expect_success(output, "multi_input")
+    names = [ "alpha.o", "beta.o", "beta.v2.o", "gamma.o" ]
+    if sorted(output.objects) != names:
+        raise TestFailure(f"multi_input: objects {sorted(output.objects)}, expected {names}")
+    for path, name in zip(paths, names):
+        alone = compile(path)
+        if coff_functions(output.objects[name]) != coff_functions(alone.objects["out.o"]):
+            raise TestFailure(f"multi_input: {name} differs from compiling {os.path.basename(path)} alone")
+
+    # Inputs that would overwrite each other's object are an error, nothing is compiled
+    for inputs in [ [ "one/util.bsn", "two/util.bsn" ], [ "one/util.bsn", "one/util.bsn" ] ]:
+        paths = [ write_source(name, "fn util() -> i32 {\n    return 0\n}\n") for name in inputs ]
+        output = compile(paths)
+        expect_error(output, "multi_input", f"ERROR: '{paths[0]}' and '{paths[1]}' would both be compiled to ")
+        if output.objects or output.success():
+            raise TestFailure(f"multi_input: {' '.join(inputs)} wrote {sorted(output.objects)}")
+
+@test
+def shared_imports():
+    # Inputs compiled together on many threads parse each imported file once,
+    # whichever path leads to it
+    write_source("lib/a.bsn", 'import "./b.bsn"\nfn a() -> i32 {\n    return b()\n}\n')
+    write_source("lib/b.bsn", "fn b() -> i32 {\n    return 2\n}\n")
+    spellings = [ "./lib/a.bsn", "./lib/../lib/a.bsn", "./lib/b.bsn", "../lib/a.bsn" ]
+    paths = []
+    for i in range(8):
+        folder = "sub/" if spellings[i % 4].startswith("..") else ""
+        paths.append(write_source(f"{folder}input{i}.bsn", f'import "{spellings[i % 4]}"\nfn f{i}() -> i32 {{\n    return {i}\n}}\n'))
+    for run in range(5):
+        output = compile(paths, "-threads", "8")
+        expect_success(output, "shared_imports")
+        parses = task_count(output.driver, "TASK_LEX_AND_PARSE")
+        if parses != len(paths) + 2:
+            raise TestFailure(f"shared_imports: {parses} files parsed, expected {len(paths) + 2} (the inputs, a.bsn and b.bsn)")
+
+@test
+def final_task_order():
+    # The object is written after every function of the compilation has machine code
+    write_source("order/lib.bsn", "\n".join(f"fn lib{i}() -> i32 {{\n    return {i}\n}}" for i in range(60)) + "\n")
+    functions = [ f"fn f{i}() -> i32 {{\n    return lib{i}()\n}}" for i in range(60) ]
+    path = write_source("order/main.bsn", 'import "./lib.bsn"\n' + "\n".join(functions) + "\n")
+    for run in range(5):
+        output = compile(path, "-threads", "4", ordered = False)
+        expect_success(output, "main.bsn")
+        lines = output.driver.split("\n")
+        machine = [ i for i, line in enumerate(lines) if re.search(r"(pick|steal) TASK_GEN_MACHINE ", line) ]
+        objects = [ i for i, line in enumerate(lines) if re.search(r"(pick|steal) TASK_GEN_OBJECT ", line) ]
+        if len(machine) != 120 or len(objects) != 1 or machine[-1] > objects[0]:
+            raise TestFailure(f"main.bsn: {len(machine)} TASK_GEN_MACHINE and {len(objects)} TASK_GEN_OBJECT, the object must be last\n{output.driver[-3000:]}")
+        functions = coff_functions(output.objects["out.o"])
+        if len([ name for name, function in functions.items() if function is not None ]) != 120:
+            raise TestFailure(f"main.bsn: the object defines {len(functions)} functions, expected 120")
+
+#############################
+#      RUNNING
+#############################
+
+def main():
+    global compiler, work_dir
+
+    names = []
+    for arg in sys.argv[1:]:
+        if arg == "-list":
+            for func in tests:
+                print(func.__name__)
+            exit(0)
+        names.append(arg)
+
+    compiler = find_compiler()
+
+    selected = [ func for func in tests if len(names) == 0 or any(func.__name__.startswith(name) for name in names) ]
+    if len(selected) == 0:
+        print(f"{COLOR_RED}ERROR:{COLOR_RESET} No test matches {' '.join(names)}")
+        exit(1)
+
+    failed = 0
+    with tempfile.TemporaryDirectory(prefix="basin_tests_") as temp:
+        for func in selected:
+            work_dir = f"{temp}/{func.__name__}"
+            os.makedirs(work_dir)
+            try:
+                func()
+                print(f"{COLOR_GREEN}PASS{COLOR_RESET} {func.__name__}")
+            except TestFailure as e:
+                failed += 1
+                print(f"{COLOR_RED}FAIL{COLOR_RESET} {func.__name__}\n{e}")
+
+    print(f"{len(selected) - failed}/{len(selected)} tests passed")
+    exit(1 if failed else 0)
 
+if __name__ == "__main__":
+    main()